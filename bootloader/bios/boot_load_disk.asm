@@ -1,31 +1,75 @@
-; load 'dh' sectors from drive 'dl' into ES:BX
+; load 'si' sectors from drive 'dl', starting right after the boot sector, to
+; KERNEL_FULL_MEM. Sectors are read one at a time into a bounce buffer below
+; 1 MiB, whatever the drive geometry is, then copied up with int 15h AH=87h.
 disk_load:
     pusha
-    ; reading from disk requires setting specific values in all registers
-    ; so we will overwrite our input parameters from 'dx'. Let's save it
-    ; to the stack for later use.
-    push dx
+    push es
+    mov [DISK_DRIVE], dl
+
+    ; ask the BIOS for the geometry: cl[5:0] <- sectors per track, dh <- last head
+    mov ah, 0x08
+    int 0x13      ; also clobbers es:di and bl
+    jc disk_error
+    and cl, 0x3f
+    mov [DISK_SECTORS], cl
+    mov [DISK_LAST_HEAD], dh
 
-    mov ah, 0x02 ; ah <- int 0x13 function. 0x02 = 'read'
-    mov al, dh   ; al <- number of sectors to read (0x01 .. 0x80)
-    mov cl, 0x02 ; cl <- sector (0x01 .. 0x11)
-                ; 0x01 is our boot sector, 0x02 is the first 'available' sector
-    mov ch, 0x00 ; ch <- cylinder (0x0 .. 0x3FF, upper 2 bits in 'cl')
-    ; dl <- drive number. Our caller sets it as a parameter and gets it from BIOS
-    ; (0 = floppy, 1 = floppy2, 0x80 = hdd, 0x81 = hdd2)
-    mov dh, 0x00 ; dh <- head number (0x0 .. 0xF)
+    mov cx, 0x0002 ; ch <- cylinder 0, cl <- sector 2 (0x01 is our boot sector)
+    xor dh, dh     ; dh <- head 0
 
-    ; [es:bx] <- pointer to buffer where the data will be stored
-    ; caller sets it up for us, and it is actually the standard location for int 13h
-    int 0x13      ; BIOS interrupt
-    jc disk_error ; if error (stored in the carry bit)
+disk_load_next:
+    mov ax, BOUNCE_SEGMENT
+    mov es, ax
+    xor bx, bx
+    mov dl, [DISK_DRIVE]
+    mov ax, 0x0201 ; ah <- int 0x13 function 0x02 = 'read', al <- 1 sector
+    int 0x13
+    jc disk_error  ; if error (stored in the carry bit)
 
+    push cx        ; copy the sector to its place above 1 MiB
+    push dx
+    push si
+    xor ax, ax
+    mov es, ax
+    mov si, MOVE_GDT
+    mov cx, 256    ; words
+    mov ah, 0x87
+    int 0x15
+    pop si
     pop dx
-    cmp al, dh    ; BIOS also sets 'al' to the # of sectors read. Compare it.
-    jne sectors_error
+    pop cx
+    jc disk_error
+    add word [MOVE_DEST], 512
+    adc byte [MOVE_DEST + 2], 0
+
+    inc cl         ; next sector, then next head, then next cylinder
+    cmp cl, [DISK_SECTORS]
+    jbe disk_load_step
+    mov cl, 1
+    inc dh
+    cmp dh, [DISK_LAST_HEAD]
+    jbe disk_load_step
+    xor dh, dh
+    inc ch
+
+disk_load_step:
+    dec si
+    jnz disk_load_next
+
+    pop es
     popa
     ret
 
+; int 15h AH=87h may leave the A20 gate as it found it: open it for good,
+; through the BIOS and through the fast A20 port for BIOSes without the call
+enable_a20:
+    mov ax, 0x2401
+    int 0x15
+    in al, 0x92
+    or al, 0x02
+    and al, 0xFE   ; bit 0 would reset the machine
+    out 0x92, al
+    ret
 
 disk_error:
     mov bx, DISK_ERROR
@@ -33,14 +77,23 @@ disk_error:
     call print_nl
     mov dh, ah ; ah = error code, dl = disk drive that dropped the error
     call print_hex ; check out the code at http://stanislavs.org/helppc/int_13-1.html
-    jmp disk_loop
-
-sectors_error:
-    mov bx, SECTORS_ERROR
-    call print
 
 disk_loop:
     jmp $
 
+DISK_DRIVE: db 0
+DISK_SECTORS: db 0
+DISK_LAST_HEAD: db 0
 DISK_ERROR: db "Disk read error", 0
-SECTORS_ERROR: db "Incorrect number of sectors read", 0
+
+; int 15h AH=87h descriptor table: null, GDT, source, destination, and two
+; entries the BIOS fills in itself
+MOVE_GDT:
+    times 16 db 0
+    dw 0xffff, (BOUNCE_SEGMENT << 4) & 0xffff ; source: limit, base 15:0
+    db BOUNCE_SEGMENT >> 12, 0x93, 0, 0       ; base 23:16, present writable data
+    dw 0xffff                       ; destination, advanced a sector at a time
+MOVE_DEST:
+    dw KERNEL_FULL_MEM & 0xffff
+    db KERNEL_FULL_MEM >> 16, 0x93, 0, 0
+    times 16 db 0
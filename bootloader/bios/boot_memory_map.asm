@@ -0,0 +1,38 @@
+; Collect the BIOS E820 memory map for the kernel.
+; Entries are 24 bytes (base, length, type, ACPI attributes) stored from
+; MEMORY_MAP_ENTRIES, the number of entries goes in the word at MEMORY_MAP_COUNT.
+; A count of 0 means the BIOS does not support E820.
+[bits 16]
+MEMORY_MAP_COUNT equ 0x500
+MEMORY_MAP_ENTRIES equ 0x508
+MEMORY_MAP_MAX equ 100
+
+detect_memory:
+    pusha
+    push es
+    xor ax, ax
+    mov es, ax
+    mov di, MEMORY_MAP_ENTRIES ; es:di <- where the BIOS writes the entry
+    xor ebx, ebx               ; continuation value, 0 for the first call
+    xor bp, bp                 ; entry counter
+
+detect_memory_next:
+    mov eax, 0xE820
+    mov ecx, 24
+    mov edx, 0x534D4150        ; 'SMAP'
+    int 0x15
+    jc detect_memory_done      ; carry means unsupported or end of the list
+    cmp eax, 0x534D4150
+    jne detect_memory_done
+    inc bp
+    add di, 24
+    test ebx, ebx              ; ebx = 0 after the last entry
+    jz detect_memory_done
+    cmp bp, MEMORY_MAP_MAX
+    jb detect_memory_next
+
+detect_memory_done:
+    mov [MEMORY_MAP_COUNT], bp
+    pop es
+    popa
+    ret
@@ -2,22 +2,17 @@
     [org 0x7C00]
 %endif
 
-; Default to 1 sector if NUM_SECTORS is not defined
+; NUM_SECTORS is the kernel image size in sectors, a 16-bit count
 %ifndef NUM_SECTORS
-%define NUM_SECTORS 74
+%define NUM_SECTORS 256
 %endif
-KERNEL_OFFSET equ 0x0000 ; The same one we used when linking the kernel
-KERNEL_SEGMENT equ 0x8000 ; The same one we used when linking the kernel
-KERNEL_FULL_MEM equ 0x80000 ; The same one we used when linking the kernel
+KERNEL_FULL_MEM equ 0x100000 ; The same one we used when linking the kernel
+BOUNCE_SEGMENT equ 0x1000 ; One sector below 1 MiB, copied up to the kernel by int 15h
 
     mov [BOOT_DRIVE], dl ; Remember that the BIOS sets us the boot drive in 'dl' on boot
     mov bp, 0x9000 ; set the stack
     mov sp, bp
 
-    mov bx, MSG_REAL_MODE
-    call print ; This will be written after the BIOS messages
-    call print_nl
-
     call load_kernel
     call switch_to_pm
     jmp $ ; this will actually never be executed
@@ -26,35 +21,31 @@ KERNEL_FULL_MEM equ 0x80000 ; The same one we used when linking the kernel
 %include "./boot_print_hex.asm"
 %include "./boot_load_disk.asm"
 %include "./32bit-gdt.asm"
-%include "./32bit-print.asm"
 %include "32bit-switch.asm"
+%include "./boot_memory_map.asm"
 
 [bits 16]
 load_kernel:
+    call detect_memory ; BIOS services are only reachable from real mode
+
     mov bx, MSG_LOAD_KERNEL
     call print
     call print_nl
 
-    mov bx, KERNEL_OFFSET ; Read from disk and store in ....
-    mov ax, KERNEL_SEGMENT
-    mov es, ax            ; 16*KERNEL_SEGMENT+KERNEL_OFFSET
-    mov dh, NUM_SECTORS   ; Number of sectors to read
+    mov si, NUM_SECTORS   ; Number of sectors to read
     mov dl, [BOOT_DRIVE]
     call disk_load
+    call enable_a20       ; The kernel lives above 1 MiB
     ret
 
 [bits 32]
 BEGIN_PM: ; after the switch we will get here
-    mov ebx, MSG_PROT_MODE
-    call print_string_pm ; Note that this will be written at the top left corner
     call KERNEL_FULL_MEM ; Give control to the kernel
     jmp $
 
 
 BOOT_DRIVE db 0 ; It is a good idea to store it in memory because 'dl' may get overwritten
-MSG_REAL_MODE db "Started in 16-bit real mode", 0
-MSG_PROT_MODE db "Loaded 32-bit protected mode", 0
-MSG_LOAD_KERNEL db "Loading kernel into memory", 0
+MSG_LOAD_KERNEL db "Loading kernel", 0
 
 ; bootsector
 times 510-($-$$) db 0
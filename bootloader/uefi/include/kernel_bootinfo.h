@@ -4,6 +4,14 @@
 #define KERNEL_BOOTINFO_MAGIC 0x4341535345554546ULL
 #define KERNEL_BOOTINFO_FLAG_UEFI 0x1
 #define KERNEL_BOOTINFO_FLAG_FRAMEBUFFER 0x2
+#define KERNEL_BOOTINFO_FLAG_MEMORY_MAP 0x4
+#define KERNEL_BOOTINFO_FLAG_ACPI 0x8
+
+#define KERNEL_MEMORY_USABLE 1
+#define KERNEL_MEMORY_RESERVED 2
+#define KERNEL_MEMORY_ACPI_RECLAIMABLE 3
+#define KERNEL_MEMORY_ACPI_NVS 4
+#define KERNEL_MEMORY_BAD 5
 
 typedef unsigned long long loader_uint64_t;
 typedef unsigned int loader_uint32_t;
@@ -18,6 +26,17 @@ typedef struct {
     loader_uint32_t fb_height;
     loader_uint32_t fb_stride;
     loader_uint32_t fb_bpp;
+    loader_uint64_t mmap_base;
+    loader_uint32_t mmap_entries;
+    loader_uint32_t mmap_entry_size;
+    loader_uint64_t acpi_rsdp;
 } kernel_bootinfo_t;
 
+typedef struct __attribute__((packed)) {
+    loader_uint64_t base;
+    loader_uint64_t length;
+    loader_uint32_t type;
+    loader_uint32_t attributes;
+} kernel_memory_region_t;
+
 #endif /* CASSEOS_UEFI_KERNEL_BOOTINFO_H */
@@ -4,7 +4,7 @@
 #include "uefi.h"
 
 #define KERNEL_RELATIVE_PATH L"\\CASSEKRN.BIN"
-#define KERNEL_LOAD_ADDRESS 0x0000000000080000ULL
+#define KERNEL_LOAD_ADDRESS 0x0000000000100000ULL
 #define KERNEL_STACK_PAGES 16
 #define PAGE_SIZE 4096ULL
 
@@ -20,6 +20,14 @@ static const EFI_GUID gEfiLoadedImageProtocolGuid = {
     0x5b1b31a1, 0x9562, 0x11d2, {0x8e, 0x3f, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b}
 };
 
+static const EFI_GUID gEfiAcpi20TableGuid = {
+    0x8868e871, 0xe4f1, 0x11d3, {0xbc, 0x22, 0x00, 0x80, 0xc7, 0x3c, 0x88, 0x81}
+};
+
+static const EFI_GUID gEfiAcpi10TableGuid = {
+    0xeb9d2d30, 0x2d88, 0x11d3, {0x9a, 0x16, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d}
+};
+
 static kernel_bootinfo_t *find_kernel_bootinfo(EFI_PHYSICAL_ADDRESS image, UINTN image_size) {
     if (image_size < sizeof(kernel_bootinfo_t)) {
         return NULL;
@@ -127,8 +135,82 @@ static EFI_STATUS load_kernel(EFI_SYSTEM_TABLE *system_table,
     return EFI_SUCCESS;
 }
 
+static loader_uint32_t kernel_memory_type(UINT32 efi_type) {
+    switch (efi_type) {
+    case EfiConventionalMemory:
+        return KERNEL_MEMORY_USABLE;
+    case EfiACPIReclaimMemory:
+        return KERNEL_MEMORY_ACPI_RECLAIMABLE;
+    case EfiACPIMemoryNVS:
+        return KERNEL_MEMORY_ACPI_NVS;
+    case EfiUnusableMemory:
+        return KERNEL_MEMORY_BAD;
+    default:
+        /* Boot services memory still holds the firmware page tables the
+         * kernel runs on, loader memory holds the kernel, its stack and this map */
+        return KERNEL_MEMORY_RESERVED;
+    }
+}
+
+/* Rewrite the firmware memory map in place as kernel_memory_region_t entries.
+ * Entries are smaller than EFI descriptors, so writes never overtake reads.
+ * Returns the number of entries written. */
+static UINTN convert_memory_map(EFI_MEMORY_DESCRIPTOR *memory_map, UINTN map_size,
+                                UINTN descriptor_size) {
+    kernel_memory_region_t *regions = (kernel_memory_region_t *)memory_map;
+    UINTN count = 0;
+
+    for (UINTN offset = 0; offset + descriptor_size <= map_size; offset += descriptor_size) {
+        EFI_MEMORY_DESCRIPTOR *desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)memory_map + offset);
+        loader_uint64_t base = desc->PhysicalStart;
+        loader_uint64_t length = desc->NumberOfPages * PAGE_SIZE;
+        loader_uint32_t type = kernel_memory_type(desc->Type);
+
+        if (count > 0) {
+            kernel_memory_region_t *last = &regions[count - 1];
+            if (last->type == type && last->base + last->length == base) {
+                last->length += length;
+                continue;
+            }
+        }
+        regions[count].base = base;
+        regions[count].length = length;
+        regions[count].type = type;
+        regions[count].attributes = 0;
+        count++;
+    }
+    return count;
+}
+
+static BOOLEAN guid_equal(const EFI_GUID *a, const EFI_GUID *b) {
+    const UINT8 *pa = (const UINT8 *)a;
+    const UINT8 *pb = (const UINT8 *)b;
+    for (UINTN i = 0; i < sizeof(EFI_GUID); ++i) {
+        if (pa[i] != pb[i]) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* RSDP from the configuration table, ACPI 2.0+ preferred over 1.0 */
+static loader_uint64_t find_acpi_rsdp(EFI_SYSTEM_TABLE *system_table) {
+    EFI_CONFIGURATION_TABLE *tables = (EFI_CONFIGURATION_TABLE *)system_table->ConfigurationTable;
+    loader_uint64_t rsdp = 0;
+    for (UINTN i = 0; i < system_table->NumberOfTableEntries; ++i) {
+        if (guid_equal(&tables[i].VendorGuid, &gEfiAcpi20TableGuid)) {
+            return (loader_uint64_t)(UINTN)tables[i].VendorTable;
+        }
+        if (guid_equal(&tables[i].VendorGuid, &gEfiAcpi10TableGuid)) {
+            rsdp = (loader_uint64_t)(UINTN)tables[i].VendorTable;
+        }
+    }
+    return rsdp;
+}
+
 static EFI_STATUS exit_boot_services(EFI_BOOT_SERVICES *bs,
-                                     EFI_HANDLE image_handle) {
+                                     EFI_HANDLE image_handle,
+                                     kernel_bootinfo_t *boot_info) {
     EFI_STATUS status;
     UINTN map_size = 0;
     UINTN map_key = 0;
@@ -168,6 +250,12 @@ static EFI_STATUS exit_boot_services(EFI_BOOT_SERVICES *bs,
         break;
     }
 
+    /* Boot services are gone, the pool allocation stays as loader data */
+    boot_info->mmap_base = (loader_uint64_t)(UINTN)memory_map;
+    boot_info->mmap_entries = (loader_uint32_t)convert_memory_map(memory_map, map_size, descriptor_size);
+    boot_info->mmap_entry_size = sizeof(kernel_memory_region_t);
+    boot_info->flags |= KERNEL_BOOTINFO_FLAG_MEMORY_MAP;
+
     return EFI_SUCCESS;
 }
 
@@ -283,6 +371,10 @@ kernel_loaded:
         boot_info->fb_stride = 0;
         boot_info->fb_bpp = 0;
     }
+    boot_info->acpi_rsdp = find_acpi_rsdp(system_table);
+    if (boot_info->acpi_rsdp) {
+        boot_info->flags |= KERNEL_BOOTINFO_FLAG_ACPI;
+    }
 
     EFI_PHYSICAL_ADDRESS stack_base = 0;
     status = bs->AllocatePages(AllocateAnyPages, EfiLoaderData, KERNEL_STACK_PAGES, &stack_base);
@@ -294,7 +386,7 @@ kernel_loaded:
     bs->SetMem((void *)(UINTN)stack_base, KERNEL_STACK_PAGES * PAGE_SIZE, 0);
 
     print(system_table, L"Exiting boot services\r\n");
-    status = exit_boot_services(bs, image_handle);
+    status = exit_boot_services(bs, image_handle, boot_info);
     if (EFI_ERROR(status)) {
         return status;
     }
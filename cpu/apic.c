@@ -0,0 +1,287 @@
+#include "apic.h"
+#include "cpuid.h"
+#include "isr.h"
+#include "msr.h"
+#include "ports.h"
+#include "timer.h"
+#include "drivers/acpi.h"
+
+#define APIC_BASE_ENABLE   (1u << 11)
+#define APIC_BASE_X2APIC   (1u << 10)
+
+/* Local APIC registers, xAPIC MMIO offsets (x2APIC MSR = 0x800 + offset/16) */
+#define LAPIC_ID           0x020
+#define LAPIC_TPR          0x080
+#define LAPIC_EOI          0x0B0
+#define LAPIC_SVR          0x0F0
+#define LAPIC_LVT_TIMER    0x320
+#define LAPIC_LVT_LINT0    0x350
+#define LAPIC_LVT_LINT1    0x360
+#define LAPIC_LVT_ERROR    0x370
+#define LAPIC_TIMER_INIT   0x380
+#define LAPIC_TIMER_CUR    0x390
+#define LAPIC_TIMER_DIV    0x3E0
+
+#define LAPIC_SVR_ENABLE   (1u << 8)
+#define LAPIC_LVT_MASKED   (1u << 16)
+#define LAPIC_LVT_NMI      (4u << 8)
+#define LAPIC_TIMER_PERIODIC (1u << 17)
+#define LAPIC_TIMER_DIV_16 0x3
+
+#define LAPIC_CALIBRATE_MS 10
+
+/* IOAPIC: index/data window, redirection table from register 0x10 */
+#define IOAPIC_REGSEL      0x00
+#define IOAPIC_WINDOW      0x10
+#define IOAPIC_VER         0x01
+#define IOAPIC_REDIR       0x10
+
+#define IOAPIC_ACTIVE_LOW  (1u << 13)
+#define IOAPIC_LEVEL       (1u << 15)
+#define IOAPIC_MASKED      (1u << 16)
+
+#define APIC_MAX_IOAPICS   4
+#define ISA_IRQS           16
+
+/* MPS INTI flags of a MADT override */
+#define MPS_POLARITY_MASK  0x3
+#define MPS_POLARITY_LOW   0x3
+#define MPS_TRIGGER_MASK   0xC
+#define MPS_TRIGGER_LEVEL  0xC
+
+typedef struct {
+    volatile uint32_t *base;
+    uint32_t gsi_base;
+    uint32_t pins;
+} ioapic_t;
+
+static bool apic_enabled = false;
+static bool apic_x2 = false;
+static volatile uint32_t *lapic_mmio = 0;
+static uint32_t bsp_apic_id = 0;
+static uint32_t cpu_count = 0;
+
+static ioapic_t ioapics[APIC_MAX_IOAPICS];
+static uint32_t ioapic_count = 0;
+
+static uint32_t isa_gsi[ISA_IRQS];
+static uint16_t isa_flags[ISA_IRQS];
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    if (apic_x2) return (uint32_t)rdmsr(MSR_X2APIC_BASE + (reg >> 4));
+    return lapic_mmio[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    if (apic_x2) wrmsr(MSR_X2APIC_BASE + (reg >> 4), value);
+    else lapic_mmio[reg / 4] = value;
+}
+
+static uint32_t ioapic_read(const ioapic_t *io, uint8_t reg) {
+    io->base[IOAPIC_REGSEL / 4] = reg;
+    return io->base[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(const ioapic_t *io, uint8_t reg, uint32_t value) {
+    io->base[IOAPIC_REGSEL / 4] = reg;
+    io->base[IOAPIC_WINDOW / 4] = value;
+}
+
+static const ioapic_t *ioapic_for_gsi(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].pins) {
+            return &ioapics[i];
+        }
+    }
+    return 0;
+}
+
+static void ioapic_route(uint32_t gsi, uint8_t vector, uint32_t flags) {
+    const ioapic_t *io = ioapic_for_gsi(gsi);
+    if (!io) return;
+    uint8_t pin = (uint8_t)(gsi - io->gsi_base);
+    /* Write the destination first so the entry is never live half-set */
+    ioapic_write(io, (uint8_t)(IOAPIC_REDIR + pin * 2 + 1), bsp_apic_id << 24);
+    ioapic_write(io, (uint8_t)(IOAPIC_REDIR + pin * 2), vector | flags);
+}
+
+/* Redirection flags for a line: the override's MPS flags when given,
+ * the bus default otherwise */
+static uint32_t route_flags(uint16_t mps, bool pci_default) {
+    bool level = pci_default;
+    bool low = pci_default;
+    if ((mps & MPS_TRIGGER_MASK) != 0) level = (mps & MPS_TRIGGER_MASK) == MPS_TRIGGER_LEVEL;
+    if ((mps & MPS_POLARITY_MASK) != 0) low = (mps & MPS_POLARITY_MASK) == MPS_POLARITY_LOW;
+    return (level ? IOAPIC_LEVEL : 0) | (low ? IOAPIC_ACTIVE_LOW : 0);
+}
+
+static bool madt_parse(const acpi_madt_t *madt, uint64_t *lapic_address) {
+    *lapic_address = madt->lapic_address;
+    for (int irq = 0; irq < ISA_IRQS; irq++) {
+        isa_gsi[irq] = (uint32_t)irq;
+        isa_flags[irq] = 0;
+    }
+
+    const uint8_t *p = (const uint8_t *)madt + sizeof(acpi_madt_t);
+    const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+    while (p + sizeof(acpi_madt_entry_t) <= end) {
+        const acpi_madt_entry_t *entry = (const acpi_madt_entry_t *)p;
+        if (entry->length < sizeof(acpi_madt_entry_t) || p + entry->length > end) break;
+
+        switch (entry->type) {
+            case ACPI_MADT_LAPIC: {
+                const acpi_madt_lapic_t *lapic = (const acpi_madt_lapic_t *)entry;
+                if (lapic->flags & 1) cpu_count++;
+                break;
+            }
+            case ACPI_MADT_X2APIC: {
+                const acpi_madt_x2apic_t *x2 = (const acpi_madt_x2apic_t *)entry;
+                if (x2->flags & 1) cpu_count++;
+                break;
+            }
+            case ACPI_MADT_IOAPIC: {
+                const acpi_madt_ioapic_t *io = (const acpi_madt_ioapic_t *)entry;
+                if (ioapic_count < APIC_MAX_IOAPICS) {
+                    ioapics[ioapic_count].base = (volatile uint32_t *)(uintptr_t)io->address;
+                    ioapics[ioapic_count].gsi_base = io->gsi_base;
+                    ioapic_count++;
+                }
+                break;
+            }
+            case ACPI_MADT_OVERRIDE: {
+                const acpi_madt_override_t *ov = (const acpi_madt_override_t *)entry;
+                if (ov->bus == 0 && ov->source < ISA_IRQS) {
+                    isa_gsi[ov->source] = ov->gsi;
+                    isa_flags[ov->source] = ov->flags;
+                }
+                break;
+            }
+            case ACPI_MADT_LAPIC_ADDRESS: {
+                const acpi_madt_lapic_address_t *addr = (const acpi_madt_lapic_address_t *)entry;
+                *lapic_address = addr->address;
+                break;
+            }
+            default:
+                break;
+        }
+        p += entry->length;
+    }
+    return ioapic_count > 0;
+}
+
+static void lapic_enable(uint64_t lapic_address) {
+    uint64_t base = rdmsr(MSR_IA32_APIC_BASE);
+    apic_x2 = cpu_features.x2apic;
+    if (apic_x2) {
+        /* xAPIC must be enabled before switching to x2APIC */
+        base |= APIC_BASE_ENABLE;
+        wrmsr(MSR_IA32_APIC_BASE, base);
+        base |= APIC_BASE_X2APIC;
+        wrmsr(MSR_IA32_APIC_BASE, base);
+    } else {
+        base |= APIC_BASE_ENABLE;
+        wrmsr(MSR_IA32_APIC_BASE, base);
+        lapic_mmio = (volatile uint32_t *)(uintptr_t)lapic_address;
+    }
+
+    bsp_apic_id = apic_x2 ? lapic_read(LAPIC_ID) : (lapic_read(LAPIC_ID) >> 24);
+
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);     /* 8259 ExtINT stays off */
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_EOI, 0);
+}
+
+bool apic_init(const kernel_bootinfo_t *bootinfo) {
+    if (!cpu_features.apic) return false;
+    if (!acpi_init(bootinfo)) return false;
+
+    const acpi_madt_t *madt = (const acpi_madt_t *)acpi_find_table("APIC");
+    uint64_t lapic_address = 0;
+    if (!madt || !madt_parse(madt, &lapic_address)) return false;
+
+    /* Mask every 8259 line, isr_install left them remapped to 32..47 */
+    port_byte_out(0x21, 0xFF);
+    port_byte_out(0xA1, 0xFF);
+
+    lapic_enable(lapic_address);
+
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        ioapics[i].pins = ((ioapic_read(&ioapics[i], IOAPIC_VER) >> 16) & 0xFF) + 1;
+        for (uint32_t pin = 0; pin < ioapics[i].pins; pin++) {
+            ioapic_write(&ioapics[i], (uint8_t)(IOAPIC_REDIR + pin * 2), IOAPIC_MASKED);
+        }
+    }
+
+    apic_enabled = true;
+
+    /* Same lines as the 8259 had open; IRQ0 is up to init_timer and
+     * IRQ2 is only the cascade */
+    for (uint8_t irq = 1; irq < ISA_IRQS; irq++) {
+        if (irq != 2) apic_enable_isa_irq(irq);
+    }
+    return true;
+}
+
+bool apic_is_enabled(void) {
+    return apic_enabled;
+}
+
+bool apic_is_x2apic(void) {
+    return apic_x2;
+}
+
+uint32_t apic_cpu_count(void) {
+    return cpu_count;
+}
+
+uint32_t apic_bsp_id(void) {
+    return bsp_apic_id;
+}
+
+void apic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+uint64_t apic_msi_address(void) {
+    return 0xFEE00000ULL | ((uint64_t)(bsp_apic_id & 0xFF) << 12);
+}
+
+uint32_t apic_msi_data(uint8_t vector) {
+    return vector;
+}
+
+bool apic_timer_start(uint32_t hz) {
+    if (!apic_enabled || hz == 0 || timer_tsc_hz() == 0) return false;
+
+    /* Count down from the maximum for a fixed TSC interval */
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | IRQ0);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    uint64_t end = timer_get_ns() + LAPIC_CALIBRATE_MS * 1000000ULL;
+    while (timer_get_ns() < end) {
+        __asm__ volatile ("pause");
+    }
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    uint64_t count = (uint64_t)elapsed * (1000 / LAPIC_CALIBRATE_MS) / hz;
+    if (count == 0 || count > 0xFFFFFFFF) return false;
+
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | IRQ0);
+    lapic_write(LAPIC_TIMER_INIT, (uint32_t)count);
+    return true;
+}
+
+void apic_enable_isa_irq(uint8_t irq) {
+    if (!apic_enabled || irq >= ISA_IRQS) return;
+    ioapic_route(isa_gsi[irq], (uint8_t)(IRQ0 + irq), route_flags(isa_flags[irq], false));
+}
+
+void apic_enable_pci_irq(uint8_t irq) {
+    if (!apic_enabled || irq >= ISA_IRQS) return;
+    ioapic_route(isa_gsi[irq], (uint8_t)(IRQ0 + irq), route_flags(isa_flags[irq], true));
+}
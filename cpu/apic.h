@@ -0,0 +1,39 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel/include/kernel/bootinfo.h"
+
+/* Local APIC (xAPIC or x2APIC) plus IOAPIC routing, configured from the ACPI
+ * MADT. ISA IRQ n keeps vector IRQ0 + n, so register_interrupt_handler works
+ * the same as with the 8259. */
+
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+/* Enable the local APIC and the IOAPICs and mask the 8259. Returns false,
+ * leaving the 8259 in charge, without ACPI/MADT or an IOAPIC. */
+bool apic_init(const kernel_bootinfo_t *bootinfo);
+bool apic_is_enabled(void);
+bool apic_is_x2apic(void);
+uint32_t apic_cpu_count(void);
+uint32_t apic_bsp_id(void);
+
+void apic_eoi(void);
+
+/* MSI/MSI-X message for an edge-triggered, fixed delivery of 'vector' to
+ * the boot CPU */
+uint64_t apic_msi_address(void);
+uint32_t apic_msi_data(uint8_t vector);
+
+/* Periodic LAPIC timer on vector IRQ0, calibrated against the TSC.
+ * Returns false when it cannot be calibrated. */
+bool apic_timer_start(uint32_t hz);
+
+/* Unmask an ISA IRQ (edge, active high unless the MADT overrides it) */
+void apic_enable_isa_irq(uint8_t irq);
+/* Unmask a PCI INTx line, given as its legacy IRQ number from config
+ * space (level, active low unless the MADT overrides it) */
+void apic_enable_pci_irq(uint8_t irq);
+
+#endif
@@ -0,0 +1,73 @@
+#include "cpuid.h"
+#include "libc/mem.h"
+
+cpu_features_t cpu_features;
+
+#define XCR0_SSE_AVX 0x6 /* XMM and YMM state enabled */
+
+void cpu_detect_features(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpu_features_t f = {0};
+
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    f.max_leaf = eax;
+    memory_copy(&f.vendor[0], &ebx, 4);
+    memory_copy(&f.vendor[4], &edx, 4);
+    memory_copy(&f.vendor[8], &ecx, 4);
+    f.vendor[12] = '\0';
+
+    if (f.max_leaf >= 1) {
+        cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+        f.stepping = eax & 0xF;
+        f.model = (eax >> 4) & 0xF;
+        f.family = (eax >> 8) & 0xF;
+        if (f.family == 0xF) {
+            f.family += (eax >> 20) & 0xFF;
+        }
+        if (f.family == 0x6 || f.family >= 0xF) {
+            f.model |= ((eax >> 16) & 0xF) << 4;
+        }
+
+        f.tsc    = edx & (1u << 4);
+        f.apic   = edx & (1u << 9);
+        f.mtrr   = edx & (1u << 12);
+        f.pat    = edx & (1u << 16);
+        f.sse2   = edx & (1u << 26);
+        f.sse3   = ecx & (1u << 0);
+        f.ssse3  = ecx & (1u << 9);
+        f.sse4_1 = ecx & (1u << 19);
+        f.sse4_2 = ecx & (1u << 20);
+        f.x2apic = ecx & (1u << 21);
+        f.xsave  = ecx & (1u << 26);
+
+        bool osxsave = ecx & (1u << 27);
+        bool os_avx = osxsave && (xgetbv(0) & XCR0_SSE_AVX) == XCR0_SSE_AVX;
+        f.avx = os_avx && (ecx & (1u << 28));
+
+        if (f.max_leaf >= 7) {
+            cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+            f.avx2 = f.avx && (ebx & (1u << 5));
+            f.erms = ebx & (1u << 9);
+            f.fsrm = edx & (1u << 4);
+        }
+    }
+
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    f.max_extended_leaf = eax;
+    if (f.max_extended_leaf >= 0x80000001) {
+        cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+        f.page_1gb = edx & (1u << 26);
+        f.rdtscp   = edx & (1u << 27);
+    }
+    f.phys_address_bits = 36;
+    if (f.max_extended_leaf >= 0x80000008) {
+        cpuid(0x80000008, 0, &eax, &ebx, &ecx, &edx);
+        f.phys_address_bits = eax & 0xFF;
+    }
+    if (f.max_extended_leaf >= 0x80000007) {
+        cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+        f.invariant_tsc = edx & (1u << 8);
+    }
+
+    cpu_features = f;
+}
@@ -0,0 +1,57 @@
+#ifndef CPUID_H
+#define CPUID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* CPU features the kernel cares about. The AVX family flags are only set when
+ * the OS side is enabled as well (CR4.OSXSAVE and XCR0), see cpu_enable_fpu_sse. */
+typedef struct {
+    char vendor[13];
+    uint32_t max_leaf;
+    uint32_t max_extended_leaf;
+    uint8_t family;
+    uint8_t model;
+    uint8_t stepping;
+
+    bool sse2;
+    bool sse3;
+    bool ssse3;
+    bool sse4_1;
+    bool sse4_2;
+    bool xsave;
+    bool avx;
+    bool avx2;
+    bool erms;          /* Enhanced rep movsb/stosb */
+    bool fsrm;          /* Fast short rep movsb */
+    bool tsc;
+    bool invariant_tsc;
+    bool rdtscp;
+    bool apic;
+    bool x2apic;
+    bool pat;
+    bool mtrr;
+    bool page_1gb;
+    uint8_t phys_address_bits;
+} cpu_features_t;
+
+extern cpu_features_t cpu_features;
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    __asm__ volatile ("cpuid"
+                      : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                      : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t xgetbv(uint32_t index) {
+    uint32_t lo, hi;
+    __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(index));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Fill cpu_features. Call after cpu_enable_fpu_sse so the AVX flags reflect
+ * what the kernel actually enabled. */
+void cpu_detect_features(void);
+
+#endif
@@ -1,4 +1,9 @@
-#include "type.h"   
+#include "type.h"
+#include "cpuid.h"
+
+/* State components saved around IRQ handlers (cpu/interrupt.asm):
+ * 0 means FXSAVE, otherwise the XCR0 mask handed to XSAVE */
+uint32_t fpu_xsave_mask = 0;
 
 static inline uint64_t read_cr0(void) {
     uint64_t val;
@@ -20,6 +25,14 @@ static inline void write_cr4(uint64_t val) {
     __asm__ volatile ("mov %0, %%cr4" :: "r"(val) : "memory");
 }
 
+static inline void xsetbv(uint32_t index, uint64_t value) {
+    __asm__ volatile ("xsetbv" :: "c"(index), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+#define XCR0_X87 (1ULL << 0)
+#define XCR0_SSE (1ULL << 1)
+#define XCR0_AVX (1ULL << 2)
+
 void cpu_enable_fpu_sse(void) {
     uint64_t cr0 = read_cr0();
     uint64_t cr4 = read_cr4();
@@ -32,8 +45,26 @@ void cpu_enable_fpu_sse(void) {
     cr4 |= (1ULL << 9);  // OSFXSR = 1 (FXSAVE/FXRSTOR support)
     cr4 |= (1ULL << 10); // OSXMMEXCPT = 1 (SSE exceptions)
 
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    bool has_xsave = ecx & (1u << 26);
+    bool has_avx = ecx & (1u << 28);
+    if (has_xsave) {
+        cr4 |= (1ULL << 18); // OSXSAVE = 1 (XGETBV/XSETBV, AVX state)
+    }
+
     write_cr0(cr0);
     write_cr4(cr4);
 
+    fpu_xsave_mask = 0;
+    if (has_xsave) {
+        uint64_t xcr0 = XCR0_X87 | XCR0_SSE;
+        if (has_avx) {
+            xcr0 |= XCR0_AVX;
+        }
+        xsetbv(0, xcr0);
+        fpu_xsave_mask = (uint32_t)xcr0;
+    }
+
     __asm__ volatile ("fninit"); // Initialize FPU/x87 state
 }
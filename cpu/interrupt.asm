@@ -50,11 +50,14 @@ GLOBAL irq13
 GLOBAL irq14
 GLOBAL irq15
 ; ... up to irq15
+GLOBAL irq_spurious
+GLOBAL irq_dynamic_stubs
 EXTERN isr_common_stub_no_err
 EXTERN isr_common_stub_err
 EXTERN irq_common_stub
 EXTERN isr_handler
 EXTERN irq_handler
+EXTERN fpu_xsave_mask
 
 %macro PUSH_ALL 0
     push r15
@@ -92,6 +95,43 @@ EXTERN irq_handler
     pop r15
 %endmacro
 
+; IRQ handlers may run SSE/AVX code (memory_copy and friends), so the
+; interrupted SIMD state is kept in a 64-byte aligned area below the saved
+; registers. rbx is callee-saved and remembers the stack before alignment.
+SIMD_SAVE_SIZE equ 1024             ; legacy area + XSAVE header + YMM upper halves
+
+%macro SAVE_SIMD 0
+    mov rbx, rsp
+    sub rsp, SIMD_SAVE_SIZE
+    and rsp, -64
+    mov eax, [rel fpu_xsave_mask]
+    test eax, eax
+    jz %%fxsave
+    xor edx, edx
+%assign header 512
+%rep 8
+    mov [rsp + header], rdx         ; XSAVE header must start out zeroed
+%assign header header + 8
+%endrep
+    xsave64 [rsp]
+    jmp %%done
+%%fxsave:
+    fxsave64 [rsp]
+%%done:
+%endmacro
+
+%macro RESTORE_SIMD 0
+    mov eax, [rel fpu_xsave_mask]
+    test eax, eax
+    jz %%fxrstor
+    xor edx, edx
+    xrstor64 [rsp]
+    jmp %%done
+%%fxrstor:
+    fxrstor64 [rsp]
+%%done:
+    mov rsp, rbx
+%endmacro
 
 %macro ISR_NO_ERR 1
 isr%1:
@@ -168,6 +208,27 @@ IRQ 13
 IRQ 14
 IRQ 15
 
+; Dynamic vectors 48..254 for MSI/MSI-X (see interrupt_alloc_vector).
+; Every stub is padded to 16 bytes so C finds vector v at
+; irq_dynamic_stubs + (v - 48) * 16, no address table needed.
+IRQ_DYNAMIC_FIRST equ 48
+IRQ_DYNAMIC_LAST equ 254
+
+align 16
+irq_dynamic_stubs:
+%assign vector IRQ_DYNAMIC_FIRST
+%rep IRQ_DYNAMIC_LAST - IRQ_DYNAMIC_FIRST + 1
+    push qword 0          ; Dummy error code
+    push qword vector     ; Interrupt number
+    jmp irq_common_stub
+    align 16
+%assign vector vector + 1
+%endrep
+
+; Local APIC spurious vector: nothing to save and no EOI to send
+irq_spurious:
+    iretq
+
 ; Common ISR stub for exceptions without error code
 isr_common_stub_no_err:
     PUSH_ALL
@@ -193,10 +254,10 @@ isr_common_stub_err:
 ; Common IRQ stub
 irq_common_stub:
     PUSH_ALL
-    mov rdi, rsp
-    sub rsp, 8
+    mov rdi, rsp            ; Pass pointer to registers_t
+    SAVE_SIMD               ; Leaves rsp 64-byte aligned
     call irq_handler
-    add rsp, 8
+    RESTORE_SIMD
     POP_ALL
     add rsp, 16             ; Remove error code and interrupt number
     iretq
@@ -5,9 +5,22 @@
 #include "../libc/string.h"
 #include "timer.h"
 #include "ports.h"
+#include "apic.h"
 
 isr_t interrupt_handlers[256];
 
+/* One bit per vector taken by interrupt_alloc_vector */
+static uint64_t dynamic_vectors_used[256 / 64];
+
+/* Handlers of the vectors shared by several devices, run in turn by
+ * shared_irq() */
+#define SHARED_HANDLERS_MAX 16
+static struct {
+    uint8_t vector;
+    isr_t handler;
+} shared_handlers[SHARED_HANDLERS_MAX];
+static int shared_handler_count;
+
 // Give string values for each exception
 char *exception_messages[] = {
     "Division by Zero",
@@ -112,6 +125,11 @@ void isr_install() {
     set_idt_gate(45, (uint64_t)irq13);
     set_idt_gate(46, (uint64_t)irq14);
     set_idt_gate(47, (uint64_t)irq15);
+    for (int vector = IRQ_DYNAMIC_FIRST; vector <= IRQ_DYNAMIC_LAST; vector++) {
+        set_idt_gate(vector, (uint64_t)(irq_dynamic_stubs +
+                     (vector - IRQ_DYNAMIC_FIRST) * IRQ_DYNAMIC_STUB_SIZE));
+    }
+    set_idt_gate(APIC_SPURIOUS_VECTOR, (uint64_t)irq_spurious);
 
     set_idt(); // Load with ASM
 }
@@ -139,22 +157,79 @@ void register_interrupt_handler(uint8_t n, isr_t handler) {
     interrupt_handlers[n] = handler;
 }
 
+static void shared_irq(registers_t *r) {
+    for (int i = 0; i < shared_handler_count; i++) {
+        if (shared_handlers[i].vector == r->int_no) {
+            shared_handlers[i].handler(r);
+        }
+    }
+}
+
+bool interrupt_add_shared_handler(uint8_t n, isr_t handler) {
+    for (int i = 0; i < shared_handler_count; i++) {
+        if (shared_handlers[i].vector == n && shared_handlers[i].handler == handler) {
+            return true;
+        }
+    }
+    /* A handler registered on its own joins the list first */
+    isr_t current = interrupt_handlers[n];
+    bool move = current && current != shared_irq && current != handler;
+    if (shared_handler_count + (move ? 2 : 1) > SHARED_HANDLERS_MAX) {
+        return false;
+    }
+    uint64_t flags = irq_save();
+    if (move) {
+        shared_handlers[shared_handler_count].vector = n;
+        shared_handlers[shared_handler_count++].handler = current;
+    }
+    shared_handlers[shared_handler_count].vector = n;
+    shared_handlers[shared_handler_count++].handler = handler;
+    interrupt_handlers[n] = shared_irq;
+    irq_restore(flags);
+    return true;
+}
+
+int interrupt_alloc_vector(isr_t handler) {
+    for (int vector = IRQ_DYNAMIC_FIRST; vector <= IRQ_DYNAMIC_LAST; vector++) {
+        uint64_t bit = 1ULL << (vector % 64);
+        if (dynamic_vectors_used[vector / 64] & bit) continue;
+        dynamic_vectors_used[vector / 64] |= bit;
+        interrupt_handlers[vector] = handler;
+        return vector;
+    }
+    return -1;
+}
+
+void interrupt_free_vector(uint8_t vector) {
+    if (vector < IRQ_DYNAMIC_FIRST || vector > IRQ_DYNAMIC_LAST) return;
+    interrupt_handlers[vector] = 0;
+    dynamic_vectors_used[vector / 64] &= ~(1ULL << (vector % 64));
+}
+
 void irq_handler(registers_t *r) {
+    bool apic = apic_is_enabled();
+
     /* After every interrupt we need to send an EOI to the PICs
      * or they will not send another interrupt again */
-    if (r->int_no >= 40) port_byte_out(0xA0, 0x20); /* slave */
-    port_byte_out(0x20, 0x20); /* master */
+    if (!apic) {
+        if (r->int_no >= 40) port_byte_out(0xA0, 0x20); /* slave */
+        port_byte_out(0x20, 0x20); /* master */
+    }
 
     /* Handle the interrupt in a more modular way */
     if (interrupt_handlers[r->int_no] != 0) {
         isr_t handler = interrupt_handlers[r->int_no];
         handler(r);
     }
+
+    /* LAPIC EOI after the handler: a level-triggered line is quiet by now,
+     * so the IOAPIC does not deliver it a second time */
+    if (apic) apic_eoi();
 }
 
 void irq_install() {
     /* Enable interruptions */
     asm volatile("sti");
     /* IRQ0: timer */
-    init_timer(4000);
+    init_timer(TIMER_PIT_HZ);
 }
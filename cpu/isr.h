@@ -2,6 +2,7 @@
 #define ISR_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /* ISRs reserved for CPU exceptions */
 extern void isr0();
@@ -53,6 +54,8 @@ extern void irq12();
 extern void irq13();
 extern void irq14();
 extern void irq15();
+extern void irq_spurious();
+extern char irq_dynamic_stubs[];
 
 #define IRQ0 32
 #define IRQ1 33
@@ -71,6 +74,11 @@ extern void irq15();
 #define IRQ14 46
 #define IRQ15 47
 
+/* Vectors handed out at runtime (MSI/MSI-X), entry stubs in interrupt.asm */
+#define IRQ_DYNAMIC_FIRST 48
+#define IRQ_DYNAMIC_LAST 254
+#define IRQ_DYNAMIC_STUB_SIZE 16
+
 /* Struct which aggregates many registers.
  * It matches exactly the pushes on interrupt.asm. From the bottom:
  * - Pushed by the processor automatically
@@ -97,5 +105,31 @@ void irq_install();
 
 typedef void (*isr_t)(registers_t*);
 void register_interrupt_handler(uint8_t n, isr_t handler);
+/* Add 'handler' to vector 'n' next to the ones already there, for PCI
+ * functions sharing an INTx line: every handler checks its own device.
+ * Adding the same handler twice is a no-op. False when the table is full. */
+bool interrupt_add_shared_handler(uint8_t n, isr_t handler);
+
+/* Reserve a free vector in IRQ_DYNAMIC_FIRST..IRQ_DYNAMIC_LAST and install
+ * 'handler' on it. Returns the vector, or -1 when all are taken. */
+int interrupt_alloc_vector(isr_t handler);
+void interrupt_free_vector(uint8_t vector);
+
+/* Disable interrupts and return the previous RFLAGS for irq_restore */
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile ("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    if (flags & (1u << 9)) __asm__ volatile ("sti" : : : "memory");
+}
+
+static inline bool interrupts_enabled(void) {
+    uint64_t flags;
+    __asm__ volatile ("pushfq; popq %0" : "=r"(flags));
+    return (flags & (1u << 9)) != 0;
+}
 
 #endif
@@ -0,0 +1,24 @@
+#ifndef MSR_H
+#define MSR_H
+
+#include <stdint.h>
+
+#define MSR_IA32_APIC_BASE 0x1B
+#define MSR_X2APIC_BASE    0x800
+#define MSR_MTRR_CAP       0xFE
+#define MSR_MTRR_PHYSBASE(n) (0x200 + 2 * (n))
+#define MSR_MTRR_PHYSMASK(n) (0x201 + 2 * (n))
+#define MSR_IA32_PAT       0x277
+#define MSR_MTRR_DEF_TYPE  0x2FF
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+#endif
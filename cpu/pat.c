@@ -0,0 +1,251 @@
+#include "pat.h"
+#include "msr.h"
+#include "cpuid.h"
+#include "isr.h"
+#include "kernel/mm/page_alloc.h"
+
+#define PAT_TYPE_UC 0x00
+#define PAT_TYPE_WC 0x01
+#define PAT_TYPE_WT 0x04
+#define PAT_TYPE_WB 0x06
+#define PAT_TYPE_UC_MINUS 0x07
+
+/* WB, WT, UC-, UC, then WC, WT, UC-, UC */
+#define PAT_VALUE ((uint64_t)PAT_TYPE_WB | ((uint64_t)PAT_TYPE_WT << 8) | \
+                   ((uint64_t)PAT_TYPE_UC_MINUS << 16) | ((uint64_t)PAT_TYPE_UC << 24) | \
+                   ((uint64_t)PAT_TYPE_WC << 32) | ((uint64_t)PAT_TYPE_WT << 40) | \
+                   ((uint64_t)PAT_TYPE_UC_MINUS << 48) | ((uint64_t)PAT_TYPE_UC << 56))
+
+#define PTE_PRESENT   (1ULL << 0)
+#define PTE_PWT       (1ULL << 3)
+#define PTE_PCD       (1ULL << 4)
+#define PTE_LARGE     (1ULL << 7)
+#define PTE_PAT_4K    (1ULL << 7)
+#define PTE_PAT_LARGE (1ULL << 12)
+#define PTE_ADDR      0x000FFFFFFFFFF000ULL
+#define PTE_HIGH_BITS 0xFFF0000000000000ULL    /* NX and protection keys */
+
+#define SIZE_4K 0x1000ULL
+#define SIZE_2M 0x200000ULL
+#define SIZE_1G 0x40000000ULL
+
+#define CR0_WP (1ULL << 16)
+#define CR0_CD (1ULL << 30)
+#define CR4_PGE  (1ULL << 7)
+#define CR4_LA57 (1ULL << 12)
+
+#define MTRR_CAP_WC (1ULL << 10)
+#define MTRR_ENABLE (1ULL << 11)
+#define MTRR_VALID  (1ULL << 11)
+
+static bool pat_ready = false;
+
+static inline uint64_t read_cr0(void) {
+    uint64_t val;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr0(uint64_t val) {
+    __asm__ volatile ("mov %0, %%cr0" :: "r"(val) : "memory");
+}
+
+static inline uint64_t read_cr3(void) {
+    uint64_t val;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr3(uint64_t val) {
+    __asm__ volatile ("mov %0, %%cr3" :: "r"(val) : "memory");
+}
+
+static inline uint64_t read_cr4(void) {
+    uint64_t val;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr4(uint64_t val) {
+    __asm__ volatile ("mov %0, %%cr4" :: "r"(val) : "memory");
+}
+
+static inline void wbinvd(void) {
+    __asm__ volatile ("wbinvd" ::: "memory");
+}
+
+static inline uint64_t *table_of(uint64_t entry) {
+    return (uint64_t *)(uintptr_t)(entry & PTE_ADDR);
+}
+
+bool pat_init(void) {
+    if (!cpu_features.pat) {
+        return false;
+    }
+    uint64_t flags = irq_save();
+    wbinvd();
+    wrmsr(MSR_IA32_PAT, PAT_VALUE);
+    wbinvd();
+    irq_restore(flags);
+    pat_ready = true;
+    return true;
+}
+
+/* PAT/PCD/PWT for 'type', PAT in its 4 KiB position */
+static uint64_t cache_bits(memory_type_t type) {
+    switch (type) {
+        case MEMORY_TYPE_WC: return pat_ready ? PTE_PAT_4K : 0;   /* slot 4, or WB + MTRR */
+        case MEMORY_TYPE_UC: return PTE_PCD | PTE_PWT;             /* slot 3 */
+        default:             return 0;                             /* slot 0 */
+    }
+}
+
+static uint64_t set_leaf_type(uint64_t entry, uint64_t bits, bool large) {
+    uint64_t pat = large ? PTE_PAT_LARGE : PTE_PAT_4K;
+    entry &= ~(PTE_PWT | PTE_PCD | pat);
+    if (bits & PTE_PAT_4K) entry |= pat;
+    return entry | (bits & (PTE_PWT | PTE_PCD));
+}
+
+/* Replace a large page by a table of 512 pages of the next size down with
+ * the same attributes. 'child_size' is 2 MiB or 4 KiB. */
+static bool split_large_page(uint64_t *entry, uint64_t child_size) {
+    uint64_t *table = page_alloc(0);
+    if (!table) {
+        return false;
+    }
+    uint64_t old = *entry;
+    uint64_t parent_mask = (child_size == SIZE_2M) ? ~(SIZE_1G - 1) : ~(SIZE_2M - 1);
+    uint64_t phys = old & PTE_ADDR & parent_mask;
+    uint64_t attrs = (old & 0x1FF) | (old & PTE_HIGH_BITS);
+    if (child_size == SIZE_4K) {
+        attrs &= ~PTE_LARGE;
+        if (old & PTE_PAT_LARGE) attrs |= PTE_PAT_4K;
+    } else {
+        attrs |= old & PTE_PAT_LARGE;
+    }
+    for (uint64_t i = 0; i < 512; i++) {
+        table[i] = (phys + i * child_size) | attrs;
+    }
+    /* Non-leaf entry: present/writable/user only, NX moved to the children */
+    *entry = (uint64_t)(uintptr_t)table | (old & 0x7);
+    return true;
+}
+
+static bool retype_range(uint64_t base, uint64_t end, uint64_t bits) {
+    uint64_t *pml4 = table_of(read_cr3());
+    uint64_t addr = base;
+    while (addr < end) {
+        uint64_t *e4 = &pml4[(addr >> 39) & 0x1FF];
+        if (!(*e4 & PTE_PRESENT)) return false;
+
+        uint64_t *e3 = &table_of(*e4)[(addr >> 30) & 0x1FF];
+        if (!(*e3 & PTE_PRESENT)) return false;
+        if (*e3 & PTE_LARGE) {
+            if ((addr & (SIZE_1G - 1)) == 0 && end - addr >= SIZE_1G) {
+                *e3 = set_leaf_type(*e3, bits, true);
+                addr += SIZE_1G;
+                continue;
+            }
+            if (!split_large_page(e3, SIZE_2M)) return false;
+        }
+
+        uint64_t *e2 = &table_of(*e3)[(addr >> 21) & 0x1FF];
+        if (!(*e2 & PTE_PRESENT)) return false;
+        if (*e2 & PTE_LARGE) {
+            if ((addr & (SIZE_2M - 1)) == 0 && end - addr >= SIZE_2M) {
+                *e2 = set_leaf_type(*e2, bits, true);
+                addr += SIZE_2M;
+                continue;
+            }
+            if (!split_large_page(e2, SIZE_4K)) return false;
+        }
+
+        uint64_t *e1 = &table_of(*e2)[(addr >> 12) & 0x1FF];
+        if (!(*e1 & PTE_PRESENT)) return false;
+        *e1 = set_leaf_type(*e1, bits, false);
+        addr += SIZE_4K;
+    }
+    return true;
+}
+
+/* Cover [base, base + size) with a WC variable MTRR, reusing one that
+ * already matches */
+static bool mtrr_set_write_combining(uint64_t base, uint64_t size) {
+    if (!cpu_features.mtrr) {
+        return false;
+    }
+    uint64_t cap = rdmsr(MSR_MTRR_CAP);
+    if (!(cap & MTRR_CAP_WC)) {
+        return false;
+    }
+
+    uint64_t span = SIZE_4K;
+    while (span < size) span <<= 1;
+    if (base & (span - 1)) {
+        return false;
+    }
+    uint64_t phys_mask = (1ULL << cpu_features.phys_address_bits) - 1;
+    uint64_t mask = ~(span - 1) & phys_mask & PTE_ADDR;
+
+    int slot = -1;
+    for (unsigned n = 0; n < (cap & 0xFF); n++) {
+        uint64_t mask_msr = rdmsr(MSR_MTRR_PHYSMASK(n));
+        if (!(mask_msr & MTRR_VALID)) {
+            if (slot < 0) slot = (int)n;
+            continue;
+        }
+        if ((mask_msr & PTE_ADDR) == mask && (rdmsr(MSR_MTRR_PHYSBASE(n)) & PTE_ADDR) == base) {
+            return (rdmsr(MSR_MTRR_PHYSBASE(n)) & 0xFF) == PAT_TYPE_WC;
+        }
+    }
+    if (slot < 0) {
+        return false;
+    }
+
+    /* SDM 11.11.7.2: caches off and flushed, MTRRs disabled while changing */
+    uint64_t flags = irq_save();
+    uint64_t cr0 = read_cr0();
+    write_cr0(cr0 | CR0_CD);
+    wbinvd();
+    uint64_t def_type = rdmsr(MSR_MTRR_DEF_TYPE);
+    wrmsr(MSR_MTRR_DEF_TYPE, def_type & ~MTRR_ENABLE);
+    wrmsr(MSR_MTRR_PHYSBASE(slot), base | PAT_TYPE_WC);
+    wrmsr(MSR_MTRR_PHYSMASK(slot), mask | MTRR_VALID);
+    wrmsr(MSR_MTRR_DEF_TYPE, def_type);
+    wbinvd();
+    write_cr0(cr0);
+    irq_restore(flags);
+    return true;
+}
+
+bool pat_set_memory_type(uint64_t base, uint64_t size, memory_type_t type) {
+    if (size == 0 || (read_cr4() & CR4_LA57)) {
+        return false;
+    }
+    uint64_t end = (base + size + SIZE_4K - 1) & ~(SIZE_4K - 1);
+    base &= ~(SIZE_4K - 1);
+
+    if (type == MEMORY_TYPE_WC && !pat_ready && !mtrr_set_write_combining(base, end - base)) {
+        return false;
+    }
+
+    /* Firmware may hand over write-protected page tables */
+    uint64_t flags = irq_save();
+    uint64_t cr0 = read_cr0();
+    write_cr0(cr0 & ~CR0_WP);
+    bool ok = retype_range(base, end, cache_bits(type));
+    write_cr0(cr0);
+    /* Stale lines of the old type must not linger, then drop old TLB
+     * entries, global ones included */
+    wbinvd();
+    uint64_t cr4 = read_cr4();
+    if (cr4 & CR4_PGE) {
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        write_cr3(read_cr3());
+    }
+    irq_restore(flags);
+    return ok;
+}
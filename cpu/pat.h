@@ -0,0 +1,24 @@
+#ifndef PAT_H
+#define PAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Memory types the kernel hands out through the page tables */
+typedef enum {
+    MEMORY_TYPE_WB,     /* write-back, normal RAM */
+    MEMORY_TYPE_WC,     /* write-combining, framebuffers */
+    MEMORY_TYPE_UC,     /* uncached, device registers */
+} memory_type_t;
+
+/* Program IA32_PAT: slots 0-3 keep their reset values so existing PWT/PCD
+ * mappings do not change, slot 4 (PAT bit alone) becomes write-combining. */
+bool pat_init(void);
+
+/* Retype the identity mapping of [base, base + size). Large pages that only
+ * partly overlap are split. Without PAT the range is made WB in the page
+ * tables and a variable MTRR supplies WC, so that needs a power-of-two,
+ * size-aligned range. */
+bool pat_set_memory_type(uint64_t base, uint64_t size, memory_type_t type);
+
+#endif
@@ -1,51 +1,330 @@
 #include "timer.h"
 #include "isr.h"
 #include "ports.h"
+#include "cpuid.h"
+#include "apic.h"
 #include "drivers/screen.h"
 #include "libc/function.h"
 
-uint64_t tick = 0;
+#define PIT_BASE_HZ 1193180
+
+/* TSC calibration: time a PIT channel 2 one-shot a few times and keep the
+ * shortest run, an interrupt landing inside a window can only lengthen it. */
+#define TSC_CALIBRATE_MS     10
+#define TSC_CALIBRATE_ROUNDS 3
+
+volatile uint64_t tick = 0;
 uint32_t frequency = 0;
 
+static uint64_t tsc_hz = 0;
+static uint64_t tsc_base = 0;
+static uint64_t tsc_ns_mult = 0;    /* ns per cycle, 32.32 fixed point */
+static const char *clocksource_name = "pit";
+static const char *tick_source_name = "pit";
+
+/* Timer wheel: TIMER_WHEEL_LEVELS levels of 64 slots, level n covers deadlines
+ * up to 64^(n+1) ticks ahead. When a level wraps, the matching slot of the
+ * level above is cascaded down, so each timer moves at most once per level.
+ * Timers live in a fixed pool and the buckets are index linked lists. */
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK   (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SPAN   (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+#define TIMER_NONE         0xFF
+
+typedef struct {
+    timer_callback_t callback;
+    void *data;
+    uint64_t deadline;
+    uint16_t generation;
+    uint8_t next;
+    uint8_t prev;
+    uint8_t level;
+    uint8_t slot;
+    bool active;
+} timer_entry_t;
+
+static timer_entry_t timers[TIMER_MAX_TIMERS];
+static uint8_t timer_wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static uint8_t timer_free_head = TIMER_NONE;
+static uint64_t wheel_now = 0;      /* last tick the wheel has processed */
+static bool wheel_ready = false;
+
+static void wheel_init(void) {
+    for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (unsigned slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            timer_wheel[level][slot] = TIMER_NONE;
+        }
+    }
+    for (unsigned i = 0; i < TIMER_MAX_TIMERS; i++) {
+        timers[i].active = false;
+        timers[i].generation = 1;
+        timers[i].next = (i + 1 < TIMER_MAX_TIMERS) ? (uint8_t)(i + 1) : TIMER_NONE;
+    }
+    timer_free_head = 0;
+    wheel_now = tick;
+    wheel_ready = true;
+}
+
+/* Put an active timer in the bucket matching its distance from wheel_now */
+static void wheel_link(uint8_t index) {
+    timer_entry_t *t = &timers[index];
+    uint64_t expires = t->deadline < wheel_now ? wheel_now : t->deadline;
+    uint64_t delta = expires - wheel_now;
+    if (delta >= TIMER_WHEEL_SPAN) {
+        expires = wheel_now + TIMER_WHEEL_SPAN - 1;    /* re-cascaded until due */
+        delta = TIMER_WHEEL_SPAN - 1;
+    }
+
+    unsigned level = 0;
+    while (delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) level++;
+    unsigned slot = (unsigned)(expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+
+    t->level = (uint8_t)level;
+    t->slot = (uint8_t)slot;
+    t->prev = TIMER_NONE;
+    t->next = timer_wheel[level][slot];
+    if (t->next != TIMER_NONE) timers[t->next].prev = index;
+    timer_wheel[level][slot] = index;
+}
+
+static void wheel_unlink(uint8_t index) {
+    timer_entry_t *t = &timers[index];
+    if (t->prev != TIMER_NONE) timers[t->prev].next = t->next;
+    else timer_wheel[t->level][t->slot] = t->next;
+    if (t->next != TIMER_NONE) timers[t->next].prev = t->prev;
+}
+
+static void timer_release(uint8_t index) {
+    timer_entry_t *t = &timers[index];
+    t->active = false;
+    t->generation++;
+    t->next = timer_free_head;
+    timer_free_head = index;
+}
+
+/* Move every timer of the current slot of 'level' to the levels below */
+static void wheel_cascade(unsigned level) {
+    unsigned slot = (unsigned)(wheel_now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    uint8_t index = timer_wheel[level][slot];
+    timer_wheel[level][slot] = TIMER_NONE;
+    while (index != TIMER_NONE) {
+        uint8_t next = timers[index].next;
+        wheel_link(index);
+        index = next;
+    }
+}
+
+/* Catch the wheel up with 'now', running expired callbacks. IRQ0 context. */
+static void wheel_advance(uint64_t now) {
+    while (wheel_now < now) {
+        wheel_now++;
+
+        unsigned top = 0;
+        while (top + 1 < TIMER_WHEEL_LEVELS &&
+               (wheel_now & ((1ULL << (TIMER_WHEEL_BITS * (top + 1))) - 1)) == 0) {
+            top++;
+        }
+        for (unsigned level = top; level > 0; level--) wheel_cascade(level);
+
+        unsigned slot = (unsigned)wheel_now & TIMER_WHEEL_MASK;
+        uint8_t index = timer_wheel[0][slot];
+        timer_wheel[0][slot] = TIMER_NONE;
+        while (index != TIMER_NONE) {
+            timer_entry_t *t = &timers[index];
+            uint8_t next = t->next;
+            if (t->deadline <= wheel_now) {
+                timer_callback_t callback = t->callback;
+                void *data = t->data;
+                timer_release(index);     /* the callback may re-arm */
+                callback(data);
+            } else {
+                wheel_link(index);
+            }
+            index = next;
+        }
+    }
+}
+
 static void timer_callback(registers_t *regs) {
     tick++;
+    if (wheel_ready) wheel_advance(tick);
     UNUSED(regs);
 }
 
+timer_handle_t timer_add(timer_callback_t callback, void *data, uint64_t deadline) {
+    if (!callback || !wheel_ready) return TIMER_INVALID;
+
+    uint64_t flags = irq_save();
+    uint8_t index = timer_free_head;
+    if (index == TIMER_NONE) {
+        irq_restore(flags);
+        return TIMER_INVALID;
+    }
+    timer_entry_t *t = &timers[index];
+    timer_free_head = t->next;
+
+    t->callback = callback;
+    t->data = data;
+    /* The slot for wheel_now already ran */
+    t->deadline = deadline > wheel_now ? deadline : wheel_now + 1;
+    t->active = true;
+    wheel_link(index);
+    timer_handle_t handle = ((timer_handle_t)t->generation << 8) | (timer_handle_t)(index + 1);
+    irq_restore(flags);
+    return handle;
+}
+
+bool timer_cancel(timer_handle_t handle) {
+    uint32_t slot = handle & 0xFF;
+    if (slot == 0 || slot > TIMER_MAX_TIMERS) return false;
+    uint8_t index = (uint8_t)(slot - 1);
+
+    uint64_t flags = irq_save();
+    timer_entry_t *t = &timers[index];
+    bool live = t->active && t->generation == (uint16_t)(handle >> 8);
+    if (live) {
+        wheel_unlink(index);
+        timer_release(index);
+    }
+    irq_restore(flags);
+    return live;
+}
+
+uint64_t timer_ms_to_ticks(uint64_t milliseconds) {
+    if (frequency == 0) return 0;
+    return (milliseconds * frequency + 999) / 1000;
+}
+
+/* Cycles elapsed while PIT channel 2 counts down 'latch' input clocks.
+ * Channel 2 is gated by port 0x61 bit 0 and reports terminal count in bit 5. */
+static uint64_t pit_measure_cycles(uint16_t latch) {
+    uint8_t gate = port_byte_in(0x61);
+    port_byte_out(0x61, (uint8_t)((gate & ~0x02) & ~0x01));   /* gate low, speaker off */
+    port_byte_out(0x43, 0xB0);                                /* ch2, lo/hi, mode 0 */
+    port_byte_out(0x42, (uint8_t)(latch & 0xFF));
+    port_byte_out(0x42, (uint8_t)(latch >> 8));
+
+    port_byte_out(0x61, (uint8_t)((gate & ~0x02) | 0x01));    /* gate high: start */
+    uint64_t start = timer_get_cycles();
+    uint32_t spins = 0;
+    while (!(port_byte_in(0x61) & 0x20)) {
+        if (++spins > 10000000) return 0;                     /* no PIT ch2 */
+    }
+    uint64_t end = timer_get_cycles();
+
+    port_byte_out(0x61, gate);
+    return end - start;
+}
+
+static bool tsc_calibrate(void) {
+    if (!cpu_features.tsc) return false;
+
+    uint16_t latch = (uint16_t)(PIT_BASE_HZ / (1000 / TSC_CALIBRATE_MS));
+    uint64_t best = 0;
+    for (int i = 0; i < TSC_CALIBRATE_ROUNDS; i++) {
+        uint64_t cycles = pit_measure_cycles(latch);
+        if (cycles && (best == 0 || cycles < best)) best = cycles;
+    }
+    if (best == 0) return false;
+
+    tsc_hz = best * PIT_BASE_HZ / latch;
+    tsc_ns_mult = (1000000000ULL << 32) / tsc_hz;
+    tsc_base = timer_get_cycles();
+    clocksource_name = cpu_features.invariant_tsc ? "tsc" : "tsc (not invariant)";
+    return true;
+}
+
 void init_timer(uint32_t freq) {
+    /* Calibrate before channel 0 speeds up, fewer interrupts in the windows */
+    tsc_calibrate();
+
+    wheel_init();
+
     /* Install the function we just wrote */
     register_interrupt_handler(IRQ0, timer_callback);
 
     frequency = freq;
 
+    /* With the APIC up the tick comes from the LAPIC timer and the PIT line
+     * stays masked at the IOAPIC */
+    if (apic_is_enabled() && apic_timer_start(freq)) {
+        tick_source_name = "lapic";
+        return;
+    }
+
     /* Get the PIT value: hardware clock at 1193180 Hz */
-    uint32_t divisor = 1193180 / freq;
+    uint32_t divisor = PIT_BASE_HZ / freq;
     uint8_t low  = (uint8_t)(divisor & 0xFF);
     uint8_t high = (uint8_t)( (divisor >> 8) & 0xFF);
     /* Send the command */
     port_byte_out(0x43, 0x36); /* Command port */
     port_byte_out(0x40, low);
     port_byte_out(0x40, high);
-
+    apic_enable_isa_irq(0);
 }
 
 uint64_t timer_get_ticks(){
     return tick;
 }
 
-void sleep_ticks(uint64_t ticks){
-    uint64_t start_ticks = tick;
-    uint64_t end_ticks = start_ticks + ticks; // TIMER_FREQUENCY in Hz
+uint64_t timer_cycles_to_ns(uint64_t cycles) {
+    return (uint64_t)(((unsigned __int128)cycles * tsc_ns_mult) >> 32);
+}
 
-    while (timer_get_ticks() < end_ticks) {
-        asm volatile("nop"); 
+uint64_t timer_get_ns(void) {
+    if (tsc_hz) {
+        return timer_cycles_to_ns(timer_get_cycles() - tsc_base);
     }
+    if (frequency == 0) return 0;
+    return tick * (1000000000ULL / frequency);
 }
 
-void sleep_ms(uint64_t milliseconds){
-    uint64_t ticks = milliseconds * frequency / 1000;
-    sleep_ticks(ticks);
+uint64_t timer_tsc_hz(void) {
+    return tsc_hz;
 }
 
+const char *timer_clocksource_name(void) {
+    return clocksource_name;
+}
 
+const char *timer_tick_source_name(void) {
+    return tick_source_name;
+}
 
+void timer_idle(void) {
+    if (interrupts_enabled()) __asm__ volatile ("hlt");
+    else __asm__ volatile ("pause");
+}
+
+static void sleep_wakeup(void *data) {
+    *(volatile bool *)data = true;
+}
+
+void sleep_ticks(uint64_t ticks){
+    /* +1: the current tick is already partly over */
+    uint64_t end_ticks = tick + ticks + 1;
+
+    if (!interrupts_enabled()) {
+        /* Nothing would wake a hlt and IRQ0 can't advance 'tick' either */
+        if (tsc_hz) {
+            uint64_t deadline = timer_get_ns() + (ticks + 1) * (1000000000ULL / frequency);
+            while (timer_get_ns() < deadline) __asm__ volatile ("pause");
+        }
+        return;
+    }
+
+    volatile bool done = false;
+    timer_handle_t handle = timer_add(sleep_wakeup, (void *)&done, end_ticks);
+    if (handle == TIMER_INVALID) {
+        while (tick < end_ticks) timer_idle();
+        return;
+    }
+    while (!done) timer_idle();
+}
+
+void sleep_ms(uint64_t milliseconds){
+    if (milliseconds == 0) return;
+    sleep_ticks(timer_ms_to_ticks(milliseconds));
+}
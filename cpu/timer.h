@@ -2,14 +2,52 @@
 #define TIMER_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
+/* PIT interrupt rate. Fine-grained time comes from the TSC, so the tick only
+ * needs to drive scheduling-style work. */
+#define TIMER_PIT_HZ 1000
 
 void init_timer(uint32_t freq);
 
 uint64_t timer_get_ticks();
 
+/* Block for at least the given time. With interrupts on the CPU halts and
+ * a timer wakes it, otherwise the wait spins. */
 void sleep_ticks(uint64_t ticks_num);
 void sleep_ms(uint64_t milliseconds);
 
+/* Halt until the next interrupt, or just pause when interrupts are off */
+void timer_idle(void);
+
+/* One-shot timers on a hierarchical wheel driven by IRQ0. Deadlines are in
+ * PIT ticks (see timer_get_ticks), a deadline already passed fires on the
+ * next tick. Callbacks run in the IRQ0 handler with interrupts disabled. */
+#define TIMER_MAX_TIMERS 32
+#define TIMER_INVALID 0
+
+typedef uint32_t timer_handle_t;
+typedef void (*timer_callback_t)(void *data);
+
+timer_handle_t timer_add(timer_callback_t callback, void *data, uint64_t deadline);
+/* Returns false if the timer already fired or the handle is stale */
+bool timer_cancel(timer_handle_t handle);
+uint64_t timer_ms_to_ticks(uint64_t milliseconds);
+
+static inline uint64_t timer_get_cycles(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Nanoseconds since init_timer. TSC based once calibrated, PIT ticks
+ * otherwise (see timer_clocksource_name). */
+uint64_t timer_get_ns(void);
+uint64_t timer_cycles_to_ns(uint64_t cycles);
+/* TSC frequency measured against the PIT, 0 when the TSC is not used */
+uint64_t timer_tsc_hz(void);
+const char *timer_clocksource_name(void);
+/* What drives IRQ0: "pit" or "lapic" */
+const char *timer_tick_source_name(void);
 
 #endif
@@ -0,0 +1,94 @@
+#include "acpi.h"
+#include "libc/mem.h"
+
+/* Tables are read in place: the BIOS path identity maps the low 4 GiB and
+ * UEFI firmware maps everything, so physical addresses are usable as is. */
+
+static const acpi_rsdp_t *acpi_rsdp = 0;
+static const acpi_sdt_header_t *acpi_root = 0;
+static bool acpi_root_is_xsdt = false;
+
+static bool acpi_checksum_ok(const void *data, uint32_t length) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) sum = (uint8_t)(sum + bytes[i]);
+    return sum == 0;
+}
+
+static const acpi_rsdp_t *acpi_check_rsdp(uintptr_t address) {
+    const acpi_rsdp_t *rsdp = (const acpi_rsdp_t *)address;
+    if (memory_compare(rsdp->signature, "RSD PTR ", 8) != 0) return 0;
+    if (!acpi_checksum_ok(rsdp, 20)) return 0;
+    if (rsdp->revision >= 2 && !acpi_checksum_ok(rsdp, rsdp->length)) return 0;
+    return rsdp;
+}
+
+/* The RSDP sits on a 16-byte boundary in the first KiB of the EBDA or in the
+ * BIOS area 0xE0000-0xFFFFF */
+static const acpi_rsdp_t *acpi_scan_bios(void) {
+    const volatile uint16_t *ebda_segment = (const volatile uint16_t *)0x40E;
+    __asm__ ("" : "+r"(ebda_segment));     /* GCC assumes nothing lives in page 0 */
+    uintptr_t ebda = (uintptr_t)(*ebda_segment) << 4;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        for (uintptr_t p = ebda; p < ebda + 1024; p += 16) {
+            const acpi_rsdp_t *rsdp = acpi_check_rsdp(p);
+            if (rsdp) return rsdp;
+        }
+    }
+    for (uintptr_t p = 0xE0000; p < 0x100000; p += 16) {
+        const acpi_rsdp_t *rsdp = acpi_check_rsdp(p);
+        if (rsdp) return rsdp;
+    }
+    return 0;
+}
+
+bool acpi_init(const kernel_bootinfo_t *bootinfo) {
+    if (bootinfo && (bootinfo->flags & KERNEL_BOOTINFO_FLAG_ACPI)) {
+        acpi_rsdp = acpi_check_rsdp((uintptr_t)bootinfo->acpi_rsdp);
+    } else if (!bootinfo || !(bootinfo->flags & KERNEL_BOOTINFO_FLAG_UEFI)) {
+        acpi_rsdp = acpi_scan_bios();
+    }
+    if (!acpi_rsdp) return false;
+
+    if (acpi_rsdp->revision >= 2 && acpi_rsdp->xsdt_address) {
+        acpi_root = (const acpi_sdt_header_t *)(uintptr_t)acpi_rsdp->xsdt_address;
+        acpi_root_is_xsdt = true;
+    } else {
+        acpi_root = (const acpi_sdt_header_t *)(uintptr_t)acpi_rsdp->rsdt_address;
+        acpi_root_is_xsdt = false;
+    }
+    if (!acpi_checksum_ok(acpi_root, acpi_root->length)) {
+        acpi_root = 0;
+        return false;
+    }
+    return true;
+}
+
+bool acpi_available(void) {
+    return acpi_root != 0;
+}
+
+const acpi_sdt_header_t *acpi_find_table(const char signature[4]) {
+    if (!acpi_root) return 0;
+
+    uint32_t entry_size = acpi_root_is_xsdt ? 8 : 4;
+    uint32_t count = (acpi_root->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    const uint8_t *entries = (const uint8_t *)acpi_root + sizeof(acpi_sdt_header_t);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t address;
+        if (acpi_root_is_xsdt) {
+            memory_copy(&address, entries + i * 8, 8);     /* entries are unaligned */
+        } else {
+            uint32_t address32;
+            memory_copy(&address32, entries + i * 4, 4);
+            address = address32;
+        }
+        const acpi_sdt_header_t *table = (const acpi_sdt_header_t *)(uintptr_t)address;
+        if (memory_compare(table->signature, signature, 4) == 0 &&
+            acpi_checksum_ok(table, table->length)) {
+            return table;
+        }
+    }
+    return 0;
+}
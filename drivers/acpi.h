@@ -0,0 +1,97 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel/include/kernel/bootinfo.h"
+
+/* Common header of every ACPI system description table */
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+typedef struct {
+    char signature[8];          /* "RSD PTR " */
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;           /* 0 = ACPI 1.0, 2 = ACPI 2.0+ */
+    uint32_t rsdt_address;
+    /* ACPI 2.0+ */
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+/* MADT ("APIC") and its interrupt controller structures */
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;             /* bit 0: dual 8259 present */
+} __attribute__((packed)) acpi_madt_t;
+
+#define ACPI_MADT_LAPIC          0
+#define ACPI_MADT_IOAPIC         1
+#define ACPI_MADT_OVERRIDE       2
+#define ACPI_MADT_LAPIC_NMI      4
+#define ACPI_MADT_LAPIC_ADDRESS  5
+#define ACPI_MADT_X2APIC         9
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) acpi_madt_entry_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;             /* bit 0: enabled */
+} __attribute__((packed)) acpi_madt_lapic_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t ioapic_id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed)) acpi_madt_ioapic_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t bus;                /* 0 = ISA */
+    uint8_t source;             /* ISA IRQ */
+    uint32_t gsi;
+    uint16_t flags;             /* MPS INTI polarity (bits 0-1) and trigger (bits 2-3) */
+} __attribute__((packed)) acpi_madt_override_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed)) acpi_madt_lapic_address_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint16_t reserved;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t processor_uid;
+} __attribute__((packed)) acpi_madt_x2apic_t;
+
+/* Locate the RSDP (from the UEFI loader, or by scanning the BIOS areas) and
+ * validate the root table. Returns false when there is no usable ACPI. */
+bool acpi_init(const kernel_bootinfo_t *bootinfo);
+bool acpi_available(void);
+/* First table with this signature whose checksum is valid, or NULL */
+const acpi_sdt_header_t *acpi_find_table(const char signature[4]);
+
+#endif
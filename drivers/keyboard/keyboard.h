@@ -6,6 +6,7 @@
 typedef enum {
     KDEV_SOURCE_PS2 = 1,
     KDEV_SOURCE_USB = 2,
+    KDEV_SOURCE_SERIAL = 3,
 } kbd_source_t;
 
 // ---------- Event types ----------
@@ -104,8 +105,8 @@ typedef struct {
     key_event_type_t type;   // PRESS/RELEASE/REPEAT
     keycode_t        code;   // ASCII or extended KC_*
     uint16_t         mods;   // KM_* mask (state after applying event)
-    kbd_source_t     src;    // PS/2 or USB
-    uint8_t          dev_id; // 0 for PS/2; USB logical id for USB devices
+    kbd_source_t     src;    // PS/2, USB or serial terminal
+    uint8_t          dev_id; // 0 for PS/2; logical id for USB and serial
 } key_event_t;
 
 // ---------- Public API ----------
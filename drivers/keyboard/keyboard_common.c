@@ -207,7 +207,7 @@ uint8_t kbd_register_device(kbd_source_t src, uint8_t hw_id) {
         g_ps2_registered = 1;
         return 0; /* PS/2 logical id is 0 */
     } else {
-        /* USB logical ids start at 1, the USB layer keeps details */
+        /* USB and serial logical ids start at 1, their drivers keep details */
         uint8_t id = g_usb_next_id++;
         return id;
     }
@@ -1,5 +1,6 @@
 #include "pci.h"
 #include "cpu/ports.h" // Your custom I/O functions
+#include "cpu/apic.h"
 #include "screen.h"
 
 pci_device_t pci_devices[MAX_PCI_DEVICES];
@@ -57,6 +58,108 @@ void pci_config_write_word(uint8_t bus, uint8_t device, uint8_t function, uint8_
     io_dword_out(PCI_CONFIG_DATA, data);
 }
 
+void pci_config_write(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value) {
+    uint32_t address = (1 << 31) |
+                        (bus << 16) |
+                        (device << 11) |
+                        (function << 8) |
+                        (offset & 0xFC);
+    io_dword_out(PCI_CONFIG_ADDRESS, address);
+    io_dword_out(PCI_CONFIG_DATA, value);
+}
+
+/* Walk the capability list; returns the config offset of 'cap_id' or 0 */
+uint8_t pci_find_capability(const pci_device_t *dev, uint8_t cap_id) {
+    uint16_t status = pci_config_read_word(dev->bus, dev->device, dev->function, 0x06);
+    if (!(status & (1 << 4))) return 0; // No capability list
+
+    uint8_t ptr = pci_config_read_byte(dev->bus, dev->device, dev->function, 0x34) & 0xFC;
+    // Bounded walk so a looping list on broken hardware cannot hang us
+    for (int guard = 0; ptr >= 0x40 && guard < 48; guard++) {
+        uint16_t header = pci_config_read_word(dev->bus, dev->device, dev->function, ptr);
+        if ((header & 0xFF) == cap_id) return ptr;
+        ptr = (uint8_t)(header >> 8) & 0xFC;
+    }
+    return 0;
+}
+
+static void pci_disable_intx(pci_device_t *dev) {
+    uint16_t command = pci_config_read_word(dev->bus, dev->device, dev->function, 0x04);
+    command |= (1 << 10); // Interrupt Disable
+    pci_config_write_word(dev->bus, dev->device, dev->function, 0x04, command);
+}
+
+bool pci_enable_msi(pci_device_t *dev, uint8_t vector) {
+    uint8_t cap = dev->msi_cap;
+    if (!cap) return false;
+
+    uint8_t bus = dev->bus, slot = dev->device, fn = dev->function;
+    uint16_t control = pci_config_read_word(bus, slot, fn, cap + 2);
+    uint64_t address = apic_msi_address();
+
+    pci_config_write(bus, slot, fn, cap + 4, (uint32_t)address);
+    if (control & (1 << 7)) {
+        // 64-bit capable: upper address dword, data at +0x0C
+        pci_config_write(bus, slot, fn, cap + 8, (uint32_t)(address >> 32));
+        pci_config_write_word(bus, slot, fn, cap + 12, (uint16_t)apic_msi_data(vector));
+    } else {
+        pci_config_write_word(bus, slot, fn, cap + 8, (uint16_t)apic_msi_data(vector));
+    }
+
+    control &= ~(7u << 4); // Multiple Message Enable = 1 vector
+    control |= 1;          // MSI Enable
+    pci_config_write_word(bus, slot, fn, cap + 2, control);
+    pci_disable_intx(dev);
+    return true;
+}
+
+bool pci_enable_msix(pci_device_t *dev, uint16_t entry, uint8_t vector) {
+    uint8_t cap = dev->msix_cap;
+    if (!cap) return false;
+
+    uint8_t bus = dev->bus, slot = dev->device, fn = dev->function;
+    uint16_t control = pci_config_read_word(bus, slot, fn, cap + 2);
+    if (entry > (control & 0x7FF)) return false; // Table Size is N-1
+
+    uint32_t table = pci_config_read(bus, slot, fn, cap + 4);
+    uint8_t bir = table & 0x7;
+    if (bir > 5 || !dev->is_memory_mapped[bir] || !dev->bar[bir]) return false;
+    uint32_t raw_bar = pci_config_read(bus, slot, fn, (uint8_t)(0x10 + bir * 4));
+    if ((raw_bar & 0x6) == 0x4 && pci_config_read(bus, slot, fn, (uint8_t)(0x14 + bir * 4)) != 0) {
+        return false; // Table above 4 GiB is not identity-mapped
+    }
+
+    // Function-mask while the entry is rewritten, then enable
+    control |= (1 << 15) | (1 << 14);
+    pci_config_write_word(bus, slot, fn, cap + 2, control);
+
+    volatile uint32_t *slot_regs = (volatile uint32_t *)(uintptr_t)
+        (dev->bar[bir] + (table & ~7u) + (uint32_t)entry * 16);
+    uint64_t address = apic_msi_address();
+    slot_regs[0] = (uint32_t)address;
+    slot_regs[1] = (uint32_t)(address >> 32);
+    slot_regs[2] = apic_msi_data(vector);
+    slot_regs[3] &= ~1u; // Unmask this vector
+
+    control &= ~(1 << 14);
+    pci_config_write_word(bus, slot, fn, cap + 2, control);
+    pci_disable_intx(dev);
+    return true;
+}
+
+int pci_request_msi(pci_device_t *dev, isr_t handler) {
+    if (!apic_is_enabled() || (!dev->msi_cap && !dev->msix_cap)) return -1;
+
+    int vector = interrupt_alloc_vector(handler);
+    if (vector < 0) return -1;
+
+    if (pci_enable_msix(dev, 0, (uint8_t)vector) || pci_enable_msi(dev, (uint8_t)vector)) {
+        return vector;
+    }
+    interrupt_free_vector((uint8_t)vector);
+    return -1;
+}
+
 /* Get vendor and device ID of a PCI device */
 pci_device_t pci_get_device(uint8_t bus, uint8_t device, uint8_t function) {
     pci_device_t dev;
@@ -143,6 +246,9 @@ void pci_scan() {
                 dev->interrupt_line = pci_config_read_byte(bus, device, function, 0x3C);
                 dev->interrupt_pin  = pci_config_read_byte(bus, device, function, 0x3D);
 
+                dev->msi_cap  = pci_find_capability(dev, PCI_CAP_MSI);
+                dev->msix_cap = pci_find_capability(dev, PCI_CAP_MSIX);
+
                 pci_device_count++;
             }
         }
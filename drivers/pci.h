@@ -2,12 +2,18 @@
 #define PCI_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "cpu/isr.h"
 
 #define PCI_CONFIG_ADDRESS 0xCF8
 #define PCI_CONFIG_DATA 0xCFC
 
 #define MAX_PCI_DEVICES 256
 
+/* Capability IDs (config 0x34 list) */
+#define PCI_CAP_MSI   0x05
+#define PCI_CAP_MSIX  0x11
+
 /* PCI device structure */
 typedef struct {
     uint16_t vendor_id;
@@ -23,6 +29,8 @@ typedef struct {
 
     uint8_t  interrupt_line;  /* PCI config 0x3C: 0..15 (IRQ#), 0xFF = unknown */
     uint8_t  interrupt_pin;   /* PCI config 0x3D: 1=A,2=B,3=C,4=D, 0=none */
+    uint8_t  msi_cap;         /* config offset of the MSI capability, 0 = none */
+    uint8_t  msix_cap;        /* config offset of the MSI-X capability, 0 = none */
 } pci_device_t;
 
 extern pci_device_t pci_devices[MAX_PCI_DEVICES];
@@ -33,6 +41,18 @@ uint16_t pci_config_read_word(uint8_t bus, uint8_t device, uint8_t function, uin
 uint8_t pci_config_read_byte(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
 void pci_enable_bus_mastering(pci_device_t *dev);
 void pci_config_write_word(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint16_t value);
+void pci_config_write(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value);
+uint8_t pci_find_capability(const pci_device_t *dev, uint8_t cap_id);
+
+/* Point the device's MSI (or MSI-X table entry 'entry') at 'vector' on the
+ * boot CPU and mask its legacy INTx pin. */
+bool pci_enable_msi(pci_device_t *dev, uint8_t vector);
+bool pci_enable_msix(pci_device_t *dev, uint16_t entry, uint8_t vector);
+
+/* Give the device a dedicated edge-triggered vector running 'handler',
+ * preferring MSI-X over MSI. Returns the vector, or -1 if the device or the
+ * interrupt controller cannot do it and the caller should use INTx. */
+int pci_request_msi(pci_device_t *dev, isr_t handler);
 pci_device_t pci_get_device(uint8_t bus, uint8_t device, uint8_t function);
 void pci_read_bars(pci_device_t *dev);
 void pci_scan();
@@ -13,6 +13,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 /* Public kernel API */
 void clear_screen();
@@ -26,7 +27,13 @@ void set_cursor_offset(int offset);
 int get_vga_offset_row(int offset);
 int get_vga_offset_col(int offset);
 
-void printf(const char *format, ...);
+/* printf-style output to the console, see libc/format.h for the conversions */
+void printf(const char *format, ...) __attribute__((format(__printf__, 1, 2)));
+
+/* Also send everything printed at the cursor (kprint, printf) to 'mirror',
+ * e.g. a serial port. Text placed at explicit positions is not mirrored. */
+typedef void (*screen_mirror_t)(const char *text, size_t len);
+void screen_set_mirror(screen_mirror_t mirror);
 
 void screen_set_available(bool available);
 bool screen_is_available(void);
@@ -0,0 +1,110 @@
+#include <stddef.h>
+#include "bga.h"
+#include "framebuffer_console.h"
+#include "cpu/ports.h"
+#include "drivers/pci.h"
+#include "kernel/log/klog.h"
+
+#define DISPI_INDEX_PORT 0x01CE
+#define DISPI_DATA_PORT  0x01CF
+
+#define DISPI_ID               0x0
+#define DISPI_XRES             0x1
+#define DISPI_YRES             0x2
+#define DISPI_BPP              0x3
+#define DISPI_ENABLE           0x4
+#define DISPI_VIRT_WIDTH       0x6
+#define DISPI_VIRT_HEIGHT      0x7
+#define DISPI_X_OFFSET         0x8
+#define DISPI_Y_OFFSET         0x9
+#define DISPI_VIDEO_MEMORY_64K 0xA
+
+#define DISPI_ID_LFB    0xB0C2      /* 32 bpp and the linear framebuffer */
+#define DISPI_ID_MEMORY 0xB0C4      /* VIDEO_MEMORY_64K */
+#define DISPI_ID_LAST   0xB0C5
+
+#define DISPI_ENABLED     0x01
+#define DISPI_LFB_ENABLED 0x40
+#define DISPI_NOCLEARMEM  0x80
+
+static bool bga_present = false;
+
+static void dispi_write(uint16_t reg, uint16_t value) {
+    port_word_out(DISPI_INDEX_PORT, reg);
+    port_word_out(DISPI_DATA_PORT, value);
+}
+
+static uint16_t dispi_read(uint16_t reg) {
+    port_word_out(DISPI_INDEX_PORT, reg);
+    return port_word_in(DISPI_DATA_PORT);
+}
+
+static pci_device_t *bga_find(void) {
+    for (uint16_t i = 0; i < pci_device_count; i++) {
+        if (pci_devices[i].vendor_id == BGA_PCI_VENDOR && pci_devices[i].device_id == BGA_PCI_DEVICE) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+bool bga_init(void) {
+    const framebuffer_console_t *fb = framebuffer_console_info();
+    pci_device_t *dev = bga_find();
+    if (!fb || !dev || fb->bpp != 32) {
+        return false;
+    }
+    uint16_t id = dispi_read(DISPI_ID);
+    if (id < DISPI_ID_LFB || id > DISPI_ID_LAST) {
+        return false;
+    }
+    /* Only when the console is drawing to this adapter */
+    if (!dev->is_memory_mapped[0] || dev->bar[0] != (uint32_t)(uintptr_t)fb->base) {
+        return false;
+    }
+
+    uint64_t vram = (id >= DISPI_ID_MEMORY) ?
+        (uint64_t)dispi_read(DISPI_VIDEO_MEMORY_64K) * 0x10000 : fb->size;
+    uint64_t lines = vram / ((uint64_t)fb->stride * sizeof(uint32_t));
+    if (lines > UINT16_MAX) lines = UINT16_MAX;
+    if (lines <= fb->height) {
+        return false;
+    }
+
+    /* The firmware's mode again, now with a virtual size. NOCLEARMEM keeps
+     * what is on screen; enabling resets the virtual width and offsets. */
+    dispi_write(DISPI_ENABLE, 0);
+    dispi_write(DISPI_XRES, (uint16_t)fb->width);
+    dispi_write(DISPI_YRES, (uint16_t)fb->height);
+    dispi_write(DISPI_BPP, 32);
+    dispi_write(DISPI_ENABLE, DISPI_ENABLED | DISPI_LFB_ENABLED | DISPI_NOCLEARMEM);
+    dispi_write(DISPI_VIRT_WIDTH, (uint16_t)fb->stride);
+    dispi_write(DISPI_VIRT_HEIGHT, (uint16_t)lines);
+    dispi_write(DISPI_X_OFFSET, 0);
+    dispi_write(DISPI_Y_OFFSET, 0);
+    bga_present = true;
+
+    /* QEMU derives the virtual height from VRAM, Bochs takes ours */
+    uint32_t virtual_height = dispi_read(DISPI_VIRT_HEIGHT);
+    if (virtual_height > lines) virtual_height = (uint32_t)lines;
+    if (dispi_read(DISPI_VIRT_WIDTH) != fb->stride ||
+        !framebuffer_console_enable_panning(virtual_height, bga_set_y_offset)) {
+        klog(KLOG_WARN, "[BGA] Panning unavailable, scrolling copies\n");
+        return true;
+    }
+    klog(KLOG_INFO, "[BGA] %ux%u, scrolling pans over %u lines\n",
+         fb->width, fb->height, virtual_height);
+    return true;
+}
+
+bool bga_is_present(void) {
+    return bga_present;
+}
+
+bool bga_set_y_offset(uint32_t y) {
+    if (!bga_present || y > UINT16_MAX) {
+        return false;
+    }
+    dispi_write(DISPI_Y_OFFSET, (uint16_t)y);
+    return true;
+}
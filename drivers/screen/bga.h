@@ -0,0 +1,22 @@
+#ifndef CASSEOS_DRIVERS_SCREEN_BGA_H
+#define CASSEOS_DRIVERS_SCREEN_BGA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Bochs/QEMU "DISPI" display interface (BGA), QEMU's -vga std. When the
+ * framebuffer console runs on its linear framebuffer, the driver takes
+ * over the mode from the firmware with a virtual height covering all of
+ * VRAM, so the console scrolls by moving Y_OFFSET. */
+
+#define BGA_PCI_VENDOR 0x1234
+#define BGA_PCI_DEVICE 0x1111
+
+/* Call after pci_scan() and framebuffer_console_init() */
+bool bga_init(void);
+bool bga_is_present(void);
+
+/* Show the framebuffer from line 'y' on */
+bool bga_set_y_offset(uint32_t y);
+
+#endif /* CASSEOS_DRIVERS_SCREEN_BGA_H */
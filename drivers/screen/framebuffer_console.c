@@ -1,11 +1,51 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "framebuffer_console.h"
+#include "gfx2d.h"
 #include "../screen.h"
+#include "cpu/isr.h"
+#include "cpu/timer.h"
+#include "cpu/pat.h"
+#include "libc/mem.h"
+#include "kernel/mm/page_alloc.h"
 
 static framebuffer_console_t fb_console;
 static bool fb_console_ready = false;
 
+/* Pending damage as [x0,x1) x [y0,y1), empty when x0 >= x1 */
+static struct {
+    uint32_t x0, y0, x1, y1;
+} fb_dirty;
+static uint64_t fb_flush_interval_ticks = 0;
+static timer_handle_t fb_flush_timer = TIMER_INVALID;
+/* Set by the flush timer, the flush itself runs outside IRQ context */
+static volatile bool fb_flush_pending = false;
+static void (*fb_render_hook)(void) = NULL;
+
+/* Display start line: 'target' is where the shadow belongs in VRAM, the
+ * hardware is moved there after the flush has written the new lines */
+static struct {
+    framebuffer_pan_t pan;
+    uint32_t shown;
+    uint32_t target;
+} fb_pan;
+
+static void framebuffer_console_alloc_shadow(void) {
+    fb_console.shadow = NULL;
+    if (!page_alloc_ready()) {
+        return;
+    }
+    uint64_t bytes = (uint64_t)fb_console.stride * fb_console.height * sizeof(uint32_t);
+    uint32_t *shadow = page_alloc_pages((size_t)((bytes + PAGE_SIZE - 1) / PAGE_SIZE));
+    if (!shadow) {
+        return;
+    }
+    /* Matches what the first clear_screen() puts on screen */
+    memory_set(shadow, 0, (size_t)bytes);
+    fb_console.shadow = shadow;
+    fb_dirty.x0 = fb_dirty.x1 = 0;
+}
+
 bool framebuffer_console_init(const kernel_bootinfo_t *bootinfo) {
     if (!bootinfo) {
         fb_console_ready = false;
@@ -30,7 +70,12 @@ bool framebuffer_console_init(const kernel_bootinfo_t *bootinfo) {
     fb_console.font = framebuffer_font8x16;
     fb_console.glyph_width = FRAMEBUFFER_FONT_WIDTH;
     fb_console.glyph_height = FRAMEBUFFER_FONT_HEIGHT;
+    fb_console.virtual_height = fb_console.height;
+    framebuffer_console_alloc_shadow();
+    gfx_init();
     fb_console_ready = true;
+    /* Firmware usually leaves the framebuffer UC: one bus write per pixel */
+    framebuffer_console_set_write_combining(true);
 
     /* Disable VGA text rendering once the framebuffer console is ready. */
     screen_set_available(false);
@@ -47,20 +92,25 @@ const framebuffer_console_t *framebuffer_console_info(void) {
 
 bool framebuffer_console_draw_glyph(char c, uint32_t x, uint32_t y,
                                     uint32_t fg_color, uint32_t bg_color) {
+    return framebuffer_console_draw_cell(c, x, y, fb_console.glyph_width, fg_color, bg_color);
+}
+
+bool framebuffer_console_draw_cell(char c, uint32_t x, uint32_t y, uint32_t cell_width,
+                                   uint32_t fg_color, uint32_t bg_color) {
     if (!fb_console_ready || fb_console.bpp != 32) {
         return false;
     }
 
     uint32_t glyph_w = fb_console.glyph_width;
     uint32_t glyph_h = fb_console.glyph_height;
-    if (glyph_w == 0 || glyph_h == 0) {
+    if (glyph_w == 0 || glyph_h == 0 || cell_width < glyph_w) {
         return false;
     }
 
     if (x >= fb_console.width || y >= fb_console.height) {
         return false;
     }
-    if (x + glyph_w > fb_console.width || y + glyph_h > fb_console.height) {
+    if (x + cell_width > fb_console.width || y + glyph_h > fb_console.height) {
         return false;
     }
 
@@ -69,15 +119,229 @@ bool framebuffer_console_draw_glyph(char c, uint32_t x, uint32_t y,
         return false;
     }
 
-    for (uint32_t row = 0; row < glyph_h; ++row) {
-        uint32_t screen_y = y + row;
-        volatile uint32_t *pixel = fb_console.base + screen_y * fb_console.stride + x;
-        uint8_t bits = glyph[row];
-        for (uint32_t col = 0; col < glyph_w; ++col) {
-            uint32_t color = (bits & (0x80u >> col)) ? fg_color : bg_color;
-            pixel[col] = color;
+    gfx_surface_t surface;
+    framebuffer_console_surface(&surface);
+    gfx_expand_mask(&surface, (gfx_rect_t){ (int32_t)x, (int32_t)y, cell_width, glyph_h },
+                    glyph, (glyph_w + 7) / 8, fg_color, bg_color);
+    framebuffer_console_mark_dirty(x, y, cell_width, glyph_h);
+
+    return true;
+}
+
+uint32_t *framebuffer_console_target(void) {
+    /* The VRAM fallback drops volatile, stores to it are never elided since
+     * nothing reads them back */
+    return fb_console.shadow ? fb_console.shadow : (uint32_t *)fb_console.base;
+}
+
+void framebuffer_console_surface(gfx_surface_t *surface) {
+    surface->pixels = fb_console_ready ? framebuffer_console_target() : NULL;
+    surface->width = fb_console.width;
+    surface->height = fb_console.height;
+    surface->stride = fb_console.stride;
+}
+
+void framebuffer_console_mark_dirty(uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+    if (!fb_console.shadow || width == 0 || height == 0) {
+        return;
+    }
+    uint32_t x1 = x + width, y1 = y + height;
+    if (x1 > fb_console.width) x1 = fb_console.width;
+    if (y1 > fb_console.height) y1 = fb_console.height;
+    if (x >= x1 || y >= y1) {
+        return;
+    }
+
+    /* Interrupt handlers may draw while a flush takes the rectangle */
+    uint64_t flags = irq_save();
+    if (fb_dirty.x0 >= fb_dirty.x1) {
+        fb_dirty.x0 = x;
+        fb_dirty.y0 = y;
+        fb_dirty.x1 = x1;
+        fb_dirty.y1 = y1;
+    } else {
+        if (x < fb_dirty.x0) fb_dirty.x0 = x;
+        if (y < fb_dirty.y0) fb_dirty.y0 = y;
+        if (x1 > fb_dirty.x1) fb_dirty.x1 = x1;
+        if (y1 > fb_dirty.y1) fb_dirty.y1 = y1;
+    }
+    irq_restore(flags);
+}
+
+void framebuffer_console_flush(void) {
+    fb_flush_pending = false;
+    if (fb_render_hook) {
+        fb_render_hook();
+    }
+    if (!fb_console.shadow) {
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    uint32_t x0 = fb_dirty.x0, y0 = fb_dirty.y0;
+    uint32_t x1 = fb_dirty.x1, y1 = fb_dirty.y1;
+    uint32_t pan_line = fb_pan.target;
+    fb_dirty.x0 = fb_dirty.x1 = 0;
+    irq_restore(flags);
+
+    /* Row copies read RAM and only write VRAM. Pixels drawn while this runs
+     * are marked dirty again afterwards and go out with the next flush. */
+    volatile uint32_t *vram = fb_console.base + (size_t)pan_line * fb_console.stride;
+    size_t row_bytes = (size_t)(x1 - x0) * sizeof(uint32_t);
+    if (x0 >= x1) {
+        /* nothing to copy */
+    } else if (x0 == 0 && x1 == fb_console.stride) {
+        size_t offset = (size_t)y0 * fb_console.stride;
+        memory_copy((void *)(vram + offset), fb_console.shadow + offset,
+                    row_bytes * (y1 - y0));
+    } else {
+        for (uint32_t y = y0; y < y1; ++y) {
+            size_t offset = (size_t)y * fb_console.stride + x0;
+            memory_copy((void *)(vram + offset), fb_console.shadow + offset, row_bytes);
         }
     }
 
+    if (fb_pan.pan && pan_line != fb_pan.shown && fb_pan.pan(pan_line)) {
+        fb_pan.shown = pan_line;
+    }
+}
+
+bool framebuffer_console_scroll(uint32_t pixels, uint32_t area_height) {
+    if (!fb_console_ready || !fb_console.shadow) {
+        return false;
+    }
+    if (area_height > fb_console.height) area_height = fb_console.height;
+    if (pixels >= area_height) {
+        framebuffer_console_mark_dirty(0, 0, fb_console.width, area_height);
+        return true;
+    }
+
+    /* With panning the lines below the area move too, they only hold the
+     * background the console cleared them to */
+    uint32_t height = fb_pan.pan ? fb_console.height : area_height;
+    gfx_surface_t surface;
+    framebuffer_console_surface(&surface);
+    gfx_copy(&surface, 0, 0, &surface,
+             (gfx_rect_t){ 0, (int32_t)pixels, fb_console.width, height - pixels });
+    if (!fb_pan.pan) {
+        framebuffer_console_mark_dirty(0, 0, fb_console.width, area_height);
+        return true;
+    }
+
+    uint64_t flags = irq_save();
+    if (fb_pan.target + pixels + fb_console.height <= fb_console.virtual_height) {
+        /* What VRAM shows below the old start already matches the shadow,
+         * pending damage moves up with the contents */
+        fb_pan.target += pixels;
+        if (fb_dirty.x0 < fb_dirty.x1) {
+            fb_dirty.y0 = fb_dirty.y0 > pixels ? fb_dirty.y0 - pixels : 0;
+            fb_dirty.y1 = fb_dirty.y1 > pixels ? fb_dirty.y1 - pixels : 0;
+            if (fb_dirty.y0 >= fb_dirty.y1) fb_dirty.x0 = fb_dirty.x1 = 0;
+        }
+        irq_restore(flags);
+        framebuffer_console_mark_dirty(0, area_height - pixels, fb_console.width,
+                                       fb_console.height - (area_height - pixels));
+    } else {
+        /* Out of virtual lines: back to the top with one full copy */
+        fb_pan.target = 0;
+        irq_restore(flags);
+        framebuffer_console_mark_dirty(0, 0, fb_console.width, fb_console.height);
+    }
     return true;
 }
+
+bool framebuffer_console_enable_panning(uint32_t virtual_height, framebuffer_pan_t pan) {
+    if (!fb_console_ready || !fb_console.shadow || !pan ||
+        virtual_height < fb_console.height + FRAMEBUFFER_FONT_HEIGHT) {
+        return false;
+    }
+    uint64_t flags = irq_save();
+    fb_console.virtual_height = virtual_height;
+    fb_console.size = (uint64_t)fb_console.stride * virtual_height * sizeof(uint32_t);
+    fb_pan.pan = pan;
+    fb_pan.shown = fb_pan.target = 0;
+    irq_restore(flags);
+    pan(0);
+    framebuffer_console_mark_dirty(0, 0, fb_console.width, fb_console.height);
+    /* The write-combining range has to cover the lines panned into */
+    if (fb_console.write_combining) {
+        framebuffer_console_set_write_combining(true);
+    }
+    framebuffer_console_present();
+    return true;
+}
+
+/* IRQ0 context: rendering and copying to VRAM would hold off every other
+ * interrupt, so they wait for the next present or framebuffer_console_poll() */
+static void framebuffer_console_flush_tick(void *data) {
+    (void)data;
+    fb_flush_timer = TIMER_INVALID;
+    fb_flush_pending = true;
+}
+
+void framebuffer_console_poll(void) {
+    if (fb_flush_pending) {
+        framebuffer_console_flush();
+    }
+}
+
+void framebuffer_console_present(void) {
+    /* With interrupts off the timer would never fire */
+    if (fb_flush_interval_ticks && interrupts_enabled() && !fb_flush_pending) {
+        uint64_t flags = irq_save();
+        if (fb_flush_timer == TIMER_INVALID && !fb_flush_pending) {
+            fb_flush_timer = timer_add(framebuffer_console_flush_tick, NULL,
+                                       timer_get_ticks() + fb_flush_interval_ticks);
+        }
+        bool armed = fb_flush_timer != TIMER_INVALID;
+        irq_restore(flags);
+        if (armed) {
+            return;
+        }
+    }
+    framebuffer_console_flush();
+}
+
+void framebuffer_console_set_render_hook(void (*hook)(void)) {
+    fb_render_hook = hook;
+}
+
+static uint64_t framebuffer_console_vram_bytes(void) {
+    uint64_t bytes = (uint64_t)fb_console.stride * fb_console.virtual_height * sizeof(uint32_t);
+    return (fb_console.size && fb_console.size < bytes) ? fb_console.size : bytes;
+}
+
+bool framebuffer_console_set_write_combining(bool enable) {
+    if (!fb_console_ready) {
+        return false;
+    }
+    bool ok = pat_set_memory_type((uint64_t)(uintptr_t)fb_console.base, framebuffer_console_vram_bytes(),
+                                  enable ? MEMORY_TYPE_WC : MEMORY_TYPE_UC);
+    fb_console.write_combining = enable && ok;
+    return ok;
+}
+
+uint64_t framebuffer_console_benchmark(uint32_t frames) {
+    if (!fb_console_ready || !fb_console.shadow || frames == 0) {
+        return 0;
+    }
+    /* The shadow already holds what is on screen, so this is invisible */
+    uint64_t frame_bytes = (uint64_t)fb_console.stride * fb_console.height * sizeof(uint32_t);
+    uint64_t start = timer_get_ns();
+    for (uint32_t i = 0; i < frames; ++i) {
+        framebuffer_console_mark_dirty(0, 0, fb_console.width, fb_console.height);
+        framebuffer_console_flush();
+    }
+    uint64_t elapsed_us = (timer_get_ns() - start) / 1000;
+    if (elapsed_us == 0) {
+        elapsed_us = 1;
+    }
+    return frame_bytes * frames * 1000000ULL / elapsed_us;
+}
+
+void framebuffer_console_set_flush_interval(uint32_t milliseconds) {
+    fb_flush_interval_ticks = milliseconds ? timer_ms_to_ticks(milliseconds) : 0;
+    if (!fb_flush_interval_ticks) {
+        framebuffer_console_flush();
+    }
+}
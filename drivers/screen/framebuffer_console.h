@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include "kernel/include/kernel/bootinfo.h"
 #include "font8x16.h"
+#include "gfx2d.h"
 
 typedef struct {
     volatile uint32_t *base;
@@ -16,12 +17,61 @@ typedef struct {
     const uint8_t (*font)[FRAMEBUFFER_FONT_HEIGHT];
     uint32_t glyph_width;
     uint32_t glyph_height;
+    uint32_t *shadow;       /* RAM copy with the same stride, NULL if not allocated */
+    bool write_combining;   /* VRAM mapped WC through PAT or an MTRR */
+    uint32_t virtual_height; /* VRAM lines the display can pan over, >= height */
 } framebuffer_console_t;
 
+/* Show the framebuffer from VRAM line 'y_offset' on */
+typedef bool (*framebuffer_pan_t)(uint32_t y_offset);
+
+/* Default delay between burst output and the flush that shows it */
+#define FRAMEBUFFER_FLUSH_INTERVAL_MS 16
+
 bool framebuffer_console_init(const kernel_bootinfo_t *bootinfo);
 bool framebuffer_console_is_ready(void);
 const framebuffer_console_t *framebuffer_console_info(void);
 bool framebuffer_console_draw_glyph(char c, uint32_t x, uint32_t y,
                                     uint32_t fg_color, uint32_t bg_color);
+/* Glyph plus bg padding up to 'cell_width' pixels, in one pass per row */
+bool framebuffer_console_draw_cell(char c, uint32_t x, uint32_t y, uint32_t cell_width,
+                                   uint32_t fg_color, uint32_t bg_color);
+
+/* Everything draws into the shadow buffer, which is plain cached RAM, and
+ * records a dirty rectangle. framebuffer_console_flush() then copies that
+ * rectangle to VRAM with writes only. Without a shadow (no page allocator)
+ * the target is VRAM itself and flushing does nothing. */
+uint32_t *framebuffer_console_target(void);
+/* The target as a gfx2d surface, no pixels until the console is ready.
+ * Drawing through it still needs framebuffer_console_mark_dirty(). */
+void framebuffer_console_surface(gfx_surface_t *surface);
+void framebuffer_console_mark_dirty(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+void framebuffer_console_flush(void);
+/* Called after a batch of drawing: flushes now, or arms a timer so bursts
+ * within the flush interval reach VRAM once */
+void framebuffer_console_present(void);
+/* Flushes once the timer has expired; the timer only flags the flush, the
+ * main loop calls this like klog_drain() */
+void framebuffer_console_poll(void);
+/* 0 flushes on every present, the default until interrupts are running */
+void framebuffer_console_set_flush_interval(uint32_t milliseconds);
+/* Runs at the start of every flush to bring the shadow up to date */
+void framebuffer_console_set_render_hook(void (*hook)(void));
+
+/* Move the top 'area_height' lines of the shadow up by 'pixels'. With
+ * panning the display moves down the virtual framebuffer instead of VRAM
+ * being rewritten, and only the lines that come into view are flushed;
+ * otherwise the whole area is. Callers redraw the bottom 'pixels' lines of
+ * the area. False without a shadow buffer. */
+bool framebuffer_console_scroll(uint32_t pixels, uint32_t area_height);
+/* Let scrolling pan over 'virtual_height' lines of VRAM through 'pan'.
+ * Needs the shadow buffer. */
+bool framebuffer_console_enable_panning(uint32_t virtual_height, framebuffer_pan_t pan);
+
+/* Map VRAM write-combining or uncached, for comparing the two */
+bool framebuffer_console_set_write_combining(bool enable);
+/* Push 'frames' full frames from the shadow to VRAM and return the VRAM
+ * write rate in bytes per second, 0 without a shadow buffer */
+uint64_t framebuffer_console_benchmark(uint32_t frames);
 
 #endif /* CASSEOS_DRIVERS_FRAMEBUFFER_CONSOLE_H */
@@ -0,0 +1,355 @@
+#include "gfx2d.h"
+#include "cpu/cpuid.h"
+#include "libc/mem.h"
+#include "kernel/mm/page_alloc.h"
+
+/* Same approach as libc/mem_simd.c: GCC vector types instead of intrinsics
+ * headers, target("avx2") on the AVX2 kernels only */
+typedef uint32_t v4u32 __attribute__((vector_size(16), aligned(4), may_alias));
+typedef uint32_t v8u32 __attribute__((vector_size(32), aligned(4), may_alias));
+typedef uint8_t v8u8 __attribute__((vector_size(8), aligned(4), may_alias));
+typedef uint8_t v16u8 __attribute__((vector_size(16), aligned(4), may_alias));
+typedef uint16_t v8u16 __attribute__((vector_size(16)));
+typedef uint16_t v16u16 __attribute__((vector_size(32)));
+
+#define ALPHA_MASK 0xFF000000u
+
+typedef struct {
+    const char *name;
+    void (*fill)(uint32_t *dst, uint32_t stride, uint32_t width, uint32_t height,
+                 uint32_t color);
+    /* 'first_bit' is the mask column of the leftmost pixel, columns from
+     * 'mask_bits' on are past the mask */
+    void (*expand)(uint32_t *dst, uint32_t stride, const uint8_t *mask, uint32_t mask_stride,
+                   uint32_t first_bit, uint32_t mask_bits, uint32_t width, uint32_t height,
+                   uint32_t fg, uint32_t bg);
+    void (*blend)(uint32_t *dst, uint32_t dst_stride, const uint32_t *src, uint32_t src_stride,
+                  uint32_t width, uint32_t height);
+} gfx_kernel_set_t;
+
+/* mask_expansion[bits][i] is all ones when pixel i of those 8 mask bits is
+ * set, so 8 pixels are one and/andnot/or of fg and bg */
+static uint32_t (*mask_expansion)[8] = NULL;
+
+/* ---- Scalar kernels: the reference the SIMD ones are tested against ---- */
+
+static inline uint32_t blend_pixel(uint32_t src, uint32_t dst) {
+    uint32_t alpha = src >> 24;
+    uint32_t out = dst & ALPHA_MASK;
+    for (uint32_t shift = 0; shift < 24; shift += 8) {
+        uint32_t t = ((src >> shift) & 0xFF) * alpha + ((dst >> shift) & 0xFF) * (255 - alpha);
+        out |= ((t + 1 + (t >> 8)) >> 8) << shift;     /* t / 255, exact over 0..255*255 */
+    }
+    return out;
+}
+
+static inline uint32_t mask_pixel(const uint8_t *mask, uint32_t bit, uint32_t mask_bits,
+                                  uint32_t fg, uint32_t bg) {
+    return (bit < mask_bits && (mask[bit / 8] & (0x80u >> (bit % 8)))) ? fg : bg;
+}
+
+static void fill_scalar(uint32_t *dst, uint32_t stride, uint32_t width, uint32_t height,
+                        uint32_t color) {
+    for (uint32_t row = 0; row < height; ++row, dst += stride) {
+        for (uint32_t col = 0; col < width; ++col) {
+            dst[col] = color;
+        }
+    }
+}
+
+static void expand_scalar(uint32_t *dst, uint32_t stride, const uint8_t *mask, uint32_t mask_stride,
+                          uint32_t first_bit, uint32_t mask_bits, uint32_t width, uint32_t height,
+                          uint32_t fg, uint32_t bg) {
+    for (uint32_t row = 0; row < height; ++row, dst += stride, mask += mask_stride) {
+        for (uint32_t col = 0; col < width; ++col) {
+            dst[col] = mask_pixel(mask, first_bit + col, mask_bits, fg, bg);
+        }
+    }
+}
+
+static void blend_scalar(uint32_t *dst, uint32_t dst_stride, const uint32_t *src, uint32_t src_stride,
+                         uint32_t width, uint32_t height) {
+    for (uint32_t row = 0; row < height; ++row, dst += dst_stride, src += src_stride) {
+        for (uint32_t col = 0; col < width; ++col) {
+            dst[col] = blend_pixel(src[col], dst[col]);
+        }
+    }
+}
+
+/* Whole mask bytes go through the table when the row starts on a byte */
+static inline uint32_t expand_table_columns(uint32_t first_bit, uint32_t mask_bits, uint32_t width) {
+    if (!mask_expansion || (first_bit % 8) || first_bit >= mask_bits) {
+        return 0;
+    }
+    uint32_t columns = mask_bits - first_bit;
+    if (columns > width) columns = width;
+    return columns & ~7u;
+}
+
+/* ---- SSE2 ---- */
+
+static void fill_sse2(uint32_t *dst, uint32_t stride, uint32_t width, uint32_t height,
+                      uint32_t color) {
+    v4u32 value = (v4u32){0} + color;
+    for (uint32_t row = 0; row < height; ++row, dst += stride) {
+        uint32_t col = 0;
+        for (; col + 4 <= width; col += 4) {
+            *(v4u32 *)(dst + col) = value;
+        }
+        for (; col < width; ++col) {
+            dst[col] = color;
+        }
+    }
+}
+
+static void expand_sse2(uint32_t *dst, uint32_t stride, const uint8_t *mask, uint32_t mask_stride,
+                        uint32_t first_bit, uint32_t mask_bits, uint32_t width, uint32_t height,
+                        uint32_t fg, uint32_t bg) {
+    v4u32 vfg = (v4u32){0} + fg;
+    v4u32 vbg = (v4u32){0} + bg;
+    uint32_t table_columns = expand_table_columns(first_bit, mask_bits, width);
+    for (uint32_t row = 0; row < height; ++row, dst += stride, mask += mask_stride) {
+        const uint8_t *bits = mask + first_bit / 8;
+        uint32_t col = 0;
+        for (; col < table_columns; col += 8) {
+            const v4u32 *m = (const v4u32 *)mask_expansion[bits[col / 8]];
+            *(v4u32 *)(dst + col) = (vfg & m[0]) | (vbg & ~m[0]);
+            *(v4u32 *)(dst + col + 4) = (vfg & m[1]) | (vbg & ~m[1]);
+        }
+        for (; col < width; ++col) {
+            dst[col] = mask_pixel(mask, first_bit + col, mask_bits, fg, bg);
+        }
+    }
+}
+
+/* Two pixels widened to 16 bits per channel, destination alpha kept */
+static inline v8u8 blend2(v8u8 src, v8u8 dst) {
+    v8u16 s = __builtin_convertvector(src, v8u16);
+    v8u16 d = __builtin_convertvector(dst, v8u16);
+    v8u16 a = __builtin_shuffle(s, (v8u16){3, 3, 3, 3, 7, 7, 7, 7});
+    v8u16 t = s * a + d * (255 - a);
+    uint64_t out = (uint64_t)__builtin_convertvector((t + 1 + (t >> 8)) >> 8, v8u8);
+    const uint64_t keep = ((uint64_t)ALPHA_MASK << 32) | ALPHA_MASK;
+    return (v8u8)((out & ~keep) | ((uint64_t)dst & keep));
+}
+
+static void blend_sse2(uint32_t *dst, uint32_t dst_stride, const uint32_t *src, uint32_t src_stride,
+                       uint32_t width, uint32_t height) {
+    for (uint32_t row = 0; row < height; ++row, dst += dst_stride, src += src_stride) {
+        uint32_t col = 0;
+        for (; col + 2 <= width; col += 2) {
+            *(v8u8 *)(dst + col) = blend2(*(const v8u8 *)(src + col), *(const v8u8 *)(dst + col));
+        }
+        for (; col < width; ++col) {
+            dst[col] = blend_pixel(src[col], dst[col]);
+        }
+    }
+}
+
+/* ---- AVX2 ---- */
+
+__attribute__((target("avx2")))
+static void fill_avx2(uint32_t *dst, uint32_t stride, uint32_t width, uint32_t height,
+                      uint32_t color) {
+    v8u32 value = (v8u32){0} + color;
+    for (uint32_t row = 0; row < height; ++row, dst += stride) {
+        uint32_t col = 0;
+        for (; col + 8 <= width; col += 8) {
+            *(v8u32 *)(dst + col) = value;
+        }
+        for (; col < width; ++col) {
+            dst[col] = color;
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void expand_avx2(uint32_t *dst, uint32_t stride, const uint8_t *mask, uint32_t mask_stride,
+                        uint32_t first_bit, uint32_t mask_bits, uint32_t width, uint32_t height,
+                        uint32_t fg, uint32_t bg) {
+    v8u32 vfg = (v8u32){0} + fg;
+    v8u32 vbg = (v8u32){0} + bg;
+    uint32_t table_columns = expand_table_columns(first_bit, mask_bits, width);
+    for (uint32_t row = 0; row < height; ++row, dst += stride, mask += mask_stride) {
+        const uint8_t *bits = mask + first_bit / 8;
+        uint32_t col = 0;
+        for (; col < table_columns; col += 8) {
+            v8u32 m = *(const v8u32 *)mask_expansion[bits[col / 8]];
+            *(v8u32 *)(dst + col) = (vfg & m) | (vbg & ~m);
+        }
+        for (; col < width; ++col) {
+            dst[col] = mask_pixel(mask, first_bit + col, mask_bits, fg, bg);
+        }
+    }
+}
+
+/* Four pixels widened to 16 bits per channel */
+__attribute__((target("avx2")))
+static inline v16u8 blend4(v16u8 src, v16u8 dst) {
+    v16u16 s = __builtin_convertvector(src, v16u16);
+    v16u16 d = __builtin_convertvector(dst, v16u16);
+    v16u16 a = __builtin_shuffle(s, (v16u16){3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15});
+    v16u16 t = s * a + d * (255 - a);
+    return __builtin_convertvector((t + 1 + (t >> 8)) >> 8, v16u8);
+}
+
+__attribute__((target("avx2")))
+static void blend_avx2(uint32_t *dst, uint32_t dst_stride, const uint32_t *src, uint32_t src_stride,
+                       uint32_t width, uint32_t height) {
+    const v4u32 keep = (v4u32){0} + ALPHA_MASK;
+    for (uint32_t row = 0; row < height; ++row, dst += dst_stride, src += src_stride) {
+        uint32_t col = 0;
+        for (; col + 4 <= width; col += 4) {
+            v4u32 d = *(const v4u32 *)(dst + col);
+            v16u8 out = blend4(*(const v16u8 *)(src + col), (v16u8)d);
+            *(v4u32 *)(dst + col) = ((v4u32)out & ~keep) | (d & keep);
+        }
+        for (; col < width; ++col) {
+            dst[col] = blend_pixel(src[col], dst[col]);
+        }
+    }
+}
+
+static const gfx_kernel_set_t gfx_kernel_sets[] = {
+    [GFX_KERNELS_SCALAR] = { "scalar", fill_scalar, expand_scalar, blend_scalar },
+    [GFX_KERNELS_SSE2]   = { "sse2", fill_sse2, expand_sse2, blend_sse2 },
+    [GFX_KERNELS_AVX2]   = { "avx2", fill_avx2, expand_avx2, blend_avx2 },
+};
+
+static const gfx_kernel_set_t *gfx_kernels = &gfx_kernel_sets[GFX_KERNELS_SSE2];
+
+void gfx_init(void) {
+    if (!mask_expansion && page_alloc_ready()) {
+        uint32_t (*table)[8] = page_alloc_pages((256 * sizeof(*table) + PAGE_SIZE - 1) / PAGE_SIZE);
+        if (table) {
+            for (uint32_t bits = 0; bits < 256; ++bits) {
+                for (uint32_t col = 0; col < 8; ++col) {
+                    table[bits][col] = (bits & (0x80u >> col)) ? 0xFFFFFFFFu : 0;
+                }
+            }
+            mask_expansion = table;
+        }
+    }
+    gfx_use_kernels(cpu_features.avx2 ? GFX_KERNELS_AVX2 : GFX_KERNELS_SSE2);
+}
+
+bool gfx_use_kernels(gfx_kernels_t kernels) {
+    if (kernels > GFX_KERNELS_AVX2 || (kernels == GFX_KERNELS_AVX2 && !cpu_features.avx2)) {
+        return false;
+    }
+    gfx_kernels = &gfx_kernel_sets[kernels];
+    return true;
+}
+
+const char *gfx_kernels_name(void) {
+    return gfx_kernels->name;
+}
+
+/* ---- Clipping ---- */
+
+bool gfx_clip(const gfx_surface_t *surface, gfx_rect_t *rect) {
+    int64_t x0 = rect->x, y0 = rect->y;
+    int64_t x1 = x0 + rect->width, y1 = y0 + rect->height;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > surface->width) x1 = surface->width;
+    if (y1 > surface->height) y1 = surface->height;
+    if (!surface->pixels || x0 >= x1 || y0 >= y1) {
+        rect->width = rect->height = 0;
+        return false;
+    }
+    rect->x = (int32_t)x0;
+    rect->y = (int32_t)y0;
+    rect->width = (uint32_t)(x1 - x0);
+    rect->height = (uint32_t)(y1 - y0);
+    return true;
+}
+
+/* Clip 'area' of 'src' and its image at (x, y) of 'dst' together */
+static bool clip_pair(const gfx_surface_t *dst, int32_t *x, int32_t *y,
+                      const gfx_surface_t *src, gfx_rect_t *area) {
+    int32_t sx = area->x, sy = area->y;
+    if (!gfx_clip(src, area)) {
+        return false;
+    }
+    gfx_rect_t target = { *x + (area->x - sx), *y + (area->y - sy), area->width, area->height };
+    int32_t tx = target.x, ty = target.y;
+    if (!gfx_clip(dst, &target)) {
+        return false;
+    }
+    area->x += target.x - tx;
+    area->y += target.y - ty;
+    area->width = target.width;
+    area->height = target.height;
+    *x = target.x;
+    *y = target.y;
+    return true;
+}
+
+static inline uint32_t *pixel_at(const gfx_surface_t *surface, int32_t x, int32_t y) {
+    return surface->pixels + (size_t)y * surface->stride + x;
+}
+
+/* ---- Primitives ---- */
+
+void gfx_fill(gfx_surface_t *dst, gfx_rect_t rect, uint32_t color) {
+    if (gfx_clip(dst, &rect)) {
+        gfx_kernels->fill(pixel_at(dst, rect.x, rect.y), dst->stride, rect.width, rect.height, color);
+    }
+}
+
+void gfx_copy(gfx_surface_t *dst, int32_t x, int32_t y,
+              const gfx_surface_t *src, gfx_rect_t area) {
+    if (!clip_pair(dst, &x, &y, src, &area)) {
+        return;
+    }
+    uint32_t *to = pixel_at(dst, x, y);
+    const uint32_t *from = pixel_at(src, area.x, area.y);
+    size_t row_bytes = (size_t)area.width * sizeof(uint32_t);
+
+    /* Full lines of one stride are a single block */
+    if (dst->stride == src->stride && area.width == dst->stride && to <= from) {
+        memory_copy(to, from, row_bytes * area.height);
+        return;
+    }
+    if (to <= from) {
+        /* Upward or leftward: forward rows, forward within a row */
+        for (uint32_t row = 0; row < area.height; ++row) {
+            memory_copy(to + (size_t)row * dst->stride, from + (size_t)row * src->stride, row_bytes);
+        }
+        return;
+    }
+    /* Downward or rightward over itself: last row first, each row backwards
+     * unless it cannot overlap its source */
+    for (uint32_t row = area.height; row-- > 0;) {
+        uint32_t *d = to + (size_t)row * dst->stride;
+        const uint32_t *s = from + (size_t)row * src->stride;
+        if (d >= s + area.width || d + area.width <= s) {
+            memory_copy(d, s, row_bytes);
+        } else {
+            for (uint32_t col = area.width; col-- > 0;) {
+                d[col] = s[col];
+            }
+        }
+    }
+}
+
+void gfx_expand_mask(gfx_surface_t *dst, gfx_rect_t rect, const uint8_t *mask,
+                     uint32_t mask_stride, uint32_t fg, uint32_t bg) {
+    int32_t x = rect.x, y = rect.y;
+    if (!gfx_clip(dst, &rect)) {
+        return;
+    }
+    uint32_t first_bit = (uint32_t)(rect.x - x);
+    mask += (size_t)(rect.y - y) * mask_stride;
+    gfx_kernels->expand(pixel_at(dst, rect.x, rect.y), dst->stride, mask, mask_stride,
+                        first_bit, mask_stride * 8, rect.width, rect.height, fg, bg);
+}
+
+void gfx_blend(gfx_surface_t *dst, int32_t x, int32_t y,
+               const gfx_surface_t *src, gfx_rect_t area) {
+    if (clip_pair(dst, &x, &y, src, &area)) {
+        gfx_kernels->blend(pixel_at(dst, x, y), dst->stride, pixel_at(src, area.x, area.y),
+                           src->stride, area.width, area.height);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef CASSEOS_DRIVERS_SCREEN_GFX2D_H
+#define CASSEOS_DRIVERS_SCREEN_GFX2D_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* 2D primitives on 32-bit pixel surfaces. Every call clips against its
+ * surfaces first, then runs one rectangle kernel; the kernels come in
+ * scalar, SSE2 and AVX2 flavours picked once by gfx_init(). Colours are
+ * 0xAARRGGBB, only gfx_blend() looks at alpha. */
+
+typedef struct {
+    uint32_t *pixels;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;        /* pixels from one line to the next */
+} gfx_surface_t;
+
+typedef struct {
+    int32_t x;
+    int32_t y;
+    uint32_t width;
+    uint32_t height;
+} gfx_rect_t;
+
+typedef enum {
+    GFX_KERNELS_SCALAR,
+    GFX_KERNELS_SSE2,
+    GFX_KERNELS_AVX2,
+} gfx_kernels_t;
+
+/* Select the best kernels for this CPU and build the mask expansion table
+ * (needs the page allocator, the scalar expansion is used until then) */
+void gfx_init(void);
+/* Switch kernels, false if the CPU lacks them. For tests and benchmarks. */
+bool gfx_use_kernels(gfx_kernels_t kernels);
+const char *gfx_kernels_name(void);
+
+/* Intersect 'rect' with the surface, false when nothing is left */
+bool gfx_clip(const gfx_surface_t *surface, gfx_rect_t *rect);
+
+void gfx_fill(gfx_surface_t *dst, gfx_rect_t rect, uint32_t color);
+
+/* Copy 'area' of 'src' to (x, y) of 'dst'. Source and destination may
+ * overlap, as when scrolling within one surface. */
+void gfx_copy(gfx_surface_t *dst, int32_t x, int32_t y,
+              const gfx_surface_t *src, gfx_rect_t area);
+
+/* Expand a 1-bit mask, most significant bit leftmost, 'mask_stride' bytes
+ * per row: set bits become 'fg', clear ones 'bg'. Columns of 'rect' past
+ * the mask bits are 'bg', so a glyph and its cell padding are one call. */
+void gfx_expand_mask(gfx_surface_t *dst, gfx_rect_t rect, const uint8_t *mask,
+                     uint32_t mask_stride, uint32_t fg, uint32_t bg);
+
+/* Composite 'area' of 'src' over (x, y) of 'dst' using the source alpha.
+ * The destination keeps its own alpha byte. */
+void gfx_blend(gfx_surface_t *dst, int32_t x, int32_t y,
+               const gfx_surface_t *src, gfx_rect_t area);
+
+#endif /* CASSEOS_DRIVERS_SCREEN_GFX2D_H */
@@ -5,16 +5,22 @@
 #include "libc/string.h"
 #include "libc/mem.h"
 #include "framebuffer_console.h"
+#include "text_grid.h"
+#include "vga_text.h"
+#include "cpu/isr.h"
+#include "libc/format.h"
 
 /* Declaration of private functions */
 int get_cursor_offset();
 void set_cursor_offset(int offset);
 int print_char(char c, int col, int row, char attr);
+static int print_run(const char *text, size_t len, int col, int row);
 int get_offset(int col, int row);
 int get_vga_offset_row(int offset);
 int get_vga_offset_col(int offset);
 
 static bool screen_available = true;
+static screen_mirror_t screen_mirror;
 bool screen_auto_cursor = true;
 
 typedef struct {
@@ -45,34 +51,33 @@ static fb_console_state_t fb_console_state = {
 static bool fb_console_use(void);
 static void fb_console_clear(void);
 static void fb_console_scroll(void);
-static int fb_console_print_char(char c, int col, int row);
+static int fb_console_print_run(const char *text, size_t len, int col, int row);
 static void fb_console_fill_rect(uint32_t x, uint32_t y, uint32_t width,
                                  uint32_t height, uint32_t color);
+static void fb_console_render(void);
 
 void screen_set_available(bool available) {
     screen_available = available;
 }
 
+void screen_set_mirror(screen_mirror_t mirror) {
+    screen_mirror = mirror;
+}
+
 bool screen_is_available(void) {
     return screen_available || framebuffer_console_is_ready();
 }
 
 bool screen_draw_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color) {
-    const framebuffer_console_t *fb = framebuffer_console_info();
-    if (!fb) {
+    if (!framebuffer_console_info()) {
         return false;
     }
 
-    uint32_t max_x = (x + width > fb->width) ? fb->width : x + width;
-    uint32_t max_y = (y + height > fb->height) ? fb->height : y + height;
-    volatile uint32_t *fb_base = fb->base;
-
-    for (uint32_t row = y; row < max_y; ++row) {
-        volatile uint32_t *line = fb_base + row * fb->stride + x;
-        for (uint32_t col = x; col < max_x; ++col) {
-            line[col - x] = color;
-        }
-    }
+    gfx_surface_t surface;
+    framebuffer_console_surface(&surface);
+    gfx_fill(&surface, (gfx_rect_t){ (int32_t)x, (int32_t)y, width, height }, color);
+    framebuffer_console_mark_dirty(x, y, width, height);
+    framebuffer_console_present();
     return true;
 }
 
@@ -92,33 +97,25 @@ bool get_auto_cursor(){
  * If col, row, are negative, we will use the current offset
  */
 void kprint_at(char *message, int col, int row) {
+    if ((col < 0 || row < 0) && screen_mirror) {
+        screen_mirror(message, (size_t)strlen(message));
+    }
     if (!screen_available && !framebuffer_console_is_ready()) {
         return;
     }
     /* Set cursor if col/row are negative */
-    int offset;
-    if (col >= 0 && row >= 0)
-        offset = get_offset(col, row);
-    else {
-        offset = get_cursor_offset();
+    if (col < 0 || row < 0) {
+        int offset = get_cursor_offset();
         row = get_vga_offset_row(offset);
         col = get_vga_offset_col(offset);
     }
-
-    /* Loop through message and print it */
-    int i = 0;
-    while (message[i] != 0) {
-        offset = print_char(message[i++], col, row, WHITE_ON_BLACK);
-        /* Compute row/col for next iteration */
-        row = get_vga_offset_row(offset);
-        col = get_vga_offset_col(offset);
+    print_run(message, (size_t)strlen(message), col, row);
+    if (framebuffer_console_is_ready()) {
+        framebuffer_console_present();
     }
 }
 
 void kprint(char *message) {
-    if (!screen_available && !framebuffer_console_is_ready()) {
-        return;
-    }
     kprint_at(message, -1, -1);
 }
 
@@ -131,6 +128,9 @@ void kprint_backspace() {
     int col = get_vga_offset_col(offset);
     print_char(0x00, col, row, WHITE_ON_BLACK);
     set_cursor_offset(offset);
+    if (framebuffer_console_is_ready()) {
+        framebuffer_console_present();
+    }
 }
 
 
@@ -145,11 +145,12 @@ void kprint_backspace() {
  * If 'col' and 'row' are negative, we will print at current cursor location
  * If 'attr' is zero it will use 'white on black' as default
  * Returns the offset of the next character
- * Sets the video cursor to the returned offset
+ * Sets the cursor to the returned offset; the VGA hardware cursor follows
+ * once per kprint/printf (vga_text_sync_cursor)
  */
 int print_char(char c, int col, int row, char attr) {
     if (framebuffer_console_is_ready() && fb_console_use()) {
-        int offset = fb_console_print_char(c, col, row);
+        int offset = fb_console_print_run(&c, 1, col, row);
         if (screen_auto_cursor) {
             set_cursor_offset(offset);
         }
@@ -158,13 +159,11 @@ int print_char(char c, int col, int row, char attr) {
     if (!screen_available) {
         return get_offset(col, row);
     }
-    unsigned char *vidmem = (unsigned char*) VIDEO_ADDRESS;
     if (!attr) attr = WHITE_ON_BLACK;
 
     /* Error control: print a red 'E' if the coords aren't right */
     if (col >= MAX_COLS || row >= MAX_ROWS) {
-        vidmem[2*(MAX_COLS)*(MAX_ROWS)-2] = 'E';
-        vidmem[2*(MAX_COLS)*(MAX_ROWS)-1] = RED_ON_WHITE;
+        vga_text_set_cell(2 * MAX_COLS * MAX_ROWS - 2, 'E', RED_ON_WHITE);
         return get_offset(col, row);
     }
 
@@ -172,32 +171,34 @@ int print_char(char c, int col, int row, char attr) {
     if (col >= 0 && row >= 0) offset = get_offset(col, row);
     else offset = get_cursor_offset();
 
-    if (c == '\n') {
-        row = get_vga_offset_row(offset);
-        offset = get_offset(0, row+1);
-    } else {
-        vidmem[offset] = c;
-        vidmem[offset+1] = attr;
-        offset += 2;
+    offset = vga_text_put(c, offset, (uint8_t)attr);
+    if(screen_auto_cursor){
+        vga_text_set_cursor(offset);
     }
+    return offset;
+}
 
-    /* Check if the offset is over screen size and scroll */
-    if (offset >= MAX_ROWS * MAX_COLS * 2) {
-        int i;
-        for (i = 1; i < MAX_ROWS; i++) 
-            memory_copy((uint8_t*)(get_offset(0, i-1) + VIDEO_ADDRESS),
-                        (uint8_t*)(get_offset(0, i) + VIDEO_ADDRESS),
-                        MAX_COLS * 2);
-
-        /* Blank last line */
-        char *last_line = (char*) (get_offset(0, MAX_ROWS-1) + (uint8_t*)VIDEO_ADDRESS);
-        for (i = 0; i < MAX_COLS * 2; i++) last_line[i] = 0;
-
-        offset -= 2 * MAX_COLS;
+/**
+ * Print 'len' characters starting at col/row, negative meaning the cursor.
+ * On the framebuffer console the geometry is validated once for the whole
+ * run rather than for every character. Returns the offset after the run.
+ */
+static int print_run(const char *text, size_t len, int col, int row) {
+    if (framebuffer_console_is_ready() && fb_console_use()) {
+        int offset = fb_console_print_run(text, len, col, row);
+        if (screen_auto_cursor) {
+            set_cursor_offset(offset);
+        }
+        return offset;
     }
-
-    if(screen_auto_cursor){
-        set_cursor_offset(offset);
+    int offset = (col >= 0 && row >= 0) ? get_offset(col, row) : get_cursor_offset();
+    for (size_t i = 0; i < len; i++) {
+        offset = print_char(text[i], col, row, WHITE_ON_BLACK);
+        row = get_vga_offset_row(offset);
+        col = get_vga_offset_col(offset);
+    }
+    if (screen_available) {
+        vga_text_sync_cursor();
     }
     return offset;
 }
@@ -214,15 +215,7 @@ int get_cursor_offset() {
     if (!screen_available) {
         return 0;
     }
-    /* Use the VGA ports to get the current cursor position
-     * 1. Ask for high byte of the cursor offset (data 14)
-     * 2. Ask for low byte (data 15)
-     */
-    port_byte_out(REG_SCREEN_CTRL, 14);
-    int offset = port_byte_in(REG_SCREEN_DATA) << 8; /* High byte: << 8 */
-    port_byte_out(REG_SCREEN_CTRL, 15);
-    offset += port_byte_in(REG_SCREEN_DATA);
-    return offset * 2; /* Position * size of character cell */
+    return vga_text_cursor();
 }
 
 void set_cursor_offset(int offset) {
@@ -250,31 +243,21 @@ void set_cursor_offset(int offset) {
     if (!screen_available) {
         return;
     }
-    /* Similar to get_cursor_offset, but instead of reading we write data */
-    offset /= 2;
-    port_byte_out(REG_SCREEN_CTRL, 14);
-    port_byte_out(REG_SCREEN_DATA, (unsigned char)(offset >> 8));
-    port_byte_out(REG_SCREEN_CTRL, 15);
-    port_byte_out(REG_SCREEN_DATA, (unsigned char)(offset & 0xff));
+    vga_text_set_cursor(offset);
+    vga_text_sync_cursor();
 }
 
 void clear_screen() {
     if (framebuffer_console_is_ready() && fb_console_use()) {
         fb_console_clear();
+        framebuffer_console_present();
         return;
     }
     if (!screen_available) {
         return;
     }
-    int screen_size = MAX_COLS * MAX_ROWS;
-    int i;
-    char *screen = VIDEO_ADDRESS;
-
-    for (i = 0; i < screen_size; i++) {
-        screen[i*2] = ' ';
-        screen[i*2+1] = WHITE_ON_BLACK;
-    }
-    set_cursor_offset(get_offset(0, 0));
+    vga_text_clear(WHITE_ON_BLACK);
+    vga_text_sync_cursor();
 }
 
 
@@ -319,106 +302,45 @@ int get_vga_offset_col(int offset) {
 }
 
 
+typedef struct {
+    bool visible;
+    int col;
+    int row;
+} console_run_t;
+
+static void console_write(void *context, const char *text, size_t len) {
+    console_run_t *run = context;
+    if (screen_mirror) {
+        screen_mirror(text, len);
+    }
+    if (!run->visible) {
+        return;
+    }
+    int offset = print_run(text, len, run->col, run->row);
+    run->col = get_vga_offset_col(offset);
+    run->row = get_vga_offset_row(offset);
+}
+
 void printf(const char *format, ...) {
-    if (!screen_available && !framebuffer_console_is_ready()) {
+    console_run_t run = { .visible = screen_available || framebuffer_console_is_ready() };
+    if (!run.visible && !screen_mirror) {
         return;
     }
-    va_list args; // List of variable arguments
-    va_start(args, format); // Initialize the list with the format string
-
-    char buffer[256]; // Temporary buffer for formatted output
-    int buffer_index = 0;
-
-    for (int i = 0; format[i] != '\0'; i++) {
-        if (format[i] == '%' && format[i + 1] != '\0') {
-            i++; // Move to the specifier
-            switch (format[i]) {
-                case 'd': { // Integer
-                    int value = va_arg(args, int);
-                    char int_buffer[16];
-                    int_to_ascii(value, int_buffer);
-                    for (int j = 0; int_buffer[j] != '\0'; j++) {
-                        buffer[buffer_index++] = int_buffer[j];
-                    }
-                    break;
-                }
-                case 'u': {
-                    unsigned int value = va_arg(args, unsigned int);
-                    char uint_buffer[16];
-                    uint_to_ascii(value, uint_buffer);  // ← you'll need this small helper
-                    for (int j = 0; uint_buffer[j] != '\0'; j++)
-                        buffer[buffer_index++] = uint_buffer[j];
-                    break;
-                }
-                case 'x': { // Hexadecimal
-                    uint64_t value = va_arg(args, uint64_t);
-                    char hex_buffer[17];
-                    hex_to_string_trimmed(value, hex_buffer);
-                    for (int j = 0; hex_buffer[j] != '\0'; j++) {
-                        buffer[buffer_index++] = hex_buffer[j];
-                    }
-                    break;
-                }
-                case 'b': { // Binary with insignificant zeros removed
-                    uint32_t value = va_arg(args, uint32_t);
-                    char binary_buffer[33]; // Max 32 bits + null terminator
-                    int started = 0; // Flag to track if we've encountered the first '1'
-                    int buffer_pos = 0;
-
-                    for (int j = 31; j >= 0; j--) {
-                        char bit = (value & (1 << j)) ? '1' : '0';
-                        if (bit == '1') {
-                            started = 1;
-                        }
-                        if (started) {
-                            binary_buffer[buffer_pos++] = bit;
-                        }
-                    }
-
-                    if (!started) {
-                        // If no '1' was encountered, the value is 0
-                        binary_buffer[buffer_pos++] = '0';
-                    }
-
-                    binary_buffer[buffer_pos] = '\0'; // Null-terminate the string
-
-                    for (int j = 0; binary_buffer[j] != '\0'; j++) {
-                        buffer[buffer_index++] = binary_buffer[j];
-                    }
-                    break;
-                }
-                case 's': { // String
-                    char *str = va_arg(args, char *);
-                    for (int j = 0; str[j] != '\0'; j++) {
-                        buffer[buffer_index++] = str[j];
-                    }
-                    break;
-                }
-                case 'c': { // Character
-                    char value = (char)va_arg(args, int);
-                    buffer[buffer_index++] = value;
-                    break;
-                }
-                case '%': { // Literal '%'
-                    buffer[buffer_index++] = '%';
-                    break;
-                }
-                default: { // Unsupported specifier
-                    buffer[buffer_index++] = '%';
-                    buffer[buffer_index++] = format[i];
-                    break;
-                }
-            }
-        } else {
-            // Regular character
-            buffer[buffer_index++] = format[i];
-        }
+    if (run.visible) {
+        int offset = get_cursor_offset();
+        run.col = get_vga_offset_col(offset);
+        run.row = get_vga_offset_row(offset);
     }
+    format_sink_t sink = { .write = console_write, .context = &run };
 
-    buffer[buffer_index] = '\0'; // Null-terminate the string
-    va_end(args); // Clean up
+    va_list args;
+    va_start(args, format);
+    format_stream(&sink, format, args);
+    va_end(args);
 
-    kprint(buffer); // Print the formatted string
+    if (framebuffer_console_is_ready()) {
+        framebuffer_console_present();
+    }
 }
 
 static bool fb_console_use(void) {
@@ -454,6 +376,10 @@ static bool fb_console_use(void) {
         fb_console_state.cursor_row = 0;
         fb_console_state.fg_color = 0x00FFFFFF;
         fb_console_state.bg_color = 0x00000000;
+        /* Without the cell grid characters are drawn as they are printed */
+        if (text_grid_init(cols, rows, fb_console_state.bg_color)) {
+            framebuffer_console_set_render_hook(fb_console_render);
+        }
     } else {
         if (fb_console_state.cursor_col >= cols) {
             fb_console_state.cursor_col = cols - 1;
@@ -473,48 +399,37 @@ static bool fb_console_use(void) {
 
 static void fb_console_fill_rect(uint32_t x, uint32_t y, uint32_t width,
                                  uint32_t height, uint32_t color) {
-    const framebuffer_console_t *fb = framebuffer_console_info();
-    if (!fb || width == 0 || height == 0) {
-        return;
-    }
-
-    if (x >= fb->width || y >= fb->height) {
-        return;
-    }
-
-    if (x + width > fb->width) {
-        width = fb->width - x;
-    }
-    if (y + height > fb->height) {
-        height = fb->height - y;
-    }
-
-    for (uint32_t row = 0; row < height; ++row) {
-        volatile uint32_t *line = fb->base + (y + row) * fb->stride + x;
-        for (uint32_t col = 0; col < width; ++col) {
-            line[col] = color;
-        }
-    }
+    gfx_surface_t surface;
+    framebuffer_console_surface(&surface);
+    gfx_fill(&surface, (gfx_rect_t){ (int32_t)x, (int32_t)y, width, height }, color);
+    framebuffer_console_mark_dirty(x, y, width, height);
 }
 
 static void fb_console_clear(void) {
     if (!fb_console_use()) {
         return;
     }
+    fb_console_state.cursor_col = 0;
+    fb_console_state.cursor_row = 0;
+    if (text_grid_ready()) {
+        uint64_t flags = irq_save();
+        text_grid_clear(fb_console_state.bg_color);
+        irq_restore(flags);
+        return;
+    }
     uint32_t width = fb_console_state.cols * fb_console_state.cell_width;
     uint32_t height = fb_console_state.rows * fb_console_state.cell_height;
     fb_console_fill_rect(0, 0, width, height, fb_console_state.bg_color);
-    fb_console_state.cursor_col = 0;
-    fb_console_state.cursor_row = 0;
 }
 
 static void fb_console_scroll(void) {
     if (!fb_console_use()) {
         return;
     }
-
-    const framebuffer_console_t *fb = framebuffer_console_info();
-    if (!fb) {
+    fb_console_state.cursor_row = fb_console_state.rows - 1;
+    fb_console_state.cursor_col = 0;
+    if (text_grid_ready()) {
+        text_grid_scroll(fb_console_state.bg_color);
         return;
     }
 
@@ -530,84 +445,95 @@ static void fb_console_scroll(void) {
         return;
     }
 
+    /* Moves happen in the shadow buffer at RAM speed, VRAM only sees the
+     * writes of the next flush */
+    gfx_surface_t surface;
+    framebuffer_console_surface(&surface);
     uint32_t copy_height = (rows - 1) * step;
-    for (uint32_t y = 0; y < copy_height; ++y) {
-        volatile uint32_t *dest = fb->base + y * fb->stride;
-        volatile uint32_t *src = fb->base + (y + step) * fb->stride;
-        for (uint32_t x = 0; x < active_width; ++x) {
-            dest[x] = src[x];
-        }
-    }
-
-    for (uint32_t y = copy_height; y < copy_height + step && y < fb->height; ++y) {
-        volatile uint32_t *line = fb->base + y * fb->stride;
-        for (uint32_t x = 0; x < active_width; ++x) {
-            line[x] = fb_console_state.bg_color;
-        }
-    }
-
-    fb_console_state.cursor_row = rows - 1;
-    fb_console_state.cursor_col = 0;
+    gfx_copy(&surface, 0, 0, &surface, (gfx_rect_t){ 0, (int32_t)step, active_width, copy_height });
+    framebuffer_console_mark_dirty(0, 0, active_width, copy_height);
+    fb_console_fill_rect(0, copy_height, active_width, step, fb_console_state.bg_color);
 }
 
-static int fb_console_print_char(char c, int col, int row) {
-    if (!fb_console_use()) {
-        return 0;
-    }
-
-    if (col < 0 || row < 0) {
-        col = (int)fb_console_state.cursor_col;
-        row = (int)fb_console_state.cursor_row;
-    }
-
+/* Caller has checked fb_console_use() */
+static int fb_console_print_run(const char *text, size_t len, int col, int row) {
     int cols = (int)fb_console_state.cols;
     int rows = (int)fb_console_state.rows;
     if (cols <= 0 || rows <= 0) {
         return 0;
     }
+    bool grid = text_grid_ready();
 
-    const framebuffer_console_t *fb = framebuffer_console_info();
-    if (!fb) {
-        return 0;
+    /* Interrupt handlers print too (exceptions, driver errors): one masked
+     * section keeps their text and cursor moves out of the middle of this run */
+    uint64_t flags = irq_save();
+    if (col < 0 || row < 0) {
+        col = (int)fb_console_state.cursor_col;
+        row = (int)fb_console_state.cursor_row;
     }
 
-    if (c == '\n') {
-        col = 0;
-        row += 1;
-    } else {
-        uint32_t px = (uint32_t)col * fb_console_state.cell_width;
-        uint32_t py = (uint32_t)row * fb_console_state.cell_height;
-        unsigned char glyph = (unsigned char)c;
-        if (glyph == 0) {
-            glyph = ' ';
-        }
-        framebuffer_console_draw_glyph((char)glyph, px, py,
-                                       fb_console_state.fg_color,
-                                       fb_console_state.bg_color);
-        if (fb_console_state.cell_width > fb->glyph_width) {
-            uint32_t gap_width = fb_console_state.cell_width - fb->glyph_width;
-            fb_console_fill_rect(px + fb->glyph_width, py, gap_width,
-                                 fb_console_state.cell_height,
-                                 fb_console_state.bg_color);
+    for (size_t i = 0; i < len; i++) {
+        char c = text[i];
+        if (c == '\n') {
+            col = 0;
+            row += 1;
+        } else if (grid) {
+            unsigned char glyph = (unsigned char)c;
+            text_grid_put((uint32_t)col, (uint32_t)row, glyph ? glyph : ' ',
+                          fb_console_state.fg_color, fb_console_state.bg_color);
+            col++;
+        } else {
+            uint32_t px = (uint32_t)col * fb_console_state.cell_width;
+            uint32_t py = (uint32_t)row * fb_console_state.cell_height;
+            unsigned char glyph = (unsigned char)c;
+            if (glyph == 0) {
+                glyph = ' ';
+            }
+            framebuffer_console_draw_cell((char)glyph, px, py, fb_console_state.cell_width,
+                                          fb_console_state.fg_color,
+                                          fb_console_state.bg_color);
+            col++;
         }
-        col++;
-    }
 
-    if (col >= cols) {
-        col = 0;
-        row++;
-    }
+        if (col >= cols) {
+            col = 0;
+            row++;
+        }
 
-    if (row >= rows) {
-        fb_console_scroll();
-        row = rows - 1;
+        if (row >= rows) {
+            fb_console_scroll();
+            row = rows - 1;
+        }
     }
 
     fb_console_state.cursor_col = (col < 0) ? 0 : (uint32_t)col;
     fb_console_state.cursor_row = (row < 0) ? 0 : (uint32_t)row;
+    irq_restore(flags);
     return 2 * (row * cols + col);
 }
 
+static void fb_console_draw_cell(uint32_t col, uint32_t row, const text_cell_t *cell) {
+    uint32_t px = col * fb_console_state.cell_width;
+    uint32_t py = row * fb_console_state.cell_height;
+    framebuffer_console_draw_cell((char)cell->codepoint, px, py, fb_console_state.cell_width,
+                                  cell->fg, cell->bg);
+}
+
+/* Scroll the drawn text by moving shadow pixels, redrawing is cheaper than
+ * reading them back from VRAM */
+static bool fb_console_shift_rows(uint32_t lines) {
+    return framebuffer_console_scroll(lines * fb_console_state.cell_height,
+                                      fb_console_state.rows * fb_console_state.cell_height);
+}
+
+static void fb_console_render(void) {
+    if (!fb_console_state.active) {
+        return;
+    }
+    uint64_t flags = irq_save();
+    text_grid_render(fb_console_draw_cell, fb_console_shift_rows);
+    irq_restore(flags);
+}
 
 uint32_t get_screen_framebuffer_cols() {
     return fb_console_use() ? fb_console_state.cols : MAX_COLS;
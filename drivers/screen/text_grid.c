@@ -0,0 +1,175 @@
+#include <stddef.h>
+#include "text_grid.h"
+#include "kernel/mm/page_alloc.h"
+
+static struct {
+    bool ready;
+    uint32_t cols;
+    uint32_t rows;
+    uint32_t head;              /* physical row shown as logical row 0 */
+    uint32_t pending_scroll;    /* scrolls since the last render */
+    text_cell_t *cells;         /* rows * cols, indexed by physical row */
+    uint64_t *damaged;          /* one bit per physical row */
+    uint16_t *span_lo;          /* damaged columns [lo, hi) per physical row */
+    uint16_t *span_hi;
+    void *block;
+} grid;
+
+static void mark_damage(uint32_t phys, uint32_t lo, uint32_t hi) {
+    uint64_t bit = 1ULL << (phys % 64);
+    if (!(grid.damaged[phys / 64] & bit)) {
+        grid.damaged[phys / 64] |= bit;
+        grid.span_lo[phys] = (uint16_t)lo;
+        grid.span_hi[phys] = (uint16_t)hi;
+        return;
+    }
+    if (lo < grid.span_lo[phys]) grid.span_lo[phys] = (uint16_t)lo;
+    if (hi > grid.span_hi[phys]) grid.span_hi[phys] = (uint16_t)hi;
+}
+
+static void mark_all(void) {
+    for (uint32_t phys = 0; phys < grid.rows; phys++) {
+        mark_damage(phys, 0, grid.cols);
+    }
+}
+
+static void blank_row(uint32_t phys, uint32_t bg) {
+    text_cell_t *cell = grid.cells + (size_t)phys * grid.cols;
+    for (uint32_t col = 0; col < grid.cols; col++) {
+        cell[col].codepoint = ' ';
+        cell[col].fg = bg;
+        cell[col].bg = bg;
+    }
+}
+
+bool text_grid_init(uint32_t cols, uint32_t rows, uint32_t bg) {
+    if (cols == 0 || rows == 0 || cols > UINT16_MAX) {
+        return false;
+    }
+    if (grid.ready && grid.cols == cols && grid.rows == rows) {
+        return true;
+    }
+
+    size_t cells_bytes = (size_t)cols * rows * sizeof(text_cell_t);
+    size_t damage_words = (rows + 63) / 64;
+    size_t bytes = cells_bytes + damage_words * sizeof(uint64_t) + 2 * rows * sizeof(uint16_t);
+    uint8_t *block = page_alloc_pages((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (!block) {
+        return false;
+    }
+    if (grid.block) {
+        page_free(grid.block);
+    }
+
+    grid.block = block;
+    grid.cells = (text_cell_t *)block;
+    grid.damaged = (uint64_t *)(block + cells_bytes);
+    grid.span_lo = (uint16_t *)(grid.damaged + damage_words);
+    grid.span_hi = grid.span_lo + rows;
+    grid.cols = cols;
+    grid.rows = rows;
+    for (size_t i = 0; i < damage_words; i++) {
+        grid.damaged[i] = 0;
+    }
+    grid.ready = true;
+    text_grid_clear(bg);
+    return true;
+}
+
+bool text_grid_ready(void) {
+    return grid.ready;
+}
+
+uint32_t text_grid_cols(void) {
+    return grid.cols;
+}
+
+uint32_t text_grid_rows(void) {
+    return grid.rows;
+}
+
+void text_grid_put(uint32_t col, uint32_t row, uint32_t codepoint, uint32_t fg, uint32_t bg) {
+    if (!grid.ready || col >= grid.cols || row >= grid.rows) {
+        return;
+    }
+    uint32_t phys = (grid.head + row) % grid.rows;
+    text_cell_t *cell = &grid.cells[(size_t)phys * grid.cols + col];
+    if (cell->codepoint == codepoint && cell->fg == fg && cell->bg == bg) {
+        return;     /* Rewriting the same character is not damage */
+    }
+    cell->codepoint = codepoint;
+    cell->fg = fg;
+    cell->bg = bg;
+    mark_damage(phys, col, col + 1);
+}
+
+const text_cell_t *text_grid_cell(uint32_t col, uint32_t row) {
+    if (!grid.ready || col >= grid.cols || row >= grid.rows) {
+        return NULL;
+    }
+    uint32_t phys = (grid.head + row) % grid.rows;
+    return &grid.cells[(size_t)phys * grid.cols + col];
+}
+
+void text_grid_scroll(uint32_t bg) {
+    if (!grid.ready) {
+        return;
+    }
+    /* The old top row becomes the new bottom row */
+    uint32_t recycled = grid.head;
+    grid.head = (grid.head + 1) % grid.rows;
+    blank_row(recycled, bg);
+    mark_damage(recycled, 0, grid.cols);
+    if (grid.pending_scroll < grid.rows) {
+        grid.pending_scroll++;
+    }
+}
+
+void text_grid_clear(uint32_t bg) {
+    if (!grid.ready) {
+        return;
+    }
+    for (uint32_t phys = 0; phys < grid.rows; phys++) {
+        blank_row(phys, bg);
+    }
+    grid.head = 0;
+    grid.pending_scroll = 0;    /* Everything is redrawn anyway */
+    mark_all();
+}
+
+bool text_grid_has_damage(void) {
+    if (!grid.ready) {
+        return false;
+    }
+    for (uint32_t i = 0; i < (grid.rows + 63) / 64; i++) {
+        if (grid.damaged[i]) return true;
+    }
+    return false;
+}
+
+void text_grid_render(text_grid_draw_t draw, text_grid_shift_t shift) {
+    if (!grid.ready) {
+        return;
+    }
+
+    if (grid.pending_scroll) {
+        if (grid.pending_scroll >= grid.rows || !shift || !shift(grid.pending_scroll)) {
+            mark_all();
+        }
+        grid.pending_scroll = 0;
+    }
+
+    for (uint32_t word = 0; word < (grid.rows + 63) / 64; word++) {
+        uint64_t bits = grid.damaged[word];
+        grid.damaged[word] = 0;
+        while (bits) {
+            uint32_t phys = word * 64 + (uint32_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+            uint32_t screen_row = (phys + grid.rows - grid.head) % grid.rows;
+            const text_cell_t *row_cells = grid.cells + (size_t)phys * grid.cols;
+            for (uint32_t col = grid.span_lo[phys]; col < grid.span_hi[phys]; col++) {
+                draw(col, screen_row, &row_cells[col]);
+            }
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef CASSEOS_DRIVERS_TEXT_GRID_H
+#define CASSEOS_DRIVERS_TEXT_GRID_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Character cells of the framebuffer console.
+ * Rows live in a ring: logical row 0 is the physical row at 'head', so a
+ * scroll bumps the head and blanks one row. Damage is kept per physical row
+ * as a bit plus a column span, which makes it follow the row content through
+ * scrolls. text_grid_render() first shifts the already drawn pixels by the
+ * scrolls since the last render, then draws each damaged cell once. */
+
+typedef struct {
+    uint32_t codepoint;
+    uint32_t fg;
+    uint32_t bg;
+} text_cell_t;
+
+/* Draw one cell at screen position (col, row) */
+typedef void (*text_grid_draw_t)(uint32_t col, uint32_t row, const text_cell_t *cell);
+/* Move the drawn pixels up by 'lines' text rows, false if that is not
+ * cheaper than redrawing (the grid then redraws every row) */
+typedef bool (*text_grid_shift_t)(uint32_t lines);
+
+/* Cells come from the page allocator, false when it is not up */
+bool text_grid_init(uint32_t cols, uint32_t rows, uint32_t bg);
+bool text_grid_ready(void);
+uint32_t text_grid_cols(void);
+uint32_t text_grid_rows(void);
+
+void text_grid_put(uint32_t col, uint32_t row, uint32_t codepoint, uint32_t fg, uint32_t bg);
+const text_cell_t *text_grid_cell(uint32_t col, uint32_t row);
+void text_grid_scroll(uint32_t bg);
+void text_grid_clear(uint32_t bg);
+
+bool text_grid_has_damage(void);
+void text_grid_render(text_grid_draw_t draw, text_grid_shift_t shift);
+
+#endif /* CASSEOS_DRIVERS_TEXT_GRID_H */
@@ -0,0 +1,150 @@
+#include <stddef.h>
+#include "vga_text.h"
+#include "../screen.h"
+#include "cpu/ports.h"
+#include "libc/mem.h"
+
+#define VGA_CELLS       (MAX_COLS * MAX_ROWS)
+#define VGA_WINDOW_ROWS (VGA_TEXT_WINDOW_CELLS / MAX_COLS)
+
+#define CRTC_START_HIGH  0x0C   /* low byte in the next register */
+#define CRTC_CURSOR_HIGH 0x0E
+
+#define BLANK_CELL ((uint16_t)(' ' | (WHITE_ON_BLACK << 8)))
+
+static struct {
+    bool ready;
+    uint32_t top_row;           /* window row shown as screen row 0 */
+    int cursor;
+    bool cursor_dirty;
+    uint16_t cells[VGA_CELLS];  /* what the screen shows */
+} vga;
+
+static volatile uint16_t *const vga_window = (volatile uint16_t *)VIDEO_ADDRESS;
+
+static void crtc_write16(uint8_t reg, uint16_t value) {
+    port_byte_out(REG_SCREEN_CTRL, reg);
+    port_byte_out(REG_SCREEN_DATA, (uint8_t)(value >> 8));
+    port_byte_out(REG_SCREEN_CTRL, (uint8_t)(reg + 1));
+    port_byte_out(REG_SCREEN_DATA, (uint8_t)value);
+}
+
+static uint16_t crtc_read16(uint8_t reg) {
+    port_byte_out(REG_SCREEN_CTRL, reg);
+    uint16_t value = (uint16_t)(port_byte_in(REG_SCREEN_DATA) << 8);
+    port_byte_out(REG_SCREEN_CTRL, (uint8_t)(reg + 1));
+    return value | port_byte_in(REG_SCREEN_DATA);
+}
+
+static volatile uint16_t *screen_cells(void) {
+    return vga_window + vga.top_row * MAX_COLS;
+}
+
+/* Adopt what the BIOS and the boot sector left on screen: the only time
+ * VRAM is read */
+static void vga_text_init(void) {
+    if (vga.ready) {
+        return;
+    }
+    uint16_t start = crtc_read16(CRTC_START_HIGH);
+    if (start > VGA_TEXT_WINDOW_CELLS - VGA_CELLS) {
+        start = 0;
+    }
+    for (int i = 0; i < VGA_CELLS; i++) {
+        vga.cells[i] = vga_window[start + i];
+    }
+    if (start) {
+        for (int i = 0; i < VGA_CELLS; i++) {
+            vga_window[i] = vga.cells[i];
+        }
+        crtc_write16(CRTC_START_HIGH, 0);
+    }
+    int cursor = (int)crtc_read16(CRTC_CURSOR_HIGH) - start;
+    vga.cursor = (cursor >= 0 && cursor < VGA_CELLS) ? cursor * 2 : 0;
+    vga.top_row = 0;
+    vga.ready = true;
+}
+
+void vga_text_set_cell(int offset, char c, uint8_t attr) {
+    vga_text_init();
+    int index = offset / 2;
+    if (index < 0 || index >= VGA_CELLS) {
+        return;
+    }
+    uint16_t value = (uint16_t)((uint8_t)c | (attr << 8));
+    if (vga.cells[index] != value) {
+        vga.cells[index] = value;
+        screen_cells()[index] = value;
+    }
+}
+
+static void vga_text_scroll(void) {
+    memory_copy(vga.cells, vga.cells + MAX_COLS, (VGA_CELLS - MAX_COLS) * sizeof(uint16_t));
+    for (int i = VGA_CELLS - MAX_COLS; i < VGA_CELLS; i++) {
+        vga.cells[i] = BLANK_CELL;
+    }
+
+    if (vga.top_row + MAX_ROWS < VGA_WINDOW_ROWS) {
+        /* The line below the screen comes into view, nothing else moves */
+        vga.top_row++;
+        volatile uint16_t *last = screen_cells() + (MAX_ROWS - 1) * MAX_COLS;
+        for (int i = 0; i < MAX_COLS; i++) {
+            last[i] = BLANK_CELL;
+        }
+    } else {
+        /* End of the window: the screen goes back to the top from RAM */
+        vga.top_row = 0;
+        for (int i = 0; i < VGA_CELLS; i++) {
+            vga_window[i] = vga.cells[i];
+        }
+    }
+    crtc_write16(CRTC_START_HIGH, (uint16_t)(vga.top_row * MAX_COLS));
+    vga.cursor_dirty = true;    /* the cursor register is window-relative */
+}
+
+int vga_text_put(char c, int offset, uint8_t attr) {
+    vga_text_init();
+    if (c == '\n') {
+        offset = (offset / (2 * MAX_COLS) + 1) * 2 * MAX_COLS;
+    } else {
+        vga_text_set_cell(offset, c, attr);
+        offset += 2;
+    }
+    if (offset >= VGA_CELLS * 2) {
+        vga_text_scroll();
+        offset -= 2 * MAX_COLS;
+    }
+    return offset;
+}
+
+void vga_text_clear(uint8_t attr) {
+    vga_text_init();
+    uint16_t blank = (uint16_t)(' ' | (attr << 8));
+    vga.top_row = 0;
+    for (int i = 0; i < VGA_CELLS; i++) {
+        vga.cells[i] = blank;
+        vga_window[i] = blank;
+    }
+    crtc_write16(CRTC_START_HIGH, 0);
+    vga.cursor = 0;
+    vga.cursor_dirty = true;
+}
+
+int vga_text_cursor(void) {
+    vga_text_init();
+    return vga.cursor;
+}
+
+void vga_text_set_cursor(int offset) {
+    vga_text_init();
+    vga.cursor = offset;
+    vga.cursor_dirty = true;
+}
+
+void vga_text_sync_cursor(void) {
+    if (!vga.ready || !vga.cursor_dirty) {
+        return;
+    }
+    crtc_write16(CRTC_CURSOR_HIGH, (uint16_t)(vga.top_row * MAX_COLS + vga.cursor / 2));
+    vga.cursor_dirty = false;
+}
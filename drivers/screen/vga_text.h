@@ -0,0 +1,28 @@
+#ifndef CASSEOS_DRIVERS_SCREEN_VGA_TEXT_H
+#define CASSEOS_DRIVERS_SCREEN_VGA_TEXT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* 80x25 VGA text backend. Cells are written through a RAM copy of the
+ * screen, so unchanged cells cost no VRAM write and nothing is ever read
+ * back from VRAM. Scrolling moves the CRTC start address down the 32 KiB
+ * text window, one copy of the screen each time the window runs out.
+ * Offsets are in bytes (2 per cell) relative to the visible screen, as in
+ * screen.c. The hardware cursor only moves on vga_text_sync_cursor(). */
+
+#define VGA_TEXT_WINDOW_CELLS 16384     /* 0xB8000-0xBFFFF */
+
+/* Store a cell at 'offset' */
+void vga_text_set_cell(int offset, char c, uint8_t attr);
+/* Print 'c' at 'offset', handling '\n' and scrolling at the bottom.
+ * Returns the offset after it. */
+int vga_text_put(char c, int offset, uint8_t attr);
+void vga_text_clear(uint8_t attr);
+
+int vga_text_cursor(void);
+/* Moves the software cursor, the hardware follows at the next sync */
+void vga_text_set_cursor(int offset);
+void vga_text_sync_cursor(void);
+
+#endif /* CASSEOS_DRIVERS_SCREEN_VGA_TEXT_H */
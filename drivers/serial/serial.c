@@ -0,0 +1,230 @@
+#include "serial.h"
+#include "cpu/ports.h"
+#include "cpu/isr.h"
+#include "drivers/keyboard/keyboard.h"
+
+/* Register offsets from the base port */
+#define UART_DATA 0     /* RBR/THR, divisor low with DLAB */
+#define UART_IER  1     /* divisor high with DLAB */
+#define UART_IIR  2     /* FCR when written */
+#define UART_LCR  3
+#define UART_MCR  4
+#define UART_LSR  5
+#define UART_MSR  6
+
+#define IER_RX_DATA   0x01
+#define IER_THR_EMPTY 0x02
+#define IER_LINE      0x04
+
+#define IIR_NONE       0x01
+#define IIR_ID_MASK    0x0E
+#define IIR_MODEM      0x00
+#define IIR_THR_EMPTY  0x02
+#define IIR_RX_DATA    0x04
+#define IIR_LINE       0x06
+#define IIR_RX_TIMEOUT 0x0C
+#define IIR_FIFO_ON    0xC0
+
+#define FCR_FIFO_14 0xC7        /* enable, clear both FIFOs, RX trigger at 14 */
+#define LCR_DLAB    0x80
+#define LCR_8N1     0x03
+#define MCR_RUN      0x0B       /* DTR, RTS, OUT2 (gates the IRQ line) */
+#define MCR_LOOPBACK 0x1E
+#define LSR_DATA_READY 0x01
+#define LSR_THR_EMPTY  0x20
+
+#define UART_CLOCK     115200
+#define UART_FIFO_SIZE 16
+
+#define ASCII_ESC 0x1B
+#define ASCII_DEL 0x7F
+
+static struct {
+    bool ready;
+    uint8_t fifo_size;          /* 1 on a UART without working FIFOs */
+    bool tx_armed;              /* THR-empty interrupt enabled */
+    uint32_t tx_head;
+    uint32_t tx_tail;
+    uint8_t tx_ring[SERIAL_TX_RING];
+    uint8_t kbd_id;
+    uint8_t escape;             /* bytes of an "ESC [" sequence seen */
+    bool last_cr;
+} uart;
+
+static inline uint8_t uart_in(uint8_t reg) {
+    return port_byte_in(SERIAL_COM1_PORT + reg);
+}
+
+static inline void uart_out(uint8_t reg, uint8_t value) {
+    port_byte_out(SERIAL_COM1_PORT + reg, value);
+}
+
+/* Move ring bytes into the FIFO, it must be empty. Interrupts off. */
+static void tx_fill(void) {
+    for (uint8_t i = 0; i < uart.fifo_size && uart.tx_tail != uart.tx_head; i++) {
+        uart_out(UART_DATA, uart.tx_ring[uart.tx_tail++ % SERIAL_TX_RING]);
+    }
+}
+
+static void tx_push(uint8_t byte) {
+    while (uart.tx_head - uart.tx_tail == SERIAL_TX_RING) {
+        /* The THR-empty interrupt cannot come in here, feed the FIFO by hand */
+        while (!(uart_in(UART_LSR) & LSR_THR_EMPTY)) {
+            __asm__ volatile ("pause");
+        }
+        tx_fill();
+    }
+    uart.tx_ring[uart.tx_head++ % SERIAL_TX_RING] = byte;
+}
+
+static void tx_arm(bool on) {
+    uint8_t ier = IER_RX_DATA | IER_LINE;
+    uart_out(UART_IER, on ? (uint8_t)(ier | IER_THR_EMPTY) : ier);
+    uart.tx_armed = on;
+}
+
+void serial_write(const char *text, size_t len) {
+    if (!uart.ready) {
+        return;
+    }
+    uint64_t flags = irq_save();
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == '\n') {
+            tx_push('\r');
+        }
+        tx_push((uint8_t)text[i]);
+    }
+    if (!uart.tx_armed) {
+        if (uart_in(UART_LSR) & LSR_THR_EMPTY) {
+            tx_fill();
+        }
+        /* Raised again once the FIFO has drained */
+        if (uart.tx_tail != uart.tx_head) {
+            tx_arm(true);
+        }
+    }
+    irq_restore(flags);
+}
+
+void serial_klog_output(const klog_entry_t *entry) {
+    serial_write(entry->text, entry->length);
+}
+
+static void send_key(keycode_t code) {
+    key_event_t ev = {
+        .type = KEY_EV_PRESS,
+        .code = code,
+        .mods = 0,
+        .src = KDEV_SOURCE_SERIAL,
+        .dev_id = uart.kbd_id,
+    };
+    kbd_dispatch_event(&ev);
+    ev.type = KEY_EV_RELEASE;
+    kbd_dispatch_event(&ev);
+}
+
+/* Terminal input to key events. The shell only draws the command line on
+ * the screen, so printable input is echoed back to the terminal here. */
+static void receive_byte(uint8_t byte) {
+    if (uart.escape == 1) {
+        uart.escape = (byte == '[') ? 2 : 0;
+        if (uart.escape) return;
+        send_key(KC_ESC);
+    } else if (uart.escape == 2) {
+        uart.escape = 0;
+        switch (byte) {
+            case 'A': send_key(KC_UP); return;
+            case 'B': send_key(KC_DOWN); return;
+            case 'C': send_key(KC_RIGHT); return;
+            case 'D': send_key(KC_LEFT); return;
+            case 'H': send_key(KC_HOME); return;
+            case 'F': send_key(KC_END); return;
+            default: return;
+        }
+    }
+
+    bool after_cr = uart.last_cr;
+    uart.last_cr = (byte == '\r');
+    if (byte == ASCII_ESC) {
+        uart.escape = 1;
+    } else if (byte == '\r' || byte == '\n') {
+        if (byte == '\n' && after_cr) return;    /* CR LF is one Enter */
+        send_key(KC_ENTER);
+    } else if (byte == ASCII_DEL || byte == '\b') {
+        send_key(KC_BACKSPACE);
+        serial_write("\b \b", 3);
+    } else if (byte == '\t' || (byte >= ' ' && byte < ASCII_DEL)) {
+        send_key(byte == '\t' ? KC_TAB : (keycode_t)byte);
+        serial_write((const char *)&byte, 1);
+    }
+}
+
+static void serial_isr(registers_t *regs) {
+    (void)regs;
+    for (;;) {
+        uint8_t iir = uart_in(UART_IIR);
+        if (iir & IIR_NONE) {
+            break;
+        }
+        switch (iir & IIR_ID_MASK) {
+            case IIR_RX_DATA:
+            case IIR_RX_TIMEOUT:
+                while (uart_in(UART_LSR) & LSR_DATA_READY) {
+                    receive_byte(uart_in(UART_DATA));
+                }
+                break;
+            case IIR_THR_EMPTY:
+                tx_fill();
+                if (uart.tx_tail == uart.tx_head) {
+                    tx_arm(false);
+                }
+                break;
+            case IIR_LINE:
+                uart_in(UART_LSR);
+                break;
+            case IIR_MODEM:
+            default:
+                uart_in(UART_MSR);
+                break;
+        }
+    }
+}
+
+bool serial_init(void) {
+    if (uart.ready) {
+        return true;
+    }
+    uint16_t divisor = UART_CLOCK / SERIAL_BAUD;
+    uart_out(UART_IER, 0);
+    uart_out(UART_LCR, LCR_DLAB);
+    uart_out(UART_DATA, (uint8_t)divisor);
+    uart_out(UART_IER, (uint8_t)(divisor >> 8));
+    uart_out(UART_LCR, LCR_8N1);
+    uart_out(UART_IIR, FCR_FIFO_14);
+
+    /* Floating ISA ports read 0xFF, a UART echoes in loopback */
+    uart_out(UART_MCR, MCR_LOOPBACK);
+    uart_out(UART_DATA, 0xA5);
+    for (int i = 0; i < 1000 && !(uart_in(UART_LSR) & LSR_DATA_READY); i++) {
+        __asm__ volatile ("pause");
+    }
+    if (uart_in(UART_DATA) != 0xA5) {
+        return false;
+    }
+    uart_out(UART_MCR, MCR_RUN);
+
+    /* An 8250/16450, or a 16550 with the broken FIFO, sends one at a time */
+    uart.fifo_size = ((uart_in(UART_IIR) & IIR_FIFO_ON) == IIR_FIFO_ON) ? UART_FIFO_SIZE : 1;
+    uart.kbd_id = kbd_register_device(KDEV_SOURCE_SERIAL, 0);
+    register_interrupt_handler(IRQ4, serial_isr);
+    uart.ready = true;
+
+    uint64_t flags = irq_save();
+    tx_arm(false);
+    irq_restore(flags);
+    return true;
+}
+
+bool serial_is_ready(void) {
+    return uart.ready;
+}
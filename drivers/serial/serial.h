@@ -0,0 +1,28 @@
+#ifndef CASSEOS_DRIVERS_SERIAL_H
+#define CASSEOS_DRIVERS_SERIAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "kernel/log/klog.h"
+
+/* COM1 as a 16550 UART at 115200 8N1. Output goes through a ring that the
+ * THR-empty interrupt feeds into the 16-byte FIFO, input is turned into
+ * keyboard events so the shell can be driven from a terminal. */
+
+#define SERIAL_COM1_PORT 0x3F8
+#define SERIAL_BAUD 115200
+#define SERIAL_TX_RING 1024     /* power of two */
+
+/* Probe and program COM1 and hook IRQ4. False when no UART answers. */
+bool serial_init(void);
+bool serial_is_ready(void);
+
+/* Queue 'len' bytes, '\n' is sent as "\r\n". When the ring is full the
+ * caller waits for the FIFO to drain, so nothing is dropped. */
+void serial_write(const char *text, size_t len);
+
+/* klog output writing the record text to the port */
+void serial_klog_output(const klog_entry_t *entry);
+
+#endif /* CASSEOS_DRIVERS_SERIAL_H */
@@ -0,0 +1,301 @@
+// drivers/usb/ehci/controller.c
+// EHCI bring-up, root ports and enumeration of high-speed devices.
+//
+// The controller is taken over from the BIOS through its USBLEGSUP extended
+// capability, reset, and given every root port by CONFIGFLAG. A port whose
+// device comes up enabled after reset is high speed and stays here. A
+// low-speed device (K state on the lines before reset) or a full-speed one
+// (port still disabled after reset) is released to the companion controller
+// with PORT_OWNER, which is why EHCI has to run before the UHCI enumeration.
+#include "ehci.h"
+#include "drivers/usb/msc.h"
+#include "cpu/isr.h"
+#include "cpu/apic.h"
+#include "cpu/timer.h"
+#include "libc/mem.h"
+
+#define EHCI_EP0_MAX_PACKET 64       // always 64 at high speed
+
+static ehci_hc_t g_ehci[EHCI_MAX_CONTROLLERS];
+
+ehci_hc_t *ehci_hc_for(uintptr_t base)
+{
+    for (int i = 0; i < EHCI_MAX_CONTROLLERS; i++) {
+        if (g_ehci[i].in_use && g_ehci[i].base == base) return &g_ehci[i];
+    }
+    return NULL;
+}
+
+// Wait until (reg & mask) == value, false after 'timeout_ms'
+static bool wait_register(const ehci_hc_t *hc, uint32_t reg, uint32_t mask, uint32_t value,
+                          uint32_t timeout_ms)
+{
+    for (uint32_t ms = 0; (ehci_read(hc, reg) & mask) != value; ms++) {
+        if (ms >= timeout_ms) return false;
+        sleep_ms(1);
+    }
+    return true;
+}
+
+static void ehci_irq(registers_t *r)
+{
+    for (int i = 0; i < EHCI_MAX_CONTROLLERS; i++) {
+        ehci_hc_t *hc = &g_ehci[i];
+        if (!hc->in_use || hc->vector != r->int_no) continue;
+        uint32_t st = ehci_read(hc, EHCI_USBSTS) & (EHCI_STS_USBINT | EHCI_STS_USBERRINT |
+                                                    EHCI_STS_PCD | EHCI_STS_HSE | EHCI_STS_IAA);
+        if (!st) continue;
+        ehci_write(hc, EHCI_USBSTS, st);
+        ehci_schedule_reclaim(hc, (st & EHCI_STS_IAA) != 0);
+        // Failed transfers complete too
+        if (st & (EHCI_STS_USBINT | EHCI_STS_USBERRINT)) ehci_urb_service(hc->base);
+        if (st & EHCI_STS_HSE) EHCI_ERR("Host system error, controller 0x%x halted\n", (unsigned)hc->base);
+    }
+}
+
+static void install_isr(ehci_hc_t *hc, pci_device_t *dev)
+{
+    int vector = pci_request_msi(dev, ehci_irq);
+    if (vector >= 0) {
+        hc->vector = (uint8_t)vector;
+        EHCI_INFO("ISR installed on MSI vector %d\n", vector);
+        return;
+    }
+    if (dev->interrupt_line >= 16) {
+        EHCI_ERR("Invalid PCI interrupt_line=%u\n", (unsigned)dev->interrupt_line);
+        return;
+    }
+    // The line may be shared with the companion controllers
+    hc->vector = (uint8_t)(IRQ0 + dev->interrupt_line);
+    if (!interrupt_add_shared_handler(hc->vector, ehci_irq)) {
+        EHCI_ERR("No shared handler slot for IRQ%u\n", (unsigned)dev->interrupt_line);
+        return;
+    }
+    apic_enable_pci_irq(dev->interrupt_line);
+    EHCI_INFO("ISR installed on IRQ%u\n", (unsigned)dev->interrupt_line);
+}
+
+// Ask the BIOS to let go of the controller and stop its SMIs
+static void bios_handoff(pci_device_t *dev, uint8_t eecp)
+{
+    while (eecp >= 0x40) {
+        uint32_t cap = pci_config_read(dev->bus, dev->device, dev->function, eecp);
+        if ((cap & 0xFF) != 0x01) {             // not USBLEGSUP
+            eecp = (uint8_t)(cap >> 8);
+            continue;
+        }
+        if (cap & (1u << 16)) {
+            // OS owned semaphore is byte 3; byte 2, the BIOS one, is written back as read
+            pci_config_write_word(dev->bus, dev->device, dev->function, eecp + 2,
+                                  (uint16_t)(((cap >> 16) & 0xFF) | 0x0100));
+            for (int i = 0; i < 100; i++) {
+                if (!(pci_config_read(dev->bus, dev->device, dev->function, eecp) & (1u << 16))) break;
+                sleep_ms(10);
+            }
+            if (pci_config_read(dev->bus, dev->device, dev->function, eecp) & (1u << 16)) {
+                EHCI_WARN("BIOS did not release the controller, taking it anyway\n");
+            }
+        }
+        pci_config_write(dev->bus, dev->device, dev->function, eecp + 4, 0);   // USBLEGCTLSTS
+        return;
+    }
+}
+
+bool ehci_initialize_controller(usb_controller_t *controller)
+{
+    pci_device_t *dev = controller->pci_device;
+    uintptr_t base = controller->base_address;
+    if (!base || !dev->is_memory_mapped[0]) {
+        EHCI_ERR("No register BAR\n");
+        return false;
+    }
+
+    ehci_hc_t *hc = ehci_hc_for(base);
+    for (int i = 0; !hc && i < EHCI_MAX_CONTROLLERS; i++) {
+        if (!g_ehci[i].in_use) hc = &g_ehci[i];
+    }
+    if (!hc) {
+        EHCI_ERR("Out of controller slots (max %d)\n", EHCI_MAX_CONTROLLERS);
+        return false;
+    }
+    hc->in_use = 0;                     // no interrupts serviced until it is set up
+
+    // Memory space and bus master
+    uint16_t command = pci_config_read_word(dev->bus, dev->device, dev->function, 0x04);
+    pci_config_write_word(dev->bus, dev->device, dev->function, 0x04, command | 0x0006);
+
+    volatile uint8_t *caps = (volatile uint8_t *)base;
+    uint32_t hcsparams = *(volatile uint32_t *)(caps + 0x04);
+    uint32_t hccparams = *(volatile uint32_t *)(caps + 0x08);
+    hc->base = base;
+    hc->op = caps + caps[0];
+    hc->ports = hcsparams & 0x0F;
+    hc->companions = (hcsparams >> 12) & 0x0F;
+    if (hccparams & 1u) {
+        EHCI_DBG("64-bit capable, data structures kept below 4 GiB\n");
+    }
+
+    bios_handoff(dev, (uint8_t)(hccparams >> 8));
+
+    ehci_write(hc, EHCI_USBCMD, ehci_read(hc, EHCI_USBCMD) & ~EHCI_CMD_RUN);
+    if (!wait_register(hc, EHCI_USBSTS, EHCI_STS_HALTED, EHCI_STS_HALTED, 20)) {
+        EHCI_WARN("Controller did not halt\n");
+    }
+    ehci_write(hc, EHCI_USBCMD, EHCI_CMD_HCRESET);
+    if (!wait_register(hc, EHCI_USBCMD, EHCI_CMD_HCRESET, 0, 250)) {
+        EHCI_ERR("Controller reset timed out\n");
+        return false;
+    }
+
+    if (!ehci_schedule_init(hc)) return false;
+
+    ehci_write(hc, EHCI_CTRLDSSEGMENT, 0);
+    ehci_write(hc, EHCI_PERIODICBASE, ehci_phys(hc->frames));
+    ehci_write(hc, EHCI_ASYNCLISTADDR, ehci_phys(hc->async_head));
+    ehci_write(hc, EHCI_USBSTS, 0x3F);                  // stale status from before the reset
+    ehci_write(hc, EHCI_USBINTR, EHCI_STS_USBINT | EHCI_STS_USBERRINT | EHCI_STS_HSE | EHCI_STS_IAA);
+    ehci_write(hc, EHCI_USBCMD, EHCI_CMD_ITC_1 | EHCI_CMD_ASYNC | EHCI_CMD_PERIODIC | EHCI_CMD_RUN);
+    if (!wait_register(hc, EHCI_USBSTS, EHCI_STS_HALTED, 0, 20)) {
+        EHCI_ERR("Controller did not start\n");
+        return false;
+    }
+    // Every port is ours from here; the companions get the slow devices back
+    ehci_write(hc, EHCI_CONFIGFLAG, 1);
+
+    hc->in_use = 1;
+    install_isr(hc, dev);
+
+    if (hcsparams & (1u << 4)) {        // port power control
+        for (int port = 0; port < hc->ports; port++) {
+            uint32_t sc = ehci_read(hc, EHCI_PORTSC(port));
+            ehci_write(hc, EHCI_PORTSC(port), (sc & ~EHCI_PORT_CHANGE) | EHCI_PORT_POWER);
+        }
+    }
+    sleep_ms(20);
+
+    EHCI_INFO("EHCI controller at 0x%x: %u ports, %u companion controllers\n",
+              (unsigned)base, hc->ports, hc->companions);
+    return true;
+}
+
+// Hand the device on 'port' to the companion controller
+static void release_port(ehci_hc_t *hc, int port, const char *speed)
+{
+    if (!hc->companions) {
+        EHCI_WARN("%s-speed device on port %d and no companion controller\n", speed, port);
+        return;
+    }
+    uint32_t sc = ehci_read(hc, EHCI_PORTSC(port));
+    ehci_write(hc, EHCI_PORTSC(port), (sc & ~EHCI_PORT_CHANGE) | EHCI_PORT_OWNER);
+    EHCI_INFO("%s-speed device on port %d handed to the companion controller\n", speed, port);
+}
+
+// Reset 'port': true when a high-speed device is enabled on it
+static bool reset_port(ehci_hc_t *hc, int port)
+{
+    uint32_t reg = EHCI_PORTSC(port);
+    uint32_t sc = ehci_read(hc, reg);
+    if (!(sc & EHCI_PORT_CONNECT) || (sc & EHCI_PORT_OWNER)) return false;
+    if ((sc & EHCI_PORT_LINE) == EHCI_PORT_LINE_K) {
+        release_port(hc, port, "Low");
+        return false;
+    }
+
+    // USB 2.0 7.1.7.5: reset for at least 50 ms at the root
+    ehci_write(hc, reg, (sc & ~(EHCI_PORT_CHANGE | EHCI_PORT_ENABLE)) | EHCI_PORT_RESET);
+    sleep_ms(50);
+    ehci_write(hc, reg, ehci_read(hc, reg) & ~(EHCI_PORT_CHANGE | EHCI_PORT_RESET));
+    if (!wait_register(hc, reg, EHCI_PORT_RESET, 0, 5)) {
+        EHCI_WARN("Port %d stuck in reset\n", port);
+        return false;
+    }
+    sleep_ms(10);                       // reset recovery
+
+    sc = ehci_read(hc, reg);
+    ehci_write(hc, reg, (sc & ~EHCI_PORT_CHANGE) | EHCI_PORT_CSC);   // ack the connect change
+    if (sc & EHCI_PORT_ENABLE) return true;
+    release_port(hc, port, "Full");
+    return false;
+}
+
+static int request(const ehci_hc_t *hc, uint8_t address, uint8_t request_type, uint8_t request,
+                   uint16_t value, void *data, uint16_t length)
+{
+    usb_setup_packet_t setup = { request_type, request, value, 0, length };
+    return usb_control_transfer(&ehci_hc_ops, hc->base, address, EHCI_EP0_MAX_PACKET, false, &setup, data);
+}
+
+static void enumerate_device(ehci_hc_t *hc, int port)
+{
+    extern usb_device_t usb_devices[MAX_USB_DEVICES];
+    extern uint8_t usb_device_count;
+
+    if (usb_device_count >= MAX_USB_DEVICES) {
+        EHCI_WARN("Max USB devices reached. Cannot add device on port %d\n", port);
+        return;
+    }
+
+    uint8_t address = (uint8_t)(port + 1);
+    if (request(hc, 0, 0x00, 0x05, address, NULL, 0) < 0) {       // SET_ADDRESS
+        EHCI_ERR("Failed to set device address on port %d\n", port);
+        return;
+    }
+    sleep_ms(10);
+
+    usb_device_t *dev = &usb_devices[usb_device_count];
+    memory_set(dev, 0, sizeof(*dev));
+    dev->address = address;
+    // Descriptors land in the controller's buffer below 4 GiB, then are copied
+    uint8_t *blob = hc->descriptor;
+    if (request(hc, address, 0x80, 0x06, USB_DESC_TYPE_DEVICE << 8, blob,
+                sizeof(dev->descriptor)) != (int)sizeof(dev->descriptor)) {
+        EHCI_ERR("Failed to get device descriptor on port %d\n", port);
+        return;
+    }
+    memory_copy(&dev->descriptor, blob, sizeof(dev->descriptor));
+
+    int length = request(hc, address, 0x80, 0x06, USB_DESC_TYPE_CONFIGURATION << 8, blob,
+                         sizeof(usb_configuration_descriptor_t));
+    if (length == (int)sizeof(usb_configuration_descriptor_t)) {
+        uint16_t total = ((const usb_configuration_descriptor_t *)blob)->total_length;
+        if (total > EHCI_DESCRIPTOR_SIZE) {
+            // The parser copes with a truncated blob, the interfaces we care about come first
+            EHCI_WARN("Configuration blob truncated from %u to %u bytes\n", total, EHCI_DESCRIPTOR_SIZE);
+            total = EHCI_DESCRIPTOR_SIZE;
+        }
+        length = request(hc, address, 0x80, 0x06, USB_DESC_TYPE_CONFIGURATION << 8, blob, total);
+    }
+    if (length < (int)sizeof(usb_configuration_descriptor_t) ||
+        !usb_parse_config_blob_into_device(blob, (uint16_t)length, dev)) {
+        EHCI_WARN("No usable configuration on port %d\n", port);
+        return;
+    }
+
+    if (request(hc, address, 0x00, 0x09, dev->config_descriptor.configuration_value, NULL, 0) < 0) {
+        EHCI_ERR("Failed to set configuration on port %d\n", port);
+        return;
+    }
+    usb_device_count++;
+
+    const usb_interface_descriptor_t *ifs = &dev->interface_descriptor;
+    EHCI_INFO("High-speed device %x:%x on port %d, address %u, class 0x%x\n",
+              (unsigned)dev->descriptor.vendor_id, (unsigned)dev->descriptor.product_id, port,
+              (unsigned)address, (unsigned)ifs->interface_class);
+    if (ifs->interface_class == USB_CLASS_MASS_STORAGE &&
+        ifs->interface_subclass == USB_SUBCLASS_SCSI &&
+        ifs->interface_protocol == USB_PROTOCOL_BULK_ONLY) {
+        usb_msc_attach(&ehci_hc_ops, hc->base, dev);
+    } else {
+        EHCI_WARN("No high-speed driver for interface class 0x%x on port %d\n",
+                  (unsigned)ifs->interface_class, port);
+    }
+}
+
+void ehci_enumerate_devices(usb_controller_t *controller)
+{
+    ehci_hc_t *hc = ehci_hc_for(controller->base_address);
+    if (!hc) return;
+    for (int port = 0; port < hc->ports; port++) {
+        if (reset_port(hc, port)) enumerate_device(hc, port);
+    }
+}
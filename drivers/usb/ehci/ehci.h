@@ -0,0 +1,224 @@
+#ifndef EHCI_EHCI_H
+#define EHCI_EHCI_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "../usb.h"
+#include "drivers/pci.h"
+#include "libc/mem.h"
+#include "../usb_descriptors.h"
+#include "../usb_urb.h"
+
+#ifndef EHCI_LOG_LEVEL
+#define EHCI_LOG_LEVEL USB_LOG_LEVEL_WARN
+#endif
+
+#define EHCI_LOG(level, tag, fmt, ...) \
+    USB_SUBSYS_LOG(level, EHCI_LOG_LEVEL, "[EHCI]", tag, fmt, ##__VA_ARGS__)
+
+#define EHCI_ERR(fmt, ...)   EHCI_LOG(USB_LOG_LEVEL_ERROR, "[ERR]", fmt, ##__VA_ARGS__)
+#define EHCI_WARN(fmt, ...)  EHCI_LOG(USB_LOG_LEVEL_WARN,  "[WRN]", fmt, ##__VA_ARGS__)
+#define EHCI_INFO(fmt, ...)  EHCI_LOG(USB_LOG_LEVEL_INFO,  "[INF]", fmt, ##__VA_ARGS__)
+#define EHCI_DBG(fmt, ...)   EHCI_LOG(USB_LOG_LEVEL_DEBUG, "[DBG]", fmt, ##__VA_ARGS__)
+
+#define EHCI_MAX_CONTROLLERS 4
+
+// ---- Operational registers (offsets from CAPLENGTH) ----
+#define EHCI_USBCMD        0x00
+#define EHCI_USBSTS        0x04
+#define EHCI_USBINTR       0x08
+#define EHCI_FRINDEX       0x0C
+#define EHCI_CTRLDSSEGMENT 0x10
+#define EHCI_PERIODICBASE  0x14
+#define EHCI_ASYNCLISTADDR 0x18
+#define EHCI_CONFIGFLAG    0x40
+#define EHCI_PORTSC(n)     (0x44 + 4 * (n))
+
+#define EHCI_CMD_RUN       (1u << 0)
+#define EHCI_CMD_HCRESET   (1u << 1)
+#define EHCI_CMD_PERIODIC  (1u << 4)
+#define EHCI_CMD_ASYNC     (1u << 5)
+#define EHCI_CMD_IAAD      (1u << 6)   // ring the async advance doorbell
+#define EHCI_CMD_ITC_1     (1u << 16)  // interrupt after every micro-frame
+
+#define EHCI_STS_USBINT    (1u << 0)
+#define EHCI_STS_USBERRINT (1u << 1)
+#define EHCI_STS_PCD       (1u << 2)
+#define EHCI_STS_HSE       (1u << 4)
+#define EHCI_STS_IAA       (1u << 5)
+#define EHCI_STS_HALTED    (1u << 12)
+
+#define EHCI_PORT_CONNECT  (1u << 0)
+#define EHCI_PORT_CSC      (1u << 1)
+#define EHCI_PORT_ENABLE   (1u << 2)
+#define EHCI_PORT_PEC      (1u << 3)
+#define EHCI_PORT_OCC      (1u << 5)
+#define EHCI_PORT_RESET    (1u << 8)
+#define EHCI_PORT_LINE_K   (1u << 10)  // line status 01: a low-speed device
+#define EHCI_PORT_LINE     (3u << 10)
+#define EHCI_PORT_POWER    (1u << 12)
+#define EHCI_PORT_OWNER    (1u << 13)  // set: the companion controller owns the port
+#define EHCI_PORT_CHANGE   (EHCI_PORT_CSC | EHCI_PORT_PEC | EHCI_PORT_OCC)  // write 1 to clear
+
+// ---- Schedule data structures ----
+#define EHCI_LINK_TERMINATE 0x00000001u
+#define EHCI_LINK_QH        0x00000002u
+
+typedef struct {
+    uint32_t next;
+    uint32_t alt_next;              // taken after a short packet
+    uint32_t token;
+    uint32_t buffer[5];             // 4 KiB pages, the first one with an offset
+    uint32_t buffer_high[5];        // 64-bit capable controllers, kept 0
+    // Software
+    uint16_t length;
+    uint8_t  pad[10];
+} __attribute__((packed, aligned(32))) ehci_qtd_t;
+
+typedef struct {
+    uint32_t horizontal;
+    uint32_t characteristics;
+    uint32_t capabilities;
+    uint32_t current;
+    uint32_t next;                  // transfer overlay, a qTD image
+    uint32_t alt_next;
+    uint32_t token;
+    uint32_t buffer[5];
+    uint32_t buffer_high[5];
+    // Software
+    usb_setup_packet_t setup;       // SETUP stage data of a control transfer
+    uint8_t  pad[20];
+} __attribute__((packed, aligned(32))) ehci_qh_t;
+
+_Static_assert(sizeof(ehci_qtd_t) == 64 && sizeof(ehci_qh_t) == 96, "EHCI descriptor sizes");
+
+// qTD token
+#define EHCI_TD_ACTIVE     (1u << 7)
+#define EHCI_TD_HALTED     (1u << 6)
+#define EHCI_TD_BUFFER_ERR (1u << 5)
+#define EHCI_TD_BABBLE     (1u << 4)
+#define EHCI_TD_XACT_ERR   (1u << 3)
+#define EHCI_TD_PID_OUT    (0u << 8)
+#define EHCI_TD_PID_IN     (1u << 8)
+#define EHCI_TD_PID_SETUP  (2u << 8)
+#define EHCI_TD_CERR_3     (3u << 10)
+#define EHCI_TD_IOC        (1u << 15)
+#define EHCI_TD_TOGGLE     (1u << 31)
+#define EHCI_TD_BYTES(t)   (((t) >> 16) & 0x7FFF)
+#define EHCI_TD_MAX_BYTES  0x5000       // five pages, less the first page offset
+#define EHCI_MAX_TRANSFER  0xFFFF       // per URB, all the 16-bit length allows: four qTDs
+
+// ---- Per-controller state (schedule.c) ----
+#define EHCI_POOL_QTDS 128
+#define EHCI_POOL_QHS  32
+#define EHCI_DESCRIPTOR_SIZE 1024       // one configuration blob at a time, after the QHs
+#define EHCI_MICROFRAME_BUDGET_US 100   // 80% of a micro-frame for periodic transfers
+#define EHCI_PERIOD_MAX  32             // longest interrupt period, in frames
+#define EHCI_TREE_NODES  (2 * EHCI_PERIOD_MAX - 1)
+// URB queue id of the async ring; a periodic QH has tree node * 8 + micro-frame
+#define EHCI_QUEUE_ASYNC (EHCI_TREE_NODES * 8)
+#define EHCI_RECLAIM     16             // unlinked transfers the controller may still hold
+
+// An unlinked QH and its qTDs, kept until the controller has let go of them
+typedef struct {
+    ehci_qh_t  *qh;                     // NULL when the slot is free
+    ehci_qtd_t *tds;
+    bool        async;
+    uint32_t    doorbell;               // async: answered doorbells that free it
+    uint32_t    frindex;                // periodic: FRINDEX when unlinked
+} ehci_retired_t;
+
+typedef struct {
+    uint8_t     in_use;
+    uintptr_t   base;                   // capability registers, the URB 'host'
+    volatile uint8_t *op;               // operational registers
+    uint8_t     ports;
+    uint8_t     companions;
+    uint8_t     vector;                 // shared INTx or own MSI vector
+    uint32_t   *frames;                 // 1024 periodic frame list entries
+    ehci_qh_t  *async_head;             // reclamation head of the async ring
+    ehci_qh_t  *skeleton;               // periodic tree nodes, never executed
+    ehci_qtd_t *halt;                   // inactive qTD that stops a queue after a short packet
+    ehci_qtd_t *qtds;
+    ehci_qh_t  *qhs;
+    ehci_qtd_t *free_qtds;
+    ehci_qh_t  *free_qhs;
+    uint8_t    *descriptor;             // EHCI_DESCRIPTOR_SIZE bytes below 4 GiB, for enumeration
+    uint16_t    load_us[EHCI_PERIOD_MAX][8];  // reserved per micro-frame, frames repeat every 32
+    usb_urb_t  *active;
+    ehci_retired_t retired[EHCI_RECLAIM];
+    uint32_t    doorbells;              // async advance doorbells answered so far
+    bool        doorbell_rung;          // one is outstanding
+} ehci_hc_t;
+
+static inline uint32_t ehci_read(const ehci_hc_t *hc, uint32_t reg)
+{
+    return *(volatile uint32_t *)(hc->op + reg);
+}
+
+static inline void ehci_write(const ehci_hc_t *hc, uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t *)(hc->op + reg) = value;
+}
+
+static inline uint32_t ehci_phys(const void *p)
+{
+    return (uint32_t)get_physical_address((void *)p);  // pools are below 4 GiB
+}
+
+// Whether the controller can reach all of [p, p + length) with 32-bit pointers
+static inline bool ehci_dma_ok(const void *p, size_t length)
+{
+    return !length || get_physical_address((uint8_t *)p + length - 1) <= 0xFFFFFFFFu;
+}
+
+// The controller state for a URB's 'host', NULL if unknown
+ehci_hc_t *ehci_hc_for(uintptr_t base);
+// Allocate the frame list, pools and the async ring head (page allocator)
+bool ehci_schedule_init(ehci_hc_t *hc);
+
+ehci_qtd_t *ehci_qtd_get(ehci_hc_t *hc);
+void ehci_qtd_put(ehci_hc_t *hc, ehci_qtd_t *qtd);
+ehci_qh_t *ehci_qh_get(ehci_hc_t *hc);
+void ehci_qh_put(ehci_hc_t *hc, ehci_qh_t *qh);
+
+void ehci_schedule_add_async(ehci_hc_t *hc, ehci_qh_t *qh);
+// Poll 'qh' every 'interval' frames, rounded down to a power of two up to
+// EHCI_PERIOD_MAX, in the least loaded phase and micro-frame: its queue id,
+// or -1 without bandwidth
+int ehci_schedule_add_periodic(ehci_hc_t *hc, ehci_qh_t *qh, uint8_t interval, uint16_t bus_us);
+// Unlink 'qh' from 'queue' (EHCI_QUEUE_ASYNC or a periodic queue id). The
+// controller may still hold it until it has been retired and reclaimed.
+void ehci_schedule_remove(ehci_hc_t *hc, ehci_qh_t *qh, int queue, uint16_t bus_us);
+// Hand an unlinked QH and its qTD chain back to the pools once the
+// controller is done with them: after the async advance doorbell, or once a
+// frame has passed for the periodic tree. Interrupts off. With 'wait' the
+// call returns only when they are free (or the controller is given up on),
+// for a caller that reuses the transfer's buffer.
+void ehci_schedule_retire(ehci_hc_t *hc, ehci_qh_t *qh, ehci_qtd_t *tds, int queue, bool wait);
+// Free what the controller has let go of; 'answered' when the doorbell
+// interrupt (USBSTS.IAA) fired. Rings the doorbell again while async QHs wait.
+void ehci_schedule_reclaim(ehci_hc_t *hc, bool answered);
+// Bus time of one high-speed transaction carrying 'bytes' of data
+uint16_t ehci_bus_time_us(uint16_t bytes);
+
+// ---- Transfers (urb.c) ----
+// URBs (usb_urb.h) with 'host' set to the register base; 'interval' is in
+// frames, as on the companions. Only high-speed devices are driven here,
+// full- and low-speed ones are handed to the companion controllers.
+int ehci_urb_submit(usb_urb_t *urb);
+bool ehci_urb_cancel(usb_urb_t *urb);
+void ehci_urb_service(uintptr_t base);
+
+extern const usb_hc_ops_t ehci_hc_ops;
+
+// ---- Controller (controller.c) ----
+// Take the controller from the BIOS, reset it, route every port to it and
+// give full- and low-speed devices back to the companions. Must run before
+// the companion UHCI controllers enumerate.
+bool ehci_initialize_controller(usb_controller_t *controller);
+void ehci_enumerate_devices(usb_controller_t *controller);
+
+#endif
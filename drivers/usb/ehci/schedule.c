@@ -0,0 +1,369 @@
+// drivers/usb/ehci/schedule.c
+// Pools, async ring and periodic tree, one set per controller.
+//
+// The async schedule is a ring of QHs around a reclamation head that is never
+// removed, so ASYNCLISTADDR stays valid. The periodic schedule is the same
+// binary tree as on UHCI: the skeleton QH for period P (1, 2, 4, ..., 32
+// frames) and phase p links to the one for P/2 and phase p % (P/2), and frame
+// f starts at the node for 32 and phase f % 32, so an interrupt QH queued
+// under (P, p) is polled every P frames. Skeleton QHs have an empty S-mask
+// and are skipped by the controller. Within the frame an interrupt QH runs in
+// the micro-frame of its S-mask; periodic time is reserved per frame and
+// micro-frame, and a new QH takes the phase and micro-frame whose frames are
+// least loaded. qTDs and QHs come from pages below 4 GiB and sit on free
+// lists threaded through their 'next' and 'horizontal' words while unused.
+//
+// An unlinked QH may still be cached by the controller. It waits on a small
+// retire list with its qTDs: async ones until the async advance doorbell is
+// answered (an interrupt), periodic ones until the frame that may have
+// fetched them is over. Nothing spins in the interrupt handler unless that
+// list is full.
+#include "ehci.h"
+#include "cpu/isr.h"
+#include "libc/mem.h"
+#include "kernel/mm/page_alloc.h"
+
+#define FRAMES 1024
+#define SCHEDULE_PAGES 6                // frame list, qTDs (two pages), QHs, skeleton (two pages)
+// A QH may not cross a page, so the skeleton fills each page with whole QHs
+#define SKELETON_PER_PAGE (PAGE_SIZE / sizeof(ehci_qh_t))
+// A controller that neither answers the doorbell nor gets this many frames
+// further in this many register reads is given up on
+#define RECLAIM_FRAMES_MAX 8
+#define RECLAIM_SPINS_MAX  1000000u
+
+_Static_assert(FRAMES * sizeof(uint32_t) == PAGE_SIZE, "frame list is one page");
+_Static_assert(EHCI_POOL_QTDS * sizeof(ehci_qtd_t) == 2 * PAGE_SIZE, "qTD pool is two pages");
+_Static_assert(EHCI_POOL_QHS * sizeof(ehci_qh_t) + EHCI_DESCRIPTOR_SIZE <= PAGE_SIZE,
+               "QH pool and descriptor buffer fit a page");
+_Static_assert(EHCI_TREE_NODES <= 2 * SKELETON_PER_PAGE, "skeleton fits two pages");
+
+static inline uint32_t qh_link(const ehci_qh_t *qh)
+{
+    return ehci_phys(qh) | EHCI_LINK_QH;
+}
+
+static inline ehci_qh_t *qh_from_link(uint32_t link)
+{
+    return (link & EHCI_LINK_TERMINATE) ? NULL : (ehci_qh_t *)(uintptr_t)(link & ~0x1Fu);
+}
+
+static inline ehci_qh_t *skeleton_qh(const ehci_hc_t *hc, int node)
+{
+    uint8_t *page = (uint8_t *)hc->skeleton + (size_t)(node / SKELETON_PER_PAGE) * PAGE_SIZE;
+    return (ehci_qh_t *)page + node % SKELETON_PER_PAGE;
+}
+
+// Tree node of period 'period' (a power of two) and phase 'phase' < period
+static inline int tree_node(uint32_t period, uint32_t phase)
+{
+    return (int)(period - 1 + phase);
+}
+
+// Period of tree node 'node': nodes P-1 .. 2P-2 have period P
+static inline uint32_t node_period(int node)
+{
+    uint32_t period = 1;
+    while (period * 2 - 1 <= (uint32_t)node) period *= 2;
+    return period;
+}
+
+// What the queue behind a skeleton QH ends in: the link that QH had when built
+static uint32_t queue_end(const ehci_hc_t *hc, int node)
+{
+    if (node == 0) return EHCI_LINK_TERMINATE;
+    uint32_t period = node_period(node);
+    uint32_t phase = (uint32_t)node - (period - 1);
+    return qh_link(skeleton_qh(hc, tree_node(period / 2, phase % (period / 2))));
+}
+
+bool ehci_schedule_init(ehci_hc_t *hc)
+{
+    if (!hc->frames) {
+        uint8_t *block = page_alloc_ready() ? page_alloc_pages(SCHEDULE_PAGES) : NULL;
+        if (!block || get_physical_address(block + SCHEDULE_PAGES * PAGE_SIZE - 1) > 0xFFFFFFFFu) {
+            EHCI_ERR("No memory below 4 GiB for the schedule\n");
+            if (block) page_free(block);
+            return false;
+        }
+        hc->frames = (uint32_t *)block;
+        hc->qtds = (ehci_qtd_t *)(block + PAGE_SIZE);
+        hc->qhs = (ehci_qh_t *)(block + 3 * PAGE_SIZE);
+        hc->descriptor = (uint8_t *)(hc->qhs + EHCI_POOL_QHS);
+        hc->skeleton = (ehci_qh_t *)(block + 4 * PAGE_SIZE);
+    }
+    memory_set(hc->qtds, 0, EHCI_POOL_QTDS * sizeof(ehci_qtd_t));
+    memory_set(hc->qhs, 0, EHCI_POOL_QHS * sizeof(ehci_qh_t));
+    memory_set(hc->load_us, 0, sizeof(hc->load_us));
+    hc->active = NULL;
+    memory_set(hc->retired, 0, sizeof(hc->retired));
+    hc->doorbells = 0;
+    hc->doorbell_rung = false;
+
+    // Entry 0 of each pool is taken: the qTD that stops a queue, and the head
+    hc->halt = &hc->qtds[0];
+    hc->halt->next = EHCI_LINK_TERMINATE;
+    hc->halt->alt_next = EHCI_LINK_TERMINATE;
+    hc->halt->token = EHCI_TD_HALTED;
+
+    ehci_qh_t *head = &hc->qhs[0];
+    head->horizontal = qh_link(head);
+    head->characteristics = (1u << 15) | (2u << 12);   // head of reclamation list, high speed
+    head->next = EHCI_LINK_TERMINATE;
+    head->alt_next = EHCI_LINK_TERMINATE;
+    head->token = EHCI_TD_HALTED;
+    hc->async_head = head;
+
+    hc->free_qtds = NULL;
+    for (int i = EHCI_POOL_QTDS - 1; i > 0; i--) ehci_qtd_put(hc, &hc->qtds[i]);
+    hc->free_qhs = NULL;
+    for (int i = EHCI_POOL_QHS - 1; i > 0; i--) ehci_qh_put(hc, &hc->qhs[i]);
+
+    for (int node = 0; node < EHCI_TREE_NODES; node++) {
+        ehci_qh_t *qh = skeleton_qh(hc, node);
+        memory_set(qh, 0, sizeof(*qh));
+        qh->horizontal = queue_end(hc, node);
+        qh->characteristics = 2u << 12;                 // high speed, S-mask left empty
+        qh->next = EHCI_LINK_TERMINATE;
+        qh->alt_next = EHCI_LINK_TERMINATE;
+        qh->token = EHCI_TD_HALTED;
+    }
+    for (int f = 0; f < FRAMES; f++) {
+        hc->frames[f] = qh_link(skeleton_qh(hc, tree_node(EHCI_PERIOD_MAX, f % EHCI_PERIOD_MAX)));
+    }
+    return true;
+}
+
+ehci_qtd_t *ehci_qtd_get(ehci_hc_t *hc)
+{
+    uint64_t flags = irq_save();
+    ehci_qtd_t *qtd = hc->free_qtds;
+    if (qtd) hc->free_qtds = (ehci_qtd_t *)(uintptr_t)qtd->next;
+    irq_restore(flags);
+    if (!qtd) {
+        EHCI_ERR("qTD pool exhausted\n");
+        return NULL;
+    }
+    memory_set(qtd, 0, sizeof(*qtd));
+    return qtd;
+}
+
+void ehci_qtd_put(ehci_hc_t *hc, ehci_qtd_t *qtd)
+{
+    if (!qtd) return;
+    uint64_t flags = irq_save();
+    qtd->token = 0;
+    qtd->next = (uint32_t)(uintptr_t)hc->free_qtds;
+    hc->free_qtds = qtd;
+    irq_restore(flags);
+}
+
+ehci_qh_t *ehci_qh_get(ehci_hc_t *hc)
+{
+    uint64_t flags = irq_save();
+    ehci_qh_t *qh = hc->free_qhs;
+    if (qh) hc->free_qhs = (ehci_qh_t *)(uintptr_t)qh->horizontal;
+    irq_restore(flags);
+    if (!qh) {
+        EHCI_ERR("QH pool exhausted\n");
+        return NULL;
+    }
+    memory_set(qh, 0, sizeof(*qh));
+    return qh;
+}
+
+void ehci_qh_put(ehci_hc_t *hc, ehci_qh_t *qh)
+{
+    if (!qh) return;
+    uint64_t flags = irq_save();
+    qh->horizontal = (uint32_t)(uintptr_t)hc->free_qhs;
+    hc->free_qhs = qh;
+    irq_restore(flags);
+}
+
+void ehci_schedule_add_async(ehci_hc_t *hc, ehci_qh_t *qh)
+{
+    uint64_t flags = irq_save();
+    qh->horizontal = hc->async_head->horizontal;
+    // The QH is complete before the controller can reach it
+    __atomic_store_n(&hc->async_head->horizontal, qh_link(qh), __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
+
+int ehci_schedule_add_periodic(ehci_hc_t *hc, ehci_qh_t *qh, uint8_t interval, uint16_t bus_us)
+{
+    // Largest power of two not above the interval: polling more often is allowed
+    uint32_t period = 1;
+    while (period * 2 <= interval && period < EHCI_PERIOD_MAX) period *= 2;
+
+    uint64_t flags = irq_save();
+    uint32_t best_phase = 0, best_uframe = 0, best_load = UINT32_MAX;
+    for (uint32_t phase = 0; phase < period; phase++) {
+        for (uint32_t m = 0; m < 8; m++) {
+            uint32_t load = 0;
+            for (uint32_t f = phase; f < EHCI_PERIOD_MAX; f += period) {
+                if (hc->load_us[f][m] > load) load = hc->load_us[f][m];
+            }
+            if (load < best_load) { best_load = load; best_phase = phase; best_uframe = m; }
+        }
+    }
+    if (best_load + bus_us > EHCI_MICROFRAME_BUDGET_US) {
+        irq_restore(flags);
+        EHCI_ERR("No periodic bandwidth for %u us every %u frames (%u us used)\n",
+                 bus_us, period, best_load);
+        return -1;
+    }
+    for (uint32_t f = best_phase; f < EHCI_PERIOD_MAX; f += period) {
+        hc->load_us[f][best_uframe] += bus_us;
+    }
+    qh->capabilities |= 1u << best_uframe;      // S-mask
+
+    // Appended behind the skeleton QH, so the other queues never see a change
+    int node = tree_node(period, best_phase);
+    uint32_t end = queue_end(hc, node);
+    ehci_qh_t *prev = skeleton_qh(hc, node);
+    while (prev->horizontal != end) prev = qh_from_link(prev->horizontal);
+    qh->horizontal = end;
+    // The QH is complete before the controller can reach it
+    __atomic_store_n(&prev->horizontal, qh_link(qh), __ATOMIC_RELEASE);
+    irq_restore(flags);
+
+    EHCI_DBG("Periodic QH every %u frames at phase %u, micro-frame %u, %u us, load up to %u/%u us\n",
+             period, best_phase, best_uframe, bus_us, best_load + bus_us, EHCI_MICROFRAME_BUDGET_US);
+    return node * 8 + (int)best_uframe;
+}
+
+void ehci_schedule_remove(ehci_hc_t *hc, ehci_qh_t *qh, int queue, uint16_t bus_us)
+{
+    if (!qh || queue < 0 || queue > EHCI_QUEUE_ASYNC) return;
+
+    uint32_t target = qh_link(qh);
+    uint64_t flags = irq_save();
+    if (queue == EHCI_QUEUE_ASYNC) {
+        ehci_qh_t *prev = hc->async_head;
+        while (prev->horizontal != target) {
+            prev = qh_from_link(prev->horizontal);
+            if (prev == hc->async_head) {
+                irq_restore(flags);
+                EHCI_ERR("QH %p is not on the async ring\n", (void *)qh);
+                return;
+            }
+        }
+        prev->horizontal = qh->horizontal;
+    } else {
+        int node = queue / 8, m = queue % 8;
+        uint32_t end = queue_end(hc, node);
+        ehci_qh_t *prev = skeleton_qh(hc, node);
+        while (prev->horizontal != target && prev->horizontal != end) {
+            prev = qh_from_link(prev->horizontal);
+        }
+        if (prev->horizontal != target) {
+            irq_restore(flags);
+            EHCI_ERR("QH %p is not on periodic queue %d\n", (void *)qh, queue);
+            return;
+        }
+        prev->horizontal = qh->horizontal;
+
+        uint32_t period = node_period(node);
+        for (uint32_t f = (uint32_t)node - (period - 1); f < EHCI_PERIOD_MAX; f += period) {
+            hc->load_us[f][m] = (hc->load_us[f][m] > bus_us) ? (uint16_t)(hc->load_us[f][m] - bus_us) : 0;
+        }
+    }
+    irq_restore(flags);
+}
+
+static inline ehci_qtd_t *qtd_from_link(uint32_t link)
+{
+    return (link & EHCI_LINK_TERMINATE) ? NULL : (ehci_qtd_t *)(uintptr_t)(link & ~0x1Fu);
+}
+
+static void ring_doorbell(ehci_hc_t *hc)
+{
+    ehci_write(hc, EHCI_USBCMD, ehci_read(hc, EHCI_USBCMD) | EHCI_CMD_IAAD);
+    hc->doorbell_rung = true;
+}
+
+static ehci_retired_t *free_slot(ehci_hc_t *hc)
+{
+    for (int i = 0; i < EHCI_RECLAIM; i++) {
+        if (!hc->retired[i].qh) return &hc->retired[i];
+    }
+    return NULL;
+}
+
+void ehci_schedule_reclaim(ehci_hc_t *hc, bool answered)
+{
+    if (answered && hc->doorbell_rung) {
+        hc->doorbells++;
+        hc->doorbell_rung = false;
+    }
+    // A halted controller reads no schedule, and answers no doorbell
+    bool halted = (ehci_read(hc, EHCI_USBSTS) & EHCI_STS_HALTED) != 0;
+    if (halted) hc->doorbell_rung = false;
+    uint32_t frindex = ehci_read(hc, EHCI_FRINDEX);
+    bool waiting = false;
+    for (int i = 0; i < EHCI_RECLAIM; i++) {
+        ehci_retired_t *r = &hc->retired[i];
+        if (!r->qh) continue;
+        // Periodic: two frame boundaries, so the frame that fetched the QH is over
+        bool done = halted || (r->async ? (int32_t)(hc->doorbells - r->doorbell) >= 0
+                                        : ((frindex - r->frindex) & 0x3FFF) >= 16);
+        if (!done) {
+            waiting |= r->async;
+            continue;
+        }
+        for (ehci_qtd_t *qtd = r->tds, *next; qtd; qtd = next) {
+            next = qtd_from_link(qtd->next);
+            ehci_qtd_put(hc, qtd);
+        }
+        ehci_qh_put(hc, r->qh);
+        r->qh = NULL;
+    }
+    if (waiting && !hc->doorbell_rung) ring_doorbell(hc);
+}
+
+// Poll with interrupts off until 'r' is reclaimed, or until any slot is when
+// 'r' is NULL. Bounded by frames and register reads rather than the clock,
+// which may not move with interrupts off. False when the controller is
+// given up on.
+static bool spin_reclaim(ehci_hc_t *hc, const ehci_retired_t *r)
+{
+    uint32_t start = ehci_read(hc, EHCI_FRINDEX);
+    for (uint32_t spins = 0; spins < RECLAIM_SPINS_MAX; spins++) {
+        bool answered = (ehci_read(hc, EHCI_USBSTS) & EHCI_STS_IAA) != 0;
+        if (answered) ehci_write(hc, EHCI_USBSTS, EHCI_STS_IAA);
+        ehci_schedule_reclaim(hc, answered);
+        if (r ? !r->qh : free_slot(hc) != NULL) return true;
+        if (((ehci_read(hc, EHCI_FRINDEX) - start) & 0x3FFF) >= RECLAIM_FRAMES_MAX * 8) break;
+        __asm__ volatile ("pause");
+    }
+    return false;
+}
+
+void ehci_schedule_retire(ehci_hc_t *hc, ehci_qh_t *qh, ehci_qtd_t *tds, int queue, bool wait)
+{
+    if (!qh) return;
+    ehci_retired_t *r = free_slot(hc);
+    if (!r && spin_reclaim(hc, NULL)) r = free_slot(hc);
+    if (!r) {
+        // Never handed back: the controller may still be reading them
+        EHCI_ERR("Controller 0x%x holds on to its QHs, QH %p leaked\n", (unsigned)hc->base, (void *)qh);
+        return;
+    }
+    bool async = queue == EHCI_QUEUE_ASYNC;
+    // A doorbell already rung may have been answered before this unlink
+    *r = (ehci_retired_t){ qh, tds, async, hc->doorbells + (hc->doorbell_rung ? 2u : 1u),
+                           ehci_read(hc, EHCI_FRINDEX) };
+    if (async && !hc->doorbell_rung) ring_doorbell(hc);
+    if (wait && !spin_reclaim(hc, r)) {
+        EHCI_ERR("Controller 0x%x did not let go of QH %p\n", (unsigned)hc->base, (void *)qh);
+    }
+}
+
+uint16_t ehci_bus_time_us(uint16_t bytes)
+{
+    // USB 2.0 5.11.3 for high-speed non-isochronous transactions, bit
+    // stuffing taken as the worst case 7/6; 2.083 ns a bit
+    uint32_t ns = 916u + 2083u * (3u + 7u * 8u * bytes / 6u) / 1000u;
+    return (uint16_t)((ns + 999) / 1000);
+}
@@ -0,0 +1,298 @@
+// drivers/usb/ehci/urb.c
+// Asynchronous transfers (URBs) on EHCI.
+//
+// A submitted URB gets a QH holding its qTD chain: control and bulk QHs go
+// on the async ring, interrupt ones on the periodic tree (schedule.c). A qTD
+// carries up to five pages, so even a 64 KiB transfer is a handful of them;
+// the data toggle is set in every qTD rather than kept by the QH. A short IN
+// packet makes the controller follow the qTD's alternate link: to the status
+// stage of a control transfer, otherwise to an inactive qTD that ends the
+// queue.
+//
+// The IOC interrupt calls ehci_urb_service(), which unlinks the URBs that are
+// done, retires their QHs and qTDs (schedule.c) and runs the completion
+// callbacks. The pools get them back once the controller has let go.
+#include "ehci.h"
+#include "cpu/isr.h"
+#include "libc/mem.h"
+
+static inline ehci_qtd_t *qtd_from_link(uint32_t link)
+{
+    return (link & EHCI_LINK_TERMINATE) ? NULL : (ehci_qtd_t *)(uintptr_t)(link & ~0x1Fu);
+}
+
+static inline uint16_t max_packet_of(const usb_urb_t *urb)
+{
+    return urb->max_packet ? urb->max_packet : 8;
+}
+
+// Packets needed for 'bytes', a zero-length packet counting as one
+static inline uint32_t packets_of(uint32_t bytes, uint16_t max_packet)
+{
+    return bytes ? (bytes + max_packet - 1) / max_packet : 1;
+}
+
+static int status_from_token(uint32_t token)
+{
+    if (token & EHCI_TD_BABBLE)     return USB_URB_BABBLE;
+    if (token & EHCI_TD_BUFFER_ERR) return USB_URB_BUFFER;
+    if (token & EHCI_TD_XACT_ERR)   return USB_URB_CRC;
+    return USB_URB_STALLED;
+}
+
+// Walk the chain: USB_URB_PENDING while qTDs are active, else the result,
+// with the data bytes moved and data packets sent
+static int urb_progress(const usb_urb_t *urb, uint16_t *actual, uint16_t *packets)
+{
+    uint16_t max_packet = max_packet_of(urb);
+    *actual = 0;
+    *packets = 0;
+    ehci_qtd_t *qtd = urb->tds;
+    while (qtd) {
+        uint32_t token = qtd->token;
+        if (token & EHCI_TD_ACTIVE) return USB_URB_PENDING;
+        if (token & EHCI_TD_HALTED) return status_from_token(token);
+        ehci_qtd_t *next = qtd_from_link(qtd->next);
+        if ((token & (3u << 8)) != EHCI_TD_PID_SETUP) {
+            uint16_t left = EHCI_TD_BYTES(token);
+            uint16_t done = (uint16_t)(qtd->length - left);
+            *actual += done;
+            *packets += (uint16_t)(left ? done / max_packet + 1u : packets_of(done, max_packet));
+            if (left && next) {
+                // Short packet: the data ends here; a control transfer went on
+                // to its status stage, the last qTD
+                if (!urb->control) return USB_URB_OK;
+                while (qtd_from_link(next->next)) next = qtd_from_link(next->next);
+            }
+        }
+        qtd = next;
+    }
+    return USB_URB_OK;
+}
+
+static void store_result(usb_urb_t *urb, int status, uint16_t actual, uint16_t packets)
+{
+    urb->actual_length = actual;
+    if (!urb->control) urb->toggle ^= (uint8_t)(packets & 1);
+    urb->status = status;
+}
+
+static ehci_qtd_t *append_qtd(ehci_hc_t *hc, usb_urb_t *urb, ehci_qtd_t *prev, uint32_t pid,
+                              uint8_t toggle, void *buffer, uint16_t length)
+{
+    ehci_qtd_t *qtd = ehci_qtd_get(hc);
+    if (!qtd) return NULL;
+    uint32_t phys = length ? ehci_phys(buffer) : 0;
+    qtd->next = EHCI_LINK_TERMINATE;
+    qtd->alt_next = EHCI_LINK_TERMINATE;
+    qtd->buffer[0] = phys;
+    for (int i = 1; i < 5; i++) qtd->buffer[i] = (phys & ~0xFFFu) + (uint32_t)i * 0x1000u;
+    qtd->length = length;
+    qtd->token = (toggle ? EHCI_TD_TOGGLE : 0) | ((uint32_t)length << 16) | EHCI_TD_CERR_3 |
+                 pid | EHCI_TD_ACTIVE;
+    if (prev) prev->next = ehci_phys(qtd);
+    else urb->tds = qtd;
+    return qtd;
+}
+
+// The URB's data as qTDs of up to five pages each, every one but the last
+// holding whole packets. Returns the last qTD, NULL when out of qTDs.
+static ehci_qtd_t *append_data(ehci_hc_t *hc, usb_urb_t *urb, ehci_qtd_t *last, uint32_t pid,
+                               uint8_t toggle)
+{
+    uint16_t max_packet = max_packet_of(urb);
+    uint8_t *data = urb->buffer;
+    uint32_t left = urb->length;
+    do {
+        uint32_t chunk = EHCI_TD_MAX_BYTES - ((uintptr_t)data & 0xFFF);
+        if (chunk >= left) chunk = left;
+        else chunk -= chunk % max_packet;
+        last = append_qtd(hc, urb, last, pid, toggle, data, (uint16_t)chunk);
+        if (!last) return NULL;
+        toggle ^= (uint8_t)(packets_of(chunk, max_packet) & 1);
+        data += chunk;
+        left -= chunk;
+    } while (left);
+    return last;
+}
+
+static bool build_transfer(ehci_hc_t *hc, usb_urb_t *urb)
+{
+    ehci_qh_t *qh = ehci_qh_get(hc);
+    urb->qh = qh;
+    if (!qh) return false;
+
+    ehci_qtd_t *last;
+    if (urb->control) {
+        bool in = (urb->setup.bmRequestType & 0x80) != 0;
+        qh->setup = urb->setup;
+        ehci_qtd_t *setup = append_qtd(hc, urb, NULL, EHCI_TD_PID_SETUP, 0, &qh->setup,
+                                       sizeof(usb_setup_packet_t));
+        if (!setup) return false;
+        last = setup;
+        if (urb->length) {
+            last = append_data(hc, urb, last, in ? EHCI_TD_PID_IN : EHCI_TD_PID_OUT, 1);
+            if (!last) return false;
+        }
+        // Status stage in the other direction, IN when there is no data
+        ehci_qtd_t *status = append_qtd(hc, urb, last, (in && urb->length) ? EHCI_TD_PID_OUT
+                                                                           : EHCI_TD_PID_IN,
+                                        1, NULL, 0);
+        if (!status) return false;
+        for (ehci_qtd_t *qtd = qtd_from_link(setup->next); qtd != status; qtd = qtd_from_link(qtd->next)) {
+            qtd->alt_next = ehci_phys(status);
+        }
+        last = status;
+    } else {
+        bool in = (urb->endpoint & 0x80) != 0;
+        last = append_data(hc, urb, NULL, in ? EHCI_TD_PID_IN : EHCI_TD_PID_OUT, urb->toggle & 1);
+        if (!last) return false;
+        if (in) {
+            for (ehci_qtd_t *qtd = urb->tds; qtd; qtd = qtd_from_link(qtd->next)) {
+                qtd->alt_next = ehci_phys(hc->halt);
+            }
+        }
+    }
+    last->token |= EHCI_TD_IOC;
+
+    bool async = urb->control || !urb->interval;
+    qh->characteristics = urb->device_address | ((uint32_t)(urb->endpoint & 0x0F) << 8) |
+                          (2u << 12) |                      // high speed
+                          (1u << 14) |                      // toggle from the qTDs
+                          ((uint32_t)max_packet_of(urb) << 16) |
+                          (async ? (4u << 28) : 0);         // NAK reload, async only
+    qh->capabilities = 1u << 30;                            // one transaction a micro-frame
+    qh->current = 0;
+    qh->next = ehci_phys(urb->tds);
+    qh->alt_next = EHCI_LINK_TERMINATE;
+    qh->token = 0;
+    return true;
+}
+
+// Never linked, so back to the pools at once
+static void release_transfer(ehci_hc_t *hc, usb_urb_t *urb)
+{
+    ehci_qtd_t *qtd = urb->tds;
+    while (qtd) {
+        ehci_qtd_t *next = qtd_from_link(qtd->next);
+        ehci_qtd_put(hc, qtd);
+        qtd = next;
+    }
+    ehci_qh_put(hc, urb->qh);
+    urb->tds = NULL;
+    urb->qh = NULL;
+}
+
+int ehci_urb_submit(usb_urb_t *urb)
+{
+    ehci_hc_t *hc = urb ? ehci_hc_for(urb->host) : NULL;
+    if (!hc || urb->max_packet > 1024 || (urb->length && !urb->buffer) ||
+        (urb->control && urb->setup.wLength != urb->length)) {
+        return USB_URB_INVALID;
+    }
+    if (!ehci_dma_ok(urb->buffer, urb->length)) {
+        EHCI_ERR("Buffer %p is above 4 GiB\n", urb->buffer);
+        return USB_URB_INVALID;
+    }
+
+    urb->qh = NULL;
+    urb->tds = NULL;
+    urb->setup_buffer = NULL;
+    urb->actual_length = 0;
+    if (!build_transfer(hc, urb)) {
+        release_transfer(hc, urb);
+        EHCI_ERR("No qTD/QH for a transfer to %u ep 0x%x\n", urb->device_address, urb->endpoint);
+        return USB_URB_NO_MEMORY;
+    }
+    urb->status = USB_URB_PENDING;
+    urb->next = NULL;
+
+    uint64_t flags = irq_save();
+    ehci_schedule_reclaim(hc, false);
+    if (urb->control || !urb->interval) {
+        urb->bus_us = 0;
+        urb->queue = EHCI_QUEUE_ASYNC;
+        ehci_schedule_add_async(hc, urb->qh);
+    } else {
+        // One packet per poll
+        uint16_t max_packet = max_packet_of(urb);
+        urb->bus_us = ehci_bus_time_us((urb->length < max_packet) ? urb->length : max_packet);
+        urb->queue = ehci_schedule_add_periodic(hc, urb->qh, urb->interval, urb->bus_us);
+        if (urb->queue < 0) {
+            irq_restore(flags);
+            release_transfer(hc, urb);
+            urb->status = USB_URB_NO_BANDWIDTH;
+            return USB_URB_NO_BANDWIDTH;
+        }
+    }
+    usb_urb_t **link = &hc->active;
+    while (*link) link = &(*link)->next;
+    *link = urb;
+    irq_restore(flags);
+    return USB_URB_OK;
+}
+
+void ehci_urb_service(uintptr_t base)
+{
+    ehci_hc_t *hc = ehci_hc_for(base);
+    if (!hc) return;
+
+    uint64_t flags = irq_save();
+    usb_urb_t *done = NULL, **done_tail = &done;
+    usb_urb_t **link = &hc->active;
+    while (*link) {
+        usb_urb_t *urb = *link;
+        uint16_t actual, packets;
+        int status = urb_progress(urb, &actual, &packets);
+        if (status == USB_URB_PENDING) {
+            link = &urb->next;
+            continue;
+        }
+        *link = urb->next;
+        ehci_schedule_remove(hc, urb->qh, urb->queue, urb->bus_us);
+        ehci_schedule_retire(hc, urb->qh, urb->tds, urb->queue, false);
+        urb->qh = NULL;
+        urb->tds = NULL;
+        store_result(urb, status, actual, packets);
+        urb->next = NULL;
+        *done_tail = urb;
+        done_tail = &urb->next;
+    }
+    // Callbacks may submit again, so they run once the list is consistent
+    while (done) {
+        usb_urb_t *urb = done;
+        done = urb->next;
+        if (urb->complete) urb->complete(urb);
+    }
+    irq_restore(flags);
+}
+
+bool ehci_urb_cancel(usb_urb_t *urb)
+{
+    ehci_hc_t *hc = urb ? ehci_hc_for(urb->host) : NULL;
+    if (!hc) return false;
+
+    uint64_t flags = irq_save();
+    usb_urb_t **link = &hc->active;
+    while (*link && *link != urb) link = &(*link)->next;
+    if (!*link) {
+        irq_restore(flags);
+        return false;
+    }
+    *link = urb->next;
+    urb->next = NULL;
+
+    ehci_schedule_remove(hc, urb->qh, urb->queue, urb->bus_us);
+    uint16_t actual, packets;
+    urb_progress(urb, &actual, &packets);
+    // The caller may reuse the buffer once this returns
+    ehci_schedule_retire(hc, urb->qh, urb->tds, urb->queue, true);
+    urb->qh = NULL;
+    urb->tds = NULL;
+    store_result(urb, USB_URB_CANCELLED, actual, packets);
+    if (urb->complete) urb->complete(urb);
+    irq_restore(flags);
+    return true;
+}
+
+const usb_hc_ops_t ehci_hc_ops = { ehci_urb_submit, ehci_urb_cancel, ehci_urb_service, EHCI_MAX_TRANSFER };
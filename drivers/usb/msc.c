@@ -0,0 +1,420 @@
+// drivers/usb/msc.c
+// USB mass storage: bulk-only transport (BOT) carrying SCSI commands.
+//
+// A command is a CBW on the bulk OUT pipe, an optional data stage, and a CSW
+// on the bulk IN pipe. The stages are chained from the URB completion
+// callback, so a command runs from the controller's interrupt without the caller
+// waking up in between, and a read or write spanning several commands sends
+// the next CBW as soon as the previous CSW is in. A data stage carries as
+// many whole blocks as the host controller takes in one URB (max_transfer),
+// and its URB engine splits them into descriptors.
+//
+// A stalled data or status stage is cleared from the callback as well (clear
+// halt, then read the CSW); anything worse ends the command and the caller
+// runs the BOT reset recovery.
+#include "msc.h"
+#include "cpu/timer.h"
+#include "libc/mem.h"
+
+#define MSC_CBW_SIGNATURE 0x43425355u   // "USBC"
+#define MSC_CSW_SIGNATURE 0x53425355u   // "USBS"
+#define MSC_TIMEOUT_MS    5000          // without progress
+
+#define SCSI_REQUEST_SENSE   0x03
+#define SCSI_INQUIRY         0x12
+#define SCSI_READ_CAPACITY   0x25
+#define SCSI_READ_10         0x28
+#define SCSI_WRITE_10        0x2A
+#define SCSI_READ_16         0x88
+#define SCSI_SERVICE_IN_16   0x9E       // READ CAPACITY(16) is service action 0x10
+
+typedef struct {
+    uint32_t signature;
+    uint32_t tag;
+    uint32_t data_length;
+    uint8_t  flags;                     // bit 7: data IN
+    uint8_t  lun;
+    uint8_t  cb_length;
+    uint8_t  cb[16];
+} __attribute__((packed)) msc_cbw_t;
+
+typedef struct {
+    uint32_t signature;
+    uint32_t tag;
+    uint32_t residue;
+    uint8_t  status;                    // 0 passed, 1 failed, 2 phase error
+} __attribute__((packed)) msc_csw_t;
+
+enum { STAGE_CBW, STAGE_DATA, STAGE_CSW, STAGE_CLEAR_HALT };
+
+typedef struct {
+    uint8_t  in_use;
+    const usb_hc_ops_t *hc;
+    uintptr_t host;
+    uint8_t  address;
+    uint8_t  interface;
+    uint8_t  max_packet0;
+    uint8_t  ep_in, ep_out;
+    uint16_t max_packet_in, max_packet_out;
+    uint8_t  toggle_in, toggle_out;
+    usb_msc_info_t info;
+
+    // Command in flight, advanced by msc_stage_done()
+    uint8_t  cb[16];
+    uint8_t  cb_length;
+    bool     in;
+    uint8_t *data;
+    uint16_t length;
+    uint16_t actual;
+    uint64_t lba;                       // reads and writes: next block
+    uint32_t blocks_left;               // 0 for a single command
+    uint32_t blocks;                    // in the current command
+    uint8_t  stage;
+    uint8_t  halted;                    // endpoint being cleared
+    bool     csw_retried;
+    uint32_t tag;
+    volatile uint32_t progress;         // bumped on every CSW
+    volatile int result;
+
+    usb_urb_t urb;                     // stages run one at a time
+    msc_cbw_t  cbw;
+    msc_csw_t  csw;
+    uint8_t    scratch[36];             // INQUIRY, capacity, sense data
+} msc_disk_t;
+
+static msc_disk_t g_disks[USB_MSC_MAX_DISKS];
+
+static inline void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+static inline uint32_t get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void msc_stage_done(usb_urb_t *urb);
+
+static usb_urb_t *stage_urb(msc_disk_t *d, uint8_t stage)
+{
+    usb_urb_t *urb = &d->urb;
+    memory_set(urb, 0, sizeof(*urb));
+    urb->host           = d->host;
+    urb->device_address = d->address;
+    urb->complete       = msc_stage_done;
+    urb->context        = d;
+    d->stage = stage;
+    return urb;
+}
+
+static void submit(msc_disk_t *d, usb_urb_t *urb)
+{
+    int rc = d->hc->submit(urb);
+    if (rc != USB_URB_OK) d->result = rc;
+}
+
+static void submit_bulk(msc_disk_t *d, uint8_t stage, bool in, void *buffer, uint16_t length)
+{
+    usb_urb_t *urb = stage_urb(d, stage);
+    urb->endpoint   = in ? d->ep_in : d->ep_out;
+    urb->max_packet = in ? d->max_packet_in : d->max_packet_out;
+    urb->toggle     = in ? d->toggle_in : d->toggle_out;
+    urb->buffer     = buffer;
+    urb->length     = length;
+    submit(d, urb);
+}
+
+// CLEAR_FEATURE(ENDPOINT_HALT), then the CSW is read
+static void submit_clear_halt(msc_disk_t *d, uint8_t endpoint)
+{
+    usb_urb_t *urb = stage_urb(d, STAGE_CLEAR_HALT);
+    urb->max_packet = d->max_packet0;
+    urb->control    = true;
+    urb->setup      = (usb_setup_packet_t){ 0x02, 0x01 /* CLEAR_FEATURE */, 0, endpoint, 0 };
+    d->halted = endpoint;
+    submit(d, urb);
+}
+
+// Command block of the next READ/WRITE, at most the host's max_transfer bytes
+static void build_rw(msc_disk_t *d, bool write)
+{
+    uint32_t max_blocks = d->hc->max_transfer / d->info.block_size;
+    d->blocks = (d->blocks_left < max_blocks) ? d->blocks_left : max_blocks;
+    d->length = (uint16_t)(d->blocks * d->info.block_size);
+    d->in = !write;
+    memory_set(d->cb, 0, sizeof(d->cb));
+    if (d->lba + d->blocks - 1 > 0xFFFFFFFFull) {
+        d->cb[0] = SCSI_READ_16;
+        put_be32(&d->cb[2], (uint32_t)(d->lba >> 32));
+        put_be32(&d->cb[6], (uint32_t)d->lba);
+        put_be32(&d->cb[10], d->blocks);
+        d->cb_length = 16;
+    } else {
+        d->cb[0] = write ? SCSI_WRITE_10 : SCSI_READ_10;
+        put_be32(&d->cb[2], (uint32_t)d->lba);
+        d->cb[7] = (uint8_t)(d->blocks >> 8);
+        d->cb[8] = (uint8_t)d->blocks;
+        d->cb_length = 10;
+    }
+}
+
+static void submit_cbw(msc_disk_t *d)
+{
+    d->cbw = (msc_cbw_t){
+        .signature   = MSC_CBW_SIGNATURE,
+        .tag         = ++d->tag,
+        .data_length = d->length,
+        .flags       = d->in ? 0x80 : 0x00,
+        .cb_length   = d->cb_length,
+    };
+    memory_copy(d->cbw.cb, d->cb, d->cb_length);
+    d->actual = 0;
+    d->csw_retried = false;
+    submit_bulk(d, STAGE_CBW, false, &d->cbw, sizeof(d->cbw));
+}
+
+static int check_csw(const msc_disk_t *d, uint16_t length)
+{
+    if (length != sizeof(msc_csw_t) || d->csw.signature != MSC_CSW_SIGNATURE || d->csw.tag != d->tag) {
+        return USB_MSC_PHASE_ERROR;
+    }
+    if (d->csw.status == 1) return USB_MSC_FAILED;
+    if (d->csw.status != 0) return USB_MSC_PHASE_ERROR;
+    return USB_URB_OK;
+}
+
+// URB completion, interrupts off: start the next stage or end the command
+static void msc_stage_done(usb_urb_t *urb)
+{
+    msc_disk_t *d = urb->context;
+    int status = urb->status;
+    if (!urb->control) {
+        if (urb->endpoint & 0x80) d->toggle_in = urb->toggle;
+        else                      d->toggle_out = urb->toggle;
+    }
+
+    switch (d->stage) {
+    case STAGE_CBW:
+        if (status != USB_URB_OK) break;
+        if (d->length) submit_bulk(d, STAGE_DATA, d->in, d->data, d->length);
+        else           submit_bulk(d, STAGE_CSW, true, &d->csw, sizeof(d->csw));
+        return;
+
+    case STAGE_DATA:
+        if (status == USB_URB_STALLED) { submit_clear_halt(d, urb->endpoint); return; }
+        if (status != USB_URB_OK) break;
+        d->actual = urb->actual_length;
+        submit_bulk(d, STAGE_CSW, true, &d->csw, sizeof(d->csw));
+        return;
+
+    case STAGE_CLEAR_HALT:
+        if (status != USB_URB_OK) break;
+        if (d->halted & 0x80) d->toggle_in = 0;
+        else                  d->toggle_out = 0;
+        submit_bulk(d, STAGE_CSW, true, &d->csw, sizeof(d->csw));
+        return;
+
+    case STAGE_CSW:
+        if (status == USB_URB_STALLED && !d->csw_retried) {
+            d->csw_retried = true;
+            submit_clear_halt(d, d->ep_in);
+            return;
+        }
+        if (status == USB_URB_OK) status = check_csw(d, urb->actual_length);
+        if (status != USB_URB_OK) break;
+        d->progress++;
+        if (d->blocks_left) {
+            if (d->actual != d->length) { status = USB_URB_BUFFER; break; }
+            d->lba += d->blocks;
+            d->data += d->length;
+            d->blocks_left -= d->blocks;
+            if (d->blocks_left) {
+                build_rw(d, !d->in);
+                submit_cbw(d);
+                return;
+            }
+        }
+        break;
+    }
+    d->result = status;
+}
+
+// BOT reset recovery: class reset, then clear halt on both bulk pipes
+static void reset_recovery(msc_disk_t *d)
+{
+    usb_setup_packet_t setup = { 0x21, 0xFF /* Bulk-Only Mass Storage Reset */, 0, d->interface, 0 };
+    usb_control_transfer(d->hc, d->host, d->address, d->max_packet0, false, &setup, NULL);
+    setup = (usb_setup_packet_t){ 0x02, 0x01 /* CLEAR_FEATURE */, 0, d->ep_in, 0 };
+    usb_control_transfer(d->hc, d->host, d->address, d->max_packet0, false, &setup, NULL);
+    setup.wIndex = d->ep_out;
+    usb_control_transfer(d->hc, d->host, d->address, d->max_packet0, false, &setup, NULL);
+    d->toggle_in = d->toggle_out = 0;
+}
+
+// Run the prepared command (chain) and wait for it
+static int run(msc_disk_t *d)
+{
+    d->result = USB_URB_PENDING;
+    submit_cbw(d);
+
+    uint32_t seen = d->progress;
+    uint64_t deadline = timer_get_ns() + MSC_TIMEOUT_MS * 1000000ULL;
+    while (d->result == USB_URB_PENDING) {
+        if (timer_get_ns() < deadline) {
+            timer_idle();
+            continue;
+        }
+        if (d->progress != seen) {
+            seen = d->progress;
+            deadline = timer_get_ns() + MSC_TIMEOUT_MS * 1000000ULL;
+            continue;
+        }
+        // A stage the lost interrupt left behind may complete here, and its
+        // callback submit the next stage into d->urb: that one starts a new
+        // deadline instead of being cancelled
+        uint8_t stage = d->stage;
+        uint32_t tag = d->tag;
+        d->hc->service(d->host);
+        if (d->result != USB_URB_PENDING) break;
+        if (d->stage != stage || d->tag != tag || d->progress != seen) {
+            seen = d->progress;
+            deadline = timer_get_ns() + MSC_TIMEOUT_MS * 1000000ULL;
+            continue;
+        }
+        if (d->hc->cancel(&d->urb)) d->result = USB_URB_TIMEOUT;
+    }
+
+    int result = d->result;
+    if (result != USB_URB_OK && result != USB_MSC_FAILED) {
+        USB_LOG_ERROR("MSC command 0x%x on %u failed (%d), resetting\n", d->cb[0], d->address, result);
+        reset_recovery(d);
+    }
+    return result;
+}
+
+static int command(msc_disk_t *d, const uint8_t *cb, uint8_t cb_length, void *data, uint16_t length)
+{
+    memory_set(d->cb, 0, sizeof(d->cb));
+    memory_copy(d->cb, cb, cb_length);
+    d->cb_length = cb_length;
+    d->in = true;
+    d->data = data;
+    d->length = length;
+    d->blocks_left = 0;
+    return run(d);
+}
+
+static int read_capacity(msc_disk_t *d)
+{
+    const uint8_t read_capacity_10[10] = { SCSI_READ_CAPACITY };
+    int rc = command(d, read_capacity_10, sizeof(read_capacity_10), d->scratch, 8);
+    if (rc != USB_URB_OK) return rc;
+    uint32_t last = get_be32(&d->scratch[0]);
+    d->info.block_size = get_be32(&d->scratch[4]);
+    d->info.blocks = (uint64_t)last + 1;
+
+    if (last == 0xFFFFFFFFu) {
+        // Past READ CAPACITY(10)'s 32-bit LBA
+        const uint8_t read_capacity_16[16] = { SCSI_SERVICE_IN_16, 0x10, [13] = 32 };
+        rc = command(d, read_capacity_16, sizeof(read_capacity_16), d->scratch, 32);
+        if (rc != USB_URB_OK) return rc;
+        d->info.blocks = (((uint64_t)get_be32(&d->scratch[0]) << 32) | get_be32(&d->scratch[4])) + 1;
+        d->info.block_size = get_be32(&d->scratch[8]);
+    }
+    if (!d->info.block_size || d->info.block_size > d->hc->max_transfer) return USB_MSC_FAILED;
+    return USB_URB_OK;
+}
+
+static void copy_trimmed(char *to, const uint8_t *from, int length)
+{
+    while (length && from[length - 1] == ' ') length--;
+    memory_copy(to, from, length);
+    to[length] = '\0';
+}
+
+int usb_msc_attach(const usb_hc_ops_t *hc, uintptr_t host, const usb_device_t *dev)
+{
+    msc_disk_t *d = NULL;
+    for (int i = 0; i < USB_MSC_MAX_DISKS && !d; i++) {
+        if (!g_disks[i].in_use) d = &g_disks[i];
+    }
+    if (!d) {
+        USB_LOG_WARN("No room for another USB disk\n");
+        return -1;
+    }
+    memory_set(d, 0, sizeof(*d));
+    d->hc             = hc;
+    d->host           = host;
+    d->address        = dev->address;
+    d->interface      = dev->interface_descriptor.interface_number;
+    d->max_packet0    = dev->descriptor.max_packet_size;
+    d->ep_in          = dev->endpoint_descriptors[0].endpoint_address;
+    d->max_packet_in  = dev->endpoint_descriptors[0].max_packet_size;
+    d->ep_out         = dev->endpoint_descriptors[1].endpoint_address;
+    d->max_packet_out = dev->endpoint_descriptors[1].max_packet_size;
+
+    const uint8_t inquiry[6] = { SCSI_INQUIRY, 0, 0, 0, 36 };
+    if (command(d, inquiry, sizeof(inquiry), d->scratch, 36) != USB_URB_OK) {
+        USB_LOG_ERROR("INQUIRY failed on device %u\n", d->address);
+        return -1;
+    }
+    copy_trimmed(d->info.vendor, &d->scratch[8], 8);
+    copy_trimmed(d->info.product, &d->scratch[16], 16);
+
+    // Fresh devices answer with a unit attention first; the sense data clears it
+    int rc = USB_MSC_FAILED;
+    for (int tries = 0; tries < 5 && rc != USB_URB_OK; tries++) {
+        rc = read_capacity(d);
+        if (rc == USB_MSC_FAILED) {
+            const uint8_t request_sense[6] = { SCSI_REQUEST_SENSE, 0, 0, 0, 18 };
+            command(d, request_sense, sizeof(request_sense), d->scratch, 18);
+            sleep_ms(100);
+        }
+    }
+    if (rc != USB_URB_OK) {
+        USB_LOG_ERROR("READ CAPACITY failed on device %u (%d)\n", d->address, rc);
+        return -1;
+    }
+
+    d->in_use = 1;
+    USB_LOG_INFO("USB disk %d: %s %s, %u blocks of %u bytes\n", (int)(d - g_disks), d->info.vendor,
+              d->info.product, (unsigned)d->info.blocks, d->info.block_size);
+    return (int)(d - g_disks);
+}
+
+static msc_disk_t *disk(int index)
+{
+    return (index >= 0 && index < USB_MSC_MAX_DISKS && g_disks[index].in_use) ? &g_disks[index] : NULL;
+}
+
+const usb_msc_info_t *usb_msc_info(int index)
+{
+    msc_disk_t *d = disk(index);
+    return d ? &d->info : NULL;
+}
+
+static int read_write(int index, bool write, uint64_t lba, uint32_t count, void *buffer)
+{
+    msc_disk_t *d = disk(index);
+    if (!d || !buffer || lba + count > d->info.blocks ||
+        (write && lba + count - 1 > 0xFFFFFFFFull)) {
+        return USB_URB_INVALID;
+    }
+    if (!count) return USB_URB_OK;
+    d->lba = lba;
+    d->blocks_left = count;
+    d->data = buffer;
+    build_rw(d, write);
+    return run(d);
+}
+
+int usb_msc_read(int index, uint64_t lba, uint32_t count, void *buffer)
+{
+    return read_write(index, false, lba, count, buffer);
+}
+
+int usb_msc_write(int index, uint64_t lba, uint32_t count, const void *buffer)
+{
+    return read_write(index, true, lba, count, (void *)buffer);
+}
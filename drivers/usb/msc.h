@@ -0,0 +1,32 @@
+#ifndef USB_MSC_H
+#define USB_MSC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usb.h"
+#include "usb_urb.h"
+
+// ---- Mass storage, bulk-only transport and SCSI (msc.c) ----
+#define USB_MSC_MAX_DISKS 2
+// Besides usb_urb_status_t codes
+#define USB_MSC_FAILED      -20  // the device failed the command
+#define USB_MSC_PHASE_ERROR -21  // bad or phase-error status, the device was reset
+
+typedef struct {
+    uint64_t blocks;
+    uint32_t block_size;
+    char     vendor[9];
+    char     product[17];
+} usb_msc_info_t;
+
+// Bring up a configured BOT/SCSI device on controller 'host', whose
+// endpoint_descriptors[0] and [1] are its bulk IN and OUT pipes: disk index,
+// or -1
+int usb_msc_attach(const usb_hc_ops_t *hc, uintptr_t host, const usb_device_t *dev);
+// NULL when there is no such disk
+const usb_msc_info_t *usb_msc_info(int disk);
+// Transfer 'count' blocks at 'lba': USB_URB_OK or a negative status
+int usb_msc_read(int disk, uint64_t lba, uint32_t count, void *buffer);
+int usb_msc_write(int disk, uint64_t lba, uint32_t count, const void *buffer);
+
+#endif
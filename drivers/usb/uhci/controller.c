@@ -7,8 +7,6 @@
 #include "libc/mem.h"
 #include "libc/function.h"
 
-uint32_t frame_list[1024] __attribute__((aligned(4096)));
-
 uint32_t find_uhci_io_base(pci_device_t *device)
 {
     for (int i = 0; i < 6; i++) {
@@ -34,12 +32,6 @@ static bool uhci_reset_controller(uint16_t io_base)
     return false;
 }
 
-static void uhci_initialize_frame_list(void)
-{
-    for (int i = 0; i < 1024; i++) frame_list[i] = 0x00000001; // T-bit
-    UHCI_DBG("Initialized frame list with 1024 T-terminated entries\n");
-}
-
 static bool uhci_set_frame_list_base_address(uint16_t io_base, uint32_t frame_list_phys_addr)
 {
     port_dword_out(io_base + 0x08, frame_list_phys_addr);
@@ -49,19 +41,23 @@ static bool uhci_set_frame_list_base_address(uint16_t io_base, uint32_t frame_li
         return true;
     }
     UHCI_ERR("Frame List set failed. Expected: 0x%x, Got: 0x%x\n",
-             (uintptr_t)frame_list_phys_addr, rd);
+             frame_list_phys_addr, rd);
     return false;
 }
 
+// Timeout/CRC | Resume | IOC | Short packet: a failing transfer completes
+// through the interrupt as well, not only one whose last TD had IOC
+#define UHCI_INTR_MASK 0x000F
+
 static bool uhci_enable_interrupts(uint16_t io_base)
 {
-    port_word_out(io_base + 0x04, 0x0006); // HSE | IOC
+    port_word_out(io_base + 0x04, UHCI_INTR_MASK);
     uint16_t intr = port_word_in(io_base + 0x04);
-    if (intr != 0x0006) {
-        UHCI_WARN("Interrupt mask mismatch: wrote 0x0006, read 0x%x\n", intr);
+    if (intr != UHCI_INTR_MASK) {
+        UHCI_WARN("Interrupt mask mismatch: wrote 0x%x, read 0x%x\n", UHCI_INTR_MASK, intr);
         return false;
     }
-    UHCI_DBG("Interrupts enabled (HSE | IOC)\n");
+    UHCI_DBG("Interrupts enabled (0x%x)\n", UHCI_INTR_MASK);
     return true;
 }
 
@@ -84,10 +80,12 @@ bool uhci_initialize_controller(usb_controller_t *controller)
 
     if (!uhci_reset_controller(io_base)) return false;
 
-    uhci_initialize_frame_list();
+    if (!uhci_pool_init(io_base)) return false;
+
+    if (!uhci_schedule_init(io_base)) return false;
+    if (!uhci_urb_init(io_base)) return false;
 
-    uintptr_t fl_phys = (uintptr_t)&frame_list; // identity map assumption
-    if (!uhci_set_frame_list_base_address(io_base, fl_phys)) return false;
+    if (!uhci_set_frame_list_base_address(io_base, uhci_schedule_frame_list(io_base))) return false;
 
     if (!uhci_enable_interrupts(io_base))
         UHCI_WARN("Interrupt enable failed; continuing with polling\n");
@@ -1,5 +1,6 @@
 #include "uhci.h"
 #include "../usb.h"
+#include "../msc.h"
 #include "cpu/ports.h"
 #include "cpu/timer.h"
 #include "libc/mem.h"
@@ -58,8 +59,9 @@ static void usb_dump_configuration_blob(const uint8_t *buf, uint16_t total_len)
 }
 #endif
 
-// Two-pass parse: pick HID boot keyboard interface if present; then first INT IN endpoint.
-static int usb_parse_config_blob_into_device(const uint8_t *buf, uint16_t total_len, usb_device_t *dev)
+// Two-pass parse: pick a HID boot keyboard interface if present, else a
+// bulk-only mass storage one; then the endpoints that interface needs.
+int usb_parse_config_blob_into_device(const uint8_t *buf, uint16_t total_len, usb_device_t *dev)
 {
     if (!buf || !dev) return 0;
     if (total_len < sizeof(usb_configuration_descriptor_t)) return 0;
@@ -67,7 +69,7 @@ static int usb_parse_config_blob_into_device(const uint8_t *buf, uint16_t total_
     memory_copy(&dev->config_descriptor, buf, sizeof(usb_configuration_descriptor_t));
 
     uint16_t off = 0;
-    int have_any_if = 0, chose_keyboard_if = 0;
+    int have_any_if = 0, chose_keyboard_if = 0, chose_msc_if = 0;
     usb_interface_descriptor_t first_if = (usb_interface_descriptor_t){0};
     usb_interface_descriptor_t best_if  = (usb_interface_descriptor_t){0};
 
@@ -84,21 +86,31 @@ static int usb_parse_config_blob_into_device(const uint8_t *buf, uint16_t total_
                 id->interface_protocol == USB_PROTOCOL_KEYBOARD) {
                 memory_copy(&best_if, id, sizeof(*id));
                 chose_keyboard_if = 1;
+            } else if (!chose_keyboard_if && !chose_msc_if &&
+                       id->interface_class == USB_CLASS_MASS_STORAGE &&
+                       id->interface_subclass == USB_SUBCLASS_SCSI &&
+                       id->interface_protocol == USB_PROTOCOL_BULK_ONLY) {
+                memory_copy(&best_if, id, sizeof(*id));
+                chose_msc_if = 1;
             }
         }
         off += len;
     }
 
     if (!have_any_if) { UHCI_ERR("No interface descriptors in configuration blob\n"); return 0; }
-    if (!chose_keyboard_if) {
+    if (chose_keyboard_if) {
+        chose_msc_if = 0;
+    } else if (!chose_msc_if) {
         memory_copy(&best_if, &first_if, sizeof(best_if));
         UHCI_DBG("No HID Boot Keyboard IF; falling back to first interface\n");
     }
     memory_copy(&dev->interface_descriptor, &best_if, sizeof(best_if));
 
-    // Pass 2: find first Interrupt IN EP within chosen IF block
+    // Pass 2: within the chosen IF block, the first Interrupt IN EP goes to
+    // slot 0; for mass storage the first Bulk IN and Bulk OUT to slots 0 and 1
     off = 0;
-    int in_block = 0, have_ep_in = 0;
+    int in_block = 0;
+    unsigned found = 0, needed = chose_msc_if ? 0x3 : 0x1;
     while (off + 2 <= total_len) {
         uint8_t len = buf[off + 0], type = buf[off + 1];
         if (len == 0 || off + len > total_len) break;
@@ -109,17 +121,23 @@ static int usb_parse_config_blob_into_device(const uint8_t *buf, uint16_t total_
                        (id->alternate_setting == dev->interface_descriptor.alternate_setting);
         } else if (type == USB_DESC_TYPE_ENDPOINT && in_block) {
             const usb_endpoint_descriptor_t *ep = (const usb_endpoint_descriptor_t *)&buf[off];
-            if (((ep->attributes & 0x3) == 0x3) && (ep->endpoint_address & 0x80)) {
-                memory_copy(&dev->endpoint_descriptors[0], ep, sizeof(*ep));
-                have_ep_in = 1;
-                break;
+            int slot = -1;
+            if (chose_msc_if) {
+                if ((ep->attributes & 0x3) == 0x2) slot = (ep->endpoint_address & 0x80) ? 0 : 1;
+            } else if (((ep->attributes & 0x3) == 0x3) && (ep->endpoint_address & 0x80)) {
+                slot = 0;
+            }
+            if (slot >= 0 && !(found & (1u << slot))) {
+                memory_copy(&dev->endpoint_descriptors[slot], ep, sizeof(*ep));
+                found |= 1u << slot;
+                if (found == needed) break;
             }
         }
         off += len;
     }
 
-    if (!have_ep_in) {
-        UHCI_ERR("No interrupt IN endpoint found for interface %u (alt %u)\n",
+    if (found != needed) {
+        UHCI_ERR("No %s endpoints found for interface %u (alt %u)\n", chose_msc_if ? "bulk" : "interrupt IN",
                  dev->interface_descriptor.interface_number,
                  dev->interface_descriptor.alternate_setting);
         return 0;
@@ -193,13 +211,18 @@ void uhci_enumerate_device(uint16_t io_base, int port)
 
     uint16_t total_len = short_cfg.total_length;
     UHCI_DBG("Config total length = %u bytes\n", total_len);
+    if (total_len > UHCI_POOL_DESCRIPTOR_SIZE) {
+        // The parser copes with a truncated blob, the interfaces we care about come first
+        UHCI_WARN("Configuration blob truncated from %u to %u bytes\n", total_len, UHCI_POOL_DESCRIPTOR_SIZE);
+        total_len = UHCI_POOL_DESCRIPTOR_SIZE;
+    }
 
-    uint8_t *blob = (uint8_t *)aligned_alloc(16, total_len);
+    uint8_t *blob = (uint8_t *)uhci_pool_get_buffer(io_base, total_len);
     if (!blob) { UHCI_ERR("Alloc full configuration blob failed\n"); return; }
 
     if (!uhci_get_full_configuration_descriptor(io_base, address, blob, total_len)) {
         UHCI_ERR("Failed to get full configuration descriptor\n");
-        aligned_free(blob);
+        uhci_pool_put_buffer(io_base, blob);
         return;
     }
 
@@ -209,10 +232,10 @@ void uhci_enumerate_device(uint16_t io_base, int port)
 
     if (!usb_parse_config_blob_into_device(blob, total_len, dev)) {
         UHCI_WARN("Parsing configuration blob failed (no suitable interface/endpoint)\n");
-        aligned_free(blob);
+        uhci_pool_put_buffer(io_base, blob);
         return;
     }
-    aligned_free(blob);
+    uhci_pool_put_buffer(io_base, blob);
 
     if (!uhci_set_configuration(io_base, address, dev->config_descriptor.configuration_value)) {
         UHCI_ERR("Failed to set configuration on port %d\n", port);
@@ -243,6 +266,10 @@ void uhci_enumerate_device(uint16_t io_base, int port)
                 UHCI_ERR("Failed to open UHCI KBD interrupt pipe\n");
             }
         }
+    } else if (ifs->interface_class == USB_CLASS_MASS_STORAGE &&
+               ifs->interface_subclass == USB_SUBCLASS_SCSI &&
+               ifs->interface_protocol == USB_PROTOCOL_BULK_ONLY) {
+        usb_msc_attach(&uhci_hc_ops, io_base, dev);
     }
 
     UHCI_INFO("\n");
@@ -2,20 +2,6 @@
 #include "uhci.h"
 #include "../../keyboard/keyboard.h"
 #include "libc/mem.h"
-#include "cpu/ports.h"
-
-#define TD_ACTIVE   (1u << 23)   // 0x0080_0000 in your code
-#define TD_IOC      (1u << 24)   // raise IRQ on completion
-#define TD_SPD      (1u << 29)   // Short Packet Detect (recommended for IN)
-
-#define TD_STALLED  (1u << 22)
-#define TD_DBE      (1u << 21)
-#define TD_BABBLE   (1u << 20)
-#define TD_NAK      (1u << 19)
-#define TD_TIMEOUT  (1u << 18)
-#define TD_BITSTUFF (1u << 17)
-#define TD_ERR_MASK (TD_STALLED | TD_DBE | TD_BABBLE | TD_TIMEOUT | TD_BITSTUFF)
-#define TD_ACTLEN_MASK 0x7FF
 
 typedef struct {
     uint8_t      in_use;
@@ -25,7 +11,9 @@ typedef struct {
     uint8_t      interval;      // in frames (ms at FS)
     uint8_t      dev_index;     // from keyboard_register_usb_boot_keyboard(...)
     uint8_t      toggle;        // DATA0/1 -> bit19 in token
-    uint16_t     first_slot;    // first frame slot used
+    bool         low_speed;     // TD LS bit, 1.5 Mb/s bus time
+    int          queue;         // schedule queue id
+    uint16_t     bus_us;        // periodic time reserved
     uint8_t      *buf;          // 8-byte report
     uhci_td_t    *td;           // single persistent TD
     uhci_qh_t    *qh;           // QH anchoring the TD
@@ -58,23 +46,6 @@ static inline uint32_t uhci_build_in_token(uint8_t addr, uint8_t ep, uint8_t tog
             | (m1 << 21);
 }
 
-static void place_qh_every_interval(uhci_kbd_pipe_t *p)
-{
-    // Place the QH into the frame list every 'interval' frames.
-    // Use current frame number + 1 as a starting slot to avoid racing the current frame.
-    uint16_t io = p->io_base;
-    uint16_t start = ((uint16_t)port_word_in(io + 0x06) & 0x7FF) + 1;
-    p->first_slot = start % 1024;
-
-    for (uint16_t f = p->first_slot; f < 1024; f = (uint16_t)((f + p->interval) % 1024)) {
-        // Protect against interval==0 (shouldn’t happen for HID; spec says >=1). Just in case:
-        if (p->interval == 0) break;
-        frame_list[f] = get_physical_address(p->qh) | 0x00000002; // QH bit set
-        // Stop once we wrap and hit the first slot again.
-        if ((uint16_t)((f + p->interval) % 1024) == p->first_slot) break;
-    }
-}
-
 static void uhci_kbd_rearm_td(uhci_kbd_pipe_t *p, bool advance_toggle)
 {
     if (advance_toggle) {
@@ -83,7 +54,7 @@ static void uhci_kbd_rearm_td(uhci_kbd_pipe_t *p, bool advance_toggle)
 
     p->td->token = uhci_build_in_token(p->dev_addr, p->ep, p->toggle, 8);
     p->td->control_status  = TD_ACTLEN_MASK;
-    p->td->control_status |= TD_SPD | TD_IOC | TD_ACTIVE;
+    p->td->control_status |= TD_SPD | TD_IOC | TD_ACTIVE | (p->low_speed ? TD_LS : 0);
     p->qh->vertical_link_pointer = get_physical_address(p->td);
 
     __asm__ __volatile__("" ::: "memory");
@@ -105,39 +76,35 @@ int uhci_kbd_open_interrupt_in(uint16_t io_base,
             p->dev_addr = dev_addr;
             p->ep       = ep_number_from_addr(endpoint_address);
             p->interval = (interval_frames == 0) ? 1 : interval_frames;
+            p->low_speed = uhci_device_low_speed(io_base, dev_addr);
             p->dev_index= (uint8_t)keyboard_dev_index;
             p->toggle   = 0; // HID interrupt IN typically starts with DATA1 (many stacks do this)
 
-            // Allocate objects
-            p->buf = (uint8_t*)aligned_alloc(16, 8);
+            // Take objects from the controller pool (zeroed)
+            p->buf = (uint8_t*)uhci_pool_get_buffer(io_base, 8);
             if (!p->buf) goto fail;
-            memory_set(p->buf, 0, 8);
 
-            p->td = (uhci_td_t*)aligned_alloc(16, sizeof(uhci_td_t));
-            p->qh = (uhci_qh_t*)aligned_alloc(16, sizeof(uhci_qh_t));
+            p->td = uhci_pool_get_td(io_base);
+            p->qh = uhci_pool_get_qh(io_base);
             if (!p->td || !p->qh) goto fail;
 
-            memory_set(p->td, 0, sizeof(*p->td));
-            memory_set(p->qh, 0, sizeof(*p->qh));
-
             // TD
             p->td->link_pointer   = 0x00000001; // terminate
             p->td->buffer_pointer = get_physical_address(p->buf);
             uhci_kbd_rearm_td(p, false);
 
-            // QH
-            p->qh->horizontal_link_pointer = 0x00000001; // terminate
-            p->qh->vertical_link_pointer   = get_physical_address(p->td);
-
-            // Schedule QH in frame list every interval frames
-            place_qh_every_interval(p);
+            // QH, polled every interval frames from the interrupt tree
+            p->qh->vertical_link_pointer = get_physical_address(p->td);
+            p->bus_us = uhci_bus_time_us(p->low_speed, 8);
+            p->queue  = uhci_schedule_add_periodic(io_base, p->qh, p->interval, p->bus_us);
+            if (p->queue < 0) goto fail;
 
             return i;
 
         fail:
-            if (p->td) aligned_free(p->td);
-            if (p->qh) aligned_free(p->qh);
-            if (p->buf) aligned_free(p->buf);
+            if (p->td) uhci_pool_put_td(io_base, p->td);
+            if (p->qh) uhci_pool_put_qh(io_base, p->qh);
+            if (p->buf) uhci_pool_put_buffer(io_base, p->buf);
             memory_set(p, 0, sizeof(*p));
             return -1;
         }
@@ -151,17 +118,13 @@ void uhci_kbd_close(int pipe_id)
     uhci_kbd_pipe_t *p = &g_kbd_pipes[pipe_id];
     if (!p->in_use) return;
 
-    // Remove QH from the frame list slots we used
-    if (p->interval) {
-        for (uint16_t f = p->first_slot; f < 1024; f = (uint16_t)((f + p->interval) % 1024)) {
-            frame_list[f] = 0x00000001; // terminate
-            if ((uint16_t)((f + p->interval) % 1024) == p->first_slot) break;
-        }
-    }
+    // Off the schedule, and out of the controller's hands, before freeing
+    uhci_schedule_remove(p->io_base, p->qh, p->queue, p->bus_us);
+    uhci_schedule_wait_frame(p->io_base);
 
-    if (p->td)  aligned_free(p->td);
-    if (p->qh)  aligned_free(p->qh);
-    if (p->buf) aligned_free(p->buf);
+    if (p->td)  uhci_pool_put_td(p->io_base, p->td);
+    if (p->qh)  uhci_pool_put_qh(p->io_base, p->qh);
+    if (p->buf) uhci_pool_put_buffer(p->io_base, p->buf);
     memory_set(p, 0, sizeof(*p));
 }
 
@@ -0,0 +1,198 @@
+// drivers/usb/uhci/pool.c
+// Preallocated TD/QH/buffer pools, one per controller.
+//
+// Everything the schedule points at comes from one physically contiguous
+// block of pages per controller, checked to lie below 4 GiB (UHCI link and
+// buffer pointers are 32-bit). Free objects are tracked by
+// index in lock-free stacks; the head carries a tag bumped on every update so
+// a pop racing with pop+push from the IRQ path cannot succeed on a stale head.
+#include "uhci.h"
+#include "libc/mem.h"
+#include "kernel/mm/page_alloc.h"
+
+#define UHCI_POOL_MAX_OBJECTS UHCI_POOL_TDS
+
+#define STACK_EMPTY    0
+#define STACK_TAG_STEP 0x10000u
+
+typedef struct {
+    uint32_t head;                          // (tag << 16) | (index + 1)
+    uint16_t next[UHCI_POOL_MAX_OBJECTS];   // index + 1 of the next free object
+} uhci_free_stack_t;
+
+typedef struct {
+    uhci_td_t tds[UHCI_POOL_TDS];
+    uhci_qh_t qhs[UHCI_POOL_QHS];
+    uint8_t   buffers[UHCI_POOL_BUFFERS][UHCI_POOL_BUFFER_SIZE] __attribute__((aligned(16)));
+    uint8_t   descriptor_buffer[UHCI_POOL_DESCRIPTOR_SIZE] __attribute__((aligned(16)));
+    uhci_free_stack_t free_tds;
+    uhci_free_stack_t free_qhs;
+    uhci_free_stack_t free_buffers;
+    uint8_t   descriptor_busy;
+    uint8_t   in_use;
+    uint16_t  io_base;
+} uhci_pool_t;
+
+_Static_assert(UHCI_POOL_QHS <= UHCI_POOL_MAX_OBJECTS && UHCI_POOL_BUFFERS <= UHCI_POOL_MAX_OBJECTS,
+               "free stack too small for the pool sizes");
+
+static uhci_pool_t *g_uhci_pools[UHCI_POOL_MAX_CONTROLLERS];
+
+static void stack_init(uhci_free_stack_t *s, uint16_t count)
+{
+    for (uint16_t i = 0; i < count; i++) {
+        s->next[i] = (uint16_t)((i + 1 < count) ? i + 2 : STACK_EMPTY);
+    }
+    __atomic_store_n(&s->head, count ? 1u : STACK_EMPTY, __ATOMIC_RELEASE);
+}
+
+static int stack_pop(uhci_free_stack_t *s)
+{
+    uint32_t old = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint16_t top = (uint16_t)(old & 0xFFFF);
+        if (top == STACK_EMPTY) return -1;
+        uint16_t next = __atomic_load_n(&s->next[top - 1], __ATOMIC_RELAXED);
+        uint32_t desired = ((old + STACK_TAG_STEP) & 0xFFFF0000u) | next;
+        if (__atomic_compare_exchange_n(&s->head, &old, desired, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return top - 1;
+        }
+    }
+}
+
+static void stack_push(uhci_free_stack_t *s, uint16_t index)
+{
+    uint32_t old = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+    for (;;) {
+        __atomic_store_n(&s->next[index], (uint16_t)(old & 0xFFFF), __ATOMIC_RELAXED);
+        uint32_t desired = ((old + STACK_TAG_STEP) & 0xFFFF0000u) | (uint32_t)(index + 1);
+        if (__atomic_compare_exchange_n(&s->head, &old, desired, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+}
+
+static uhci_pool_t *pool_for(uint16_t io_base)
+{
+    for (int i = 0; i < UHCI_POOL_MAX_CONTROLLERS; i++) {
+        if (g_uhci_pools[i] && g_uhci_pools[i]->in_use && g_uhci_pools[i]->io_base == io_base) return g_uhci_pools[i];
+    }
+    UHCI_ERR("No TD/QH pool for IO base 0x%x\n", io_base);
+    return NULL;
+}
+
+bool uhci_pool_init(uint16_t io_base)
+{
+    int slot = -1;
+    for (int i = 0; i < UHCI_POOL_MAX_CONTROLLERS; i++) {
+        if (g_uhci_pools[i] && g_uhci_pools[i]->io_base == io_base) { slot = i; break; }
+        if (slot < 0 && (!g_uhci_pools[i] || !g_uhci_pools[i]->in_use)) slot = i;
+    }
+    if (slot < 0) {
+        UHCI_ERR("Out of TD/QH pools (max %d controllers)\n", UHCI_POOL_MAX_CONTROLLERS);
+        return false;
+    }
+    if (!g_uhci_pools[slot]) {
+        size_t pages = (sizeof(uhci_pool_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+        uhci_pool_t *block = page_alloc_ready() ? page_alloc_pages(pages) : NULL;
+        if (!block || get_physical_address((uint8_t *)block + pages * PAGE_SIZE - 1) > 0xFFFFFFFFu) {
+            UHCI_ERR("No memory below 4 GiB for the TD/QH pool\n");
+            if (block) page_free(block);
+            return false;
+        }
+        g_uhci_pools[slot] = block;
+    }
+    uhci_pool_t *pool = g_uhci_pools[slot];
+
+    pool->io_base = io_base;
+    pool->descriptor_busy = 0;
+    stack_init(&pool->free_tds, UHCI_POOL_TDS);
+    stack_init(&pool->free_qhs, UHCI_POOL_QHS);
+    stack_init(&pool->free_buffers, UHCI_POOL_BUFFERS);
+    pool->in_use = 1;
+    UHCI_DBG("Pool ready for IO base 0x%x: %d TDs, %d QHs, %d buffers\n",
+             io_base, UHCI_POOL_TDS, UHCI_POOL_QHS, UHCI_POOL_BUFFERS);
+    return true;
+}
+
+uhci_td_t *uhci_pool_get_td(uint16_t io_base)
+{
+    uhci_pool_t *pool = pool_for(io_base);
+    if (!pool) return NULL;
+    int index = stack_pop(&pool->free_tds);
+    if (index < 0) { UHCI_ERR("TD pool exhausted\n"); return NULL; }
+    uhci_td_t *td = &pool->tds[index];
+    memory_set(td, 0, sizeof(*td));
+    return td;
+}
+
+void uhci_pool_put_td(uint16_t io_base, uhci_td_t *td)
+{
+    uhci_pool_t *pool = pool_for(io_base);
+    if (!pool || !td) return;
+    if (td < pool->tds || td >= pool->tds + UHCI_POOL_TDS) { UHCI_ERR("TD %p not from this pool\n", (void *)td); return; }
+    stack_push(&pool->free_tds, (uint16_t)(td - pool->tds));
+}
+
+uhci_qh_t *uhci_pool_get_qh(uint16_t io_base)
+{
+    uhci_pool_t *pool = pool_for(io_base);
+    if (!pool) return NULL;
+    int index = stack_pop(&pool->free_qhs);
+    if (index < 0) { UHCI_ERR("QH pool exhausted\n"); return NULL; }
+    uhci_qh_t *qh = &pool->qhs[index];
+    memory_set(qh, 0, sizeof(*qh));
+    return qh;
+}
+
+void uhci_pool_put_qh(uint16_t io_base, uhci_qh_t *qh)
+{
+    uhci_pool_t *pool = pool_for(io_base);
+    if (!pool || !qh) return;
+    if (qh < pool->qhs || qh >= pool->qhs + UHCI_POOL_QHS) { UHCI_ERR("QH %p not from this pool\n", (void *)qh); return; }
+    stack_push(&pool->free_qhs, (uint16_t)(qh - pool->qhs));
+}
+
+void *uhci_pool_get_buffer(uint16_t io_base, size_t size)
+{
+    uhci_pool_t *pool = pool_for(io_base);
+    if (!pool) return NULL;
+
+    if (size <= UHCI_POOL_BUFFER_SIZE) {
+        int index = stack_pop(&pool->free_buffers);
+        if (index < 0) { UHCI_ERR("Buffer pool exhausted\n"); return NULL; }
+        memory_set(pool->buffers[index], 0, size);
+        return pool->buffers[index];
+    }
+    if (size <= UHCI_POOL_DESCRIPTOR_SIZE) {
+        if (__atomic_exchange_n(&pool->descriptor_busy, 1, __ATOMIC_ACQUIRE)) {
+            UHCI_ERR("Descriptor buffer busy\n");
+            return NULL;
+        }
+        memory_set(pool->descriptor_buffer, 0, size);
+        return pool->descriptor_buffer;
+    }
+    UHCI_ERR("No pool buffer for %u bytes\n", (unsigned)size);
+    return NULL;
+}
+
+void uhci_pool_put_buffer(uint16_t io_base, void *buffer)
+{
+    uhci_pool_t *pool = pool_for(io_base);
+    if (!pool || !buffer) return;
+
+    uint8_t *p = (uint8_t *)buffer;
+    if (p == pool->descriptor_buffer) {
+        __atomic_store_n(&pool->descriptor_busy, 0, __ATOMIC_RELEASE);
+        return;
+    }
+    uint8_t *first = pool->buffers[0];
+    if (p < first || p >= first + sizeof(pool->buffers) ||
+        ((size_t)(p - first) % UHCI_POOL_BUFFER_SIZE) != 0) {
+        UHCI_ERR("Buffer %p not from this pool\n", buffer);
+        return;
+    }
+    stack_push(&pool->free_buffers, (uint16_t)((size_t)(p - first) / UHCI_POOL_BUFFER_SIZE));
+}
@@ -0,0 +1,240 @@
+// drivers/usb/uhci/schedule.c
+// Frame list and QH skeleton, one per controller.
+//
+// Interrupt endpoints hang off a binary tree of skeleton QHs: the node for
+// period P (1, 2, 4, ..., 128 frames) and phase p is linked to the node for
+// P/2 and phase p % (P/2), and frame f starts at the node for 128 and phase
+// f % 128. A frame therefore visits exactly one node per period, and an
+// endpoint queued under (P, p) is polled every P frames. The period-1 node
+// leads to the control queue head, which leads to the bulk queue head:
+//
+//   frame f -> [128, f%128] -> [64, f%64] -> ... -> [1, 0] -> control -> bulk -> T
+//
+// Endpoint QHs are only ever inserted between a skeleton QH and the next one
+// and removed by relinking their predecessor, so adding or removing one
+// endpoint never changes what the controller sees of the others. Periodic
+// time is reserved per frame; a period-P endpoint takes the phase whose
+// frames are least loaded.
+#include "uhci.h"
+#include "cpu/isr.h"
+#include "cpu/ports.h"
+#include "libc/mem.h"
+#include "kernel/mm/page_alloc.h"
+
+#define TREE_NODES   (2 * UHCI_PERIOD_MAX - 1)
+#define QUEUE_CONTROL TREE_NODES
+#define QUEUE_BULK    (TREE_NODES + 1)
+#define SKELETON_QHS  (TREE_NODES + 2)
+#define FRAMES 1024
+
+typedef struct {
+    uint8_t    in_use;
+    uint16_t   io_base;
+    uint32_t  *frames;                      // 1024 entries, page aligned
+    uhci_qh_t *skeleton;                    // tree nodes, then control and bulk heads
+    uint16_t   load_us[UHCI_PERIOD_MAX];    // reserved periodic time, frames repeat every 128
+} uhci_schedule_t;
+
+_Static_assert(FRAMES * sizeof(uint32_t) == PAGE_SIZE, "frame list is one page");
+
+static uhci_schedule_t g_schedules[UHCI_POOL_MAX_CONTROLLERS];
+
+static uhci_schedule_t *schedule_for(uint16_t io_base)
+{
+    for (int i = 0; i < UHCI_POOL_MAX_CONTROLLERS; i++) {
+        if (g_schedules[i].in_use && g_schedules[i].io_base == io_base) return &g_schedules[i];
+    }
+    return NULL;
+}
+
+static inline uint32_t qh_link(const uhci_qh_t *qh)
+{
+    return (uint32_t)get_physical_address((void *)qh) | UHCI_LINK_QH;
+}
+
+static inline uhci_qh_t *qh_from_link(uint32_t link)
+{
+    return (link & UHCI_LINK_TERMINATE) ? NULL : (uhci_qh_t *)(uintptr_t)(link & ~0xFu);
+}
+
+// Tree node of period 'period' (a power of two) and phase 'phase' < period
+static inline int tree_node(uint32_t period, uint32_t phase)
+{
+    return (int)(period - 1 + phase);
+}
+
+// Period of tree node 'queue': nodes P-1 .. 2P-2 have period P
+static inline uint32_t node_period(int queue)
+{
+    uint32_t period = 1;
+    while (period * 2 - 1 <= (uint32_t)queue) period *= 2;
+    return period;
+}
+
+// What a queue ends in: the link its skeleton QH had when built
+static uint32_t queue_end(const uhci_schedule_t *s, int queue)
+{
+    if (queue == QUEUE_BULK) return UHCI_LINK_TERMINATE;
+    if (queue == QUEUE_CONTROL) return qh_link(&s->skeleton[QUEUE_BULK]);
+    if (queue == 0) return qh_link(&s->skeleton[QUEUE_CONTROL]);
+    uint32_t period = node_period(queue);
+    uint32_t phase = (uint32_t)queue - (period - 1);
+    return qh_link(&s->skeleton[tree_node(period / 2, phase % (period / 2))]);
+}
+
+bool uhci_schedule_init(uint16_t io_base)
+{
+    uhci_schedule_t *s = NULL;
+    for (int i = 0; i < UHCI_POOL_MAX_CONTROLLERS; i++) {
+        if (g_schedules[i].in_use && g_schedules[i].io_base == io_base) { s = &g_schedules[i]; break; }
+        if (!s && !g_schedules[i].in_use) s = &g_schedules[i];
+    }
+    if (!s) {
+        UHCI_ERR("Out of schedules (max %d controllers)\n", UHCI_POOL_MAX_CONTROLLERS);
+        return false;
+    }
+
+    if (!s->frames) {
+        // Frame list page, then the skeleton; UHCI pointers are 32-bit
+        size_t pages = 1 + (SKELETON_QHS * sizeof(uhci_qh_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+        uint8_t *block = page_alloc_ready() ? page_alloc_pages(pages) : NULL;
+        if (!block || get_physical_address(block + pages * PAGE_SIZE - 1) > 0xFFFFFFFFu) {
+            UHCI_ERR("No memory below 4 GiB for the frame list\n");
+            if (block) page_free(block);
+            return false;
+        }
+        s->frames = (uint32_t *)block;
+        s->skeleton = (uhci_qh_t *)(block + PAGE_SIZE);
+    }
+    s->io_base = io_base;
+    s->in_use = 1;
+    memory_set(s->load_us, 0, sizeof(s->load_us));
+
+    for (int q = 0; q < SKELETON_QHS; q++) {
+        s->skeleton[q].horizontal_link_pointer = queue_end(s, q);
+        s->skeleton[q].vertical_link_pointer   = UHCI_LINK_TERMINATE;
+    }
+    for (int f = 0; f < FRAMES; f++) {
+        s->frames[f] = qh_link(&s->skeleton[tree_node(UHCI_PERIOD_MAX, f % UHCI_PERIOD_MAX)]);
+    }
+    UHCI_DBG("Schedule for IO base 0x%x: %d skeleton QHs\n", io_base, SKELETON_QHS);
+    return true;
+}
+
+uint32_t uhci_schedule_frame_list(uint16_t io_base)
+{
+    uhci_schedule_t *s = schedule_for(io_base);
+    return s ? (uint32_t)get_physical_address(s->frames) : 0;
+}
+
+// Append 'qh' to the queue behind skeleton QH 'queue'
+static void queue_insert(uhci_schedule_t *s, int queue, uhci_qh_t *qh)
+{
+    uint32_t end = queue_end(s, queue);
+    uint64_t flags = irq_save();
+    uhci_qh_t *prev = &s->skeleton[queue];
+    while (prev->horizontal_link_pointer != end) {
+        prev = qh_from_link(prev->horizontal_link_pointer);
+    }
+    qh->horizontal_link_pointer = end;
+    // The QH is complete before the controller can reach it
+    __atomic_store_n(&prev->horizontal_link_pointer, qh_link(qh), __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
+
+int uhci_schedule_add_async(uint16_t io_base, uhci_qh_t *qh, bool bulk)
+{
+    uhci_schedule_t *s = schedule_for(io_base);
+    if (!s || !qh) return -1;
+    int queue = bulk ? QUEUE_BULK : QUEUE_CONTROL;
+    queue_insert(s, queue, qh);
+    return queue;
+}
+
+int uhci_schedule_add_periodic(uint16_t io_base, uhci_qh_t *qh, uint8_t interval, uint16_t bus_us)
+{
+    uhci_schedule_t *s = schedule_for(io_base);
+    if (!s || !qh) return -1;
+
+    // Largest power of two not above the interval: polling more often is allowed
+    uint32_t period = 1;
+    while (period * 2 <= interval && period < UHCI_PERIOD_MAX) period *= 2;
+
+    uint64_t flags = irq_save();
+    uint32_t best_phase = 0, best_load = UINT32_MAX;
+    for (uint32_t phase = 0; phase < period; phase++) {
+        uint32_t load = 0;
+        for (uint32_t f = phase; f < UHCI_PERIOD_MAX; f += period) {
+            if (s->load_us[f] > load) load = s->load_us[f];
+        }
+        if (load < best_load) { best_load = load; best_phase = phase; }
+    }
+    if (best_load + bus_us > UHCI_PERIODIC_BUDGET_US) {
+        irq_restore(flags);
+        UHCI_ERR("No periodic bandwidth for %u us every %u frames (%u us used)\n",
+                 bus_us, period, best_load);
+        return -1;
+    }
+    for (uint32_t f = best_phase; f < UHCI_PERIOD_MAX; f += period) {
+        s->load_us[f] += bus_us;
+    }
+    irq_restore(flags);
+
+    int queue = tree_node(period, best_phase);
+    queue_insert(s, queue, qh);
+    UHCI_DBG("Periodic QH every %u frames at phase %u, %u us, frame load up to %u/%u us\n",
+             period, best_phase, bus_us, best_load + bus_us, UHCI_PERIODIC_BUDGET_US);
+    return queue;
+}
+
+void uhci_schedule_remove(uint16_t io_base, uhci_qh_t *qh, int queue, uint16_t bus_us)
+{
+    uhci_schedule_t *s = schedule_for(io_base);
+    if (!s || !qh || queue < 0 || queue >= SKELETON_QHS) return;
+
+    uint32_t target = qh_link(qh);
+    uint32_t end = queue_end(s, queue);
+    uint64_t flags = irq_save();
+    uhci_qh_t *prev = &s->skeleton[queue];
+    while (prev->horizontal_link_pointer != target && prev->horizontal_link_pointer != end) {
+        prev = qh_from_link(prev->horizontal_link_pointer);
+    }
+    if (prev->horizontal_link_pointer != target) {
+        irq_restore(flags);
+        UHCI_ERR("QH %p is not on queue %d\n", (void *)qh, queue);
+        return;
+    }
+    prev->horizontal_link_pointer = qh->horizontal_link_pointer;
+
+    if (queue < TREE_NODES) {
+        uint32_t period = node_period(queue);
+        for (uint32_t f = (uint32_t)queue - (period - 1); f < UHCI_PERIOD_MAX; f += period) {
+            s->load_us[f] = (s->load_us[f] > bus_us) ? (uint16_t)(s->load_us[f] - bus_us) : 0;
+        }
+    }
+    irq_restore(flags);
+}
+
+void uhci_schedule_wait_frame(uint16_t io_base)
+{
+    uint16_t frame = port_word_in(io_base + 0x06) & 0x7FF;
+    while ((port_word_in(io_base + 0x06) & 0x7FF) == frame) {
+        __asm__ volatile ("pause");
+    }
+}
+
+uint16_t uhci_schedule_frame_load(uint16_t io_base, uint16_t frame)
+{
+    uhci_schedule_t *s = schedule_for(io_base);
+    return s ? s->load_us[frame % UHCI_PERIOD_MAX] : 0;
+}
+
+uint16_t uhci_bus_time_us(bool low_speed, uint16_t bytes)
+{
+    // USB 2.0 5.11.3 for non-isochronous transactions, bit stuffing taken
+    // as the worst case 7/6; full speed 83.54 ns and low speed 676.67 ns a bit
+    uint32_t bits = 32 + 7u * 8u * bytes / 6u;
+    uint32_t ns = low_speed ? 64060u + 2u * 1000u + bits * 677u
+                            : 9107u + 1000u + bits * 84u;
+    return (uint16_t)((ns + 999) / 1000);
+}
@@ -2,170 +2,114 @@
 #include "../usb.h"
 #include "cpu/ports.h"
 #include "cpu/timer.h"
-#include "libc/mem.h"
-#include "libc/function.h"
 
-// TD/QH/setup types come from your existing uhci headers
-// allocate/free helpers kept TU-local (not exported)
+// Standard requests on endpoint 0, run through the URB engine (urb.c) and
+// waited for. They return 1 on success and 0 on failure.
 
-static uhci_td_t *allocate_td(void)
-{
-    uhci_td_t *td = (uhci_td_t *)aligned_alloc(16, sizeof(uhci_td_t));
-    if (!td) { UHCI_ERR("TD allocation failed\n"); return NULL; }
-    memory_set(td, 0, sizeof(*td));
-    return td;
-}
+#define EP0_SLOTS 16
+
+// Endpoint 0 max packet size of each addressed device, learnt from the first
+// 8 bytes of its device descriptor; 8 (what every device accepts) until then.
+// The speed comes from the root port's PORTSC when the address is set.
+typedef struct {
+    uint16_t io_base;
+    uint8_t  address;
+    uint8_t  max_packet;    // 0 when the slot is free
+    bool     low_speed;
+} ep0_info_t;
+
+static ep0_info_t g_ep0[EP0_SLOTS];
 
-static uhci_qh_t *allocate_qh(void)
+static ep0_info_t *ep0_slot(uint16_t io_base, uint8_t addr, bool create)
 {
-    uhci_qh_t *qh = (uhci_qh_t *)aligned_alloc(16, sizeof(uhci_qh_t));
-    if (!qh) { UHCI_ERR("QH allocation failed\n"); return NULL; }
-    memory_set(qh, 0, sizeof(*qh));
-    return qh;
+    ep0_info_t *free_slot = NULL;
+    for (int i = 0; i < EP0_SLOTS; i++) {
+        if (g_ep0[i].max_packet && g_ep0[i].io_base == io_base && g_ep0[i].address == addr) {
+            return &g_ep0[i];
+        }
+        if (!free_slot && !g_ep0[i].max_packet) free_slot = &g_ep0[i];
+    }
+    if (!create || !free_slot) return NULL;
+    free_slot->io_base = io_base;
+    free_slot->address = addr;
+    free_slot->low_speed = false;
+    return free_slot;
 }
 
-static usb_setup_packet_t *allocate_setup_packet(void)
+bool uhci_device_low_speed(uint16_t io_base, uint8_t addr)
 {
-    usb_setup_packet_t *p = (usb_setup_packet_t *)aligned_alloc(16, sizeof(usb_setup_packet_t));
-    if (!p) { UHCI_ERR("Failed to allocate Setup Packet\n"); return NULL; }
-    memory_set(p, 0, sizeof(*p));
-    return p;
+    ep0_info_t *ep0 = ep0_slot(io_base, addr, false);
+    return ep0 && ep0->low_speed;
 }
 
-static void free_td(uhci_td_t *td) { aligned_free(td); }
-static void free_qh(uhci_qh_t *qh) { aligned_free(qh); }
-static void free_setup_packet(usb_setup_packet_t *sp) { aligned_free(sp); }
-
-static int uhci_wait_for_transfer_complete(uhci_td_t *td)
+static int control_request(uint16_t io_base, uint8_t addr, uint8_t request_type, uint8_t request,
+                           uint16_t value, void *data, uint16_t length)
 {
-    int timeout = 3000; // ms
-    UHCI_TRACE("Waiting for TD completion @%p\n", td);
-    while ((td->control_status & 0x800000) && timeout-- > 0) sleep_ms(1);
-
-    if (timeout <= 0)      { UHCI_ERR("Transfer timeout (TD=0x%x)\n", td->control_status); return -1; }
-    if (td->control_status & (1 << 22)) { UHCI_ERR("Transfer stalled\n"); return -2; }
-    if (td->control_status & (1 << 21)) { UHCI_ERR("Data Buffer Error\n"); return -3; }
-    if (td->control_status & (1 << 20)) { UHCI_ERR("Babble Detected\n"); return -4; }
-    if (td->control_status & (1 << 19)) { UHCI_WARN("NAK Received\n");   return -5; }
-    if (td->control_status & (1 << 18)) { UHCI_ERR("CRC/Timeout Error\n"); return -6; }
-    if (td->control_status & (1 << 17)) { UHCI_ERR("Bit Stuff Error\n"); return -7; }
-    return 1;
+    ep0_info_t *ep0 = ep0_slot(io_base, addr, false);
+    usb_setup_packet_t setup = {
+        .bmRequestType = request_type,
+        .bRequest      = request,
+        .wValue        = value,
+        .wIndex        = 0,
+        .wLength       = length,
+    };
+    return usb_control_transfer(&uhci_hc_ops, io_base, addr, ep0 ? ep0->max_packet : 8,
+                                ep0 && ep0->low_speed, &setup, data);
 }
 
 // ---- Public control helpers ----
 
 int uhci_set_device_address(uint16_t io_base, uint8_t port, uint8_t new_address)
 {
-    usb_setup_packet_t *sp = allocate_setup_packet();
-    if (!sp) return 0;
-
-    sp->bmRequestType = 0x00; // Host->Device, std, device
-    sp->bRequest      = 0x05; // SET_ADDRESS
-    sp->wValue        = new_address;
-    sp->wIndex        = 0;
-    sp->wLength       = 0;
-
-    UNUSED(port);
-
-    uhci_td_t *td_setup  = allocate_td();
-    uhci_td_t *td_status = allocate_td();
-    uhci_qh_t *qh        = allocate_qh();
-    if (!td_setup || !td_status || !qh) { UHCI_ERR("Alloc TD/QH SET_ADDRESS\n"); return 0; }
-
-    td_setup->link_pointer   = get_physical_address(td_status) | 0x04;
-    td_setup->control_status = 0x800000;
-    td_setup->token          = (0x2D) | (0 << 8) | (0 << 15) | (7 << 21);
-    td_setup->buffer_pointer = get_physical_address(sp);
-
-    td_status->link_pointer   = 0x00000001;
-    td_status->control_status = 0x800000;
-    td_status->token          = (0x69) | (0 << 8) | (0 << 15) | (0 << 21);
-    td_status->buffer_pointer = 0;
-
-    qh->horizontal_link_pointer = 0x00000001;
-    qh->vertical_link_pointer    = get_physical_address(td_setup);
-
-    uint16_t cur  = port_word_in(io_base + 0x06) & 0x7FF;
-    uint16_t fr   = cur + 1;
-    frame_list[fr % 1024]         = get_physical_address(qh) | 0x00000002;
-    frame_list[(fr + 1) % 1024]   = get_physical_address(qh) | 0x00000002;
-
-    if (!(port_word_in(io_base + 0x00) & 0x01)) { UHCI_ERR("Controller not running\n"); return 0; }
-
-    if (uhci_wait_for_transfer_complete(td_status) != 1) { UHCI_ERR("SET_ADDRESS completion failed\n"); return 0; }
-
-    uint16_t st = port_word_in(io_base + 0x02);
-    if (st & 0x02) { UHCI_WARN("USBERRINT during SET_ADDRESS, clearing\n"); port_word_out(io_base + 0x02, 0x02); }
-
-    if (td_setup->control_status & 0x400000) {
-        UHCI_ERR("Error in SET_ADDRESS transfer (CS=0x%x)\n", td_setup->control_status);
-        frame_list[fr % 1024]       = 0x00000001;
-        frame_list[(fr + 1) % 1024] = 0x00000001;
-        free_td(td_setup); free_td(td_status); free_qh(qh); free_setup_packet(sp);
+    // Address 0 is the device on 'port' until SET_ADDRESS is through
+    bool low_speed = (port_word_in(io_base + PORT_SC_OFFSET + port * 2) & PORT_LOW_SPEED) != 0;
+    ep0_info_t *ep0 = ep0_slot(io_base, 0, true);
+    if (ep0) {
+        ep0->max_packet = 8;
+        ep0->low_speed = low_speed;
+    }
+    int rc = control_request(io_base, 0, 0x00, 0x05 /* SET_ADDRESS */, new_address, NULL, 0);
+    if (ep0) ep0->max_packet = 0;
+    if (rc < 0) {
+        UHCI_ERR("SET_ADDRESS completion failed (%d)\n", rc);
         return 0;
     }
 
-    frame_list[fr % 1024]       = 0x00000001;
-    frame_list[(fr + 1) % 1024] = 0x00000001;
-    free_td(td_setup); free_td(td_status); free_qh(qh); free_setup_packet(sp);
+    // A new device at this address, its endpoint 0 is not known yet
+    ep0 = ep0_slot(io_base, new_address, true);
+    if (ep0) {
+        ep0->max_packet = 8;
+        ep0->low_speed = low_speed;
+    }
 
-    sleep_ms(10);
+    sleep_ms(10);   // SET_ADDRESS recovery interval
     UHCI_INFO("SET_ADDRESS -> %u OK\n", new_address);
     return 1;
 }
 
 int uhci_get_device_descriptor(uint16_t io_base, uint8_t addr, usb_device_descriptor_t *dev_desc)
 {
-    usb_setup_packet_t *sp = allocate_setup_packet();
-    if (!sp) return 0;
-
-    sp->bmRequestType = 0x80;
-    sp->bRequest      = 0x06;
-    sp->wValue        = (USB_DESC_TYPE_DEVICE << 8) | 0x00;
-    sp->wIndex        = 0;
-    sp->wLength       = sizeof(*dev_desc);
-
-    uhci_td_t *td_setup  = allocate_td();
-    uhci_td_t *td_data   = allocate_td();
-    uhci_td_t *td_status = allocate_td();
-    uhci_qh_t *qh        = allocate_qh();
-    if (!td_setup || !td_data || !td_status || !qh) { UHCI_ERR("Alloc TD/QH GET_DEVICE\n"); return 0; }
-
-    td_setup->link_pointer   = get_physical_address(td_data) | 0x04;
-    td_setup->control_status = 0x800000;
-    td_setup->token          = (0x2D) | (addr << 8) | (0 << 15) | (7 << 21);
-    td_setup->buffer_pointer = get_physical_address(sp);
-
-    td_data->link_pointer   = get_physical_address(td_status) | 0x04;
-    td_data->control_status = 0x800000;
-    td_data->token          = (0x69) | (addr << 8) | (1 << 19) | ((sizeof(*dev_desc) - 1) << 21);
-    td_data->buffer_pointer = get_physical_address(dev_desc);
-
-    td_status->link_pointer   = 0x00000001;
-    td_status->control_status = 0x800000;
-    td_status->token          = (0xE1) | (addr << 8) | (1 << 19) | (0 << 21);
-    td_status->buffer_pointer = 0;
-
-    qh->horizontal_link_pointer = 0x00000001;
-    qh->vertical_link_pointer    = get_physical_address(td_setup);
-
-    uint16_t fr = (port_word_in(io_base + 0x06) & 0x7FF) + 1;
-    frame_list[fr % 1024]         = get_physical_address(qh) | 0x00000002;
-    frame_list[(fr + 1) % 1024]   = get_physical_address(qh) | 0x00000002;
-
-    if (uhci_wait_for_transfer_complete(td_status) != 1) { UHCI_ERR("GET_DEVICE completion failed\n"); return 0; }
-
-    if (td_data->control_status & 0x400000) {
-        UHCI_ERR("Error in GET_DEVICE transfer\n");
-        frame_list[fr % 1024]       = 0x00000001;
-        frame_list[(fr + 1) % 1024] = 0x00000001;
-        free_td(td_setup); free_td(td_data); free_td(td_status); free_qh(qh);
+    // The first 8 bytes fit in any endpoint 0 packet and hold bMaxPacketSize0
+    int rc = control_request(io_base, addr, 0x80, 0x06 /* GET_DESCRIPTOR */,
+                             (USB_DESC_TYPE_DEVICE << 8) | 0x00, dev_desc, 8);
+    if (rc < 8) {
+        UHCI_ERR("GET_DEVICE (8 bytes) completion failed (%d)\n", rc);
         return 0;
     }
+    uint8_t max_packet = dev_desc->max_packet_size;
+    if (max_packet != 8 && max_packet != 16 && max_packet != 32 && max_packet != 64) {
+        UHCI_WARN("Bogus EP0 max packet %u, using 8\n", max_packet);
+        max_packet = 8;
+    }
+    ep0_info_t *ep0 = ep0_slot(io_base, addr, true);
+    if (ep0) ep0->max_packet = max_packet;
 
-    frame_list[fr % 1024]       = 0x00000001;
-    frame_list[(fr + 1) % 1024] = 0x00000001;
-    free_td(td_setup); free_td(td_data); free_td(td_status); free_qh(qh);
+    rc = control_request(io_base, addr, 0x80, 0x06 /* GET_DESCRIPTOR */,
+                         (USB_DESC_TYPE_DEVICE << 8) | 0x00, dev_desc, sizeof(*dev_desc));
+    if (rc < 0) {
+        UHCI_ERR("GET_DEVICE completion failed (%d)\n", rc);
+        return 0;
+    }
 
     UHCI_INFO("Got DEVICE descriptor: VID=0x%x PID=0x%x\n", dev_desc->vendor_id, dev_desc->product_id);
     return 1;
@@ -173,153 +117,38 @@ int uhci_get_device_descriptor(uint16_t io_base, uint8_t addr, usb_device_descri
 
 int uhci_get_configuration_descriptor(uint16_t io_base, uint8_t addr, usb_configuration_descriptor_t *cfg)
 {
-    usb_setup_packet_t *sp = allocate_setup_packet();
-    if (!sp) return 0;
-
-    sp->bmRequestType = 0x80;
-    sp->bRequest      = 0x06;
-    sp->wValue        = (USB_DESC_TYPE_CONFIGURATION << 8) | 0x00;
-    sp->wIndex        = 0;
-    sp->wLength       = sizeof(*cfg);
-
-    uhci_td_t *td_setup  = allocate_td();
-    uhci_td_t *td_data   = allocate_td();
-    uhci_td_t *td_status = allocate_td();
-    uhci_qh_t *qh        = allocate_qh();
-    if (!td_setup || !td_data || !td_status || !qh) { UHCI_ERR("Alloc TD/QH GET_CONFIG\n"); return 0; }
-
-    td_setup->link_pointer   = get_physical_address(td_data) | 0x04;
-    td_setup->control_status = 0x800000;
-    td_setup->token          = (0x2D) | (addr << 8) | (0 << 15) | (7 << 21);
-    td_setup->buffer_pointer = get_physical_address(sp);
-
-    td_data->link_pointer   = get_physical_address(td_status) | 0x04;
-    td_data->control_status = 0x800000;
-    td_data->token          = (0x69) | (addr << 8) | (1 << 19) | ((sizeof(*cfg) - 1) << 21);
-    td_data->buffer_pointer = get_physical_address(cfg);
-
-    td_status->link_pointer   = 0x00000001;
-    td_status->control_status = 0x800000;
-    td_status->token          = (0xE1) | (addr << 8) | (1 << 19) | (0 << 21);
-    td_status->buffer_pointer = 0;
-
-    qh->horizontal_link_pointer = 0x00000001;
-    qh->vertical_link_pointer    = get_physical_address(td_setup);
-
-    uint16_t fr = port_word_in(io_base + 0x06) & 0x7FF;
-    frame_list[fr % 1024] = get_physical_address(qh) | 0x00000002;
-
-    if (uhci_wait_for_transfer_complete(td_data) != 1) {
-        UHCI_ERR("GET_CONFIG completion failed\n");
-        free_td(td_setup); free_td(td_data); free_td(td_status); free_qh(qh);
+    int rc = control_request(io_base, addr, 0x80, 0x06 /* GET_DESCRIPTOR */,
+                             (USB_DESC_TYPE_CONFIGURATION << 8) | 0x00, cfg, sizeof(*cfg));
+    if (rc < 0) {
+        UHCI_ERR("GET_CONFIG completion failed (%d)\n", rc);
         return 0;
     }
 
-    frame_list[fr % 1024] = 0x00000001;
-    free_td(td_setup); free_td(td_data); free_td(td_status); free_qh(qh);
-
     UHCI_DBG("Short CONFIG descriptor: total_len=%u ifaces=%u\n", cfg->total_length, cfg->num_interfaces);
     return 1;
 }
 
 int uhci_get_full_configuration_descriptor(uint16_t io_base, uint8_t addr, uint8_t *buf, uint16_t total_len)
 {
-    usb_setup_packet_t *sp = allocate_setup_packet();
-    if (!sp) return 0;
-
-    sp->bmRequestType = 0x80;
-    sp->bRequest      = 0x06;
-    sp->wValue        = (USB_DESC_TYPE_CONFIGURATION << 8) | 0x00;
-    sp->wIndex        = 0;
-    sp->wLength       = total_len;
-
-    uhci_td_t *td_setup  = allocate_td();
-    uhci_td_t *td_data   = allocate_td();
-    uhci_td_t *td_status = allocate_td();
-    uhci_qh_t *qh        = allocate_qh();
-    if (!td_setup || !td_data || !td_status || !qh) { UHCI_ERR("Alloc TD/QH GET_CONFIG(full)\n"); return 0; }
-
-    td_setup->link_pointer   = get_physical_address(td_data) | 0x04;
-    td_setup->control_status = 0x800000;
-    td_setup->token          = (0x2D) | (addr << 8) | (0 << 15) | (7 << 21);
-    td_setup->buffer_pointer = get_physical_address(sp);
-
-    td_data->link_pointer   = get_physical_address(td_status) | 0x04;
-    td_data->control_status = 0x800000;
-    td_data->token          = (0x69) | (addr << 8) | (1 << 19) | ((total_len - 1) << 21);
-    td_data->buffer_pointer = get_physical_address(buf);
-
-    td_status->link_pointer   = 0x00000001;
-    td_status->control_status = 0x800000;
-    td_status->token          = (0xE1) | (addr << 8) | (1 << 19) | (0 << 21);
-    td_status->buffer_pointer = 0;
-
-    qh->horizontal_link_pointer = 0x00000001;
-    qh->vertical_link_pointer    = get_physical_address(td_setup);
-
-    uint16_t fr = port_word_in(io_base + 0x06) & 0x7FF;
-    frame_list[fr % 1024] = get_physical_address(qh) | 0x00000002;
-
-    if (uhci_wait_for_transfer_complete(td_data) != 1) {
-        UHCI_ERR("GET_DESCRIPTOR (full config) failed\n");
-        free_td(td_setup); free_td(td_data); free_td(td_status); free_qh(qh); free_setup_packet(sp);
+    int rc = control_request(io_base, addr, 0x80, 0x06 /* GET_DESCRIPTOR */,
+                             (USB_DESC_TYPE_CONFIGURATION << 8) | 0x00, buf, total_len);
+    if (rc < 0) {
+        UHCI_ERR("GET_DESCRIPTOR (full config) failed (%d)\n", rc);
         return 0;
     }
 
-    frame_list[fr % 1024] = 0x00000001;
-    free_td(td_setup); free_td(td_data); free_td(td_status); free_qh(qh); free_setup_packet(sp);
-
-    UHCI_DBG("Full CONFIG blob fetched: %u bytes\n", total_len);
+    UHCI_DBG("Full CONFIG blob fetched: %d of %u bytes\n", rc, total_len);
     return 1;
 }
 
 int uhci_set_configuration(uint16_t io_base, uint8_t addr, uint8_t cfg_val)
 {
-    usb_setup_packet_t *sp = allocate_setup_packet();
-    if (!sp) return 0;
-
-    sp->bmRequestType = 0x00;
-    sp->bRequest      = 0x09; // SET_CONFIGURATION
-    sp->wValue        = cfg_val;
-    sp->wIndex        = 0;
-    sp->wLength       = 0;
-
-    uhci_td_t *td_setup  = allocate_td();
-    uhci_td_t *td_status = allocate_td();
-    uhci_qh_t *qh        = allocate_qh();
-    if (!td_setup || !td_status || !qh) { UHCI_ERR("Alloc TD/QH SET_CONFIG\n"); return 0; }
-
-    td_setup->link_pointer   = get_physical_address(td_status) | 0x04;
-    td_setup->control_status = 0x800000;
-    td_setup->token          = (0x2D) | (addr << 8) | (0 << 15) | (7 << 21);
-    td_setup->buffer_pointer = get_physical_address(sp);
-
-    td_status->link_pointer   = 0x00000001;
-    td_status->control_status = 0x800000;
-    td_status->token          = (0x69) | (addr << 8) | (1 << 19) | (0 << 21);
-    td_status->buffer_pointer = 0;
-
-    qh->horizontal_link_pointer = 0x00000001;
-    qh->vertical_link_pointer    = get_physical_address(td_setup);
-
-    uint16_t fr = (port_word_in(io_base + 0x06) & 0x7FF) + 1;
-    frame_list[fr % 1024]         = get_physical_address(qh) | 0x00000002;
-    frame_list[(fr + 1) % 1024]   = get_physical_address(qh) | 0x00000002;
-
-    if (uhci_wait_for_transfer_complete(td_status) != 1) { UHCI_ERR("SET_CONFIGURATION completion failed\n"); return 0; }
-
-    if (td_status->control_status & (1 << 22)) {
-        UHCI_ERR("SET_CONFIGURATION stalled\n");
-        frame_list[fr % 1024]       = 0x00000001;
-        frame_list[(fr + 1) % 1024] = 0x00000001;
-        free_td(td_setup); free_td(td_status); free_qh(qh);
+    int rc = control_request(io_base, addr, 0x00, 0x09 /* SET_CONFIGURATION */, cfg_val, NULL, 0);
+    if (rc < 0) {
+        UHCI_ERR("SET_CONFIGURATION failed (%d)\n", rc);
         return 0;
     }
 
-    frame_list[fr % 1024]       = 0x00000001;
-    frame_list[(fr + 1) % 1024] = 0x00000001;
-    free_td(td_setup); free_td(td_status); free_qh(qh);
-
     UHCI_INFO("SET_CONFIGURATION -> %u OK\n", cfg_val);
     return 1;
 }
@@ -9,6 +9,7 @@
 #include "../usb.h"
 #include "drivers/pci.h"
 #include "../usb_descriptors.h"
+#include "../usb_urb.h"
 
 #ifndef UHCI_LOG_LEVEL
 #define UHCI_LOG_LEVEL USB_LOG_LEVEL_WARN
@@ -42,6 +43,9 @@
 #ifndef PORT_RESET
 #define PORT_RESET (1 << 9)
 #endif
+#ifndef PORT_LOW_SPEED
+#define PORT_LOW_SPEED (1 << 8)
+#endif
 
 #ifndef NUM_PORTS
 #define NUM_PORTS 2 // Many UHCI controllers expose 2 root ports
@@ -64,6 +68,8 @@ int uhci_get_device_descriptor(uint16_t io_base, uint8_t device_address, usb_dev
 int uhci_get_configuration_descriptor(uint16_t io_base, uint8_t device_address, usb_configuration_descriptor_t *config_desc);
 int uhci_get_full_configuration_descriptor(uint16_t io_base, uint8_t device_address, uint8_t *buffer, uint16_t total_length);
 int uhci_set_configuration(uint16_t io_base, uint8_t device_address, uint8_t configuration_value);
+// Speed of an addressed device, as its root port reported it
+bool uhci_device_low_speed(uint16_t io_base, uint8_t device_address);
 
 // Enumeration
 void uhci_enumerate_device(uint16_t io_base, int port);
@@ -90,7 +96,103 @@ typedef struct {
     uint32_t vertical_link_pointer;
 } __attribute__((packed, aligned(16))) uhci_qh_t;
 
-// Shared frame list (defined in controller.c)
-extern uint32_t frame_list[1024];
+// Link pointer bits (frame list entries, TD links, QH links)
+#define UHCI_LINK_TERMINATE 0x00000001u
+#define UHCI_LINK_QH        0x00000002u
+#define UHCI_LINK_DEPTH     0x00000004u  // TD links: run the next TD of this queue first
+
+// TD control/status bits
+#define TD_ACTIVE   (1u << 23)
+#define TD_IOC      (1u << 24)   // raise IRQ on completion
+#define TD_SPD      (1u << 29)   // Short Packet Detect (recommended for IN)
+#define TD_CERR_3   (3u << 27)   // retry a failing transaction 3 times
+#define TD_LS       (1u << 26)   // low-speed device
+
+#define TD_STALLED  (1u << 22)
+#define TD_DBE      (1u << 21)
+#define TD_BABBLE   (1u << 20)
+#define TD_NAK      (1u << 19)
+#define TD_TIMEOUT  (1u << 18)
+#define TD_BITSTUFF (1u << 17)
+#define TD_ERR_MASK (TD_STALLED | TD_DBE | TD_BABBLE | TD_TIMEOUT | TD_BITSTUFF)
+#define TD_ACTLEN_MASK 0x7FF
+
+// TD token PIDs
+#define UHCI_PID_SETUP 0x2D
+#define UHCI_PID_IN    0x69
+#define UHCI_PID_OUT   0xE1
+
+#define UHCI_TD_MAX_LENGTH 1280  // largest MaxLen a TD can encode
+
+// ---- Schedule (schedule.c) ----
+// Per-controller frame list and QH skeleton: a tree of interrupt QHs for
+// 1..128 ms periods in front of the control and bulk queues. Endpoint QHs
+// are added and removed without touching the others; the caller keeps the
+// returned queue id for uhci_schedule_remove() and, as for any unlinked QH,
+// must not reuse the QH before the controller has left the current frame.
+#define UHCI_PERIOD_MAX 128
+#define UHCI_PERIODIC_BUDGET_US 900   // 90% of a frame for interrupt transfers
+
+// Allocate the frame list and skeleton (page allocator, below 4 GiB)
+bool uhci_schedule_init(uint16_t io_base);
+// Physical address for FLBASEADD
+uint32_t uhci_schedule_frame_list(uint16_t io_base);
+
+// Queue id, or -1 when there is no schedule or no bandwidth left
+int uhci_schedule_add_async(uint16_t io_base, uhci_qh_t *qh, bool bulk);
+// Poll 'qh' every 'interval' frames (rounded down to a power of two, at
+// most 128), reserving 'bus_us' in each of those frames
+int uhci_schedule_add_periodic(uint16_t io_base, uhci_qh_t *qh, uint8_t interval, uint16_t bus_us);
+void uhci_schedule_remove(uint16_t io_base, uhci_qh_t *qh, int queue, uint16_t bus_us);
+// Spin until the frame number changes
+void uhci_schedule_wait_frame(uint16_t io_base);
+
+// Periodic time reserved in 'frame', in microseconds
+uint16_t uhci_schedule_frame_load(uint16_t io_base, uint16_t frame);
+// Bus time of one transaction carrying 'bytes' of data
+uint16_t uhci_bus_time_us(bool low_speed, uint16_t bytes);
+
+// ---- Asynchronous transfers (urb.c) ----
+// URBs (usb_urb.h) with 'host' set to the I/O base. Every URB gets its own
+// QH on the control, bulk or interrupt part of the schedule, so transfers to
+// different devices and endpoints are in flight at the same time.
+
+// Set up URB tracking for a controller whose schedule is ready
+bool uhci_urb_init(uint16_t io_base);
+
+int uhci_urb_submit(usb_urb_t *urb);
+bool uhci_urb_cancel(usb_urb_t *urb);
+// Complete the URBs whose TDs are done, called from the UHCI interrupt
+void uhci_urb_service(uint16_t io_base);
+
+extern const usb_hc_ops_t uhci_hc_ops;
+
+// ---- Per-controller TD/QH/buffer pool (pool.c) ----
+// Sized for every keyboard pipe (1 TD + 1 QH + report buffer) and a handful
+// of URBs in flight or waiting to be reclaimed, each one a QH and a TD per
+// packet (a 4 KiB bulk read at 64 bytes a packet is 64 TDs).
+#ifndef UHCI_POOL_MAX_CONTROLLERS
+#define UHCI_POOL_MAX_CONTROLLERS 8     // ICH9: three companions on each of two EHCIs
+#endif
+#ifndef UHCI_POOL_TDS
+#define UHCI_POOL_TDS 256
+#endif
+#ifndef UHCI_POOL_QHS
+#define UHCI_POOL_QHS 32
+#endif
+#ifndef UHCI_POOL_BUFFERS
+#define UHCI_POOL_BUFFERS 32
+#endif
+#define UHCI_POOL_BUFFER_SIZE 64        // setup packets, HID reports
+#define UHCI_POOL_DESCRIPTOR_SIZE 1024  // one configuration blob at a time
+#define UHCI_MAX_TRANSFER 8192          // per URB, 128 TDs at 64 bytes a packet
+
+bool uhci_pool_init(uint16_t io_base);
+uhci_td_t *uhci_pool_get_td(uint16_t io_base);
+void uhci_pool_put_td(uint16_t io_base, uhci_td_t *td);
+uhci_qh_t *uhci_pool_get_qh(uint16_t io_base);
+void uhci_pool_put_qh(uint16_t io_base, uhci_qh_t *qh);
+void *uhci_pool_get_buffer(uint16_t io_base, size_t size);
+void uhci_pool_put_buffer(uint16_t io_base, void *buffer);
 
 #endif // UHCI_UHCI_H
@@ -1,5 +1,6 @@
 #include "uhci_isr.h"
 #include "cpu/isr.h"
+#include "cpu/apic.h"
 #include "cpu/ports.h"
 
 #define USBSTS_USBINT     (1u << 0)  // Interrupt on Completion
@@ -8,26 +9,37 @@
 #define USBSTS_HCERR      (1u << 3)  // Host Controller Process Error
 #define USBSTS_HCHALTED   (1u << 5)  // Controller Halted
 
+/* One per controller: controllers on a shared INTx line have the same
+ * vector, an MSI vector belongs to a single one */
 typedef struct {
+    uint8_t  in_use;
     uint16_t io_base;
-    uint8_t  irq_line;  // 0..15 (legacy INTx)
+    uint8_t  vector;
 } uhci_isr_ctx_t;
 
-static uhci_isr_ctx_t g_uhci_ctx;
+static uhci_isr_ctx_t g_uhci_ctx[UHCI_POOL_MAX_CONTROLLERS];
 
 /* Map legacy IRQ line to your vector constants in cpu/isr.h */
 static inline uint8_t irq_to_vector(uint8_t irq_line) { return (uint8_t)(IRQ0 + irq_line); }
 
-/* --- Top-half ISR (keep it very fast) --- */
-static void uhci_irq_top(registers_t* r)
+static uhci_isr_ctx_t *ctx_for(uint16_t io_base)
 {
-    (void)r;
-    const uint16_t io = g_uhci_ctx.io_base;
+    uhci_isr_ctx_t *free_ctx = NULL;
+    for (int i = 0; i < UHCI_POOL_MAX_CONTROLLERS; i++) {
+        if (g_uhci_ctx[i].in_use && g_uhci_ctx[i].io_base == io_base) return &g_uhci_ctx[i];
+        if (!free_ctx && !g_uhci_ctx[i].in_use) free_ctx = &g_uhci_ctx[i];
+    }
+    return free_ctx;
+}
 
+/* Status of one controller: read, ack, and complete its transfers */
+static void uhci_service_status(uint16_t io)
+{
     /* Read UHCI status (write-1-to-clear) */
     uint16_t st = port_word_in(io + 0x02);
     if (!st) {
-        /* Shared/spurious IRQ: nothing for this controller */
+        /* Shared/spurious IRQ: nothing for this controller (an MSI vector
+           is ours alone, so this only happens on INTx) */
         return;
     }
 
@@ -35,11 +47,13 @@ static void uhci_irq_top(registers_t* r)
     port_word_out(io + 0x02, st);
 
     if (st & USBSTS_USBINT) {
-        /* TD(s) completed: service periodic endpoints (e.g., boot keyboard) */
+        /* TD(s) completed: finish transfers, service periodic endpoints (e.g., boot keyboard) */
+        uhci_urb_service(io);
         if (uhci_kbd_service) uhci_kbd_service();
     }
     if (st & USBSTS_USBERRINT) {
         UHCI_WARN("UHCI: USBERRINT (USBSTS=0x%x)\n", st);
+        uhci_urb_service(io);       /* failed transfers complete too */
         if (uhci_kbd_service) uhci_kbd_service(); /* still try to drain/rearm */
     }
     if (st & USBSTS_RESUMEDET) {
@@ -52,27 +66,64 @@ static void uhci_irq_top(registers_t* r)
         /* Usually means the HC stopped. If persistent, consider reset/restart. */
         UHCI_WARN("UHCI: HCHalted observed\n");
     }
+}
+
+/* --- Top-half ISR (keep it very fast) --- */
+static void uhci_irq_top(registers_t* r)
+{
+    /* Every controller on this vector gets to look at its status */
+    for (int i = 0; i < UHCI_POOL_MAX_CONTROLLERS; i++) {
+        uhci_isr_ctx_t *ctx = &g_uhci_ctx[i];
+        if (!ctx->in_use || ctx->vector != r->int_no) continue;
+        uhci_service_status(ctx->io_base);
+    }
 
     /* NOTE: Do NOT send PIC EOI here — your generic IRQ path should do that,
        exactly like it does for the PS/2 keyboard handler. */
 }
 
-/* --- Public: install the ISR on this controller's legacy IRQ line --- */
+/* --- Public: install the ISR, on a dedicated MSI vector when the
+       controller has one, else on its legacy IRQ line --- */
 void uhci_install_isr(usb_controller_t* ctrl)
 {
-    g_uhci_ctx.io_base  = (uint16_t)ctrl->base_address;
-    g_uhci_ctx.irq_line = ctrl->pci_device->interrupt_line;  // 0..15 expected
+    uint16_t io_base = (uint16_t)ctrl->base_address;
+    uint8_t irq_line = ctrl->pci_device->interrupt_line;  // 0..15 expected
+    uhci_isr_ctx_t *ctx = ctx_for(io_base);
+    if (!ctx) {
+        UHCI_ERR("UHCI: no ISR context left (max %d controllers)\n", UHCI_POOL_MAX_CONTROLLERS);
+        return;
+    }
+    if (ctx->in_use) return;    /* already installed */
 
-    if (g_uhci_ctx.irq_line >= 16) {
-        UHCI_ERR("UHCI: invalid PCI interrupt_line=%u\n", (unsigned)g_uhci_ctx.irq_line);
+    int msi_vector = pci_request_msi(ctrl->pci_device, uhci_irq_top);
+    if (msi_vector >= 0) {
+        ctx->io_base = io_base;
+        ctx->vector  = (uint8_t)msi_vector;
+        ctx->in_use  = 1;
+        UHCI_INFO("UHCI: ISR installed on MSI vector %u, IO base=0x%x\n",
+                    (unsigned)msi_vector, (unsigned)io_base);
         return;
     }
 
-    /* Register the handler on that vector */
-    register_interrupt_handler(irq_to_vector(g_uhci_ctx.irq_line), uhci_irq_top);
+    if (irq_line >= 16) {
+        UHCI_ERR("UHCI: invalid PCI interrupt_line=%u\n", (unsigned)irq_line);
+        return;
+    }
+
+    /* The line may be shared with other companions and their EHCI */
+    uint8_t vector = irq_to_vector(irq_line);
+    uint64_t flags = irq_save();
+    ctx->io_base = io_base;
+    ctx->vector  = vector;
+    ctx->in_use  = 1;
+    irq_restore(flags);
+    if (!interrupt_add_shared_handler(vector, uhci_irq_top)) {
+        UHCI_ERR("UHCI: no shared handler slot for IRQ%u\n", (unsigned)irq_line);
+        ctx->in_use = 0;
+        return;
+    }
+    apic_enable_pci_irq(irq_line);
 
     UHCI_INFO("UHCI: ISR installed on IRQ%u (vector=%u), IO base=0x%x\n",
-                (unsigned)g_uhci_ctx.irq_line,
-                (unsigned)irq_to_vector(g_uhci_ctx.irq_line),
-                (unsigned)g_uhci_ctx.io_base);
+                (unsigned)irq_line, (unsigned)vector, (unsigned)io_base);
 }
@@ -0,0 +1,390 @@
+// drivers/usb/uhci/urb.c
+// Asynchronous transfers (URBs).
+//
+// A submitted URB gets a QH holding its TD chain, queued on the control,
+// bulk or interrupt part of the controller's schedule (schedule.c), so the
+// controller works on every pending transfer. The IOC interrupt calls
+// uhci_urb_service(), which retires the URBs whose TDs are done and calls
+// their completion callbacks.
+//
+// Data is split into one TD per max-packet-sized chunk, toggling DATA0/1 from
+// TD to TD. Control and bulk chains are linked depth first, so the controller
+// runs as many of their packets as fit in a frame; an interrupt chain is
+// linked breadth first and moves on by one packet per poll. IN TDs have short
+// packet detection on: a short packet halts the queue and ends the data.
+//
+// An unlinked QH may still be in use by the controller until the frame it
+// was seen in has ended, so retired QHs and TDs wait in a small reclaim list
+// and go back to the pool once the frame number has moved on.
+#include "uhci.h"
+#include "cpu/isr.h"
+#include "cpu/ports.h"
+#include "libc/mem.h"
+
+#define USB_URB_RECLAIM 8
+
+typedef struct {
+    uhci_qh_t *qh;          // NULL when the slot is free
+    uhci_td_t *tds;
+    void      *setup_buffer;
+    uint16_t   frame;       // frame number when unlinked
+} uhci_retired_t;
+
+typedef struct {
+    uint8_t     in_use;
+    uint16_t    io_base;
+    usb_urb_t *active;
+    uhci_retired_t retired[USB_URB_RECLAIM];
+} uhci_async_t;
+
+static uhci_async_t g_async[UHCI_POOL_MAX_CONTROLLERS];
+
+static uhci_async_t *async_for(uint16_t io_base)
+{
+    for (int i = 0; i < UHCI_POOL_MAX_CONTROLLERS; i++) {
+        if (g_async[i].in_use && g_async[i].io_base == io_base) return &g_async[i];
+    }
+    return NULL;
+}
+
+static inline uint16_t current_frame(uint16_t io_base)
+{
+    return port_word_in(io_base + 0x06) & 0x7FF;
+}
+
+static inline uhci_td_t *td_from_link(uint32_t link)
+{
+    return (link & UHCI_LINK_TERMINATE) ? NULL : (uhci_td_t *)(uintptr_t)(link & ~0xFu);
+}
+
+static void free_tds(uint16_t io_base, uhci_td_t *td)
+{
+    while (td) {
+        uhci_td_t *next = td_from_link(td->link_pointer);
+        uhci_pool_put_td(io_base, td);
+        td = next;
+    }
+}
+
+// Give back the retired transfers the controller has moved past; with
+// 'wait' first let the current frame end so every slot is freed
+static void reclaim(uhci_async_t *as, bool wait)
+{
+    uint16_t frame = current_frame(as->io_base);
+    for (int i = 0; i < USB_URB_RECLAIM; i++) {
+        uhci_retired_t *r = &as->retired[i];
+        if (!r->qh) continue;
+        if (r->frame == frame) {
+            if (!wait) continue;
+            while (current_frame(as->io_base) == frame) {
+                __asm__ volatile ("pause");
+            }
+        }
+        free_tds(as->io_base, r->tds);
+        uhci_pool_put_qh(as->io_base, r->qh);
+        if (r->setup_buffer) uhci_pool_put_buffer(as->io_base, r->setup_buffer);
+        r->qh = NULL;
+    }
+}
+
+// The URB's QH is already unlinked. Interrupts off.
+static void retire(uhci_async_t *as, usb_urb_t *urb)
+{
+    int slot = -1;
+    for (int pass = 0; pass < 2 && slot < 0; pass++) {
+        if (pass) reclaim(as, true);
+        for (int i = 0; i < USB_URB_RECLAIM; i++) {
+            if (!as->retired[i].qh) { slot = i; break; }
+        }
+    }
+    as->retired[slot] = (uhci_retired_t){
+        urb->qh, urb->tds, urb->setup_buffer, current_frame(as->io_base)
+    };
+    urb->qh = NULL;
+    urb->tds = NULL;
+    urb->setup_buffer = NULL;
+}
+
+// Remove 'urb' from the active list and the schedule, false if not there
+static bool unlink_urb(uhci_async_t *as, usb_urb_t *urb)
+{
+    for (usb_urb_t **link = &as->active; *link; link = &(*link)->next) {
+        if (*link == urb) {
+            *link = urb->next;
+            uhci_schedule_remove(as->io_base, urb->qh, urb->queue, urb->bus_us);
+            return true;
+        }
+    }
+    return false;
+}
+
+static int status_from_td(uint32_t cs)
+{
+    if (cs & TD_STALLED)  return USB_URB_STALLED;
+    if (cs & TD_DBE)      return USB_URB_BUFFER;
+    if (cs & TD_BABBLE)   return USB_URB_BABBLE;
+    if (cs & TD_TIMEOUT)  return USB_URB_CRC;
+    if (cs & TD_BITSTUFF) return USB_URB_BITSTUFF;
+    return USB_URB_OK;
+}
+
+// Walk the TDs in order: USB_URB_PENDING while one is still active. The
+// bytes and data packets of the TDs done so far are stored either way.
+// After a short packet the rest of the data stage is skipped: a control
+// transfer goes on with its status stage, anything else is complete.
+static int urb_progress(const usb_urb_t *urb, uint16_t *actual, uint16_t *packets)
+{
+    *actual = 0;
+    *packets = 0;
+    uhci_td_t *td = urb->tds;
+    while (td) {
+        uint32_t cs = td->control_status;
+        if (cs & TD_ACTIVE) return USB_URB_PENDING;
+        if (cs & TD_ERR_MASK) return status_from_td(cs);
+        uhci_td_t *next = td_from_link(td->link_pointer);
+        if ((td->token & 0xFF) == UHCI_PID_SETUP) {
+            td = next;
+            continue;
+        }
+        // Lengths are stored minus one, 0x7FF standing for 0 bytes
+        uint16_t length = (uint16_t)((cs + 1) & TD_ACTLEN_MASK);
+        uint16_t max_length = (uint16_t)(((td->token >> 21) + 1) & TD_ACTLEN_MASK);
+        *actual += length;
+        (*packets)++;
+        if (length < max_length && next) {
+            if (!urb->control) return USB_URB_OK;
+            while (next->link_pointer != UHCI_LINK_TERMINATE) {
+                next = td_from_link(next->link_pointer);
+            }
+            // The halted QH still points at the short TD; restart it at the status stage
+            if (next->control_status & TD_ACTIVE) {
+                __atomic_store_n(&((uhci_qh_t *)urb->qh)->vertical_link_pointer,
+                                 (uint32_t)get_physical_address(next), __ATOMIC_RELEASE);
+            }
+        }
+        td = next;
+    }
+    return USB_URB_OK;
+}
+
+static void store_result(usb_urb_t *urb, int status, uint16_t actual, uint16_t packets)
+{
+    urb->actual_length = actual;
+    if (!urb->control) urb->toggle ^= (uint8_t)(packets & 1);
+    urb->status = status;
+}
+
+static uhci_td_t *append_td(const usb_urb_t *urb, uhci_td_t *prev, uint8_t pid, uint8_t toggle,
+                            void *buffer, uint16_t length, uint32_t depth)
+{
+    uhci_td_t *td = uhci_pool_get_td((uint16_t)urb->host);
+    if (!td) return NULL;
+    uint32_t max_len = length ? (uint32_t)(length - 1) : 0x7FF;  // 0x7FF is a zero-length packet
+    td->link_pointer   = UHCI_LINK_TERMINATE;
+    td->control_status = TD_CERR_3 | (urb->low_speed ? TD_LS : 0) | TD_ACTIVE;
+    td->token          = pid | ((uint32_t)urb->device_address << 8) |
+                         ((uint32_t)(urb->endpoint & 0x0F) << 15) |
+                         ((uint32_t)(toggle & 1) << 19) | (max_len << 21);
+    td->buffer_pointer = length ? (uint32_t)get_physical_address(buffer) : 0;
+    if (pid == UHCI_PID_IN) td->control_status |= TD_SPD;
+    if (prev) prev->link_pointer = (uint32_t)get_physical_address(td) | depth;
+    return td;
+}
+
+// Append the data stage as max-packet-sized TDs, toggling from 'toggle';
+// a zero-length transfer is a single empty packet. The last TD or NULL.
+static uhci_td_t *append_data(usb_urb_t *urb, uhci_td_t *last, uint8_t pid, uint8_t toggle,
+                              uint32_t depth)
+{
+    uint16_t max_packet = urb->max_packet ? urb->max_packet : 8;
+    uint8_t *data = urb->buffer;
+    uint16_t left = urb->length;
+    do {
+        uint16_t chunk = (left < max_packet) ? left : max_packet;
+        last = append_td(urb, last, pid, toggle, data, chunk, depth);
+        if (!last) return NULL;
+        if (!urb->tds) urb->tds = last;
+        toggle ^= 1;
+        data += chunk;
+        left = (uint16_t)(left - chunk);
+    } while (left);
+    return last;
+}
+
+// Build the URB's TD chain and QH, false when the pool ran out
+static bool build_transfer(usb_urb_t *urb)
+{
+    uint16_t io = (uint16_t)urb->host;
+    bool in = (urb->endpoint & 0x80) != 0;
+    uhci_td_t *last = NULL;
+
+    if (urb->control) {
+        in = (urb->setup.bmRequestType & 0x80) != 0;
+        urb->setup_buffer = uhci_pool_get_buffer(io, sizeof(usb_setup_packet_t));
+        if (!urb->setup_buffer) return false;
+        memory_copy(urb->setup_buffer, &urb->setup, sizeof(usb_setup_packet_t));
+        last = urb->tds = append_td(urb, NULL, UHCI_PID_SETUP, 0, urb->setup_buffer,
+                                    sizeof(usb_setup_packet_t), 0);
+        if (!last) return false;
+        if (urb->length) {
+            last = append_data(urb, last, in ? UHCI_PID_IN : UHCI_PID_OUT, 1, UHCI_LINK_DEPTH);
+            if (!last) return false;
+        }
+        // Status stage: the opposite direction, IN when there was no data
+        last = append_td(urb, last, (in && urb->length) ? UHCI_PID_OUT : UHCI_PID_IN,
+                         1, NULL, 0, UHCI_LINK_DEPTH);
+    } else {
+        last = append_data(urb, NULL, in ? UHCI_PID_IN : UHCI_PID_OUT, urb->toggle,
+                           urb->interval ? 0 : UHCI_LINK_DEPTH);
+    }
+    if (!last) return false;
+    last->control_status |= TD_IOC;
+
+    uhci_qh_t *qh = uhci_pool_get_qh(io);
+    urb->qh = qh;
+    if (!qh) return false;
+    qh->horizontal_link_pointer = UHCI_LINK_TERMINATE;
+    qh->vertical_link_pointer   = (uint32_t)get_physical_address(urb->tds);
+    return true;
+}
+
+static void release_transfer(usb_urb_t *urb)
+{
+    free_tds((uint16_t)urb->host, urb->tds);
+    if (urb->qh) uhci_pool_put_qh((uint16_t)urb->host, urb->qh);
+    if (urb->setup_buffer) uhci_pool_put_buffer((uint16_t)urb->host, urb->setup_buffer);
+    urb->tds = NULL;
+    urb->qh = NULL;
+    urb->setup_buffer = NULL;
+}
+
+bool uhci_urb_init(uint16_t io_base)
+{
+    uhci_async_t *as = async_for(io_base);
+    for (int i = 0; i < UHCI_POOL_MAX_CONTROLLERS && !as; i++) {
+        if (!g_async[i].in_use) as = &g_async[i];
+    }
+    if (!as) {
+        UHCI_ERR("No URB slot for IO base 0x%x\n", io_base);
+        return false;
+    }
+    memory_set(as, 0, sizeof(*as));
+    as->io_base = io_base;
+    as->in_use = 1;
+    return true;
+}
+
+int uhci_urb_submit(usb_urb_t *urb)
+{
+    uhci_async_t *as = urb ? async_for((uint16_t)urb->host) : NULL;
+    if (!as || urb->max_packet > UHCI_TD_MAX_LENGTH || (urb->length && !urb->buffer) ||
+        (urb->control && urb->setup.wLength != urb->length)) {
+        return USB_URB_INVALID;
+    }
+    // TD buffer pointers are 32-bit
+    if (urb->length && get_physical_address((uint8_t *)urb->buffer + urb->length - 1) > 0xFFFFFFFFu) {
+        UHCI_ERR("Buffer %p is above 4 GiB\n", urb->buffer);
+        return USB_URB_INVALID;
+    }
+
+    urb->qh = NULL;
+    urb->tds = NULL;
+    urb->setup_buffer = NULL;
+    urb->actual_length = 0;
+    if (!build_transfer(urb)) {
+        release_transfer(urb);
+        UHCI_ERR("No TD/QH for a transfer to %u ep 0x%x\n", urb->device_address, urb->endpoint);
+        return USB_URB_NO_MEMORY;
+    }
+    urb->status = USB_URB_PENDING;
+    urb->next = NULL;
+
+    uint64_t flags = irq_save();
+    reclaim(as, false);
+    if (urb->control || !urb->interval) {
+        urb->bus_us = 0;
+        urb->queue = uhci_schedule_add_async((uint16_t)urb->host, urb->qh, !urb->control);
+    } else {
+        // One packet per poll
+        uint16_t max_packet = urb->max_packet ? urb->max_packet : 8;
+        urb->bus_us = uhci_bus_time_us(urb->low_speed,
+                                       (urb->length < max_packet) ? urb->length : max_packet);
+        urb->queue = uhci_schedule_add_periodic((uint16_t)urb->host, urb->qh, urb->interval, urb->bus_us);
+    }
+    if (urb->queue < 0) {
+        irq_restore(flags);
+        release_transfer(urb);
+        urb->status = USB_URB_NO_BANDWIDTH;
+        return USB_URB_NO_BANDWIDTH;
+    }
+    usb_urb_t **link = &as->active;
+    while (*link) link = &(*link)->next;
+    *link = urb;
+    irq_restore(flags);
+    return USB_URB_OK;
+}
+
+void uhci_urb_service(uint16_t io_base)
+{
+    uhci_async_t *as = async_for(io_base);
+    if (!as) return;
+
+    uint64_t flags = irq_save();
+    reclaim(as, false);
+    usb_urb_t *done = NULL, **done_tail = &done;
+    usb_urb_t **link = &as->active;
+    while (*link) {
+        usb_urb_t *urb = *link;
+        uint16_t actual, packets;
+        int status = urb_progress(urb, &actual, &packets);
+        if (status == USB_URB_PENDING) {
+            link = &urb->next;
+            continue;
+        }
+        *link = urb->next;
+        uhci_schedule_remove(as->io_base, urb->qh, urb->queue, urb->bus_us);
+        retire(as, urb);
+        store_result(urb, status, actual, packets);
+        urb->next = NULL;
+        *done_tail = urb;
+        done_tail = &urb->next;
+    }
+    // Callbacks may submit again, so they run once the list is consistent
+    while (done) {
+        usb_urb_t *urb = done;
+        done = urb->next;
+        if (urb->complete) urb->complete(urb);
+    }
+    irq_restore(flags);
+}
+
+bool uhci_urb_cancel(usb_urb_t *urb)
+{
+    uhci_async_t *as = urb ? async_for((uint16_t)urb->host) : NULL;
+    if (!as) return false;
+
+    uint64_t flags = irq_save();
+    if (!unlink_urb(as, urb)) {
+        irq_restore(flags);
+        return false;
+    }
+    uint16_t actual, packets;
+    urb_progress(urb, &actual, &packets);
+    uint16_t frame = current_frame(as->io_base);
+    retire(as, urb);
+    // The controller may still hold the QH in this frame
+    while (current_frame(as->io_base) == frame) {
+        __asm__ volatile ("pause");
+    }
+    store_result(urb, USB_URB_CANCELLED, actual, packets);
+    if (urb->complete) urb->complete(urb);
+    irq_restore(flags);
+    return true;
+}
+
+static void service_host(uintptr_t host)
+{
+    uhci_urb_service((uint16_t)host);
+}
+
+const usb_hc_ops_t uhci_hc_ops = { uhci_urb_submit, uhci_urb_cancel, service_host, UHCI_MAX_TRANSFER };
@@ -3,6 +3,8 @@
 #include "libc/string.h"
 #include "cpu/ports.h"
 #include "uhci/uhci.h"
+#include "ehci/ehci.h"
+#include "msc.h"
 #include "cpu/timer.h"
 #include <stddef.h>
 
@@ -57,6 +59,19 @@ void pci_scan_for_usb_controllers() {
 void usb_enumerate_devices() {
     usb_device_count = 0;
 
+    // EHCI first: it keeps the high-speed devices and hands the others to
+    // its companion controllers, which must only look at their ports after
+    for (int i = 0; i < usb_controller_count; i++) {
+        usb_controller_t *controller = &usb_controllers[i];
+        if (controller->pci_device == NULL || controller->pci_device->prog_if != 0x20) {
+            continue;
+        }
+        USB_LOG_INFO("The current controller is of type: EHCI\n");
+        if (ehci_initialize_controller(controller)) {
+            ehci_enumerate_devices(controller);
+        }
+    }
+
     for (int i = 0; i < usb_controller_count; i++) {
         usb_controller_t *controller = &usb_controllers[i];
 
@@ -73,7 +88,7 @@ void usb_enumerate_devices() {
         } else if(controller->pci_device->prog_if==0x10){
             USB_LOG_WARN("USB driver for OHCI not yet available.\n");
         } else if(controller->pci_device->prog_if==0x20){
-            USB_LOG_WARN("USB driver for EHCI not yet available.\n");
+            // Brought up above
         } else if(controller->pci_device->prog_if==0x30){
             USB_LOG_WARN("USB driver for xHCI not yet available.\n");
         }
@@ -84,3 +99,28 @@ void usb_enumerate_devices() {
     }
 }
 
+void usb_print_disks() {
+    const usb_msc_info_t *info;
+    for (int disk = 0; (info = usb_msc_info(disk)) != NULL; disk++) {
+        printf("usb%d: %s %s, %llu blocks of %u bytes\n", disk, info->vendor, info->product,
+               (unsigned long long)info->blocks, info->block_size);
+    }
+}
+
+void usb_print_schedule() {
+    for (int i = 0; i < usb_controller_count; i++) {
+        usb_controller_t *controller = &usb_controllers[i];
+        if (controller->pci_device == NULL || controller->pci_device->prog_if != 0x00) {
+            continue;
+        }
+        uint16_t io_base = (uint16_t)controller->base_address;
+        uint32_t peak = 0, total = 0;
+        for (uint16_t frame = 0; frame < UHCI_PERIOD_MAX; frame++) {
+            uint32_t load = uhci_schedule_frame_load(io_base, frame);
+            if (load > peak) peak = load;
+            total += load;
+        }
+        printf("UHCI 0x%x: periodic load peak %u us, average %u us, budget %u us per frame\n",
+               io_base, peak, total / UHCI_PERIOD_MAX, UHCI_PERIODIC_BUDGET_US);
+    }
+}
@@ -4,8 +4,11 @@
 #include <stdint.h>
 #include "../pci.h"
 #include "../screen.h"
+#include "kernel/log/klog.h"
 #include "usb_descriptors.h"
 
+/* Messages go to the kernel log (see klog.h), so tracing from the IRQ
+ * handlers costs one formatted copy rather than drawing on the console */
 typedef enum {
     USB_LOG_LEVEL_NONE  = 0,
     USB_LOG_LEVEL_TRACE = 1,
@@ -22,7 +25,7 @@ typedef enum {
 #define USB_LOG_ENABLED(level) ((level) >= USB_LOG_LEVEL)
 
 #define USB_LOG_PRINT(level, level_tag, fmt, ...) \
-    do { if (USB_LOG_ENABLED(level)) printf("[USB]" level_tag " " fmt, ##__VA_ARGS__); } while (0)
+    do { if (USB_LOG_ENABLED(level)) klog((klog_level_t)(level), "[USB]" level_tag " " fmt, ##__VA_ARGS__); } while (0)
 
 #define USB_LOG_TRACE(fmt, ...) USB_LOG_PRINT(USB_LOG_LEVEL_TRACE, "[TRC]", fmt, ##__VA_ARGS__)
 #define USB_LOG_DEBUG(fmt, ...) USB_LOG_PRINT(USB_LOG_LEVEL_DEBUG, "[DBG]", fmt, ##__VA_ARGS__)
@@ -33,7 +36,7 @@ typedef enum {
 #define USB_SUBSYS_LOG(level, subsystem_level, subsystem_tag, level_tag, fmt, ...) \
     do { \
         if (((level) >= (subsystem_level)) && USB_LOG_ENABLED(level)) { \
-            printf("[USB]" subsystem_tag level_tag " " fmt, ##__VA_ARGS__); \
+            klog((klog_level_t)(level), "[USB]" subsystem_tag level_tag " " fmt, ##__VA_ARGS__); \
         } \
     } while (0)
 
@@ -46,7 +49,17 @@ extern usb_controller_t usb_controllers[16]; // Support up to 16 controllers
 extern uint8_t usb_controller_count;
 
 void pci_scan_for_usb_controllers();
+// EHCI controllers first, so full- and low-speed devices are on the
+// companion controllers by the time those enumerate
 void usb_enumerate_devices();
+// Fill config/interface/endpoint descriptors of 'dev' from a configuration blob,
+// preferring a HID boot keyboard interface, then a bulk-only mass storage one.
+// Returns 1 on success. Shared by the UHCI and EHCI enumeration.
+int usb_parse_config_blob_into_device(const uint8_t *buf, uint16_t total_len, usb_device_t *dev);
+// Periodic bandwidth reserved on each controller's schedule
+void usb_print_schedule();
+// Mass storage devices that came up
+void usb_print_disks();
 //void usb_init();
 
 #endif
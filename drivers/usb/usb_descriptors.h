@@ -16,6 +16,9 @@
 #define USB_CLASS_HID                0x03
 #define USB_SUBCLASS_BOOT            0x01
 #define USB_PROTOCOL_KEYBOARD        0x01
+#define USB_CLASS_MASS_STORAGE       0x08
+#define USB_SUBCLASS_SCSI            0x06
+#define USB_PROTOCOL_BULK_ONLY       0x50
 
 /* Device Descriptor */
 typedef struct {
@@ -0,0 +1,64 @@
+// drivers/usb/usb_urb.c
+// Waiting for URBs, on whichever host controller they were submitted to.
+#include "usb.h"
+#include "usb_urb.h"
+#include "cpu/timer.h"
+#include "libc/mem.h"
+
+int usb_urb_wait(const usb_hc_ops_t *hc, usb_urb_t *urb, uint32_t timeout_ms)
+{
+    uint64_t deadline = timer_get_ns() + timeout_ms * 1000000ULL;
+    while (urb->status == USB_URB_PENDING && timer_get_ns() < deadline) {
+        timer_idle();
+    }
+    if (urb->status == USB_URB_PENDING) {
+        // A lost interrupt should not fail a transfer that did complete
+        hc->service(urb->host);
+        if (hc->cancel(urb)) {
+            USB_LOG_ERROR("Transfer to %u ep 0x%x timed out\n", urb->device_address, urb->endpoint);
+            urb->status = USB_URB_TIMEOUT;
+        }
+    }
+    return urb->status;
+}
+
+int usb_control_transfer(const usb_hc_ops_t *hc, uintptr_t host, uint8_t device_address,
+                         uint16_t max_packet, bool low_speed, const usb_setup_packet_t *setup,
+                         void *data)
+{
+    usb_urb_t urb;
+    memory_set(&urb, 0, sizeof(urb));
+    urb.host           = host;
+    urb.device_address = device_address;
+    urb.max_packet     = max_packet;
+    urb.low_speed      = low_speed;
+    urb.control        = true;
+    urb.setup          = *setup;
+    urb.buffer         = data;
+    urb.length         = setup->wLength;
+
+    int status = hc->submit(&urb);
+    if (status == USB_URB_OK) status = usb_urb_wait(hc, &urb, USB_TRANSFER_TIMEOUT_MS);
+    return (status == USB_URB_OK) ? urb.actual_length : status;
+}
+
+int usb_bulk_transfer(const usb_hc_ops_t *hc, uintptr_t host, uint8_t device_address,
+                      uint8_t endpoint, uint16_t max_packet, uint8_t *toggle,
+                      void *data, uint16_t length)
+{
+    usb_urb_t urb;
+    memory_set(&urb, 0, sizeof(urb));
+    urb.host           = host;
+    urb.device_address = device_address;
+    urb.endpoint       = endpoint;
+    urb.max_packet     = max_packet;
+    urb.buffer         = data;
+    urb.length         = length;
+    urb.toggle         = *toggle;
+
+    int status = hc->submit(&urb);
+    if (status == USB_URB_OK) status = usb_urb_wait(hc, &urb, USB_TRANSFER_TIMEOUT_MS);
+    // Packets that got through moved the toggle, even when the transfer failed
+    if (status != USB_URB_NO_MEMORY && status != USB_URB_INVALID) *toggle = urb.toggle;
+    return (status == USB_URB_OK) ? urb.actual_length : status;
+}
@@ -0,0 +1,93 @@
+#ifndef USB_URB_H
+#define USB_URB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usb_descriptors.h"
+
+// A URB describes one transfer: it is submitted to a host controller driver,
+// runs while the caller goes on, and its completion callback is called from
+// the controller's interrupt. Class drivers only go through this interface
+// and the controller's usb_hc_ops_t, so they run on UHCI and EHCI alike.
+typedef enum {
+    USB_URB_OK        = 0,
+    USB_URB_PENDING   = 1,
+    USB_URB_TIMEOUT   = -1,  // not completed within usb_urb_wait's deadline
+    USB_URB_STALLED   = -2,
+    USB_URB_BUFFER    = -3,  // data buffer overrun/underrun
+    USB_URB_BABBLE    = -4,
+    USB_URB_CRC       = -6,  // CRC error or no answer from the device
+    USB_URB_BITSTUFF  = -7,
+    USB_URB_CANCELLED = -8,
+    USB_URB_NO_MEMORY = -9,  // TD/QH pool exhausted
+    USB_URB_INVALID   = -10,
+    USB_URB_NO_BANDWIDTH = -11,  // the frames of an interrupt URB are full
+} usb_urb_status_t;
+
+typedef struct usb_urb usb_urb_t;
+// Runs with interrupts disabled, may submit the URB again
+typedef void (*usb_urb_complete_t)(usb_urb_t *urb);
+
+struct usb_urb {
+    // Set by the caller
+    uintptr_t host;                 // controller: UHCI I/O base, EHCI register base
+    uint8_t  device_address;
+    uint8_t  endpoint;              // endpoint address, bit 7 set for IN
+    uint16_t max_packet;            // wMaxPacketSize, 0 for 8; data goes in packets of this size
+    bool     low_speed;             // 1.5 Mb/s device on a UHCI root port
+    bool     control;               // SETUP stage from 'setup', direction from bmRequestType
+    usb_setup_packet_t setup;
+    void    *buffer;                // below 4 GiB, owned by the controller until completion
+    uint16_t length;
+    uint8_t  toggle;                // bulk/interrupt DATA0/1, advanced past the packets sent
+    uint8_t  interval;              // interrupt endpoints: frames between polls, 0 for bulk
+    usb_urb_complete_t complete;    // optional
+    void    *context;
+
+    // Results, valid once status is no longer USB_URB_PENDING
+    volatile int status;            // usb_urb_status_t
+    uint16_t actual_length;
+
+    // Engine, private to the host controller driver
+    void      *qh;
+    void      *tds;
+    void      *setup_buffer;
+    int        queue;               // schedule queue id
+    uint16_t   bus_us;              // periodic time reserved
+    usb_urb_t *next;
+};
+
+// What a host controller driver provides for URBs
+typedef struct {
+    // USB_URB_OK when the URB is on the schedule, else an error and the
+    // URB was not submitted
+    int  (*submit)(usb_urb_t *urb);
+    // Take a pending URB off the schedule, status becomes USB_URB_CANCELLED.
+    // Returns once the controller can no longer touch the buffer; false if
+    // the URB had already completed.
+    bool (*cancel)(usb_urb_t *urb);
+    // Complete the URBs that are done, as the controller's interrupt does
+    void (*service)(uintptr_t host);
+    // Largest data stage a class driver should put in one URB, in bytes
+    uint16_t max_transfer;
+} usb_hc_ops_t;
+
+#define USB_TRANSFER_TIMEOUT_MS 3000
+
+// Block until the URB completes, cancelling it after 'timeout_ms'
+int usb_urb_wait(const usb_hc_ops_t *hc, usb_urb_t *urb, uint32_t timeout_ms);
+
+// Synchronous control transfer on endpoint 0: bytes transferred in the data
+// stage, or a negative usb_urb_status_t
+int usb_control_transfer(const usb_hc_ops_t *hc, uintptr_t host, uint8_t device_address,
+                         uint16_t max_packet, bool low_speed, const usb_setup_packet_t *setup,
+                         void *data);
+// Synchronous bulk transfer, direction from bit 7 of 'endpoint'. '*toggle' is
+// the endpoint's DATA0/1 state and is advanced past the packets sent. Bytes
+// transferred (less than 'length' after a short packet), or a negative
+// usb_urb_status_t.
+int usb_bulk_transfer(const usb_hc_ops_t *hc, uintptr_t host, uint8_t device_address,
+                      uint8_t endpoint, uint16_t max_packet, uint8_t *toggle,
+                      void *data, uint16_t length);
+
+#endif
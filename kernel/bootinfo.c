@@ -11,4 +11,7 @@ const kernel_bootinfo_t kernel_bootinfo_header = {
     .flags = 0,
 };
 
+/* kernel_entry.asm copies and fills the structure using this size */
+_Static_assert(sizeof(kernel_bootinfo_t) == 80, "kernel_bootinfo_t layout changed, update kernel_entry.asm");
+
 kernel_bootinfo_t kernel_bootinfo;
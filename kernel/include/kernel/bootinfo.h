@@ -15,9 +15,29 @@ typedef struct {
     uint32_t fb_height;
     uint32_t fb_stride;
     uint32_t fb_bpp;
+    uint64_t mmap_base;       /* Physical address of the kernel_memory_region_t array */
+    uint32_t mmap_entries;
+    uint32_t mmap_entry_size; /* Stride between entries, at least 20 bytes */
+    uint64_t acpi_rsdp;       /* Physical address of the ACPI RSDP, see FLAG_ACPI */
 } kernel_bootinfo_t;
 
 #define KERNEL_BOOTINFO_FLAG_UEFI 0x1
 #define KERNEL_BOOTINFO_FLAG_FRAMEBUFFER 0x2
+#define KERNEL_BOOTINFO_FLAG_MEMORY_MAP 0x4
+#define KERNEL_BOOTINFO_FLAG_ACPI 0x8
+
+/* Physical memory map entry, same layout as a BIOS E820 entry */
+typedef struct __attribute__((packed)) {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t attributes;
+} kernel_memory_region_t;
+
+#define KERNEL_MEMORY_USABLE 1
+#define KERNEL_MEMORY_RESERVED 2
+#define KERNEL_MEMORY_ACPI_RECLAIMABLE 3
+#define KERNEL_MEMORY_ACPI_NVS 4
+#define KERNEL_MEMORY_BAD 5
 
 #endif /* CASSEOS_KERNEL_BOOTINFO_H */
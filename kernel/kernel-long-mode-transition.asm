@@ -4,33 +4,79 @@ paging_set_up:
 %ifndef PML4T_ADDR
 %define PML4T_ADDR 0x1000
 %endif
-%define print_protected 0x7ceb
+%define print_protected print_string_pm
+
+; Identity map the low 4 GiB: PML4T -> PDPT -> 4 page directories of 2 MiB
+; pages, or PDPT entries of 1 GiB pages when the CPU supports them.
+; The top GiB (PCI MMIO, LAPIC/IOAPIC, flash) is mapped uncached.
+%define PDPT_ADDR (PML4T_ADDR + 0x1000)
+%define PDT_ADDR (PML4T_ADDR + 0x2000)
+%define PDT_COUNT 4
+%define PAGE_PRESENT_RW 0x003
+%define PAGE_LARGE 0x080
+%define PAGE_UNCACHED 0x018             ; PCD | PWT
+%define MMIO_GIGABYTE 3                 ; Index of the first uncached GiB
 
     mov edi, PML4T_ADDR     ; PML4T page address
     mov cr3, edi
     xor eax, eax
+    mov ecx, (2 + PDT_COUNT) * 0x1000 / 4 ; PML4T + PDPT + page directories, in dwords
     rep stosd               ; Now actually zero out the page table entries
-    ; Set edi back to PML4T[0]
-    mov edi, cr3
-
-    mov dword[edi], 0x2003      ; Set PML4T[0] to address 0x2000 (PDPT) with flags 0x0003
-    add edi, 0x1000             ; Go to PDPT[0]
-    mov dword[edi], 0x3003      ; Set PDPT[0] to address 0x3000 (PDT) with flags 0x0003
-    add edi, 0x1000             ; Go to PDT[0]
-    mov dword[edi], 0x4003      ; Set PDT[0] to address 0x4000 (PT) with flags 0x0003
-
-    mov edi, 0x4000             ; Go to PT[0]
-    mov ebx, 0x00000003         ; EBX has address 0x0000 with flags 0x0003
-    mov ecx, 512                ; Do the operation 512 times
 
+    mov dword[PML4T_ADDR], PDPT_ADDR | PAGE_PRESENT_RW
+
+    mov eax, 0x80000001
+    cpuid
+    test edx, 1 << 26       ; 1 GiB pages supported?
+    jz map_2mib_pages
+
+    ; PDPT[x] = x GiB, large page
+    mov edi, PDPT_ADDR
+    mov ebx, PAGE_PRESENT_RW | PAGE_LARGE
+    xor ecx, ecx
+    add_gigabyte_entry_protected:
+        mov eax, ebx
+        cmp ecx, MMIO_GIGABYTE
+        jb .cached
+        or eax, PAGE_UNCACHED
+    .cached:
+        mov dword[edi], eax
+        add ebx, 0x40000000
+        add edi, 8
+        inc ecx
+        cmp ecx, PDT_COUNT
+        jb add_gigabyte_entry_protected
+    jmp page_tables_done
+
+map_2mib_pages:
+    ; PDPT[x] = page directory x
+    mov edi, PDPT_ADDR
+    mov ebx, PDT_ADDR | PAGE_PRESENT_RW
+    mov ecx, PDT_COUNT
+    add_directory_entry_protected:
+        mov dword[edi], ebx
+        add ebx, 0x1000
+        add edi, 8
+        loop add_directory_entry_protected
+
+    ; PDT[x] = x * 2 MiB, large page; the directories are contiguous
+    mov edi, PDT_ADDR
+    mov ebx, PAGE_PRESENT_RW | PAGE_LARGE
+    xor ecx, ecx
     add_page_entry_protected:
-        ; a = address, x = index of page table, flags are entry flags
-        mov dword[edi], ebx                 ; Write ebx to PT[x] = a.append(flags)
-        add ebx, 0x1000                     ; Increment address of ebx (a+1)
-        add edi, 8                          ; Increment page table location (since entries are 8 bytes)
-                                            ; x++
-        loop add_page_entry_protected       ; Decrement ecx and loop again
-
+        mov eax, ebx
+        cmp ecx, MMIO_GIGABYTE * 512
+        jb .cached
+        or eax, PAGE_UNCACHED
+    .cached:
+        mov dword[edi], eax                 ; Write PDT[x] = a.append(flags)
+        add ebx, 0x200000                   ; Next 2 MiB
+        add edi, 8                          ; Entries are 8 bytes
+        inc ecx
+        cmp ecx, PDT_COUNT * 512
+        jb add_page_entry_protected
+
+page_tables_done:
 
     ; Set up PAE paging, but don't enable it quite yet
     ;
@@ -121,6 +167,8 @@ lm_not_found_protected:
     call print_protected
     jmp $
 
+%include "./32bit-print.asm"
+
 lm_not_found_str:                   db `ERROR: Long mode not supported. Exiting...             `, 0
 cpuid_not_found_str:                db `ERROR: CPUID unsupported, but required for long mode     `, 0
 
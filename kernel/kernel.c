@@ -6,6 +6,8 @@
 #include "cpu/isr.h"
 #include "cpu/idt.h"
 #include "cpu/timer.h"
+#include "cpu/cpuid.h"
+#include "libc/mem.h"
 #include "drivers/screen.h"
 #include "drivers/keyboard/keyboard.h"
 #include "shell/shell.h"
@@ -13,29 +15,88 @@
 #include "drivers/usb/usb.h"
 #include "kernel/include/kernel/bootinfo.h"
 #include "drivers/screen/framebuffer_console.h"
+#include "drivers/screen/bga.h"
+#include "kernel/mm/page_alloc.h"
+#include "cpu/apic.h"
+#include "cpu/pat.h"
+#include "kernel/log/klog.h"
+#include "drivers/serial/serial.h"
+
+/* The BIOS boot path identity maps 4 GiB and leaves the top GiB uncached for MMIO,
+ * UEFI firmware maps everything */
+#define BIOS_IDENTITY_MAP_LIMIT 0xC0000000ULL
 
 extern kernel_bootinfo_t kernel_bootinfo;
 
+/* The console is mirrored to the UART, so it only needs the log records
+ * the console leaves out */
+static void serial_debug_output(const klog_entry_t *entry) {
+    if (entry->level < KLOG_CONSOLE_LEVEL) {
+        serial_klog_output(entry);
+    }
+}
+
 void kernel_main() {
     cpu_enable_fpu_sse();
+    cpu_detect_features();
+    pat_init();
+    memory_init_dispatch();
     isr_install();
+    uint64_t mapped_limit = (kernel_bootinfo.flags & KERNEL_BOOTINFO_FLAG_UEFI) ?
+        UINT64_MAX : BIOS_IDENTITY_MAP_LIMIT;
+    bool mm_ready = page_alloc_init(&kernel_bootinfo, mapped_limit);
+    klog_init();
+    klog_add_output(klog_console_output, KLOG_CONSOLE_LEVEL);
+    if (serial_init()) {
+        screen_set_mirror(serial_write);
+        klog_add_output(serial_debug_output, KLOG_TRACE);
+    }
     bool fb_ready = framebuffer_console_init(&kernel_bootinfo);
+    bool apic_ready = apic_init(&kernel_bootinfo);
     if (!fb_ready) {
         screen_set_available(true);
     }
     irq_install();
+    if (fb_ready) {
+        framebuffer_console_set_flush_interval(FRAMEBUFFER_FLUSH_INTERVAL_MS);
+    }
     
     if (screen_is_available()) {
         clear_screen();
         printf("[DEBUG] Screen size: (%d,%d)\n",get_screen_framebuffer_cols(), get_screen_framebuffer_rows());
+        if (fb_ready) {
+            printf("[DEBUG] Framebuffer: %s\n",
+                   framebuffer_console_info()->write_combining ? "write-combining" : "firmware caching");
+        }
+        printf("[DEBUG] CPU: %s, memory ops: %s\n", cpu_features.vendor, memory_implementation_name());
+        if (apic_ready) {
+            printf("[DEBUG] Interrupts: %s, %d CPU(s), tick from %s\n",
+                   apic_is_x2apic() ? "x2apic" : "xapic", (int)apic_cpu_count(), timer_tick_source_name());
+        } else {
+            printf("[DEBUG] Interrupts: 8259 PIC\n");
+        }
+        if (timer_tsc_hz()) {
+            printf("[DEBUG] Clock: %s, %d MHz\n", timer_clocksource_name(), (int)(timer_tsc_hz() / 1000000));
+        } else {
+            printf("[DEBUG] Clock: %s, %d Hz\n", timer_clocksource_name(), TIMER_PIT_HZ);
+        }
+        if (mm_ready) {
+            printf("[DEBUG] Memory: %d KiB free\n", (int)(page_alloc_free_pages() * (PAGE_SIZE / 1024)));
+        } else {
+            printf("[ERROR] No usable memory map, dynamic allocation disabled\n");
+        }
     }
     pci_scan();
+    bga_init();
     pci_scan_for_usb_controllers();
     usb_enumerate_devices();
     kbd_subsystem_init();
 
     
     while(true){
+        klog_drain();
+        framebuffer_console_poll();
         shell_main_loop();
+        timer_idle();   // keyboard and timer interrupts wake us up
     }
 }
@@ -7,13 +7,37 @@ _start:
 extern kernel_main
 extern kernel_bootinfo
 
+%define KERNEL_BOOTINFO_SIZE 80
+%define KERNEL_BOOTINFO_FLAGS 16
+%define KERNEL_BOOTINFO_MMAP_BASE 56
+%define KERNEL_BOOTINFO_MMAP_ENTRIES 64
+%define KERNEL_BOOTINFO_MMAP_ENTRY_SIZE 68
+%define KERNEL_BOOTINFO_FLAG_MEMORY_MAP 0x4
+
+; Filled by the BIOS boot sector (bootloader/bios/boot_memory_map.asm)
+%define BIOS_MEMORY_MAP_COUNT 0x500
+%define BIOS_MEMORY_MAP_ENTRIES 0x508
+%define BIOS_MEMORY_MAP_ENTRY_SIZE 24
+
 [bits 64]
 start_kernel:
+    ; Describe the E820 map left by the boot sector
+    lea rdi, [rel kernel_bootinfo]
+    xor eax, eax
+    mov rcx, KERNEL_BOOTINFO_SIZE / 8
+    rep stosq
+    movzx eax, word [BIOS_MEMORY_MAP_COUNT]
+    test eax, eax
+    jz .no_memory_map
+    lea rdi, [rel kernel_bootinfo]
+    mov qword [rdi + KERNEL_BOOTINFO_MMAP_BASE], BIOS_MEMORY_MAP_ENTRIES
+    mov dword [rdi + KERNEL_BOOTINFO_MMAP_ENTRIES], eax
+    mov dword [rdi + KERNEL_BOOTINFO_MMAP_ENTRY_SIZE], BIOS_MEMORY_MAP_ENTRY_SIZE
+    mov qword [rdi + KERNEL_BOOTINFO_FLAGS], KERNEL_BOOTINFO_FLAG_MEMORY_MAP
+.no_memory_map:
     call kernel_main           ; Calls the C function. The linker will know where it is placed in memory
     jmp $
 
-%define KERNEL_BOOTINFO_SIZE 56
-
 global kernel_uefi_entry
 kernel_uefi_entry:
     cli
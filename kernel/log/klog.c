@@ -0,0 +1,181 @@
+#include "klog.h"
+#include "libc/format.h"
+#include "cpu/timer.h"
+#include "drivers/screen.h"
+#include "kernel/mm/page_alloc.h"
+
+typedef struct {
+    uint64_t seq;               /* index + 1 once complete, 0 while written */
+    uint64_t timestamp_ns;
+    uint8_t level;
+    uint8_t length;
+    char text[KLOG_TEXT_MAX + 1];
+} klog_record_t;
+
+_Static_assert(sizeof(klog_record_t) == 128, "klog records are meant to be 128 bytes");
+
+typedef enum {
+    RECORD_READY,
+    RECORD_PENDING,     /* reserved but not complete yet */
+    RECORD_LOST,        /* overwritten by a newer message */
+} record_state_t;
+
+static struct {
+    klog_record_t *records;
+    uint64_t head;              /* next index to reserve, shared by producers */
+    uint64_t tail;              /* next index to drain */
+    uint64_t lost;
+    bool draining;
+    klog_output_t outputs[KLOG_MAX_OUTPUTS];
+    klog_level_t output_levels[KLOG_MAX_OUTPUTS];
+    unsigned output_count;
+} klog_state;
+
+bool klog_init(void) {
+    if (klog_state.records) {
+        return true;
+    }
+    size_t bytes = KLOG_RECORDS * sizeof(klog_record_t);
+    klog_record_t *records = page_alloc_pages((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (!records) {
+        return false;
+    }
+    for (size_t i = 0; i < KLOG_RECORDS; i++) {
+        records[i].seq = 0;
+    }
+    __atomic_store_n(&klog_state.records, records, __ATOMIC_RELEASE);
+    return true;
+}
+
+void klog_vprintf(klog_level_t level, const char *format, va_list args) {
+    klog_record_t *records = __atomic_load_n(&klog_state.records, __ATOMIC_ACQUIRE);
+    if (!records) {
+        char line[KLOG_TEXT_MAX + 1];
+        kvsnprintf(line, sizeof(line), format, args);
+        kprint(line);
+        return;
+    }
+
+    /* Claiming a slot is the only shared write, the rest is private until
+     * 'seq' publishes it */
+    uint64_t index = __atomic_fetch_add(&klog_state.head, 1, __ATOMIC_RELAXED);
+    klog_record_t *record = &records[index % KLOG_RECORDS];
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->timestamp_ns = timer_get_ns();
+    record->level = (uint8_t)level;
+    int length = kvsnprintf(record->text, sizeof(record->text), format, args);
+    record->length = (uint8_t)(length < KLOG_TEXT_MAX ? length : KLOG_TEXT_MAX);
+    __atomic_store_n(&record->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+void klog(klog_level_t level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    klog_vprintf(level, format, args);
+    va_end(args);
+}
+
+bool klog_add_output(klog_output_t output, klog_level_t min_level) {
+    if (!output || klog_state.output_count >= KLOG_MAX_OUTPUTS) {
+        return false;
+    }
+    klog_state.output_levels[klog_state.output_count] = min_level;
+    klog_state.outputs[klog_state.output_count++] = output;
+    return true;
+}
+
+void klog_console_output(const klog_entry_t *entry) {
+    kprint((char *)entry->text);
+}
+
+/* Copy record 'index' out of the ring. A producer may reuse the slot
+ * meanwhile, so the copy only counts if 'seq' did not change under it. */
+static record_state_t read_record(uint64_t index, klog_entry_t *entry) {
+    const klog_record_t *record = &klog_state.records[index % KLOG_RECORDS];
+    uint64_t seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+    if (seq == index + 1) {
+        entry->seq = index;
+        entry->timestamp_ns = record->timestamp_ns;
+        entry->level = (klog_level_t)record->level;
+        uint32_t length = record->length;
+        if (length > KLOG_TEXT_MAX) length = KLOG_TEXT_MAX;
+        for (uint32_t i = 0; i < length; i++) {
+            entry->text[i] = record->text[i];
+        }
+        entry->text[length] = '\0';
+        entry->length = length;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&record->seq, __ATOMIC_RELAXED) == seq) {
+            return RECORD_READY;
+        }
+    }
+    uint64_t head = __atomic_load_n(&klog_state.head, __ATOMIC_RELAXED);
+    return (head - index > KLOG_RECORDS) ? RECORD_LOST : RECORD_PENDING;
+}
+
+static void emit(const klog_entry_t *entry) {
+    for (unsigned i = 0; i < klog_state.output_count; i++) {
+        if (entry->level >= klog_state.output_levels[i]) {
+            klog_state.outputs[i](entry);
+        }
+    }
+}
+
+void klog_drain(void) {
+    if (!klog_state.records || __atomic_exchange_n(&klog_state.draining, true, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    klog_entry_t entry;
+    uint64_t lost = 0;
+    uint64_t head = __atomic_load_n(&klog_state.head, __ATOMIC_RELAXED);
+    if (head - klog_state.tail > KLOG_RECORDS) {
+        lost = head - KLOG_RECORDS - klog_state.tail;
+        klog_state.tail = head - KLOG_RECORDS;
+    }
+    while (klog_state.tail != head) {
+        record_state_t state = read_record(klog_state.tail, &entry);
+        if (state == RECORD_PENDING) {
+            break;      /* keeps the order, picked up by the next drain */
+        }
+        klog_state.tail++;
+        if (state == RECORD_LOST) {
+            lost++;
+            continue;
+        }
+        if (lost) {
+            klog_entry_t note = { .seq = entry.seq, .timestamp_ns = entry.timestamp_ns,
+                                  .level = KLOG_WARN };
+            note.length = (uint32_t)ksnprintf(note.text, sizeof(note.text),
+                                              "[KLOG] %llu messages lost\n",
+                                              (unsigned long long)lost);
+            emit(&note);
+            klog_state.lost += lost;
+            lost = 0;
+        }
+        emit(&entry);
+    }
+    klog_state.lost += lost;
+
+    __atomic_store_n(&klog_state.draining, false, __ATOMIC_RELEASE);
+}
+
+void klog_replay(klog_output_t visit) {
+    if (!klog_state.records || !visit) {
+        return;
+    }
+    klog_entry_t entry;
+    uint64_t head = __atomic_load_n(&klog_state.head, __ATOMIC_RELAXED);
+    uint64_t index = head > KLOG_RECORDS ? head - KLOG_RECORDS : 0;
+    for (; index != head; index++) {
+        if (read_record(index, &entry) == RECORD_READY) {
+            visit(&entry);
+        }
+    }
+}
+
+uint64_t klog_lost(void) {
+    return klog_state.lost;
+}
@@ -0,0 +1,59 @@
+#ifndef CASSEOS_KERNEL_LOG_KLOG_H
+#define CASSEOS_KERNEL_LOG_KLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdarg.h>
+
+/* Kernel log: a ring of fixed-size records that any context, IRQ handlers
+ * included, appends to without locks. Producers only format their message
+ * into a slot; the consoles are fed later by klog_drain() from the main loop.
+ * When producers lap the consumer the oldest records are dropped. */
+
+typedef enum {
+    KLOG_TRACE = 1,     /* same values as usb_log_level_t */
+    KLOG_DEBUG = 2,
+    KLOG_INFO  = 3,
+    KLOG_WARN  = 4,
+    KLOG_ERROR = 5,
+} klog_level_t;
+
+#define KLOG_RECORDS     512     /* 64 KiB of 128-byte records */
+#define KLOG_TEXT_MAX    109     /* longer messages are truncated */
+#define KLOG_MAX_OUTPUTS 4
+#define KLOG_CONSOLE_LEVEL KLOG_INFO    /* lowest level printed on screen */
+
+typedef struct {
+    uint64_t seq;               /* message number since boot */
+    uint64_t timestamp_ns;      /* timer_get_ns() when logged */
+    klog_level_t level;
+    uint32_t length;
+    char text[KLOG_TEXT_MAX + 1];
+} klog_entry_t;
+
+typedef void (*klog_output_t)(const klog_entry_t *entry);
+
+/* Allocate the ring, needs the page allocator. Until then messages are
+ * printed directly. */
+bool klog_init(void);
+
+void klog(klog_level_t level, const char *format, ...) __attribute__((format(__printf__, 2, 3)));
+void klog_vprintf(klog_level_t level, const char *format, va_list args);
+
+/* Have klog_drain pass records of at least 'min_level' to 'output' */
+bool klog_add_output(klog_output_t output, klog_level_t min_level);
+/* Output for klog_add_output that prints the text on the screen */
+void klog_console_output(const klog_entry_t *entry);
+
+/* Hand the records logged since the last call to the outputs. Call from
+ * thread context only. */
+void klog_drain(void);
+
+/* Visit every record still held by the ring, oldest first */
+void klog_replay(klog_output_t visit);
+
+/* Records overwritten before they were drained */
+uint64_t klog_lost(void);
+
+#endif /* CASSEOS_KERNEL_LOG_KLOG_H */
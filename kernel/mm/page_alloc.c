@@ -0,0 +1,328 @@
+#include "page_alloc.h"
+#include "libc/mem.h"
+
+/* End of the kernel image including .bss, provided by linker.ld */
+extern uint8_t _kernel_end[];
+
+/* Everything below 1 MiB stays reserved: IVT/BDA, boot page tables, the E820
+ * copy, the BIOS stack, EBDA, VGA memory and option ROMs. */
+#define LOW_MEMORY_END 0x100000ULL
+
+#define PAGE_META_RESERVED   0xFF /* not managed (hole, firmware, kernel) */
+#define PAGE_META_FREE       0x80 /* head of a free block, low bits = order */
+#define PAGE_META_USED       0x40 /* head of an allocated block, low bits = order */
+#define PAGE_META_RUN        0x20 /* max-order block continuing a page_alloc_pages run */
+#define PAGE_META_KIND_MASK  0xF0
+#define PAGE_META_ORDER_MASK 0x0F
+/* 0x00 marks a page inside a larger block */
+
+#define MAX_ORDER_PAGES (1ULL << PAGE_ALLOC_MAX_ORDER)
+
+typedef struct free_block {
+    struct free_block *next;
+    struct free_block *prev;
+} free_block_t;
+
+static free_block_t *free_lists[PAGE_ALLOC_MAX_ORDER + 1];
+static uint8_t *page_meta;      /* one state byte per page frame */
+static uint8_t *page_private;   /* one owner byte per page frame */
+static uint64_t first_pfn;      /* frame described by page_meta[0], max-order aligned */
+static uint64_t pfn_count;
+static uint64_t total_pages = 0;
+static uint64_t free_pages = 0;
+static bool allocator_ready = false;
+
+static inline void *pfn_to_ptr(uint64_t pfn) {
+    return (void *)(uintptr_t)(pfn << PAGE_SHIFT);
+}
+
+static inline uint64_t ptr_to_pfn(const void *ptr) {
+    return (uint64_t)(uintptr_t)ptr >> PAGE_SHIFT;
+}
+
+static inline bool pfn_managed(uint64_t pfn) {
+    return pfn >= first_pfn && pfn < first_pfn + pfn_count;
+}
+
+static void free_list_push(unsigned order, uint64_t pfn) {
+    free_block_t *block = (free_block_t *)pfn_to_ptr(pfn);
+    block->prev = NULL;
+    block->next = free_lists[order];
+    if (block->next) {
+        block->next->prev = block;
+    }
+    free_lists[order] = block;
+    page_meta[pfn - first_pfn] = (uint8_t)(PAGE_META_FREE | order);
+}
+
+static void free_list_remove(unsigned order, free_block_t *block) {
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        free_lists[order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    page_meta[ptr_to_pfn(block) - first_pfn] = 0;
+}
+
+/* Return a block to the free lists, merging it with its buddy as long as the
+ * buddy is a free block of the same order */
+static void buddy_release(uint64_t pfn, unsigned order) {
+    page_meta[pfn - first_pfn] = 0;
+    page_private[pfn - first_pfn] = 0;
+
+    while (order < PAGE_ALLOC_MAX_ORDER) {
+        uint64_t buddy = pfn ^ (1ULL << order);
+        if (!pfn_managed(buddy) || page_meta[buddy - first_pfn] != (PAGE_META_FREE | order)) {
+            break;
+        }
+        free_list_remove(order, (free_block_t *)pfn_to_ptr(buddy));
+        pfn &= ~(1ULL << order);
+        order++;
+    }
+    free_list_push(order, pfn);
+}
+
+static inline uint64_t align_up(uint64_t value, uint64_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static inline uint64_t align_down(uint64_t value, uint64_t align) {
+    return value & ~(align - 1);
+}
+
+static const kernel_memory_region_t *memory_region(const kernel_bootinfo_t *bootinfo, uint32_t index) {
+    uintptr_t base = (uintptr_t)bootinfo->mmap_base;
+    return (const kernel_memory_region_t *)(base + (uintptr_t)index * bootinfo->mmap_entry_size);
+}
+
+/* Usable part of a map entry, clipped to [floor, limit) and to whole pages */
+static bool usable_range(const kernel_memory_region_t *region, uint64_t floor, uint64_t limit,
+                         uint64_t *start, uint64_t *end) {
+    if (region->type != KERNEL_MEMORY_USABLE || region->length == 0) {
+        return false;
+    }
+    uint64_t lo = region->base;
+    uint64_t hi = region->base + region->length;
+    if (hi < lo) {
+        hi = UINT64_MAX;
+    }
+    if (lo < floor) lo = floor;
+    if (hi > limit) hi = limit;
+    lo = align_up(lo, PAGE_SIZE);
+    hi = align_down(hi, PAGE_SIZE);
+    if (lo >= hi) {
+        return false;
+    }
+    *start = lo;
+    *end = hi;
+    return true;
+}
+
+/* Release the still reserved pages of [start, end) one by one */
+static void release_range(uint64_t start, uint64_t end) {
+    for (uint64_t pfn = start >> PAGE_SHIFT; pfn < (end >> PAGE_SHIFT); pfn++) {
+        if (page_meta[pfn - first_pfn] != PAGE_META_RESERVED) {
+            continue;
+        }
+        buddy_release(pfn, 0);
+        total_pages++;
+        free_pages++;
+    }
+}
+
+bool page_alloc_init(const kernel_bootinfo_t *bootinfo, uint64_t mapped_limit) {
+    allocator_ready = false;
+    if (!bootinfo || (bootinfo->flags & KERNEL_BOOTINFO_FLAG_MEMORY_MAP) == 0 ||
+        bootinfo->mmap_base == 0 || bootinfo->mmap_entries == 0 ||
+        bootinfo->mmap_entry_size < 20) {
+        return false;
+    }
+
+    uint64_t floor = (uint64_t)(uintptr_t)_kernel_end;
+    if (floor < LOW_MEMORY_END) {
+        floor = LOW_MEMORY_END;
+    }
+    floor = align_up(floor, PAGE_SIZE);
+
+    /* Pass 1: extent of usable memory */
+    uint64_t lowest = UINT64_MAX, highest = 0;
+    for (uint32_t i = 0; i < bootinfo->mmap_entries; i++) {
+        uint64_t start, end;
+        if (!usable_range(memory_region(bootinfo, i), floor, mapped_limit, &start, &end)) {
+            continue;
+        }
+        if (start < lowest) lowest = start;
+        if (end > highest) highest = end;
+    }
+    if (highest == 0) {
+        return false;
+    }
+
+    first_pfn = align_down(lowest >> PAGE_SHIFT, MAX_ORDER_PAGES);
+    pfn_count = (highest >> PAGE_SHIFT) - first_pfn;
+    uint64_t meta_bytes = align_up(pfn_count * 2, PAGE_SIZE);
+
+    /* Pass 2: the state arrays live at the start of the first region big enough */
+    uint64_t meta_start = 0;
+    for (uint32_t i = 0; i < bootinfo->mmap_entries; i++) {
+        uint64_t start, end;
+        if (usable_range(memory_region(bootinfo, i), floor, mapped_limit, &start, &end) &&
+            end - start >= meta_bytes) {
+            meta_start = start;
+            break;
+        }
+    }
+    if (meta_start == 0) {
+        return false;
+    }
+    uint64_t meta_end = meta_start + meta_bytes;
+
+    page_meta = (uint8_t *)(uintptr_t)meta_start;
+    page_private = page_meta + pfn_count;
+    memory_set(page_meta, PAGE_META_RESERVED, pfn_count);
+    memory_set(page_private, 0, pfn_count);
+    for (unsigned order = 0; order <= PAGE_ALLOC_MAX_ORDER; order++) {
+        free_lists[order] = NULL;
+    }
+    total_pages = 0;
+    free_pages = 0;
+
+    /* Pass 3: release every usable page, the buddy merge rebuilds large blocks.
+     * Pages already released through an overlapping entry are skipped. */
+    for (uint32_t i = 0; i < bootinfo->mmap_entries; i++) {
+        uint64_t start, end;
+        if (!usable_range(memory_region(bootinfo, i), floor, mapped_limit, &start, &end)) {
+            continue;
+        }
+        if (start < meta_end && end > meta_start) {
+            /* Only the state arrays are cut out, both sides stay usable */
+            release_range(start, meta_start < end ? meta_start : end);
+            start = meta_end;
+        }
+        release_range(start, end);
+    }
+
+    allocator_ready = true;
+    return true;
+}
+
+bool page_alloc_ready(void) {
+    return allocator_ready;
+}
+
+void *page_alloc(unsigned order) {
+    if (!allocator_ready || order > PAGE_ALLOC_MAX_ORDER) {
+        return NULL;
+    }
+
+    unsigned current = order;
+    while (current <= PAGE_ALLOC_MAX_ORDER && free_lists[current] == NULL) {
+        current++;
+    }
+    if (current > PAGE_ALLOC_MAX_ORDER) {
+        return NULL;
+    }
+
+    free_block_t *block = free_lists[current];
+    free_list_remove(current, block);
+    uint64_t pfn = ptr_to_pfn(block);
+
+    /* Split: the upper halves go back to the lower-order lists */
+    while (current > order) {
+        current--;
+        free_list_push(current, pfn + (1ULL << current));
+    }
+
+    page_meta[pfn - first_pfn] = (uint8_t)(PAGE_META_USED | order);
+    free_pages -= 1ULL << order;
+    return block;
+}
+
+void *page_alloc_pages(size_t count) {
+    if (!allocator_ready || count == 0) {
+        return NULL;
+    }
+    if (count <= MAX_ORDER_PAGES) {
+        unsigned order = 0;
+        while ((1ULL << order) < count) {
+            order++;
+        }
+        return page_alloc(order);
+    }
+
+    /* Look for adjacent free max-order blocks */
+    uint64_t blocks = (count + MAX_ORDER_PAGES - 1) / MAX_ORDER_PAGES;
+    const uint8_t free_head = PAGE_META_FREE | PAGE_ALLOC_MAX_ORDER;
+    for (uint64_t pfn = first_pfn; pfn + blocks * MAX_ORDER_PAGES <= first_pfn + pfn_count;
+         pfn += MAX_ORDER_PAGES) {
+        uint64_t run = 0;
+        while (run < blocks && page_meta[pfn + run * MAX_ORDER_PAGES - first_pfn] == free_head) {
+            run++;
+        }
+        if (run < blocks) {
+            pfn += run * MAX_ORDER_PAGES;
+            continue;
+        }
+
+        for (uint64_t i = 0; i < blocks; i++) {
+            uint64_t block_pfn = pfn + i * MAX_ORDER_PAGES;
+            free_list_remove(PAGE_ALLOC_MAX_ORDER, (free_block_t *)pfn_to_ptr(block_pfn));
+            page_meta[block_pfn - first_pfn] = (i == 0) ?
+                (uint8_t)(PAGE_META_USED | PAGE_ALLOC_MAX_ORDER) : PAGE_META_RUN;
+        }
+        free_pages -= blocks * MAX_ORDER_PAGES;
+        return pfn_to_ptr(pfn);
+    }
+    return NULL;
+}
+
+void page_free(void *block) {
+    if (!allocator_ready || !block || ((uintptr_t)block & (PAGE_SIZE - 1)) != 0) {
+        return;
+    }
+    uint64_t pfn = ptr_to_pfn(block);
+    if (!pfn_managed(pfn)) {
+        return;
+    }
+    uint8_t meta = page_meta[pfn - first_pfn];
+    if ((meta & PAGE_META_KIND_MASK) != PAGE_META_USED) {
+        return; /* Not the head of an allocated block */
+    }
+
+    unsigned order = meta & PAGE_META_ORDER_MASK;
+    uint64_t next = pfn + (1ULL << order);
+    buddy_release(pfn, order);
+    free_pages += 1ULL << order;
+
+    while (pfn_managed(next) && page_meta[next - first_pfn] == PAGE_META_RUN) {
+        buddy_release(next, PAGE_ALLOC_MAX_ORDER);
+        free_pages += MAX_ORDER_PAGES;
+        next += MAX_ORDER_PAGES;
+    }
+}
+
+void page_set_private(void *page, uint8_t value) {
+    uint64_t pfn = ptr_to_pfn(page);
+    if (allocator_ready && pfn_managed(pfn)) {
+        page_private[pfn - first_pfn] = value;
+    }
+}
+
+uint8_t page_get_private(const void *page) {
+    uint64_t pfn = ptr_to_pfn(page);
+    if (allocator_ready && pfn_managed(pfn)) {
+        return page_private[pfn - first_pfn];
+    }
+    return 0;
+}
+
+uint64_t page_alloc_total_pages(void) {
+    return total_pages;
+}
+
+uint64_t page_alloc_free_pages(void) {
+    return free_pages;
+}
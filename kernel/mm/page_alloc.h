@@ -0,0 +1,38 @@
+#ifndef CASSEOS_KERNEL_MM_PAGE_ALLOC_H
+#define CASSEOS_KERNEL_MM_PAGE_ALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "kernel/include/kernel/bootinfo.h"
+
+/* Buddy allocator for physical pages.
+ * Blocks go from order 0 (4 KiB) to PAGE_ALLOC_MAX_ORDER (2 MiB) and are
+ * naturally aligned to their size. Physical memory is identity mapped, so the
+ * returned addresses can be used directly. */
+
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+#define PAGE_ALLOC_MAX_ORDER 9
+
+/* Build the free lists from the boot memory map. Memory at or above
+ * 'mapped_limit' is ignored because it is not reachable yet. */
+bool page_alloc_init(const kernel_bootinfo_t *bootinfo, uint64_t mapped_limit);
+bool page_alloc_ready(void);
+
+/* Allocate a block of 2^order pages, NULL when no block is left */
+void *page_alloc(unsigned order);
+/* Allocate 'count' physically contiguous pages, runs above 2 MiB are built
+ * from adjacent max-order blocks */
+void *page_alloc_pages(size_t count);
+/* Release a block returned by page_alloc or page_alloc_pages */
+void page_free(void *block);
+
+/* One byte of owner data per page, e.g. the slab class of a slab page */
+void page_set_private(void *page, uint8_t value);
+uint8_t page_get_private(const void *page);
+
+uint64_t page_alloc_total_pages(void);
+uint64_t page_alloc_free_pages(void);
+
+#endif /* CASSEOS_KERNEL_MM_PAGE_ALLOC_H */
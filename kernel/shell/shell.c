@@ -6,6 +6,9 @@
 #include "cpu/type.h"
 #include "libc/string.h"
 #include "drivers/usb/usb.h"
+#include "libc/mem.h"
+#include "drivers/screen/framebuffer_console.h"
+#include "kernel/log/klog.h"
 
 uint8_t cursor=0;
 bool end_command = false;
@@ -14,8 +17,19 @@ bool pop = true;
 
 char command[MAX_COMMAND_LENGTH];
 
+#define FBBENCH_FRAMES 16
+
 extern char key_buffer;
 
+static void dmesg_print(const klog_entry_t *entry) {
+    uint64_t us = entry->timestamp_ns / 1000;
+    printf("[%5llu.%06llu] %s", (unsigned long long)(us / 1000000),
+           (unsigned long long)(us % 1000000), entry->text);
+    if (entry->length == 0 || entry->text[entry->length - 1] != '\n') {
+        kprint("\n");
+    }
+}
+
 void shell_main_loop(){
     if(start){
         kprint("Welcome to CasseOS Shell!\n>");
@@ -30,6 +44,48 @@ void shell_main_loop(){
             kprint("Executing the scan...\n");
             pci_scan_for_usb_controllers();
         }
+        else if(strcmp(command, "memtest")==0){
+            for (size_t i = 0; i < memory_variant_count(); i++) {
+                const char *name = "?";
+                int failures = memory_self_test_variant(i, &name);
+                if (failures < 0) {
+                    printf("  %s: skipped\n", name);
+                } else {
+                    printf("  %s: %s (%d mismatches)\n", name, failures ? "FAILED" : "ok", failures);
+                }
+            }
+            printf("Active: %s\n", memory_implementation_name());
+        }
+        else if(strcmp(command, "fbbench")==0){
+            // Same frames with VRAM uncached and then write-combining
+            const framebuffer_console_t *fb = framebuffer_console_info();
+            if (!fb || !fb->shadow) {
+                kprint("No framebuffer shadow to benchmark\n");
+            } else {
+                bool was_wc = fb->write_combining;
+                framebuffer_console_set_write_combining(false);
+                uint64_t uc = framebuffer_console_benchmark(FBBENCH_FRAMES);
+                bool wc_ok = framebuffer_console_set_write_combining(true);
+                uint64_t wc = wc_ok ? framebuffer_console_benchmark(FBBENCH_FRAMES) : 0;
+                if (!was_wc) framebuffer_console_set_write_combining(false);
+                printf("Framebuffer writes: uncached %d MB/s, write-combining ", (int)(uc / 1000000));
+                if (wc_ok) printf("%d MB/s\n", (int)(wc / 1000000));
+                else kprint("unavailable\n");
+            }
+        }
+        else if(strcmp(command, "usbsched")==0){
+            usb_print_schedule();
+        }
+        else if(strcmp(command, "usbdisk")==0){
+            usb_print_disks();
+        }
+        else if(strcmp(command, "dmesg")==0){
+            klog_drain();
+            klog_replay(dmesg_print);
+            if (klog_lost()) {
+                printf("(%llu messages lost)\n", (unsigned long long)klog_lost());
+            }
+        }
         else{
             kprint("Incorrect command: '");
             kprint(command);
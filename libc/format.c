@@ -0,0 +1,319 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "format.h"
+
+/* Conversions are staged here and handed to the sink in one call */
+#define FORMAT_CHUNK 64
+
+#define FLAG_LEFT  (1 << 0)
+#define FLAG_ZERO  (1 << 1)
+#define FLAG_PLUS  (1 << 2)
+#define FLAG_SPACE (1 << 3)
+#define FLAG_ALT   (1 << 4)
+#define FLAG_UPPER (1 << 5)
+#define FLAG_PTR   (1 << 6)
+
+typedef enum {
+    LENGTH_DEFAULT,
+    LENGTH_HH,
+    LENGTH_H,
+    LENGTH_L,
+    LENGTH_LL,
+    LENGTH_Z,
+    LENGTH_T,
+    LENGTH_J,
+} format_length_t;
+
+typedef struct {
+    int flags;
+    int width;
+    int precision;      /* -1 when absent */
+} format_spec_t;
+
+typedef struct {
+    const format_sink_t *sink;
+    char chunk[FORMAT_CHUNK];
+    size_t used;
+    int total;
+} format_out_t;
+
+static void out_flush(format_out_t *out) {
+    if (out->used) {
+        out->sink->write(out->sink->context, out->chunk, out->used);
+        out->used = 0;
+    }
+}
+
+static void out_char(format_out_t *out, char c) {
+    if (out->used == FORMAT_CHUNK) {
+        out_flush(out);
+    }
+    out->chunk[out->used++] = c;
+    out->total++;
+}
+
+/* Short runs join the chunk, long ones go to the sink untouched */
+static void out_run(format_out_t *out, const char *text, size_t len) {
+    if (len > FORMAT_CHUNK - out->used) {
+        out_flush(out);
+        if (len >= FORMAT_CHUNK) {
+            out->sink->write(out->sink->context, text, len);
+            out->total += (int)len;
+            return;
+        }
+    }
+    for (size_t i = 0; i < len; i++) {
+        out->chunk[out->used++] = text[i];
+    }
+    out->total += (int)len;
+}
+
+static void out_pad(format_out_t *out, char c, int count) {
+    while (count-- > 0) {
+        out_char(out, c);
+    }
+}
+
+static void emit_padded(format_out_t *out, const format_spec_t *spec,
+                        const char *text, size_t len) {
+    int pad = spec->width - (int)len;
+    if (!(spec->flags & FLAG_LEFT)) out_pad(out, ' ', pad);
+    out_run(out, text, len);
+    if (spec->flags & FLAG_LEFT) out_pad(out, ' ', pad);
+}
+
+static void emit_number(format_out_t *out, const format_spec_t *spec, uint64_t value,
+                        bool negative, unsigned base) {
+    const char *digits_set = (spec->flags & FLAG_UPPER) ? "0123456789ABCDEF" : "0123456789abcdef";
+    char digits[64];
+    int ndigits = 0;
+    while (value) {
+        digits[ndigits++] = digits_set[value % base];
+        value /= base;
+    }
+    bool was_zero = ndigits == 0;
+    /* "%.0d" of zero prints nothing, otherwise zero is one digit */
+    if (was_zero && spec->precision != 0) {
+        digits[ndigits++] = '0';
+    }
+
+    char prefix[2];
+    int nprefix = 0;
+    if (negative) prefix[nprefix++] = '-';
+    else if (spec->flags & FLAG_PLUS) prefix[nprefix++] = '+';
+    else if (spec->flags & FLAG_SPACE) prefix[nprefix++] = ' ';
+    if (base == 16 && ((spec->flags & FLAG_PTR) || ((spec->flags & FLAG_ALT) && !was_zero))) {
+        prefix[nprefix++] = '0';
+        prefix[nprefix++] = (spec->flags & FLAG_UPPER) ? 'X' : 'x';
+    }
+
+    int zeros = spec->precision > ndigits ? spec->precision - ndigits : 0;
+    if (base == 8 && (spec->flags & FLAG_ALT) && zeros == 0 &&
+        (ndigits == 0 || digits[ndigits - 1] != '0')) {
+        zeros = 1;
+    }
+    int body = nprefix + zeros + ndigits;
+    int pad = spec->width > body ? spec->width - body : 0;
+    if ((spec->flags & FLAG_ZERO) && !(spec->flags & FLAG_LEFT) && spec->precision < 0) {
+        zeros += pad;
+        pad = 0;
+    }
+
+    if (!(spec->flags & FLAG_LEFT)) out_pad(out, ' ', pad);
+    out_run(out, prefix, (size_t)nprefix);
+    out_pad(out, '0', zeros);
+    while (ndigits) {
+        out_char(out, digits[--ndigits]);
+    }
+    if (spec->flags & FLAG_LEFT) out_pad(out, ' ', pad);
+}
+
+static int parse_int(const char **cursor) {
+    int value = 0;
+    while (**cursor >= '0' && **cursor <= '9') {
+        value = value * 10 + (**cursor - '0');
+        (*cursor)++;
+    }
+    return value;
+}
+
+int format_stream(const format_sink_t *sink, const char *format, va_list args) {
+    format_out_t out = { .sink = sink, .used = 0, .total = 0 };
+    const char *p = format;
+
+    while (*p) {
+        const char *run = p;
+        while (*p && *p != '%') p++;
+        if (p != run) {
+            out_run(&out, run, (size_t)(p - run));
+        }
+        if (!*p) {
+            break;
+        }
+        const char *conversion = p++;
+
+        format_spec_t spec = { .flags = 0, .width = 0, .precision = -1 };
+        for (;; p++) {
+            if (*p == '-') spec.flags |= FLAG_LEFT;
+            else if (*p == '0') spec.flags |= FLAG_ZERO;
+            else if (*p == '+') spec.flags |= FLAG_PLUS;
+            else if (*p == ' ') spec.flags |= FLAG_SPACE;
+            else if (*p == '#') spec.flags |= FLAG_ALT;
+            else break;
+        }
+        if (*p == '*') {
+            spec.width = va_arg(args, int);
+            if (spec.width < 0) {
+                spec.flags |= FLAG_LEFT;
+                spec.width = -spec.width;
+            }
+            p++;
+        } else {
+            spec.width = parse_int(&p);
+        }
+        if (*p == '.') {
+            p++;
+            if (*p == '*') {
+                spec.precision = va_arg(args, int);
+                if (spec.precision < 0) spec.precision = -1;
+                p++;
+            } else {
+                spec.precision = parse_int(&p);
+            }
+        }
+
+        format_length_t length = LENGTH_DEFAULT;
+        switch (*p) {
+            case 'h':
+                p++;
+                length = (*p == 'h') ? (p++, LENGTH_HH) : LENGTH_H;
+                break;
+            case 'l':
+                p++;
+                length = (*p == 'l') ? (p++, LENGTH_LL) : LENGTH_L;
+                break;
+            case 'z': p++; length = LENGTH_Z; break;
+            case 't': p++; length = LENGTH_T; break;
+            case 'j': p++; length = LENGTH_J; break;
+            default: break;
+        }
+
+        switch (*p) {
+            case 'd':
+            case 'i': {
+                int64_t value;
+                switch (length) {
+                    case LENGTH_HH: value = (signed char)va_arg(args, int); break;
+                    case LENGTH_H:  value = (short)va_arg(args, int); break;
+                    case LENGTH_L:  value = va_arg(args, long); break;
+                    case LENGTH_LL: value = va_arg(args, long long); break;
+                    case LENGTH_Z:
+                    case LENGTH_T:  value = va_arg(args, ptrdiff_t); break;
+                    case LENGTH_J:  value = va_arg(args, intmax_t); break;
+                    default:        value = va_arg(args, int); break;
+                }
+                uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+                emit_number(&out, &spec, magnitude, value < 0, 10);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'b': {
+                uint64_t value;
+                switch (length) {
+                    case LENGTH_HH: value = (unsigned char)va_arg(args, unsigned int); break;
+                    case LENGTH_H:  value = (unsigned short)va_arg(args, unsigned int); break;
+                    case LENGTH_L:  value = va_arg(args, unsigned long); break;
+                    case LENGTH_LL: value = va_arg(args, unsigned long long); break;
+                    case LENGTH_Z:  value = va_arg(args, size_t); break;
+                    case LENGTH_T:  value = (uint64_t)va_arg(args, ptrdiff_t); break;
+                    case LENGTH_J:  value = va_arg(args, uintmax_t); break;
+                    default:        value = va_arg(args, unsigned int); break;
+                }
+                unsigned base = 10;
+                if (*p == 'x' || *p == 'X') base = 16;
+                else if (*p == 'o') base = 8;
+                else if (*p == 'b') base = 2;
+                if (*p == 'X') spec.flags |= FLAG_UPPER;
+                spec.flags &= ~(FLAG_PLUS | FLAG_SPACE);
+                emit_number(&out, &spec, value, false, base);
+                break;
+            }
+            case 'p': {
+                uintptr_t value = (uintptr_t)va_arg(args, void *);
+                spec.flags |= FLAG_PTR;
+                spec.flags &= ~(FLAG_PLUS | FLAG_SPACE);
+                emit_number(&out, &spec, value, false, 16);
+                break;
+            }
+            case 'c': {
+                char c = (char)va_arg(args, int);
+                emit_padded(&out, &spec, &c, 1);
+                break;
+            }
+            case 's': {
+                const char *text = va_arg(args, const char *);
+                if (!text) text = "(null)";
+                size_t len = 0;
+                while (text[len] && (spec.precision < 0 || len < (size_t)spec.precision)) {
+                    len++;
+                }
+                emit_padded(&out, &spec, text, len);
+                break;
+            }
+            case '%':
+                out_char(&out, '%');
+                break;
+            default:
+                /* Unknown conversion: print it back verbatim */
+                if (!*p) {
+                    out_run(&out, conversion, (size_t)(p - conversion));
+                    continue;
+                }
+                out_run(&out, conversion, (size_t)(p + 1 - conversion));
+                break;
+        }
+        p++;
+    }
+
+    out_flush(&out);
+    return out.total;
+}
+
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t used;
+} buffer_sink_t;
+
+static void buffer_write(void *context, const char *text, size_t len) {
+    buffer_sink_t *dest = context;
+    if (dest->used + 1 >= dest->size) {
+        return;
+    }
+    size_t room = dest->size - 1 - dest->used;
+    if (len > room) len = room;
+    for (size_t i = 0; i < len; i++) {
+        dest->buffer[dest->used++] = text[i];
+    }
+}
+
+int kvsnprintf(char *buffer, size_t size, const char *format, va_list args) {
+    buffer_sink_t dest = { .buffer = buffer, .size = size, .used = 0 };
+    format_sink_t sink = { .write = buffer_write, .context = &dest };
+    int total = format_stream(&sink, format, args);
+    if (size) {
+        buffer[dest.used] = '\0';
+    }
+    return total;
+}
+
+int ksnprintf(char *buffer, size_t size, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int total = kvsnprintf(buffer, size, format, args);
+    va_end(args);
+    return total;
+}
@@ -0,0 +1,28 @@
+#ifndef CASSEOS_LIBC_FORMAT_H
+#define CASSEOS_LIBC_FORMAT_H
+
+#include <stdarg.h>
+#include <stddef.h>
+
+/* Receives formatted output as runs of 'len' characters, not NUL terminated */
+typedef void (*format_write_t)(void *context, const char *text, size_t len);
+
+typedef struct {
+    format_write_t write;
+    void *context;
+} format_sink_t;
+
+/* printf-style formatting streamed into 'sink'. Literal text is passed
+ * through as-is, conversions are batched in a small on-stack chunk, so the
+ * output length is unbounded. Supports the '-' '0' '+' ' ' '#' flags, width
+ * and precision (also '*'), the hh/h/l/ll/z/t/j length modifiers and
+ * %d %i %u %x %X %o %b %c %s %p %%. Returns the number of characters written. */
+int format_stream(const format_sink_t *sink, const char *format, va_list args);
+
+/* Format into 'buffer', truncating to 'size' - 1 characters plus the NUL.
+ * Returns the length the full output would have had. */
+int kvsnprintf(char *buffer, size_t size, const char *format, va_list args);
+int ksnprintf(char *buffer, size_t size, const char *format, ...)
+    __attribute__((format(__printf__, 3, 4)));
+
+#endif
@@ -1,128 +1,261 @@
 #include "mem.h"
+#include "mem_simd.h"
+#include "cpu/cpuid.h"
+#include "kernel/mm/page_alloc.h"
 
-void memory_copy(void *dest, const void *source, size_t nbytes) {
-    uint8_t *d = (uint8_t*)dest;
-    const uint8_t *s = (const uint8_t*)source;
+/* ______________________________________________________________________________________ */
+/* memory_copy/memory_set/memory_compare dispatch.
+ * Byte loops until memory_init_dispatch() has looked at the CPU, then the
+ * best variant from mem_simd.c. */
+
+typedef struct {
+    const char *name;
+    void (*copy)(void *dest, const void *source, size_t nbytes);
+    void *(*set)(void *dest, uint8_t val, size_t len);
+    int (*compare)(const void *a, const void *b, size_t n);
+} memory_ops_t;
+
+enum {
+    MEMORY_OPS_BYTES = 0,
+    MEMORY_OPS_SSE2,
+    MEMORY_OPS_ERMS,
+    MEMORY_OPS_AVX2,
+    MEMORY_OPS_COUNT
+};
 
-    for (size_t i = 0; i < nbytes; i++) {
-        d[i] = s[i];
+static const memory_ops_t memory_ops_table[MEMORY_OPS_COUNT] = {
+    [MEMORY_OPS_BYTES] = { "bytes", memory_copy_bytes, memory_set_bytes, memory_compare_bytes },
+    [MEMORY_OPS_SSE2]  = { "sse2",  memory_copy_sse2,  memory_set_sse2,  memory_compare_sse2 },
+    [MEMORY_OPS_ERMS]  = { "erms",  memory_copy_erms,  memory_set_erms,  memory_compare_sse2 },
+    [MEMORY_OPS_AVX2]  = { "avx2",  memory_copy_avx2,  memory_set_avx2,  memory_compare_avx2 },
+};
+
+static const memory_ops_t *memory_ops = &memory_ops_table[MEMORY_OPS_BYTES];
+
+static bool memory_ops_supported(int index) {
+    switch (index) {
+        case MEMORY_OPS_BYTES: return true;
+        case MEMORY_OPS_SSE2:  return cpu_features.sse2;
+        case MEMORY_OPS_ERMS:  return cpu_features.erms && cpu_features.sse2;
+        case MEMORY_OPS_AVX2:  return cpu_features.avx2;
+        default:               return false;
     }
 }
 
+void memory_init_dispatch(void) {
+    int choice = MEMORY_OPS_BYTES;
+    if (cpu_features.erms && cpu_features.fsrm) {
+        choice = MEMORY_OPS_ERMS;   // rep movsb is fast even for short copies
+    } else if (cpu_features.avx2) {
+        choice = MEMORY_OPS_AVX2;
+    } else if (cpu_features.erms) {
+        choice = MEMORY_OPS_ERMS;
+    } else if (cpu_features.sse2) {
+        choice = MEMORY_OPS_SSE2;
+    }
+    memory_ops = &memory_ops_table[choice];
+}
+
+const char *memory_implementation_name(void) {
+    return memory_ops->name;
+}
+
+void memory_copy(void *dest, const void *source, size_t nbytes) {
+    memory_ops->copy(dest, source, nbytes);
+}
+
 void* memory_set(void *dest, uint8_t val, size_t len) {
-    uint8_t *temp = (uint8_t *)dest;
-    for ( ; len != 0; len--) *temp++ = val;
-    return dest;
+    return memory_ops->set(dest, val, len);
 }
 
 int memory_compare(const void* a, const void* b, size_t n) {
-    const unsigned char* p1 = (const unsigned char*)a;
-    const unsigned char* p2 = (const unsigned char*)b;
+    return memory_ops->compare(a, b, n);
+}
 
-    for (size_t i = 0; i < n; i++) {
-        if (p1[i] != p2[i])
-            return (p1[i] < p2[i]) ? -1 : 1;
+/* Self-test: every variant the CPU supports against the byte loops, on random
+ * sizes and alignments plus a few sizes past the non-temporal threshold. */
+
+#define SELF_TEST_ROUNDS 400
+#define SELF_TEST_MAX_SMALL 4096
+#define SELF_TEST_SLACK 64
+#define SELF_TEST_BUFFER (MEM_NONTEMPORAL_THRESHOLD + 4096 + 2 * SELF_TEST_SLACK)
+
+static uint64_t self_test_state;
+
+static uint64_t self_test_random(void) {
+    uint64_t x = self_test_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    self_test_state = x;
+    return x;
+}
+
+static void self_test_fill(uint8_t *buffer, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        buffer[i] = (uint8_t)self_test_random();
     }
-    return 0;
 }
 
+static int sign_of(int value) {
+    return (value > 0) - (value < 0);
+}
 
-/* This should be computed at link time, but a hardcoded
- * value is fine for now. Remember that our kernel starts
- * at 0x1000 as defined on the Makefile */
-uint32_t free_mem_addr = 0x10000;
-/* Implementation is just a pointer to some free memory which
- * keeps growing */
-uint32_t kmalloc(size_t size, int align, uint32_t *phys_addr) {
-    /* Pages are aligned to 4K, or 0x1000 */
-    if (align == 1 && (free_mem_addr & 0xFFFFF000)) {
-        free_mem_addr &= 0xFFFFF000;
-        free_mem_addr += 0x1000;
-    }
-    /* Save also the physical address */
-    if (phys_addr) *phys_addr = free_mem_addr;
-
-    uint32_t ret = free_mem_addr;
-    free_mem_addr += size; /* Remember to increment the pointer */
-    return ret;
+size_t memory_variant_count(void) {
+    return MEMORY_OPS_COUNT;
 }
 
-/* ______________________________________________________________________________________ */
-typedef struct AllocationHeader {
-    size_t size;                        // Size of the allocated block
-    struct AllocationHeader* next_free; // Pointer to the next free block
-} AllocationHeader;
+int memory_self_test_variant(size_t index, const char **name) {
+    if (index >= MEMORY_OPS_COUNT) {
+        return -1;
+    }
+    const memory_ops_t *ops = &memory_ops_table[index];
+    if (name) {
+        *name = ops->name;
+    }
+    if (!memory_ops_supported((int)index)) {
+        return -1;
+    }
 
+    uint8_t *src = aligned_alloc(64, SELF_TEST_BUFFER);
+    uint8_t *expect = aligned_alloc(64, SELF_TEST_BUFFER);
+    uint8_t *actual = aligned_alloc(64, SELF_TEST_BUFFER);
+    if (!src || !expect || !actual) {
+        aligned_free(src);
+        aligned_free(expect);
+        aligned_free(actual);
+        return -1;
+    }
 
-#define ALLOCATOR_SIZE (1024 * 512) // 512 KB allocator buffer
-static uint8_t allocator_buffer[ALLOCATOR_SIZE];
-static size_t allocator_offset = 0;
+    int failures = 0;
+    self_test_state = 0x9E3779B97F4A7C15ULL ^ index;
+    for (int round = 0; round < SELF_TEST_ROUNDS; round++) {
+        size_t len = (size_t)(self_test_random() % SELF_TEST_MAX_SMALL);
+        if (round % 4 == 0) {
+            len %= 64; // Small sizes take the most branches
+        } else if (round % 50 == 0) {
+            len += MEM_NONTEMPORAL_THRESHOLD;
+        }
+        size_t src_offset = (size_t)(self_test_random() % SELF_TEST_SLACK);
+        size_t dst_offset = (size_t)(self_test_random() % SELF_TEST_SLACK);
+        size_t span = len + 2 * SELF_TEST_SLACK;
+        uint8_t val = (uint8_t)self_test_random();
 
-static AllocationHeader* free_list = NULL; // Start of the free list
+        // copy
+        self_test_fill(src, span);
+        self_test_fill(expect, span);
+        memory_copy_bytes(actual, expect, span);
+        memory_copy_bytes(expect + dst_offset, src + src_offset, len);
+        ops->copy(actual + dst_offset, src + src_offset, len);
+        if (memory_compare_bytes(expect, actual, span) != 0) {
+            failures++;
+        }
 
-void* aligned_alloc(size_t alignment, size_t size) {
-    // Ensure alignment is at least the size of a pointer and a power of two
-    if (alignment < sizeof(void*)) {
-        alignment = sizeof(void*);
-    }
-    if ((alignment & (alignment - 1)) != 0) {
-        return NULL; // Invalid alignment
+        // set
+        memory_set_bytes(expect + dst_offset, val, len);
+        ops->set(actual + dst_offset, val, len);
+        if (memory_compare_bytes(expect, actual, span) != 0) {
+            failures++;
+        }
+
+        // compare: equal, then one byte changed somewhere (or past the end)
+        memory_copy_bytes(actual, src, span);
+        if (ops->compare(src + src_offset, actual + src_offset, len) != 0) {
+            failures++;
+        }
+        size_t flip = (size_t)(self_test_random() % (len + 1));
+        actual[src_offset + flip] ^= (uint8_t)(1u << (self_test_random() % 8));
+        int want = sign_of(memory_compare_bytes(src + src_offset, actual + src_offset, len));
+        if (sign_of(ops->compare(src + src_offset, actual + src_offset, len)) != want) {
+            failures++;
+        }
     }
 
-    // Adjust size to include the AllocationHeader
-    size_t total_size = size + sizeof(AllocationHeader);
+    aligned_free(src);
+    aligned_free(expect);
+    aligned_free(actual);
+    return failures;
+}
 
-    // Search for a suitable free block
-    AllocationHeader** current = &free_list;
-    while (*current != NULL) {
-        if ((*current)->size >= total_size) {
-            // Found a suitable block
-            AllocationHeader* alloc_header = *current;
-            *current = alloc_header->next_free; // Remove from free list
+/* ______________________________________________________________________________________ */
+/* Size-class slab allocator on top of the buddy page allocator.
+ * Requests up to 4 KiB are served from per-class free lists (16, 32, ...,
+ * 4096 bytes) carved out of single pages, anything larger takes a block of
+ * whole pages. Objects inside a slab page sit at multiples of their class
+ * size, so every object is naturally aligned to its class and no header is
+ * needed: the page private byte tells aligned_free which class a pointer
+ * belongs to (0 means a page block). */
 
-            // Calculate the aligned user data address
-            uintptr_t raw_address = (uintptr_t)(alloc_header + 1);
-            uintptr_t aligned_address = (raw_address + (alignment - 1)) & ~(alignment - 1);
-            size_t padding = aligned_address - raw_address;
+#define SLAB_MIN_SHIFT 4    // 16 bytes
+#define SLAB_MAX_SHIFT 12   // 4096 bytes, one object per page
+#define SLAB_CLASS_COUNT (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
 
-            if (padding > 0) {
-                // Need to adjust for alignment; create a new header
-                AllocationHeader* new_header = (AllocationHeader*)(aligned_address - sizeof(AllocationHeader));
-                new_header->size = alloc_header->size - padding;
-                alloc_header = new_header;
-            }
+typedef struct slab_object {
+    struct slab_object *next;
+} slab_object_t;
 
-            // Return the aligned user data pointer
-            return (void*)(alloc_header + 1);
-        }
+typedef struct {
+    slab_object_t *free_list; // Objects handed back by aligned_free
+    uint8_t *bump;            // Not yet carved part of the newest slab page
+    uint8_t *bump_end;
+} slab_class_t;
 
-        current = &((*current)->next_free);
+static slab_class_t slab_classes[SLAB_CLASS_COUNT];
+
+/* Smallest class whose object size covers 'need' bytes */
+static int slab_class_for(size_t need) {
+    int shift = SLAB_MIN_SHIFT;
+    while (((size_t)1 << shift) < need) {
+        shift++;
     }
+    return shift - SLAB_MIN_SHIFT;
+}
 
-    // No suitable free block found; allocate from the buffer
-    uintptr_t current_address = (uintptr_t)&allocator_buffer[allocator_offset];
+static void *slab_alloc(int class_index) {
+    slab_class_t *cls = &slab_classes[class_index];
+    size_t object_size = (size_t)1 << (class_index + SLAB_MIN_SHIFT);
 
-    // Ensure the allocation header is aligned
-    size_t header_padding = (alignment - (current_address % alignment)) % alignment;
-    if (header_padding < sizeof(AllocationHeader)) {
-        header_padding += alignment;
+    if (cls->free_list) {
+        slab_object_t *object = cls->free_list;
+        cls->free_list = object->next;
+        return object;
     }
-    current_address += header_padding;
 
-    // Check for buffer overflow
-    if (allocator_offset + header_padding + total_size > ALLOCATOR_SIZE) {
-        return NULL; // Not enough memory
+    if (cls->bump == cls->bump_end) {
+        uint8_t *page = page_alloc(0);
+        if (!page) {
+            return NULL;
+        }
+        page_set_private(page, (uint8_t)(class_index + 1));
+        cls->bump = page;
+        cls->bump_end = page + PAGE_SIZE;
     }
 
-    // Update the allocator offset
-    allocator_offset += header_padding + total_size;
+    void *object = cls->bump;
+    cls->bump += object_size;
+    return object;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    // Ensure alignment is at least the size of a pointer and a power of two
+    if (alignment < sizeof(void*)) {
+        alignment = sizeof(void*);
+    }
+    if ((alignment & (alignment - 1)) != 0) {
+        return NULL; // Invalid alignment
+    }
 
-    // Set up the allocation header
-    AllocationHeader* alloc_header = (AllocationHeader*)current_address;
-    alloc_header->size = total_size;
+    size_t need = (size > alignment) ? size : alignment;
+    if (need <= ((size_t)1 << SLAB_MAX_SHIFT)) {
+        return slab_alloc(slab_class_for(need));
+    }
 
-    // Return the aligned user data pointer
-    return (void*)(alloc_header + 1);
+    // Large request: buddy blocks are aligned to their own size and runs
+    // longer than the largest order start on a max-order boundary
+    if (alignment > (PAGE_SIZE << PAGE_ALLOC_MAX_ORDER)) {
+        return NULL;
+    }
+    return page_alloc_pages((need + PAGE_SIZE - 1) / PAGE_SIZE);
 }
 
 void aligned_free(void* ptr) {
@@ -130,12 +263,16 @@ void aligned_free(void* ptr) {
         return; // Do nothing for NULL pointer
     }
 
-    // Get the allocation header
-    AllocationHeader* alloc_header = (AllocationHeader*)ptr - 1;
-
-    // Add the block to the free list
-    alloc_header->next_free = free_list;
-    free_list = alloc_header;
+    void *page = (void *)((uintptr_t)ptr & ~(uintptr_t)(PAGE_SIZE - 1));
+    uint8_t tag = page_get_private(page);
+    if (tag != 0) {
+        slab_class_t *cls = &slab_classes[tag - 1];
+        slab_object_t *object = (slab_object_t *)ptr;
+        object->next = cls->free_list;
+        cls->free_list = object;
+    } else {
+        page_free(ptr); // Ignores anything that is not the head of a page block
+    }
 }
 
 
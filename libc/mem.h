@@ -13,9 +13,18 @@ void* memory_set(void *dest, uint8_t val, size_t len);
 int memory_compare(const void* a, const void* b, size_t n);
 #define memcmp memory_compare
 
+/* Switch the three functions above to the best variant for this CPU,
+ * call after cpu_detect_features() */
+void memory_init_dispatch(void);
+const char *memory_implementation_name(void);
 
-/* At this stage there is no 'free' implemented. */
-uint32_t kmalloc(size_t size, int align, uint32_t *phys_addr);
+/* Check variant 'index' against the byte loops. Returns the number of
+ * mismatches, or -1 if the CPU lacks the variant or memory ran out. */
+size_t memory_variant_count(void);
+int memory_self_test_variant(size_t index, const char **name);
+
+
+/* Backed by the page allocator, usable once page_alloc_init succeeded */
 void* aligned_alloc(size_t alignment, size_t size);
 uintptr_t get_physical_address(void* virtual_address);
 void aligned_free(void* ptr);
@@ -0,0 +1,267 @@
+/* SIMD and rep-string variants of the memory primitives.
+ * No intrinsics headers in a freestanding build: plain loads and stores go
+ * through GCC vector types, non-temporal stores through inline asm.
+ * The AVX2 functions carry a target attribute so the rest of the kernel is
+ * still built for baseline x86_64 and only runs them when mem.c saw AVX2. */
+#include "mem_simd.h"
+
+typedef uint64_t u64_unaligned __attribute__((aligned(1), may_alias));
+typedef uint32_t u32_unaligned __attribute__((aligned(1), may_alias));
+typedef uint8_t v16u8 __attribute__((vector_size(16), aligned(1), may_alias));
+typedef uint8_t v16u8_aligned __attribute__((vector_size(16), may_alias));
+typedef uint64_t v2u64 __attribute__((vector_size(16)));
+typedef uint8_t v32u8 __attribute__((vector_size(32), aligned(1), may_alias));
+typedef uint8_t v32u8_aligned __attribute__((vector_size(32), may_alias));
+typedef uint64_t v4u64 __attribute__((vector_size(32)));
+
+/* ---- Byte loops: the reference every other variant is tested against ---- */
+
+void memory_copy_bytes(void *dest, const void *source, size_t nbytes) {
+    uint8_t *d = (uint8_t*)dest;
+    const uint8_t *s = (const uint8_t*)source;
+
+    for (size_t i = 0; i < nbytes; i++) {
+        d[i] = s[i];
+    }
+}
+
+void *memory_set_bytes(void *dest, uint8_t val, size_t len) {
+    uint8_t *temp = (uint8_t *)dest;
+    for ( ; len != 0; len--) *temp++ = val;
+    return dest;
+}
+
+int memory_compare_bytes(const void *a, const void *b, size_t n) {
+    const unsigned char* p1 = (const unsigned char*)a;
+    const unsigned char* p2 = (const unsigned char*)b;
+
+    for (size_t i = 0; i < n; i++) {
+        if (p1[i] != p2[i])
+            return (p1[i] < p2[i]) ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Up to 15 bytes with overlapping head/tail accesses, everything is loaded
+ * before anything is stored */
+static inline void copy_small(uint8_t *d, const uint8_t *s, size_t n) {
+    if (n >= 8) {
+        uint64_t head = *(const u64_unaligned *)s;
+        uint64_t tail = *(const u64_unaligned *)(s + n - 8);
+        *(u64_unaligned *)d = head;
+        *(u64_unaligned *)(d + n - 8) = tail;
+    } else if (n >= 4) {
+        uint32_t head = *(const u32_unaligned *)s;
+        uint32_t tail = *(const u32_unaligned *)(s + n - 4);
+        *(u32_unaligned *)d = head;
+        *(u32_unaligned *)(d + n - 4) = tail;
+    } else if (n > 0) {
+        uint8_t first = s[0], middle = s[n / 2], last = s[n - 1];
+        d[0] = first;
+        d[n / 2] = middle;
+        d[n - 1] = last;
+    }
+}
+
+static inline void set_small(uint8_t *d, uint8_t val, size_t n) {
+    uint64_t pattern = 0x0101010101010101ULL * val;
+    if (n >= 8) {
+        *(u64_unaligned *)d = pattern;
+        *(u64_unaligned *)(d + n - 8) = pattern;
+    } else if (n >= 4) {
+        *(u32_unaligned *)d = (uint32_t)pattern;
+        *(u32_unaligned *)(d + n - 4) = (uint32_t)pattern;
+    } else if (n > 0) {
+        d[0] = val;
+        d[n / 2] = val;
+        d[n - 1] = val;
+    }
+}
+
+/* ---- ERMS: rep movsb/stosb, microcoded to full cache-line moves ---- */
+
+void memory_copy_erms(void *dest, const void *source, size_t nbytes) {
+    __asm__ volatile ("rep movsb"
+                      : "+D"(dest), "+S"(source), "+c"(nbytes)
+                      :
+                      : "memory");
+}
+
+void *memory_set_erms(void *dest, uint8_t val, size_t len) {
+    void *d = dest;
+    __asm__ volatile ("rep stosb"
+                      : "+D"(d), "+c"(len)
+                      : "a"(val)
+                      : "memory");
+    return dest;
+}
+
+/* ---- SSE2 ---- */
+
+static inline void stream16(uint8_t *d, v16u8 value) {
+    __asm__ volatile ("movntdq %1, %0" : "=m"(*(v16u8_aligned *)d) : "x"(value));
+}
+
+void memory_copy_sse2(void *dest, const void *source, size_t nbytes) {
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)source;
+    if (nbytes < 16) {
+        copy_small(d, s, nbytes);
+        return;
+    }
+
+    uint8_t *end = d + nbytes;
+    v16u8 head = *(const v16u8 *)s;
+    v16u8 tail = *(const v16u8 *)(s + nbytes - 16);
+
+    if (nbytes >= MEM_NONTEMPORAL_THRESHOLD) {
+        /* Streaming stores need an aligned destination, the unaligned head
+         * is covered by the head store below */
+        size_t skew = (16 - ((uintptr_t)d & 15)) & 15;
+        uint8_t *p = d + skew;
+        s += skew;
+        for (; p + 16 <= end - 16; p += 16, s += 16) {
+            stream16(p, *(const v16u8 *)s);
+        }
+        __asm__ volatile ("sfence" ::: "memory");
+        for (; p < end - 16; p += 16, s += 16) {
+            *(v16u8 *)p = *(const v16u8 *)s;
+        }
+    } else {
+        uint8_t *p = d + 16;
+        s += 16;
+        for (; p < end - 16; p += 16, s += 16) {
+            *(v16u8 *)p = *(const v16u8 *)s;
+        }
+    }
+    *(v16u8 *)d = head;
+    *(v16u8 *)(end - 16) = tail;
+}
+
+void *memory_set_sse2(void *dest, uint8_t val, size_t len) {
+    uint8_t *d = (uint8_t *)dest;
+    if (len < 16) {
+        set_small(d, val, len);
+        return dest;
+    }
+
+    v16u8 v = (v16u8){0} + val;
+    uint8_t *end = d + len;
+    *(v16u8 *)d = v;
+    *(v16u8 *)(end - 16) = v;
+
+    uint8_t *p = (uint8_t *)(((uintptr_t)d + 16) & ~(uintptr_t)15);
+    if (len >= MEM_NONTEMPORAL_THRESHOLD) {
+        for (; p + 16 <= end; p += 16) {
+            stream16(p, v);
+        }
+        __asm__ volatile ("sfence" ::: "memory");
+    } else {
+        for (; p + 16 <= end; p += 16) {
+            *(v16u8_aligned *)p = v;
+        }
+    }
+    return dest;
+}
+
+int memory_compare_sse2(const void *a, const void *b, size_t n) {
+    const uint8_t *p1 = (const uint8_t *)a;
+    const uint8_t *p2 = (const uint8_t *)b;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        v2u64 diff = (v2u64)(*(const v16u8 *)(p1 + i) ^ *(const v16u8 *)(p2 + i));
+        if (diff[0] | diff[1]) {
+            break;
+        }
+    }
+    return memory_compare_bytes(p1 + i, p2 + i, n - i);
+}
+
+/* ---- AVX2 ---- */
+
+__attribute__((target("avx2")))
+static inline void stream32(uint8_t *d, v32u8 value) {
+    __asm__ volatile ("vmovntdq %1, %0" : "=m"(*(v32u8_aligned *)d) : "x"(value));
+}
+
+__attribute__((target("avx2")))
+void memory_copy_avx2(void *dest, const void *source, size_t nbytes) {
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)source;
+    if (nbytes < 32) {
+        if (nbytes >= 16) {
+            v16u8 head = *(const v16u8 *)s;
+            v16u8 tail = *(const v16u8 *)(s + nbytes - 16);
+            *(v16u8 *)d = head;
+            *(v16u8 *)(d + nbytes - 16) = tail;
+        } else {
+            copy_small(d, s, nbytes);
+        }
+        return;
+    }
+
+    uint8_t *end = d + nbytes;
+    v32u8 head = *(const v32u8 *)s;
+    v32u8 tail = *(const v32u8 *)(s + nbytes - 32);
+
+    if (nbytes >= MEM_NONTEMPORAL_THRESHOLD) {
+        size_t skew = (32 - ((uintptr_t)d & 31)) & 31;
+        uint8_t *p = d + skew;
+        s += skew;
+        for (; p + 32 <= end - 32; p += 32, s += 32) {
+            stream32(p, *(const v32u8 *)s);
+        }
+        __asm__ volatile ("sfence" ::: "memory");
+        for (; p < end - 32; p += 32, s += 32) {
+            *(v32u8 *)p = *(const v32u8 *)s;
+        }
+    } else {
+        uint8_t *p = d + 32;
+        s += 32;
+        for (; p < end - 32; p += 32, s += 32) {
+            *(v32u8 *)p = *(const v32u8 *)s;
+        }
+    }
+    *(v32u8 *)d = head;
+    *(v32u8 *)(end - 32) = tail;
+}
+
+__attribute__((target("avx2")))
+void *memory_set_avx2(void *dest, uint8_t val, size_t len) {
+    uint8_t *d = (uint8_t *)dest;
+    if (len < 32) {
+        return memory_set_sse2(dest, val, len);
+    }
+
+    v32u8 v = (v32u8){0} + val;
+    uint8_t *end = d + len;
+    *(v32u8 *)d = v;
+    *(v32u8 *)(end - 32) = v;
+
+    uint8_t *p = (uint8_t *)(((uintptr_t)d + 32) & ~(uintptr_t)31);
+    if (len >= MEM_NONTEMPORAL_THRESHOLD) {
+        for (; p + 32 <= end; p += 32) {
+            stream32(p, v);
+        }
+        __asm__ volatile ("sfence" ::: "memory");
+    } else {
+        for (; p + 32 <= end; p += 32) {
+            *(v32u8_aligned *)p = v;
+        }
+    }
+    return dest;
+}
+
+__attribute__((target("avx2")))
+int memory_compare_avx2(const void *a, const void *b, size_t n) {
+    const uint8_t *p1 = (const uint8_t *)a;
+    const uint8_t *p2 = (const uint8_t *)b;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        v4u64 diff = (v4u64)(*(const v32u8 *)(p1 + i) ^ *(const v32u8 *)(p2 + i));
+        if (diff[0] | diff[1] | diff[2] | diff[3]) {
+            break;
+        }
+    }
+    return memory_compare_bytes(p1 + i, p2 + i, n - i);
+}
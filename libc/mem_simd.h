@@ -0,0 +1,28 @@
+#ifndef MEM_SIMD_H
+#define MEM_SIMD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Size from which the SSE2/AVX2 variants switch to non-temporal stores:
+ * past this point the destination would mostly evict useful cache lines. */
+#define MEM_NONTEMPORAL_THRESHOLD (256 * 1024)
+
+/* Variants behind memory_copy/memory_set/memory_compare (see mem.c).
+ * Copies run forward, so dest < source overlaps are fine like the byte loop. */
+void memory_copy_bytes(void *dest, const void *source, size_t nbytes);
+void *memory_set_bytes(void *dest, uint8_t val, size_t len);
+int memory_compare_bytes(const void *a, const void *b, size_t n);
+
+void memory_copy_erms(void *dest, const void *source, size_t nbytes);
+void *memory_set_erms(void *dest, uint8_t val, size_t len);
+
+void memory_copy_sse2(void *dest, const void *source, size_t nbytes);
+void *memory_set_sse2(void *dest, uint8_t val, size_t len);
+int memory_compare_sse2(const void *a, const void *b, size_t n);
+
+void memory_copy_avx2(void *dest, const void *source, size_t nbytes);
+void *memory_set_avx2(void *dest, uint8_t val, size_t len);
+int memory_compare_avx2(const void *a, const void *b, size_t n);
+
+#endif
@@ -0,0 +1,122 @@
+#include "host.h"
+#include "cpu/cpuid.h"
+#include "drivers/keyboard/keyboard.h"
+#include "drivers/usb/uhci/uhci.h"
+#include "kernel/mm/page_alloc.h"
+#include "libc/mem.h"
+#include "libc/mem_simd.h"
+#include "libc/string.h"
+
+/* Microbenchmarks for the host build: per-variant mem ops over a range of
+ * sizes, plus the string helpers, the PS/2 mapper and the USB config parser.
+ * Each case runs until BENCH_MIN_NS has elapsed so short ops get enough
+ * iterations to be measurable. */
+
+#define BENCH_MIN_NS 50000000ull
+#define BENCH_MAX_SIZE (1u << 20)
+
+void ps2_on_scancode_byte(uint8_t b);
+
+typedef struct {
+    const char *name;
+    bool supported;
+    void (*copy)(void *dest, const void *source, size_t nbytes);
+    void *(*set)(void *dest, uint8_t val, size_t len);
+    int (*compare)(const void *a, const void *b, size_t n);
+} bench_variant_t;
+
+static volatile int bench_sink;
+
+#define BENCH_LOOP(label, bytes, body)                                   \
+    do {                                                                 \
+        uint64_t iters_ = 0, start_ = host_now_ns(), elapsed_;           \
+        do {                                                             \
+            for (int k_ = 0; k_ < 64; k_++) { body; }                    \
+            iters_ += 64;                                                \
+            elapsed_ = host_now_ns() - start_;                           \
+        } while (elapsed_ < BENCH_MIN_NS);                               \
+        host_report_bench((label), (bytes), iters_, elapsed_);           \
+    } while (0)
+
+static void bench_label(char *out, const char *op, const char *variant) {
+    int n = 0;
+    while (*op) out[n++] = *op++;
+    out[n++] = '/';
+    while (*variant) out[n++] = *variant++;
+    out[n] = '\0';
+}
+
+static void bench_mem(void) {
+    static const size_t sizes[] = { 16, 64, 256, 4096, 65536, BENCH_MAX_SIZE };
+    const bench_variant_t variants[] = {
+        { "bytes", true, memory_copy_bytes, memory_set_bytes, memory_compare_bytes },
+        { "sse2", cpu_features.sse2, memory_copy_sse2, memory_set_sse2, memory_compare_sse2 },
+        { "erms", cpu_features.erms && cpu_features.sse2, memory_copy_erms, memory_set_erms, memory_compare_sse2 },
+        { "avx2", cpu_features.avx2, memory_copy_avx2, memory_set_avx2, memory_compare_avx2 },
+    };
+    char label[32];
+
+    uint8_t *src = page_alloc_pages(BENCH_MAX_SIZE / PAGE_SIZE);
+    uint8_t *dst = page_alloc_pages(BENCH_MAX_SIZE / PAGE_SIZE);
+    if (!src || !dst) {
+        host_print("mem: out of pages");
+        return;
+    }
+    memory_set(src, 0x5A, BENCH_MAX_SIZE);
+    memory_set(dst, 0x5A, BENCH_MAX_SIZE);
+
+    host_print("[mem]");
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        const bench_variant_t *bv = &variants[v];
+        if (!bv->supported) continue;
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t n = sizes[s];
+            bench_label(label, "copy", bv->name);
+            BENCH_LOOP(label, n, bv->copy(dst, src, n));
+            bench_label(label, "set", bv->name);
+            BENCH_LOOP(label, n, bv->set(dst, 0x5A, n));
+            bench_label(label, "compare", bv->name);
+            BENCH_LOOP(label, n, bench_sink += bv->compare(dst, src, n));
+        }
+    }
+
+    page_free(src);
+    page_free(dst);
+}
+
+static void bench_string(void) {
+    char buf[32];
+    char text[] = "the quick brown fox jumps over the lazy dog";
+
+    host_print("[string]");
+    BENCH_LOOP("int_to_ascii", 0, int_to_ascii(-(int)bench_sink - 123456789, buf));
+    BENCH_LOOP("hex_to_string_trimmed", 0, hex_to_string_trimmed(0xDEADBEEFull + bench_sink, buf));
+    BENCH_LOOP("strlen/43", 0, bench_sink += strlen(text));
+    BENCH_LOOP("strcmp/43", 0, bench_sink += strcmp(text, text));
+}
+
+static void bench_input(void) {
+    static const uint8_t blob[] = {
+        9, USB_DESC_TYPE_CONFIGURATION, 34, 0, 1, 1, 0, 0xA0, 50,
+        9, USB_DESC_TYPE_INTERFACE, 0, 0, 1, USB_CLASS_HID, USB_SUBCLASS_BOOT, USB_PROTOCOL_KEYBOARD, 0,
+        9, USB_DESC_TYPE_HID, 0x11, 0x01, 0, 1, 0x22, 63, 0,
+        7, USB_DESC_TYPE_ENDPOINT, 0x81, 0x03, 8, 0, 10,
+    };
+    static usb_device_t dev;
+    key_event_t ev;
+
+    host_print("[input]");
+    BENCH_LOOP("usb_parse_config_blob", 0, bench_sink += usb_parse_config_blob_into_device(blob, sizeof(blob), &dev));
+    BENCH_LOOP("ps2_on_scancode_byte x2", 0,
+               ps2_on_scancode_byte(0x1C); ps2_on_scancode_byte(0x9C);
+               while (kbd_read_event(&ev)) { } while (kbd_read_char()) { });
+}
+
+int main(void) {
+    host_memory_init();
+    kbd_subsystem_init();
+    bench_mem();
+    bench_string();
+    bench_input();
+    return 0;
+}
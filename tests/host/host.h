@@ -0,0 +1,39 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "cpu/isr.h"
+
+/* Shared helpers of the host test and benchmark binaries. Kernel-side test
+ * files include this instead of any host C library header; host_env.c is the
+ * only translation unit that talks to the host libc. */
+
+void host_check(int ok, const char *expr, const char *file, int line);
+#define CHECK(expr) host_check((expr) ? 1 : 0, #expr, __FILE__, __LINE__)
+
+/* Back the page allocator with a fixed host mapping, detect CPU features
+ * and select the mem ops variant, like kernel_main does. */
+#define HOST_ARENA_BASE 0x40000000UL
+#define HOST_ARENA_SIZE (64UL << 20)
+void host_memory_init(void);
+
+void host_suite(const char *name);
+int host_finish(void);
+
+uint64_t host_now_ns(void);
+void host_report_bench(const char *name, size_t bytes, uint64_t iterations, uint64_t elapsed_ns);
+void host_print(const char *line);
+
+/* Captured by the register_interrupt_handler stub */
+extern isr_t host_irq1_handler;
+
+void test_libc(void);
+void test_keyboard(void);
+void test_usb(void);
+void test_acpi(void);
+void test_text_grid(void);
+void test_klog(void);
+void test_gfx2d(void);
+
+#endif
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "host.h"
+#include "kernel/mm/page_alloc.h"
+#include "libc/mem.h"
+#include "cpu/cpuid.h"
+
+/* Host side of the harness: the only file built against the host C library
+ * (no host_names.h), so printf here is the real one. */
+
+uint32_t mock_port_values[65536];
+uint32_t mock_port_writes;
+
+static int host_checks;
+static int host_failures;
+
+void host_check(int ok, const char *expr, const char *file, int line) {
+    host_checks++;
+    if (!ok) {
+        host_failures++;
+        printf("  FAIL %s:%d: %s\n", file, line, expr);
+    }
+}
+
+void host_suite(const char *name) {
+    printf("[%s]\n", name);
+}
+
+int host_finish(void) {
+    printf("%d checks, %d failures\n", host_checks, host_failures);
+    return host_failures ? 1 : 0;
+}
+
+void host_memory_init(void) {
+    static kernel_memory_region_t map[2];
+    static kernel_bootinfo_t bootinfo;
+
+    void *arena = mmap((void *)HOST_ARENA_BASE, HOST_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (arena != (void *)HOST_ARENA_BASE) {
+        printf("host: cannot map the page allocator arena at 0x%lx\n", HOST_ARENA_BASE);
+        return;
+    }
+
+    /* Overlapping entries, as some firmware reports them: the state arrays
+     * land in the first one, above the start of the second */
+    map[0].base = HOST_ARENA_BASE + (1UL << 20);
+    map[0].length = HOST_ARENA_SIZE - (1UL << 20);
+    map[0].type = KERNEL_MEMORY_USABLE;
+    map[1].base = HOST_ARENA_BASE;
+    map[1].length = HOST_ARENA_SIZE;
+    map[1].type = KERNEL_MEMORY_USABLE;
+    bootinfo.flags = KERNEL_BOOTINFO_FLAG_MEMORY_MAP;
+    bootinfo.mmap_base = (uintptr_t)map;
+    bootinfo.mmap_entries = 2;
+    bootinfo.mmap_entry_size = sizeof(kernel_memory_region_t);
+    if (!page_alloc_init(&bootinfo, UINT64_MAX)) {
+        printf("host: page_alloc_init failed\n");
+        return;
+    }
+
+    cpu_detect_features();
+    memory_init_dispatch();
+    printf("cpu %s, mem ops %s\n", cpu_features.vendor, memory_implementation_name());
+}
+
+uint64_t host_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void host_report_bench(const char *name, size_t bytes, uint64_t iterations, uint64_t elapsed_ns) {
+    double ns_per_op = iterations ? (double)elapsed_ns / (double)iterations : 0.0;
+    if (bytes) {
+        double gbps = elapsed_ns ? (double)bytes * (double)iterations / (double)elapsed_ns : 0.0;
+        printf("  %-28s %8zu B %12.2f ns/op %8.2f GB/s\n", name, bytes, ns_per_op, gbps);
+    } else {
+        printf("  %-28s %10s %12.2f ns/op\n", name, "", ns_per_op);
+    }
+}
+
+void host_print(const char *line) {
+    printf("%s\n", line);
+}
@@ -0,0 +1,52 @@
+#ifndef PORTS_H
+#define PORTS_H
+
+/* Host build stand-in for cpu/ports.h: port I/O goes to a table the tests
+ * can preload and inspect instead of real hardware. */
+
+#include <stdint.h>
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+#define PCI_CLASS_SERIAL    0x0C
+#define PCI_SUBCLASS_USB    0x03
+
+extern uint32_t mock_port_values[65536];
+extern uint32_t mock_port_writes;
+
+static inline uint8_t port_byte_in(uint16_t port) {
+    return (uint8_t)mock_port_values[port];
+}
+
+static inline void port_byte_out(uint16_t port, uint8_t data) {
+    mock_port_values[port] = data;
+    mock_port_writes++;
+}
+
+static inline uint16_t port_word_in(uint16_t port) {
+    return (uint16_t)mock_port_values[port];
+}
+
+static inline void port_word_out(uint16_t port, uint16_t data) {
+    mock_port_values[port] = data;
+    mock_port_writes++;
+}
+
+static inline uint32_t port_dword_in(uint16_t port) {
+    return mock_port_values[port];
+}
+
+static inline void port_dword_out(uint16_t port, uint32_t data) {
+    mock_port_values[port] = data;
+    mock_port_writes++;
+}
+
+#define io_byte_in port_byte_in
+#define io_byte_out port_byte_out
+#define io_word_in port_word_in
+#define io_word_out port_word_out
+#define io_dword_in port_dword_in
+#define io_dword_out port_dword_out
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef HOST_NAMES_H
+#define HOST_NAMES_H
+
+/* Force-included into every kernel-side translation unit of the host build.
+ * Renames the kernel symbols that would otherwise interpose the host C
+ * library (printf, strlen, ...) so the test binaries keep a working libc. */
+
+#define printf        kernel_printf
+#define strlen        kernel_strlen
+#define strcmp        kernel_strcmp
+#define aligned_alloc kernel_aligned_alloc
+
+#endif
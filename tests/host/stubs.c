@@ -0,0 +1,86 @@
+#include "host.h"
+#include "cpu/timer.h"
+#include "drivers/screen.h"
+#include "drivers/usb/uhci/uhci.h"
+#include "drivers/usb/msc.h"
+#include "libc/mem.h"
+
+/* Kernel-side stand-ins for what the host build does not link: the
+ * interrupt layer, the screen, and the UHCI transfer functions that
+ * enumerate.c calls. */
+
+uint8_t _kernel_end[1];
+
+usb_device_t usb_devices[MAX_USB_DEVICES];
+uint8_t usb_device_count;
+
+isr_t host_irq1_handler;
+
+void register_interrupt_handler(uint8_t n, isr_t handler) {
+    if (n == IRQ1) host_irq1_handler = handler;
+}
+
+void sleep_ms(uint64_t milliseconds) {
+    (void)milliseconds;
+}
+
+uint64_t timer_get_ns(void) {
+    return host_now_ns();
+}
+
+void kprint(char *message) {
+    (void)message;
+}
+
+void printf(const char *format, ...) {
+    (void)format;
+}
+
+int uhci_set_device_address(uint16_t io_base, uint8_t port, uint8_t new_address) {
+    (void)io_base; (void)port; (void)new_address;
+    return 0;
+}
+
+int uhci_get_device_descriptor(uint16_t io_base, uint8_t device_address, usb_device_descriptor_t *device_desc) {
+    (void)io_base; (void)device_address; (void)device_desc;
+    return 0;
+}
+
+int uhci_get_configuration_descriptor(uint16_t io_base, uint8_t device_address, usb_configuration_descriptor_t *config_desc) {
+    (void)io_base; (void)device_address; (void)config_desc;
+    return 0;
+}
+
+int uhci_get_full_configuration_descriptor(uint16_t io_base, uint8_t device_address, uint8_t *buffer, uint16_t total_length) {
+    (void)io_base; (void)device_address; (void)buffer; (void)total_length;
+    return 0;
+}
+
+int uhci_set_configuration(uint16_t io_base, uint8_t device_address, uint8_t configuration_value) {
+    (void)io_base; (void)device_address; (void)configuration_value;
+    return 0;
+}
+
+int uhci_kbd_open_interrupt_in(uint16_t io_base, uint8_t dev_addr, uint8_t endpoint_address,
+                               uint8_t interval_frames, uint16_t wMaxPacket, int keyboard_dev_index) {
+    (void)io_base; (void)dev_addr; (void)endpoint_address;
+    (void)interval_frames; (void)wMaxPacket; (void)keyboard_dev_index;
+    return 0;
+}
+
+const usb_hc_ops_t uhci_hc_ops;
+
+int usb_msc_attach(const usb_hc_ops_t *hc, uintptr_t host, const usb_device_t *dev) {
+    (void)hc; (void)host; (void)dev;
+    return -1;
+}
+
+void *uhci_pool_get_buffer(uint16_t io_base, size_t size) {
+    (void)io_base;
+    return aligned_alloc(16, size);
+}
+
+void uhci_pool_put_buffer(uint16_t io_base, void *buffer) {
+    (void)io_base;
+    aligned_free(buffer);
+}
@@ -0,0 +1,93 @@
+#include "host.h"
+#include "drivers/acpi.h"
+#include "libc/mem.h"
+
+/* RSDP -> XSDT -> {FACP, APIC} built in memory, checksums fixed up */
+static uint8_t rsdp_area[sizeof(acpi_rsdp_t)] __attribute__((aligned(16)));
+static uint8_t xsdt_area[sizeof(acpi_sdt_header_t) + 2 * 8];
+static uint8_t facp_area[sizeof(acpi_sdt_header_t)];
+static uint8_t madt_area[sizeof(acpi_madt_t) + sizeof(acpi_madt_lapic_t) + sizeof(acpi_madt_ioapic_t)];
+
+static uint8_t checksum_fix(const void *data, uint32_t length) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) sum = (uint8_t)(sum + bytes[i]);
+    return (uint8_t)(0x100 - sum);
+}
+
+static void table_init(uint8_t *area, const char *signature, uint32_t length) {
+    acpi_sdt_header_t *h = (acpi_sdt_header_t *)area;
+    memory_copy(h->signature, signature, 4);
+    h->length = length;
+    h->revision = 1;
+    h->checksum = 0;
+}
+
+static void table_seal(uint8_t *area) {
+    acpi_sdt_header_t *h = (acpi_sdt_header_t *)area;
+    h->checksum = checksum_fix(area, h->length);
+}
+
+static void build_tables(void) {
+    table_init(facp_area, "FACP", sizeof(facp_area));
+    table_seal(facp_area);
+
+    table_init(madt_area, "APIC", sizeof(madt_area));
+    acpi_madt_t *madt = (acpi_madt_t *)madt_area;
+    madt->lapic_address = 0xFEE00000;
+    madt->flags = 1;
+    acpi_madt_lapic_t *lapic = (acpi_madt_lapic_t *)(madt_area + sizeof(acpi_madt_t));
+    lapic->entry.type = ACPI_MADT_LAPIC;
+    lapic->entry.length = sizeof(*lapic);
+    lapic->flags = 1;
+    acpi_madt_ioapic_t *io = (acpi_madt_ioapic_t *)(lapic + 1);
+    io->entry.type = ACPI_MADT_IOAPIC;
+    io->entry.length = sizeof(*io);
+    io->address = 0xFEC00000;
+    table_seal(madt_area);
+
+    table_init(xsdt_area, "XSDT", sizeof(xsdt_area));
+    uint64_t entries[2] = { (uintptr_t)facp_area, (uintptr_t)madt_area };
+    memory_copy(xsdt_area + sizeof(acpi_sdt_header_t), entries, sizeof(entries));
+    table_seal(xsdt_area);
+
+    acpi_rsdp_t *rsdp = (acpi_rsdp_t *)rsdp_area;
+    memory_copy(rsdp->signature, "RSD PTR ", 8);
+    rsdp->revision = 2;
+    rsdp->length = sizeof(acpi_rsdp_t);
+    rsdp->xsdt_address = (uintptr_t)xsdt_area;
+    rsdp->checksum = 0;
+    rsdp->checksum = checksum_fix(rsdp, 20);
+    rsdp->extended_checksum = 0;
+    rsdp->extended_checksum = checksum_fix(rsdp, sizeof(acpi_rsdp_t));
+}
+
+void test_acpi(void) {
+    kernel_bootinfo_t bootinfo;
+
+    host_suite("acpi");
+    build_tables();
+    memory_set(&bootinfo, 0, sizeof(bootinfo));
+    bootinfo.flags = KERNEL_BOOTINFO_FLAG_UEFI | KERNEL_BOOTINFO_FLAG_ACPI;
+    bootinfo.acpi_rsdp = (uintptr_t)rsdp_area;
+
+    CHECK(acpi_init(&bootinfo));
+    CHECK(acpi_available());
+    CHECK(acpi_find_table("FACP") == (const acpi_sdt_header_t *)facp_area);
+
+    const acpi_madt_t *madt = (const acpi_madt_t *)acpi_find_table("APIC");
+    CHECK(madt == (const acpi_madt_t *)madt_area);
+    CHECK(madt && madt->lapic_address == 0xFEE00000);
+    CHECK(acpi_find_table("HPET") == 0);
+
+    /* A table with a bad checksum is skipped */
+    madt_area[sizeof(acpi_madt_t)] ^= 0xFF;
+    CHECK(acpi_find_table("APIC") == 0);
+    madt_area[sizeof(acpi_madt_t)] ^= 0xFF;
+
+    /* So is an RSDP with a bad checksum */
+    rsdp_area[8] ^= 1;
+    CHECK(!acpi_init(&bootinfo));
+    rsdp_area[8] ^= 1;
+    CHECK(acpi_init(&bootinfo));
+}
@@ -0,0 +1,138 @@
+#include "host.h"
+#include "drivers/screen/gfx2d.h"
+
+#define SURF_W 37               /* odd, so every kernel runs its scalar tail */
+#define SURF_H 9
+#define SURF_STRIDE 40
+
+static uint32_t pixels[SURF_H * SURF_STRIDE];
+static uint32_t expected[SURF_H * SURF_STRIDE];
+static uint32_t source[SURF_H * SURF_STRIDE];
+
+static gfx_surface_t surface(uint32_t *base) {
+    return (gfx_surface_t){ base, SURF_W, SURF_H, SURF_STRIDE };
+}
+
+static void pattern(uint32_t *base, uint32_t seed) {
+    for (uint32_t i = 0; i < SURF_H * SURF_STRIDE; i++) {
+        base[i] = (i * 2654435761u) ^ seed;
+    }
+}
+
+static bool same(const uint32_t *a, const uint32_t *b) {
+    for (uint32_t i = 0; i < SURF_H * SURF_STRIDE; i++) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+static void clone(uint32_t *to, const uint32_t *from) {
+    for (uint32_t i = 0; i < SURF_H * SURF_STRIDE; i++) to[i] = from[i];
+}
+
+/* Pixel by pixel reference of an overlapping move, through a scratch copy */
+static void expect_move(int32_t dx, int32_t dy, gfx_rect_t area) {
+    uint32_t scratch[SURF_H * SURF_STRIDE];
+    clone(scratch, expected);
+    for (uint32_t row = 0; row < area.height; row++) {
+        for (uint32_t col = 0; col < area.width; col++) {
+            int32_t sx = area.x + (int32_t)col, sy = area.y + (int32_t)row;
+            int32_t tx = dx + (int32_t)col, ty = dy + (int32_t)row;
+            if (sx < 0 || sy < 0 || sx >= SURF_W || sy >= SURF_H) continue;
+            if (tx < 0 || ty < 0 || tx >= SURF_W || ty >= SURF_H) continue;
+            expected[ty * SURF_STRIDE + tx] = scratch[sy * SURF_STRIDE + sx];
+        }
+    }
+}
+
+static void check_kernels(void) {
+    gfx_surface_t dst = surface(pixels);
+    gfx_surface_t src = surface(source);
+
+    /* Fill clips a negative origin and stays off the stride padding */
+    pattern(pixels, 1);
+    clone(expected, pixels);
+    gfx_fill(&dst, (gfx_rect_t){ -3, 2, 40, 3 }, 0xAABBCCDD);
+    for (uint32_t y = 2; y < 5; y++)
+        for (uint32_t x = 0; x < SURF_W; x++) expected[y * SURF_STRIDE + x] = 0xAABBCCDD;
+    CHECK(same(pixels, expected));
+
+    /* Overlapping copies within one surface, in all four directions */
+    static const int32_t moves[][2] = { {0, 2}, {0, -2}, {5, 0}, {-5, 0}, {3, 1}, {-3, -1} };
+    for (uint32_t i = 0; i < sizeof(moves) / sizeof(moves[0]); i++) {
+        gfx_rect_t area = { 4, 2, 25, 5 };
+        pattern(pixels, 7 + i);
+        clone(expected, pixels);
+        expect_move(area.x + moves[i][0], area.y + moves[i][1], area);
+        gfx_copy(&dst, area.x + moves[i][0], area.y + moves[i][1], &dst, area);
+        CHECK(same(pixels, expected));
+    }
+
+    /* Copy from another surface with the target clipped on the left */
+    pattern(pixels, 3);
+    pattern(source, 4);
+    clone(expected, pixels);
+    for (uint32_t y = 0; y < 4; y++)
+        for (uint32_t x = 0; x < 6; x++)
+            expected[(y + 1) * SURF_STRIDE + x] = source[(y + 2) * SURF_STRIDE + 10 + 4 + x];
+    gfx_copy(&dst, -4, 1, &src, (gfx_rect_t){ 10, 2, 10, 4 });
+    CHECK(same(pixels, expected));
+
+    /* Mask expansion: 2 bytes per row, a 19-wide cell pads with bg */
+    static const uint8_t mask[3][2] = { {0xF0, 0x0F}, {0x81, 0xC0}, {0xFF, 0xFF} };
+    pattern(pixels, 5);
+    clone(expected, pixels);
+    for (uint32_t y = 0; y < 3; y++)
+        for (uint32_t x = 0; x < 19; x++) {
+            bool set = x < 16 && (mask[y][x / 8] & (0x80u >> (x % 8)));
+            expected[(y + 4) * SURF_STRIDE + 7 + x] = set ? 0xFFFFFF : 0x112233;
+        }
+    gfx_expand_mask(&dst, (gfx_rect_t){ 7, 4, 19, 3 }, &mask[0][0], 2, 0xFFFFFF, 0x112233);
+    CHECK(same(pixels, expected));
+
+    /* Clipped on the left the mask starts mid-byte */
+    pattern(pixels, 6);
+    clone(expected, pixels);
+    for (uint32_t y = 0; y < 3; y++)
+        for (uint32_t x = 3; x < 19; x++) {
+            bool set = x < 16 && (mask[y][x / 8] & (0x80u >> (x % 8)));
+            expected[y * SURF_STRIDE + x - 3] = set ? 1 : 2;
+        }
+    gfx_expand_mask(&dst, (gfx_rect_t){ -3, 0, 19, 3 }, &mask[0][0], 2, 1, 2);
+    CHECK(same(pixels, expected));
+
+    /* Blend: alpha 0 keeps, 255 replaces, 128 mixes; destination alpha stays */
+    for (uint32_t i = 0; i < SURF_H * SURF_STRIDE; i++) {
+        uint32_t alpha = (i % 3 == 0) ? 0 : (i % 3 == 1) ? 0xFF : 0x80;
+        source[i] = (alpha << 24) | 0x00FF4000;
+        pixels[i] = 0x5500FF80;
+    }
+    clone(expected, pixels);
+    for (uint32_t y = 0; y < SURF_H; y++)
+        for (uint32_t x = 0; x < SURF_W; x++) {
+            uint32_t i = y * SURF_STRIDE + x;
+            uint32_t alpha = source[i] >> 24;
+            expected[i] = alpha == 0 ? 0x5500FF80 : alpha == 0xFF ? 0x55FF4000 : 0x55809F3F;
+        }
+    gfx_blend(&dst, 0, 0, &src, (gfx_rect_t){ 0, 0, SURF_W, SURF_H });
+    CHECK(same(pixels, expected));
+}
+
+void test_gfx2d(void) {
+    host_suite("gfx2d");
+
+    gfx_rect_t rect = { -5, 3, 10, 100 };
+    gfx_surface_t dst = surface(pixels);
+    CHECK(gfx_clip(&dst, &rect) && rect.x == 0 && rect.width == 5 && rect.height == SURF_H - 3);
+    rect = (gfx_rect_t){ SURF_W, 0, 4, 4 };
+    CHECK(!gfx_clip(&dst, &rect) && rect.width == 0);
+
+    gfx_init();
+    static const gfx_kernels_t sets[] = { GFX_KERNELS_SCALAR, GFX_KERNELS_SSE2, GFX_KERNELS_AVX2 };
+    for (uint32_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+        if (gfx_use_kernels(sets[i])) {
+            check_kernels();
+        }
+    }
+    gfx_init();
+}
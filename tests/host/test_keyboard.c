@@ -0,0 +1,118 @@
+#include "host.h"
+#include "cpu/ports.h"
+#include "drivers/keyboard/keyboard.h"
+#include <stdbool.h>
+
+/* Not exported through a header; declared the same way by their callers */
+void ps2_on_scancode_byte(uint8_t b);
+int keyboard_register_usb_boot_keyboard(uint8_t address, uint8_t endpoint_addr,
+                                        uint8_t interval_ms, uint16_t wMaxPacketSize);
+void keyboard_usb_on_boot_report(int dev_index, const uint8_t report[8]);
+void keyboard_usb_unregister(int dev_index);
+
+static void drain(void) {
+    key_event_t ev;
+    while (kbd_read_event(&ev)) { }
+    while (kbd_read_char()) { }
+}
+
+/* Deliver one byte the way IRQ1 does: the handler reads it from port 0x60 */
+static void irq1_byte(uint8_t sc) {
+    mock_port_values[0x60] = sc;
+    host_irq1_handler(0);
+}
+
+static void test_ps2_irq(void) {
+    key_event_t ev;
+
+    CHECK(host_irq1_handler != 0);
+    if (!host_irq1_handler) return;
+    drain();
+
+    irq1_byte(0x10);                    /* 'q' make (QWERTY) */
+    CHECK(kbd_read_event(&ev) && ev.type == KEY_EV_PRESS && ev.code == 'q');
+    CHECK(ev.src == KDEV_SOURCE_PS2);
+    irq1_byte(0x90);                    /* 'q' break: no printable event */
+    CHECK(!kbd_read_event(&ev));
+    CHECK(kbd_read_char() == 'q');
+
+    irq1_byte(0x2A);                    /* left shift down */
+    CHECK(kbd_read_event(&ev) && ev.code == KC_LSHIFT && (ev.mods & KM_SHIFT));
+    irq1_byte(0x10);
+    CHECK(kbd_read_event(&ev) && ev.code == 'Q');
+    irq1_byte(0xAA);                    /* left shift up */
+    CHECK(kbd_read_event(&ev) && ev.type == KEY_EV_RELEASE && !(ev.mods & KM_SHIFT));
+
+    irq1_byte(0xE0);
+    irq1_byte(0x48);                    /* E0 48: up arrow */
+    CHECK(kbd_read_event(&ev) && ev.code == KC_UP && ev.type == KEY_EV_PRESS);
+    irq1_byte(0xE0);
+    irq1_byte(0xC8);
+    CHECK(kbd_read_event(&ev) && ev.code == KC_UP && ev.type == KEY_EV_RELEASE);
+    drain();
+}
+
+static void test_ps2_mapper(void) {
+    key_event_t ev;
+    drain();
+
+    ps2_on_scancode_byte(0x1C);
+    CHECK(kbd_read_event(&ev) && ev.code == KC_ENTER && ev.type == KEY_EV_PRESS);
+    ps2_on_scancode_byte(0x9C);
+    CHECK(kbd_read_event(&ev) && ev.code == KC_ENTER && ev.type == KEY_EV_RELEASE);
+
+    ps2_on_scancode_byte(0xE0);
+    ps2_on_scancode_byte(0x4B);
+    CHECK(kbd_read_event(&ev) && ev.code == KC_LEFT);
+
+    ps2_on_scancode_byte(0x10);         /* letters are not mapped here */
+    CHECK(!kbd_read_event(&ev));
+    drain();
+}
+
+static void test_usb_boot_reports(void) {
+    key_event_t ev;
+    uint8_t report[8] = {0};
+    drain();
+
+    int idx = keyboard_register_usb_boot_keyboard(2, 0x81, 10, 8);
+    CHECK(idx >= 0);
+    if (idx < 0) return;
+
+    report[2] = 0x04;                   /* usage 'a' */
+    keyboard_usb_on_boot_report(idx, report);
+    CHECK(kbd_read_event(&ev) && ev.type == KEY_EV_PRESS && ev.code == 'a');
+    CHECK(ev.src == KDEV_SOURCE_USB && ev.dev_id != 0);
+
+    keyboard_usb_on_boot_report(idx, report);   /* repeated report: no new event */
+    CHECK(!kbd_read_event(&ev));
+
+    report[2] = 0;
+    keyboard_usb_on_boot_report(idx, report);
+    CHECK(kbd_read_event(&ev) && ev.type == KEY_EV_RELEASE && ev.code == 'a');
+
+    report[0] = 0x02;                   /* left shift */
+    report[2] = 0x04;
+    keyboard_usb_on_boot_report(idx, report);
+    CHECK(kbd_read_event(&ev) && ev.code == KC_LSHIFT && ev.type == KEY_EV_PRESS);
+    CHECK(kbd_read_event(&ev) && ev.code == 'A');
+
+    report[0] = 0;
+    report[2] = 0x52;                   /* up arrow */
+    keyboard_usb_on_boot_report(idx, report);
+    CHECK(kbd_read_event(&ev) && ev.code == KC_LSHIFT && ev.type == KEY_EV_RELEASE);
+    CHECK(kbd_read_event(&ev) && ev.code == 'a' && ev.type == KEY_EV_RELEASE);
+    CHECK(kbd_read_event(&ev) && ev.code == KC_UP && ev.type == KEY_EV_PRESS);
+
+    keyboard_usb_unregister(idx);
+    drain();
+}
+
+void test_keyboard(void) {
+    host_suite("keyboard");
+    kbd_set_layout(0);
+    kbd_subsystem_init();
+    test_ps2_irq();
+    test_ps2_mapper();
+    test_usb_boot_reports();
+}
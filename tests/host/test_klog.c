@@ -0,0 +1,65 @@
+#include "host.h"
+#include "kernel/log/klog.h"
+
+#define SEEN_MAX 8
+
+static uint32_t seen_count;
+static uint64_t seen_seq[SEEN_MAX];
+static klog_level_t seen_level[SEEN_MAX];
+static char seen_first_char[SEEN_MAX];
+static uint32_t seen_length[SEEN_MAX];
+static uint32_t replayed;
+
+static void record_output(const klog_entry_t *entry) {
+    if (seen_count < SEEN_MAX) {
+        seen_seq[seen_count] = entry->seq;
+        seen_level[seen_count] = entry->level;
+        seen_first_char[seen_count] = entry->text[0];
+        seen_length[seen_count] = entry->length;
+    }
+    seen_count++;
+}
+
+static void count_replay(const klog_entry_t *entry) {
+    (void)entry;
+    replayed++;
+}
+
+void test_klog(void) {
+    host_suite("klog");
+
+    CHECK(klog_init());
+    CHECK(klog_add_output(record_output, KLOG_INFO));
+
+    /* Nothing reaches the outputs before the drain, and levels filter */
+    klog(KLOG_INFO, "a %d\n", 1);
+    klog(KLOG_DEBUG, "b\n");
+    klog(KLOG_ERROR, "c %s\n", "x");
+    CHECK(seen_count == 0);
+    klog_drain();
+    CHECK(seen_count == 2);
+    CHECK(seen_first_char[0] == 'a' && seen_length[0] == 4 && seen_level[0] == KLOG_INFO);
+    CHECK(seen_first_char[1] == 'c' && seen_seq[1] == seen_seq[0] + 2);
+    seen_count = 0;
+    klog_drain();
+    CHECK(seen_count == 0);
+
+    /* Long messages are cut at the record size */
+    klog(KLOG_WARN, "%200s", "");
+    klog_drain();
+    CHECK(seen_count == 1 && seen_length[0] == KLOG_TEXT_MAX);
+
+    /* Lapping the consumer drops the oldest records and says so once */
+    seen_count = 0;
+    for (int i = 0; i < KLOG_RECORDS + 10; i++) {
+        klog(KLOG_INFO, "%c\n", i < 10 ? 'o' : 'n');
+    }
+    klog_drain();
+    CHECK(klog_lost() == 10);
+    CHECK(seen_count == KLOG_RECORDS + 1);
+    CHECK(seen_level[0] == KLOG_WARN && seen_first_char[0] == '[');
+    CHECK(seen_first_char[1] == 'n');
+
+    klog_replay(count_replay);
+    CHECK(replayed == KLOG_RECORDS);
+}
@@ -0,0 +1,129 @@
+#include "host.h"
+#include "libc/mem.h"
+#include "libc/string.h"
+#include "libc/format.h"
+#include "kernel/mm/page_alloc.h"
+
+static void test_mem(void) {
+    static uint8_t src[256], dst[256];
+    for (int i = 0; i < 256; i++) src[i] = (uint8_t)(i * 7 + 3);
+
+    memory_set(dst, 0xAA, sizeof(dst));
+    CHECK(dst[0] == 0xAA && dst[255] == 0xAA);
+
+    memory_copy(dst + 1, src, 200);
+    CHECK(dst[0] == 0xAA);
+    CHECK(memory_compare(dst + 1, src, 200) == 0);
+    CHECK(dst[201] == 0xAA);
+
+    dst[100] ^= 1;
+    CHECK(memory_compare(dst + 1, src, 200) != 0);
+    CHECK(memory_compare(dst, src, 0) == 0);
+
+    /* Forward overlapping copy (dest < source), used by the console scroll */
+    for (int i = 0; i < 256; i++) dst[i] = (uint8_t)i;
+    memory_copy(dst, dst + 16, 200);
+    CHECK(dst[0] == 16 && dst[199] == 215);
+
+    const char *name = 0;
+    for (size_t i = 0; i < memory_variant_count(); i++) {
+        int failures = memory_self_test_variant(i, &name);
+        CHECK(failures == 0 || failures == -1);
+    }
+
+    /* Every arena page is managed but the state arrays, two bytes a page */
+    uint64_t arena_pages = HOST_ARENA_SIZE / PAGE_SIZE;
+    CHECK(page_alloc_total_pages() == arena_pages - (arena_pages * 2 + PAGE_SIZE - 1) / PAGE_SIZE);
+
+    void *a = aligned_alloc(64, 100);
+    void *b = aligned_alloc(4096, 3 * 4096);
+    CHECK(a && ((uintptr_t)a & 63) == 0);
+    CHECK(b && ((uintptr_t)b & 4095) == 0);
+    aligned_free(a);
+    aligned_free(b);
+}
+
+static void test_string(void) {
+    char buf[32];
+
+    int_to_ascii(-1234, buf);
+    CHECK(strcmp(buf, "-1234") == 0);
+    int_to_ascii(0, buf);
+    CHECK(strcmp(buf, "0") == 0);
+
+    uint_to_ascii(4294967295u, buf);
+    CHECK(strcmp(buf, "4294967295") == 0);
+
+    hex_to_string(0xBEEF, buf);
+    CHECK(strcmp(buf, "000000000000BEEF") == 0);
+    hex_to_string_trimmed(0xBEEF, buf);
+    CHECK(strcmp(buf, "BEEF") == 0);
+    hex_to_string_trimmed(0, buf);
+    CHECK(strcmp(buf, "0") == 0);
+
+    buf[0] = '\0';
+    append(buf, 'a');
+    append(buf, 'b');
+    CHECK(strlen(buf) == 2);
+    backspace(buf);
+    CHECK(strcmp(buf, "a") == 0);
+
+    CHECK(strcmp("abc", "abd") < 0);
+    CHECK(strcmp("abd", "abc") > 0);
+}
+
+static size_t sink_calls;
+
+static void count_write(void *context, const char *text, size_t len) {
+    (void)context;
+    (void)text;
+    (void)len;
+    sink_calls++;
+}
+
+static int stream(const format_sink_t *sink, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int total = format_stream(sink, format, args);
+    va_end(args);
+    return total;
+}
+
+static void test_format(void) {
+    char buf[64];
+
+    ksnprintf(buf, sizeof(buf), "%d|%5d|%-5d|%05d|%+d", -42, 42, 42, -42, 7);
+    CHECK(strcmp(buf, "-42|   42|42   |-0042|+7") == 0);
+    ksnprintf(buf, sizeof(buf), "%x|%#X|%08x|%.3u|%o|%#o|%b", 0xbeefu, 0xabu, 0x1234u, 5u, 8u, 8u, 5u);
+    CHECK(strcmp(buf, "beef|0XAB|00001234|005|10|010|101") == 0);
+    ksnprintf(buf, sizeof(buf), "%lx|%llu|%zu|%ld", 0x123456789ABCUL, 18446744073709551615ULL,
+              (size_t)3, (long)INT64_MIN);
+    CHECK(strcmp(buf, "123456789abc|18446744073709551615|3|-9223372036854775808") == 0);
+    ksnprintf(buf, sizeof(buf), "%p|%p", (void *)0x1000, (void *)0);
+    CHECK(strcmp(buf, "0x1000|0x0") == 0);
+    ksnprintf(buf, sizeof(buf), "[%.2s|%4s|%-3c|%*d|%.*s]", "abcdef", "ab", 'z', 3, 1, 1, "xy");
+    CHECK(strcmp(buf, "[ab|  ab|z  |  1|x]") == 0);
+    const char *volatile no_text = 0;
+    ksnprintf(buf, sizeof(buf), "%.0d|%%|%s", 0, no_text);
+    CHECK(strcmp(buf, "|%|(null)") == 0);
+
+    /* Truncation keeps the NUL and reports the full length */
+    CHECK(ksnprintf(buf, 4, "%s", "abcdef") == 6 && strcmp(buf, "abc") == 0);
+    CHECK(ksnprintf(buf, 0, "abc") == 3);
+
+    /* Output is not bounded by any buffer, and reaches the sink in chunks */
+    static char long_text[1000];
+    for (size_t i = 0; i < sizeof(long_text) - 1; i++) long_text[i] = 'a';
+    format_sink_t sink = { .write = count_write, .context = 0 };
+    sink_calls = 0;
+    CHECK(stream(&sink, "%s", long_text) == 999 && sink_calls == 1);
+    sink_calls = 0;
+    CHECK(stream(&sink, "%d %d %d %d", 1, 2, 3, 4) == 7 && sink_calls == 1);
+}
+
+void test_libc(void) {
+    host_suite("libc");
+    test_mem();
+    test_string();
+    test_format();
+}
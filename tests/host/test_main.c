@@ -0,0 +1,13 @@
+#include "host.h"
+
+int main(void) {
+    host_memory_init();
+    test_libc();
+    test_keyboard();
+    test_usb();
+    test_acpi();
+    test_text_grid();
+    test_klog();
+    test_gfx2d();
+    return host_finish();
+}
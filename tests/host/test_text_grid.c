@@ -0,0 +1,79 @@
+#include "host.h"
+#include "drivers/screen/text_grid.h"
+
+#define GRID_COLS 4
+#define GRID_ROWS 3
+
+static uint32_t draws[GRID_ROWS][GRID_COLS];
+static uint32_t draw_total;
+static uint32_t drawn_codepoint[GRID_ROWS][GRID_COLS];
+static uint32_t shift_calls;
+static uint32_t shift_lines;
+
+static void record_draw(uint32_t col, uint32_t row, const text_cell_t *cell) {
+    draws[row][col]++;
+    drawn_codepoint[row][col] = cell->codepoint;
+    draw_total++;
+}
+
+static bool record_shift(uint32_t lines) {
+    shift_calls++;
+    shift_lines = lines;
+    return true;
+}
+
+static void render(void) {
+    for (int r = 0; r < GRID_ROWS; r++)
+        for (int c = 0; c < GRID_COLS; c++) draws[r][c] = 0;
+    draw_total = 0;
+    shift_calls = 0;
+    text_grid_render(record_draw, record_shift);
+}
+
+static bool each_cell_drawn_once(void) {
+    for (int r = 0; r < GRID_ROWS; r++)
+        for (int c = 0; c < GRID_COLS; c++)
+            if (draws[r][c] != 1) return false;
+    return true;
+}
+
+void test_text_grid(void) {
+    host_suite("text_grid");
+
+    CHECK(text_grid_init(GRID_COLS, GRID_ROWS, 0));
+    render();
+    CHECK(each_cell_drawn_once());
+
+    /* Only changed cells are redrawn */
+    text_grid_put(1, 0, 'a', 0xFFFFFF, 0);
+    render();
+    CHECK(draw_total == 1 && draws[0][1] == 1 && drawn_codepoint[0][1] == 'a');
+    text_grid_put(1, 0, 'a', 0xFFFFFF, 0);
+    render();
+    CHECK(draw_total == 0);
+
+    /* One scroll: pixels shift, the new bottom row and older damage are drawn */
+    text_grid_put(2, 2, 'z', 0xFFFFFF, 0);
+    text_grid_scroll(0);
+    render();
+    CHECK(shift_calls == 1 && shift_lines == 1);
+    CHECK(draw_total == GRID_COLS + 1 && draws[2][0] == 1 && drawn_codepoint[2][2] == ' ');
+    CHECK(text_grid_cell(2, 1)->codepoint == 'z');
+    CHECK(draws[1][2] == 1 && drawn_codepoint[1][2] == 'z');   /* damaged before the scroll */
+
+    /* A flood of more lines than the screen holds draws every cell once */
+    for (uint32_t line = 0; line < 10; line++) {
+        for (uint32_t col = 0; col < GRID_COLS; col++) {
+            text_grid_put(col, GRID_ROWS - 1, '0' + line, 0xFFFFFF, 0);
+        }
+        text_grid_scroll(0);
+    }
+    render();
+    CHECK(shift_calls == 0);
+    CHECK(each_cell_drawn_once());
+    CHECK(drawn_codepoint[1][0] == '9' && drawn_codepoint[0][3] == '8');
+
+    text_grid_clear(0);
+    render();
+    CHECK(each_cell_drawn_once() && drawn_codepoint[0][3] == ' ');
+}
@@ -0,0 +1,82 @@
+#include "host.h"
+#include "drivers/usb/uhci/uhci.h"
+#include "libc/mem.h"
+
+/* Configuration blob: a vendor interface first, then a HID boot keyboard
+ * with an OUT and an interrupt IN endpoint. */
+static const uint8_t config_blob[] = {
+    9, USB_DESC_TYPE_CONFIGURATION, 50, 0, 2, 1, 0, 0xA0, 50,
+    9, USB_DESC_TYPE_INTERFACE, 0, 0, 1, 0xFF, 0, 0, 0,
+    7, USB_DESC_TYPE_ENDPOINT, 0x82, 0x02, 64, 0, 0,
+    9, USB_DESC_TYPE_INTERFACE, 1, 0, 2, USB_CLASS_HID, USB_SUBCLASS_BOOT, USB_PROTOCOL_KEYBOARD, 0,
+    9, USB_DESC_TYPE_HID, 0x11, 0x01, 0, 1, 0x22, 63, 0,
+    7, USB_DESC_TYPE_ENDPOINT, 0x02, 0x03, 8, 0, 10,
+};
+
+static void test_parse_keyboard_blob(void) {
+    usb_device_t dev;
+    memory_set(&dev, 0, sizeof(dev));
+    CHECK(usb_parse_config_blob_into_device(config_blob, sizeof(config_blob), &dev) == 0);
+
+    /* add the interrupt IN endpoint to the keyboard interface */
+    uint8_t blob[sizeof(config_blob) + 7];
+    memory_copy(blob, config_blob, sizeof(config_blob));
+    const uint8_t ep_in[7] = { 7, USB_DESC_TYPE_ENDPOINT, 0x81, 0x03, 8, 0, 10 };
+    memory_copy(blob + sizeof(config_blob), ep_in, sizeof(ep_in));
+
+    memory_set(&dev, 0, sizeof(dev));
+    CHECK(usb_parse_config_blob_into_device(blob, sizeof(blob), &dev) == 1);
+    CHECK(dev.config_descriptor.configuration_value == 1);
+    CHECK(dev.interface_descriptor.interface_number == 1);
+    CHECK(dev.interface_descriptor.interface_protocol == USB_PROTOCOL_KEYBOARD);
+    CHECK(dev.endpoint_descriptors[0].endpoint_address == 0x81);
+    CHECK(dev.endpoint_descriptors[0].interval == 10);
+}
+
+/* Mass storage interface: bulk OUT listed before bulk IN, an interrupt
+ * endpoint in between that must not be taken */
+static void test_parse_mass_storage_blob(void) {
+    static const uint8_t blob[] = {
+        9, USB_DESC_TYPE_CONFIGURATION, 39, 0, 1, 1, 0, 0x80, 50,
+        9, USB_DESC_TYPE_INTERFACE, 0, 0, 3, USB_CLASS_MASS_STORAGE, USB_SUBCLASS_SCSI, USB_PROTOCOL_BULK_ONLY, 0,
+        7, USB_DESC_TYPE_ENDPOINT, 0x02, 0x02, 64, 0, 0,
+        7, USB_DESC_TYPE_ENDPOINT, 0x83, 0x03, 8, 0, 10,
+        7, USB_DESC_TYPE_ENDPOINT, 0x81, 0x02, 64, 0, 0,
+    };
+    usb_device_t dev;
+    memory_set(&dev, 0, sizeof(dev));
+    CHECK(usb_parse_config_blob_into_device(blob, sizeof(blob), &dev) == 1);
+    CHECK(dev.interface_descriptor.interface_class == USB_CLASS_MASS_STORAGE);
+    CHECK(dev.endpoint_descriptors[0].endpoint_address == 0x81);
+    CHECK(dev.endpoint_descriptors[1].endpoint_address == 0x02);
+    CHECK(dev.endpoint_descriptors[1].max_packet_size == 64);
+
+    /* without its bulk IN endpoint the interface is unusable */
+    memory_set(&dev, 0, sizeof(dev));
+    CHECK(usb_parse_config_blob_into_device(blob, sizeof(blob) - 7, &dev) == 0);
+}
+
+static void test_parse_malformed(void) {
+    usb_device_t dev;
+    uint8_t blob[sizeof(config_blob)];
+
+    memory_set(&dev, 0, sizeof(dev));
+    CHECK(usb_parse_config_blob_into_device(config_blob, 4, &dev) == 0);
+    CHECK(usb_parse_config_blob_into_device(0, sizeof(config_blob), &dev) == 0);
+
+    /* zero-length descriptor stops the walk before any interface */
+    memory_copy(blob, config_blob, sizeof(blob));
+    blob[9] = 0;
+    CHECK(usb_parse_config_blob_into_device(blob, sizeof(blob), &dev) == 0);
+
+    /* descriptor running past total_len is ignored */
+    memory_copy(blob, config_blob, sizeof(blob));
+    CHECK(usb_parse_config_blob_into_device(blob, 12, &dev) == 0);
+}
+
+void test_usb(void) {
+    host_suite("usb");
+    test_parse_keyboard_blob();
+    test_parse_mass_storage_blob();
+    test_parse_malformed();
+}